@@ -66,6 +66,10 @@ void start_main(void)
 
 	(void) main(main_argc, (main_argc != 0) ? main_argv : NULL);
 
+#if CONFIG(LP_STORAGE)
+	storage_flush_all();
+#endif
+
 	/*
 	 * Returning here will go to the _leave function to return
 	 * us to the original context.
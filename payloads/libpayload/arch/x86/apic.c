@@ -105,7 +105,7 @@ uint8_t apic_id(void)
 	return id;
 }
 
-void apic_delay(unsigned int usec)
+void apic_wait(unsigned int usec, const volatile uint8_t *wakeup)
 {
 	die_if(!ticks_per_ms, "apic_init_timer was not run.");
 	die_if(timer_waiting, "timer already started.");
@@ -126,8 +126,12 @@ void apic_delay(unsigned int usec)
 
 	apic_write32(APIC_TIMER_INIT_COUNT, ticks);
 
-	/* Loop in case another interrupt has fired and resumed execution. */
-	do {
+	/* Loop in case another interrupt has fired and resumed execution.
+	 * The timer can still be counting after timer_waiting was cleared
+	 * if a previous wait stopped it with its interrupt already pending,
+	 * so keep waiting until it really expired. */
+	while ((timer_waiting || apic_read32(APIC_TIMER_CUR_COUNT)) &&
+	       !(wakeup && *wakeup)) {
 		asm volatile(
 			"sti\n\t"
 			"hlt\n\t"
@@ -135,12 +139,21 @@ void apic_delay(unsigned int usec)
 			 * between checking timer_waiting and executing the hlt
 			 * instruction again. */
 			"cli\n\t");
-	} while (timer_waiting);
+	}
+
+	/* Stop the timer if we were woken up early. */
+	apic_write32(APIC_TIMER_INIT_COUNT, 0);
+	timer_waiting = 0;
 
 	/* Leave hardware interrupts enabled. */
 	enable_interrupts();
 }
 
+void apic_delay(unsigned int usec)
+{
+	apic_wait(usec, NULL);
+}
+
 static void timer_interrupt_handler(u8 vector)
 {
 	timer_waiting = 0;
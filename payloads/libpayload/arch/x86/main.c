@@ -78,5 +78,10 @@ int start_main(void)
 	 * Returning from main() will go to the _leave function to return
 	 * us to the original context.
 	 */
-	return main(main_argc, (main_argc != 0) ? main_argv : NULL);
+	const int ret = main(main_argc, (main_argc != 0) ? main_argv : NULL);
+
+#if CONFIG(LP_STORAGE)
+	storage_flush_all();
+#endif
+	return ret;
 }
@@ -184,6 +184,10 @@ static int curses_getchar(int _delay)
 		} else if (_delay > 0) {
 			mdelay(_delay);
 			_delay = 0;
+#if CONFIG(LP_USB_XHCI_MSI)
+		} else {
+			usb_idle(100);
+#endif
 		}
 	} while (1);
 
@@ -100,6 +100,52 @@ int ahci_error_recovery(ahci_dev_t *const dev, const u32 intr_status)
 		return -1;
 }
 
+/*
+ * Reset the port after a failed or timed out NCQ command. The drive stays
+ * in an error state that only READ LOG EXT page 10h or a reset clears, and
+ * commands still in flight have to be aborted, so this always does a
+ * COMRESET. Clearing PxCMD.ST makes the HBA clear PxSACT and PxCI.
+ */
+int ahci_port_reset(ahci_dev_t *const dev)
+{
+	hba_port_t *const port = dev->port;
+	int timeout;
+
+	dev->queued = 0;
+
+	port->cmd_stat &= ~HBA_PxCMD_ST;
+	timeout = 500; /* Time out after 500 * 1ms == 500ms. */
+	while ((port->cmd_stat & HBA_PxCMD_CR) && timeout--)
+		mdelay(1);
+	if (timeout < 0) {
+		printf("ahci: Timeout during stopping of command engine.\n");
+		return -1;
+	}
+
+	const u32 sctl = port->sata_control & ~HBA_PxSCTL_DET_MASK;
+	port->sata_control = sctl | HBA_PxSCTL_DET_COMRESET;
+	mdelay(1);
+	port->sata_control = sctl;
+
+	/* Wait for the link to come back and the drive to send its
+	   signature. */
+	timeout = 1000; /* Time out after 1000 * 10ms == 10s. */
+	while ((!ahci_port_is_active(port) ||
+		(port->taskfile_data & (HBA_PxTFD_BSY | HBA_PxTFD_DRQ))) &&
+	       timeout--)
+		mdelay(10);
+
+	ahci_clear_status(port, sata_error);
+	ahci_clear_status(port, intr_status);
+
+	if (timeout < 0) {
+		printf("ahci: Port didn't come back after COMRESET.\n");
+		return -1;
+	}
+
+	return ahci_cmdengine_start(port);
+}
+
 static int ahci_dev_init(hba_ctrl_t *const ctrl,
 			 hba_port_t *const port,
 			 const int portnum)
@@ -111,16 +157,16 @@ static int ahci_dev_init(hba_ctrl_t *const ctrl,
 	if (ahci_cmdengine_stop(port))
 		return 1;
 
-	/* Allocate command list, one command table and received FIS. */
+	/* Allocate command list, command tables and received FIS. */
 	cmd_t *const cmdlist = memalign(1024, ncs * sizeof(cmd_t));
-	cmdtable_t *const cmdtable = memalign(128, sizeof(cmdtable_t));
+	cmdtable_t *const cmdtable = memalign(128, ncs * sizeof(cmdtable_t));
 	rcvd_fis_t *const rcvd_fis = memalign(256, sizeof(rcvd_fis_t));
 	/* Allocate our device structure. */
 	ahci_dev_t *const dev = calloc(1, sizeof(ahci_dev_t));
 	if (!cmdlist || !cmdtable || !rcvd_fis || !dev)
 		goto _cleanup_ret;
 	memset((void *)cmdlist, '\0', ncs * sizeof(cmd_t));
-	memset((void *)cmdtable, '\0', sizeof(*cmdtable));
+	memset((void *)cmdtable, '\0', ncs * sizeof(*cmdtable));
 	memset((void *)rcvd_fis, '\0', sizeof(*rcvd_fis));
 
 	/* Set command list base and received FIS base. */
@@ -136,6 +182,7 @@ static int ahci_dev_init(hba_ctrl_t *const ctrl,
 	dev->cmdlist = cmdlist;
 	dev->cmdtable = cmdtable;
 	dev->rcvd_fis = rcvd_fis;
+	dev->slots = ncs;
 
 	/*
 	 * Wait for D2H Register FIS with device' signature.
@@ -39,6 +39,84 @@
 #include "ahci_private.h"
 
 
+/* Queued reads are split into commands of this size. */
+#define AHCI_QUEUED_CHUNK	(256 * KiB)
+
+static int ahci_ata_queue_depth(const ahci_dev_t *const dev)
+{
+	if (!(dev->ctrl->caps & HBA_CAPS_SNCQ))
+		return 0;
+	return MIN(dev->ata_dev.queue_depth, dev->slots);
+}
+
+static void ahci_ata_fpdma_fis(cmdtable_t *const cmdtable, const lba_t start,
+			       const size_t sectors, const int tag)
+{
+	cmdtable->fis[ 0] = FIS_HOST_TO_DEVICE;
+	cmdtable->fis[ 1] = FIS_H2D_CMD;
+	cmdtable->fis[ 2] = ATA_READ_FPDMA_QUEUED;
+	cmdtable->fis[ 3] = (sectors >>  0) & 0xff;
+	cmdtable->fis[ 4] = (start >>  0) & 0xff;
+	cmdtable->fis[ 5] = (start >>  8) & 0xff;
+	cmdtable->fis[ 6] = (start >> 16) & 0xff;
+	cmdtable->fis[ 7] = FIS_H2D_DEV_LBA;
+	cmdtable->fis[ 8] = (start >> 24) & 0xff;
+#if CONFIG(LP_STORAGE_64BIT_LBA)
+	cmdtable->fis[ 9] = (start >> 32) & 0xff;
+	cmdtable->fis[10] = (start >> 40) & 0xff;
+#endif
+	cmdtable->fis[11] = (sectors >>  8) & 0xff;
+	cmdtable->fis[12] = tag << 3;
+}
+
+/*
+ * Read with READ FPDMA QUEUED, keeping up to `depth` commands in flight.
+ * Whenever a command completes, its slot is reused for the next chunk.
+ */
+static ssize_t ahci_ata_read_queued(ahci_dev_t *const dev,
+				    const lba_t start, const size_t count,
+				    u8 *const buf, const int depth)
+{
+	const size_t shift = dev->ata_dev.sector_size_shift;
+	const size_t chunk = MAX(AHCI_QUEUED_CHUNK >> shift, 1);
+	size_t issued = 0;
+	u32 pending = 0;
+	u32 new;
+	int slot;
+
+	if (!(dev->port->cmd_stat & HBA_PxCMD_CR))
+		return -1;
+
+	while (issued < count || pending) {
+		new = 0;
+		for (slot = 0; slot < depth && issued < count; ++slot) {
+			if (pending & (1 << slot))
+				continue;
+
+			const size_t sectors = MIN(chunk, count - issued);
+			ahci_cmdslot_prepare_slot(dev, slot,
+					buf + (issued << shift),
+					sectors << shift);
+			ahci_ata_fpdma_fis(&dev->cmdtable[slot], start + issued,
+					   sectors, slot);
+			new |= 1 << slot;
+			issued += sectors;
+		}
+
+		if (new) {
+			ahci_cmdslots_issue(dev, new, 1);
+			pending |= new;
+		}
+
+		if (ahci_cmdslots_wait(dev, &pending) < 0)
+			return -1;
+	}
+
+	/* The HBA doesn't need to update the PRD byte count for queued
+	   commands, so there is nothing to check it against. */
+	return count;
+}
+
 ssize_t ahci_ata_read_sectors(ata_dev_t *const ata_dev,
 				     const lba_t start, size_t count,
 				     u8 *const buf)
@@ -48,6 +126,21 @@ ssize_t ahci_ata_read_sectors(ata_dev_t *const ata_dev,
 	if (count == 0)
 		return 0;
 
+	/* Queued commands can't go through the bounce buffer for odd
+	   addresses, use the single slot path for those. */
+	const int depth = ahci_ata_queue_depth(dev);
+	if (depth > 0 && !((uintptr_t)buf & 1)) {
+		const ssize_t ret =
+			ahci_ata_read_queued(dev, start, count, buf, depth);
+		if (ret >= 0)
+			return ret;
+
+		/* ahci_cmdslots_wait() reset the port, so the non-queued
+		   command starts on a drive without commands in flight. */
+		printf("ahci: Queued read failed, disabling NCQ.\n");
+		ata_dev->queue_depth = 0;
+	}
+
 	if (ata_dev->read_cmd == ATA_READ_DMA) {
 		if (start >= (1 << 28)) {
 		       printf("ahci: Sector is not 28-bit addressable.\n");
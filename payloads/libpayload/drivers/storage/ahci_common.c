@@ -154,60 +154,109 @@ int ahci_cmdengine_stop(hba_port_t *const port)
 	return 0;
 }
 
+/* Commands time out if none of them completes for 5s. */
+#define AHCI_CMD_TIMEOUT_US	(5 * 1000 * 1000)
+
+void ahci_cmdslots_issue(ahci_dev_t *const dev, const u32 slots,
+			 const int queued)
+{
+	/* SACT has to be set before the command is issued. */
+	if (queued) {
+		dev->port->sata_active = slots;
+		dev->queued |= slots;
+	}
+	dev->port->cmd_issue = slots;
+}
+
+int ahci_cmdslots_wait(ahci_dev_t *const dev, u32 *const pending)
+{
+	hba_port_t *const port = dev->port;
+	const u64 start = timer_us(0);
+	u32 busy;
+
+	if (!*pending)
+		return 0;
+
+	/*
+	 * Completion is polled without any delay in between. Reading the
+	 * registers is cheap, and waiting longer than the device takes to
+	 * complete a command directly reduces throughput.
+	 */
+	while (1) {
+		busy = port->cmd_issue | port->sata_active;
+		if ((busy & *pending) != *pending)
+			break;
+		if (port->intr_status & HBA_PxIS_TFES)
+			break;
+		if (timer_us(start) > AHCI_CMD_TIMEOUT_US) {
+			printf("ahci: Timeout during command execution.\n");
+			/* The slots have to be freed before they are reused. */
+			ahci_port_reset(dev);
+			*pending = 0;
+			return -1;
+		}
+	}
+
+	const u32 intr_status = ahci_clear_status(port, intr_status);
+	if (intr_status & (HBA_PxIS_FATAL | HBA_PxIS_PCS)) {
+		/* Restarting the command engine aborts all commands. A
+		   failed NCQ command also needs the drive to be reset. */
+		if (dev->queued)
+			ahci_port_reset(dev);
+		else
+			ahci_error_recovery(dev, intr_status);
+		*pending = 0;
+		return -1;
+	}
+
+	*pending &= busy;
+	dev->queued &= busy;
+	return 0;
+}
+
 ssize_t ahci_cmdslot_exec(ahci_dev_t *const dev)
 {
 	const int slotnum = 0; /* We always use the first slot. */
+	u32 pending = 1 << slotnum;
 
 	if (!(dev->port->cmd_stat & HBA_PxCMD_CR))
 		return -1;
 
 	/* Trigger command execution. */
-	dev->port->cmd_issue |= (1 << slotnum);
+	ahci_cmdslots_issue(dev, pending, 0);
 
 	/* Wait for the controller to finish command execution. */
-	int timeout = 50000; /* Time out after 50000 * 100us == 5s. */
-	while ((dev->port->cmd_issue & (1 << slotnum)) &&
-			!(dev->port->intr_status & HBA_PxIS_TFES) &&
-			timeout--)
-		udelay(100);
-	if (timeout < 0) {
-		printf("ahci: Timeout during command execution.\n");
-		return -1;
+	while (pending) {
+		if (ahci_cmdslots_wait(dev, &pending) < 0) {
+			ahci_prdbuf_finalize(dev);
+			return -1;
+		}
 	}
 
 	ahci_prdbuf_finalize(dev);
 
-	const u32 intr_status = ahci_clear_status(dev->port, intr_status);
-	if (intr_status & (HBA_PxIS_FATAL | HBA_PxIS_PCS)) {
-		ahci_error_recovery(dev, intr_status);
-		return -1;
-	} else {
-		return dev->cmdlist[slotnum].prd_bytes;
-	}
+	return dev->cmdlist[slotnum].prd_bytes;
 }
 
-size_t ahci_cmdslot_prepare(ahci_dev_t *const dev,
-				   u8 *const user_buf, size_t buf_len,
-				   const int out)
+size_t ahci_cmdslot_prepare_slot(ahci_dev_t *const dev, const int slotnum,
+				 u8 *buf, size_t buf_len)
 {
-	const int slotnum = 0; /* We always use the first slot. */
+	cmdtable_t *const cmdtable = &dev->cmdtable[slotnum];
 
 	size_t read_count = 0;
 
 	memset((void *)&dev->cmdlist[slotnum],
 			'\0', sizeof(dev->cmdlist[slotnum]));
-	memset((void *)dev->cmdtable,
-			'\0', sizeof(*dev->cmdtable));
+	memset((void *)cmdtable, '\0', sizeof(*cmdtable));
 	dev->cmdlist[slotnum].cmd = CMD_CFL(FIS_H2D_FIS_LEN);
-	dev->cmdlist[slotnum].cmdtable_base = virt_to_phys(dev->cmdtable);
+	dev->cmdlist[slotnum].cmdtable_base = virt_to_phys(cmdtable);
 
 	if (buf_len > 0) {
 		size_t prdt_len;
-		u8 *buf;
 		int i;
 
 		prdt_len = ((buf_len - 1) >> BYTES_PER_PRD_SHIFT) + 1;
-		const size_t max_prdt_len = ARRAY_SIZE(dev->cmdtable->prdt);
+		const size_t max_prdt_len = ARRAY_SIZE(cmdtable->prdt);
 		if (prdt_len > max_prdt_len) {
 			prdt_len = max_prdt_len;
 			buf_len = prdt_len << BYTES_PER_PRD_SHIFT;
@@ -216,15 +265,12 @@ size_t ahci_cmdslot_prepare(ahci_dev_t *const dev,
 		dev->cmdlist[slotnum].prdt_length = prdt_len;
 		read_count = buf_len;
 
-		buf = ahci_prdbuf_init(dev, user_buf, buf_len, out);
-		if (!buf)
-			return 0;
 		for (i = 0; i < prdt_len; ++i) {
 			const size_t bytes =
 				(buf_len < BYTES_PER_PRD)
 				? buf_len : BYTES_PER_PRD;
-			dev->cmdtable->prdt[i].data_base = virt_to_phys(buf);
-			dev->cmdtable->prdt[i].flags = PRD_TABLE_BYTES(bytes);
+			cmdtable->prdt[i].data_base = virt_to_phys(buf);
+			cmdtable->prdt[i].flags = PRD_TABLE_BYTES(bytes);
 			buf_len -= bytes;
 			buf += bytes;
 		}
@@ -233,6 +279,26 @@ size_t ahci_cmdslot_prepare(ahci_dev_t *const dev,
 	return read_count;
 }
 
+size_t ahci_cmdslot_prepare(ahci_dev_t *const dev,
+				   u8 *const user_buf, size_t buf_len,
+				   const int out)
+{
+	const int slotnum = 0; /* We always use the first slot. */
+	const size_t max_len = ARRAY_SIZE(dev->cmdtable->prdt) * BYTES_PER_PRD;
+	u8 *buf = user_buf;
+
+	if (buf_len > max_len)
+		buf_len = max_len;
+
+	if (buf_len > 0) {
+		buf = ahci_prdbuf_init(dev, user_buf, buf_len, out);
+		if (!buf)
+			return 0;
+	}
+
+	return ahci_cmdslot_prepare_slot(dev, slotnum, buf, buf_len);
+}
+
 int ahci_identify_device(ata_dev_t *const ata_dev, u8 *const buf)
 {
 	ahci_dev_t *const dev = (ahci_dev_t *)ata_dev;
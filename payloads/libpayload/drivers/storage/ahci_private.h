@@ -109,6 +109,7 @@ typedef volatile struct {
 	hba_port_t ports[32];
 } hba_ctrl_t;
 
+#define HBA_CAPS_SNCQ		(1 << 30) /* SNCQ - Supports Native Command Queuing */
 #define HBA_CAPS_SSS		(1 << 27) /* SSS - Supports Staggered Spin-up */
 #define HBA_CAPS_NCS_SHIFT	8	/* NCS - Number of Command Slots */
 #define HBA_CAPS_NCS_MASK	(0x1f << HBA_CAPS_NCS_SHIFT)
@@ -191,8 +192,10 @@ typedef struct {
 	hba_port_t *port;
 
 	cmd_t *cmdlist;
-	cmdtable_t *cmdtable;
+	cmdtable_t *cmdtable;	/* One command table per slot. */
 	rcvd_fis_t *rcvd_fis;
+	int slots;		/* Number of command slots. */
+	u32 queued;		/* Slots with NCQ commands in flight. */
 
 	u8 *buf, *user_buf;
 	int write_back;
@@ -212,9 +215,26 @@ size_t ahci_cmdslot_prepare(ahci_dev_t *const dev,
 		   u8 *const user_buf, size_t buf_len,
 		   const int out);
 
+/*
+ * Commands in slots other than 0 are prepared directly on the caller's
+ * buffer, which has to be at an even address. They are started with
+ * ahci_cmdslots_issue(), with queued != 0 for NCQ commands, and
+ * ahci_cmdslots_wait() returns once at least one of them has completed.
+ * If a command fails or times out, ahci_cmdslots_wait() aborts all of them,
+ * resetting the port if NCQ commands were in flight, and returns -1.
+ */
+size_t ahci_cmdslot_prepare_slot(ahci_dev_t *const dev, const int slotnum,
+		   u8 *buf, size_t buf_len);
+
+void ahci_cmdslots_issue(ahci_dev_t *const dev, const u32 slots,
+		   const int queued);
+
+int ahci_cmdslots_wait(ahci_dev_t *const dev, u32 *const pending);
+
 int ahci_identify_device(ata_dev_t *const ata_dev, u8 *const buf);
 
 int ahci_error_recovery(ahci_dev_t *const dev, const u32 intr_status);
+int ahci_port_reset(ahci_dev_t *const dev);
 
 /*
  * ahci_atapi.c
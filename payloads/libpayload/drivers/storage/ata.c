@@ -226,6 +226,11 @@ int ata_attach_device(ata_dev_t *const dev, const storage_port_t port_type)
 	if (ata_decode_sector_size(dev, id))
 		return -1;
 
+	if (id[ATA_ID_SATA_CAPS] != 0xffff && id[ATA_ID_SATA_CAPS] & (1 << 8))
+		dev->queue_depth = (id[ATA_ID_QUEUE_DEPTH] & 0x1f) + 1;
+	else
+		dev->queue_depth = 0;
+
 	dev->storage_dev.port_type = port_type;
 	ata_initialize_storage_ops(dev);
 
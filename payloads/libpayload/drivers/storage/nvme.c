@@ -0,0 +1,763 @@
+/*
+ * This file is part of the libpayload project.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+
+/*
+ * NVMe driver. Commands are spread over a few I/O queue pairs and
+ * completions are polled, so a large request keeps many commands in flight
+ * without interrupts.
+ */
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <arch/barrier.h>
+#include <libpayload.h>
+#include <pci.h>
+#include <pci/pci.h>
+#include <storage/storage.h>
+#include <storage/nvme.h>
+
+/* Controller registers */
+#define NVME_CAP		0x00
+#define NVME_VS			0x08
+#define NVME_CC			0x14
+#define NVME_CSTS		0x1c
+#define NVME_AQA		0x24
+#define NVME_ASQ		0x28
+#define NVME_ACQ		0x30
+#define NVME_DOORBELLS		0x1000
+
+#define NVME_CAP_MQES(cap)	(((cap) & 0xffff) + 1)
+#define NVME_CAP_TO(cap)	(((cap) >> 24) & 0xff)	/* in 500ms units */
+#define NVME_CAP_DSTRD(cap)	(((cap) >> 32) & 0xf)
+#define NVME_CAP_CSS_NVM	(1ULL << 37)
+#define NVME_CAP_MPSMIN(cap)	(((cap) >> 48) & 0xf)
+
+#define NVME_CC_EN		(1 << 0)
+#define NVME_CC_CSS_NVM		(0 << 4)
+#define NVME_CC_MPS_4K		(0 << 7)
+#define NVME_CC_AMS_RR		(0 << 11)
+#define NVME_CC_IOSQES		(6 << 16)	/* 64 byte entries */
+#define NVME_CC_IOCQES		(4 << 20)	/* 16 byte entries */
+
+#define NVME_CSTS_RDY		(1 << 0)
+#define NVME_CSTS_CFS		(1 << 1)
+
+/* Admin commands */
+#define NVME_ADMIN_CREATE_SQ	0x01
+#define NVME_ADMIN_CREATE_CQ	0x05
+#define NVME_ADMIN_IDENTIFY	0x06
+#define NVME_ADMIN_SET_FEATURES	0x09
+
+#define NVME_IDENTIFY_NS	0x00
+#define NVME_IDENTIFY_CTRL	0x01
+#define NVME_FEAT_NUM_QUEUES	0x07
+
+/* NVM commands */
+#define NVME_CMD_WRITE		0x01
+#define NVME_CMD_READ		0x02
+
+#define NVME_PAGE_SIZE		4096
+#define NVME_ADMIN_QUEUE_DEPTH	8
+#define NVME_IO_QUEUES		4
+#define NVME_IO_QUEUE_DEPTH	64	/* at most 64, command ids are a u64 mask */
+#define NVME_MAX_TRANSFER	(128 * KiB)
+#define NVME_PRP_ENTRIES	(NVME_MAX_TRANSFER / NVME_PAGE_SIZE)
+#define NVME_MAX_NAMESPACES	16
+#define NVME_CMD_TIMEOUT_US	(5 * 1000 * 1000)
+
+typedef struct {
+	u8 opc;
+	u8 flags;
+	u16 cid;
+	u32 nsid;
+	u64 rsvd;
+	u64 mptr;
+	u64 prp1;
+	u64 prp2;
+	u32 cdw10;
+	u32 cdw11;
+	u32 cdw12;
+	u32 cdw13;
+	u32 cdw14;
+	u32 cdw15;
+} __packed nvme_sqe_t;
+
+typedef struct {
+	u32 dw0;
+	u32 rsvd;
+	u16 sqhd;
+	u16 sqid;
+	u16 cid;
+	u16 status;	/* bit 0 is the phase tag */
+} __packed nvme_cqe_t;
+
+typedef struct {
+	nvme_sqe_t *sq;
+	volatile nvme_cqe_t *cq;
+	volatile u32 *sq_db;
+	volatile u32 *cq_db;
+	u16 depth;
+	u16 sq_tail;
+	u16 cq_head;
+	u8 phase;
+	u16 outstanding;
+	u64 busy;		/* command ids in use */
+	u64 *prp_lists;		/* NVME_PRP_ENTRIES per command id */
+	u16 status[NVME_IO_QUEUE_DEPTH];
+	u32 result[NVME_IO_QUEUE_DEPTH];
+} nvme_queue_t;
+
+typedef struct {
+	void *regs;
+	u64 cap;
+	size_t max_transfer;
+	nvme_queue_t admin;
+	nvme_queue_t io[NVME_IO_QUEUES];
+	int num_io;
+	int next_io;		/* round robin over the I/O queues */
+	int failed;		/* commands timed out, don't touch it again */
+} nvme_ctrl_t;
+
+typedef struct {
+	storage_dev_t storage_dev;
+	nvme_ctrl_t *ctrl;
+	u32 nsid;
+	u64 num_blocks;
+	unsigned int block_shift;
+	u8 *bounce;		/* max_transfer bytes, allocated on first use */
+} nvme_ns_t;
+
+static inline u32 nvme_read32(nvme_ctrl_t *const ctrl, const int reg)
+{
+	return read32(ctrl->regs + reg);
+}
+
+static inline void nvme_write32(nvme_ctrl_t *const ctrl, const int reg,
+				const u32 val)
+{
+	write32(ctrl->regs + reg, val);
+}
+
+/* 64-bit registers may be accessed as two dwords, low dword first */
+static inline u64 nvme_read64(nvme_ctrl_t *const ctrl, const int reg)
+{
+	return nvme_read32(ctrl, reg) |
+		(u64)nvme_read32(ctrl, reg + 4) << 32;
+}
+
+static inline void nvme_write64(nvme_ctrl_t *const ctrl, const int reg,
+				const u64 val)
+{
+	nvme_write32(ctrl, reg, val);
+	nvme_write32(ctrl, reg + 4, val >> 32);
+}
+
+static int nvme_wait_ready(nvme_ctrl_t *const ctrl, const int ready)
+{
+	/* CAP.TO is the worst case time to become (not) ready */
+	const u64 timeout_us = MAX(NVME_CAP_TO(ctrl->cap), 1) * 500 * 1000;
+	const u64 start = timer_us(0);
+
+	while ((nvme_read32(ctrl, NVME_CSTS) & NVME_CSTS_RDY) != ready) {
+		if (nvme_read32(ctrl, NVME_CSTS) & NVME_CSTS_CFS) {
+			printf("nvme: Controller fatal status.\n");
+			return -1;
+		}
+		if (timer_us(start) > timeout_us) {
+			printf("nvme: Timed out waiting for RDY == %d.\n",
+			       ready);
+			return -1;
+		}
+		udelay(10);
+	}
+	return 0;
+}
+
+static int nvme_queue_alloc(nvme_ctrl_t *const ctrl, nvme_queue_t *const q,
+			    const int qid, const int depth)
+{
+	const size_t stride = 4 << NVME_CAP_DSTRD(ctrl->cap);
+
+	memset(q, 0, sizeof(*q));
+	q->sq = dma_memalign(NVME_PAGE_SIZE, depth * sizeof(nvme_sqe_t));
+	q->cq = dma_memalign(NVME_PAGE_SIZE, depth * sizeof(nvme_cqe_t));
+	if (qid)
+		q->prp_lists = dma_memalign(NVME_PAGE_SIZE,
+				depth * NVME_PRP_ENTRIES * sizeof(u64));
+	if (!q->sq || !q->cq || (qid && !q->prp_lists)) {
+		free(q->sq);
+		free((void *)q->cq);
+		free(q->prp_lists);
+		return -1;
+	}
+	memset(q->sq, 0, depth * sizeof(nvme_sqe_t));
+	memset((void *)q->cq, 0, depth * sizeof(nvme_cqe_t));
+
+	q->sq_db = ctrl->regs + NVME_DOORBELLS + (2 * qid) * stride;
+	q->cq_db = ctrl->regs + NVME_DOORBELLS + (2 * qid + 1) * stride;
+	q->depth = depth;
+	q->phase = 1;
+	return 0;
+}
+
+/* returns a free command id, or -1 if the queue is full */
+static int nvme_alloc_cid(nvme_queue_t *const q)
+{
+	int cid;
+
+	/* One entry stays empty to tell a full queue from an empty one. */
+	if (q->outstanding >= q->depth - 1)
+		return -1;
+	for (cid = 0; cid < q->depth; ++cid) {
+		if (!(q->busy & (1ULL << cid)))
+			break;
+	}
+	q->busy |= 1ULL << cid;
+	q->outstanding++;
+	return cid;
+}
+
+/* queue a command, it's passed to the controller by nvme_ring() */
+static void nvme_submit(nvme_queue_t *const q, const nvme_sqe_t *const cmd)
+{
+	memcpy(&q->sq[q->sq_tail], cmd, sizeof(*cmd));
+	if (++q->sq_tail == q->depth)
+		q->sq_tail = 0;
+}
+
+static void nvme_ring(nvme_queue_t *const q)
+{
+	wmb();
+	write32(q->sq_db, q->sq_tail);
+}
+
+/* Process completed commands, returns how many there were. */
+static int nvme_reap(nvme_queue_t *const q)
+{
+	int reaped = 0;
+
+	while ((q->cq[q->cq_head].status & 1) == q->phase) {
+		const volatile nvme_cqe_t *const cqe = &q->cq[q->cq_head];
+		const u16 cid = cqe->cid;
+
+		if (cid < q->depth && (q->busy & (1ULL << cid))) {
+			q->status[cid] = cqe->status >> 1;
+			q->result[cid] = cqe->dw0;
+			q->busy &= ~(1ULL << cid);
+			q->outstanding--;
+		} else {
+			printf("nvme: Spurious completion for cid %u.\n", cid);
+		}
+
+		if (++q->cq_head == q->depth) {
+			q->cq_head = 0;
+			q->phase ^= 1;
+		}
+		++reaped;
+	}
+	if (reaped)
+		write32(q->cq_db, q->cq_head);
+	return reaped;
+}
+
+/* Run an admin command and wait for it, returns its status or -1. */
+static int nvme_admin_cmd(nvme_ctrl_t *const ctrl, nvme_sqe_t *const cmd,
+			  u32 *const result)
+{
+	nvme_queue_t *const q = &ctrl->admin;
+	const int cid = nvme_alloc_cid(q);
+	if (cid < 0)
+		return -1;
+
+	cmd->cid = cid;
+	nvme_submit(q, cmd);
+	nvme_ring(q);
+
+	const u64 start = timer_us(0);
+	while (q->busy & (1ULL << cid)) {
+		if (!nvme_reap(q) && timer_us(start) > NVME_CMD_TIMEOUT_US) {
+			printf("nvme: Admin command 0x%02x timed out.\n",
+			       cmd->opc);
+			ctrl->failed = 1;
+			return -1;
+		}
+	}
+
+	if (q->status[cid])
+		printf("nvme: Admin command 0x%02x failed, status 0x%x.\n",
+		       cmd->opc, q->status[cid]);
+	if (result)
+		*result = q->result[cid];
+	return q->status[cid];
+}
+
+static int nvme_identify(nvme_ctrl_t *const ctrl, const u32 nsid,
+			 const u32 cns, void *const buf)
+{
+	nvme_sqe_t cmd = {
+		.opc	= NVME_ADMIN_IDENTIFY,
+		.nsid	= nsid,
+		.prp1	= virt_to_phys(buf),
+		.cdw10	= cns,
+	};
+	return nvme_admin_cmd(ctrl, &cmd, NULL) ? -1 : 0;
+}
+
+static int nvme_create_io_queues(nvme_ctrl_t *const ctrl)
+{
+	const int depth = MIN(NVME_CAP_MQES(ctrl->cap), NVME_IO_QUEUE_DEPTH);
+	u32 result;
+	int i;
+
+	nvme_sqe_t cmd = {
+		.opc	= NVME_ADMIN_SET_FEATURES,
+		.cdw10	= NVME_FEAT_NUM_QUEUES,
+		.cdw11	= (NVME_IO_QUEUES - 1) << 16 | (NVME_IO_QUEUES - 1),
+	};
+	if (nvme_admin_cmd(ctrl, &cmd, &result))
+		return -1;
+	/* The controller tells how many queues it allocated, 0's based. */
+	const int num = MIN(MIN((result & 0xffff), result >> 16) + 1,
+			    NVME_IO_QUEUES);
+
+	for (i = 0; i < num; ++i) {
+		nvme_queue_t *const q = &ctrl->io[i];
+		const int qid = i + 1;
+
+		if (nvme_queue_alloc(ctrl, q, qid, depth))
+			break;
+
+		nvme_sqe_t create_cq = {
+			.opc	= NVME_ADMIN_CREATE_CQ,
+			.prp1	= virt_to_phys((void *)q->cq),
+			.cdw10	= (depth - 1) << 16 | qid,
+			.cdw11	= 1,	/* physically contiguous, no irq */
+		};
+		nvme_sqe_t create_sq = {
+			.opc	= NVME_ADMIN_CREATE_SQ,
+			.prp1	= virt_to_phys(q->sq),
+			.cdw10	= (depth - 1) << 16 | qid,
+			.cdw11	= qid << 16 | 1,	/* CQ id, contiguous */
+		};
+		if (nvme_admin_cmd(ctrl, &create_cq, NULL) ||
+		    nvme_admin_cmd(ctrl, &create_sq, NULL)) {
+			/* Keep the memory, the controller may know it. */
+			break;
+		}
+	}
+	ctrl->num_io = i;
+
+	return ctrl->num_io ? 0 : -1;
+}
+
+/* Describe buf to the controller, PRP lists are only needed past 2 pages. */
+static void nvme_set_prps(nvme_queue_t *const q, const int cid,
+			  nvme_sqe_t *const cmd, void *const buf, size_t len)
+{
+	const u64 addr = virt_to_phys(buf);
+	const size_t first = NVME_PAGE_SIZE - (addr & (NVME_PAGE_SIZE - 1));
+	u64 next = addr + first;
+	size_t i;
+
+	cmd->prp1 = addr;
+	cmd->prp2 = 0;
+	if (len <= first)
+		return;
+	len -= first;
+
+	if (len <= NVME_PAGE_SIZE) {
+		cmd->prp2 = next;
+		return;
+	}
+
+	u64 *const list = q->prp_lists + cid * NVME_PRP_ENTRIES;
+	for (i = 0; i < div_round_up(len, NVME_PAGE_SIZE); ++i)
+		list[i] = next + i * NVME_PAGE_SIZE;
+	cmd->prp2 = virt_to_phys(list);
+}
+
+/*
+ * Read or write whole blocks. Commands of up to max_transfer bytes are
+ * queued on all I/O queues and refilled as they complete. buf has to be
+ * DMA coherent, nvme_transfer() takes care of other buffers.
+ */
+static ssize_t nvme_rw(nvme_ns_t *const ns, const u8 opc, u64 lba,
+		       const size_t count, u8 *buf)
+{
+	nvme_ctrl_t *const ctrl = ns->ctrl;
+	const size_t max_blocks = ctrl->max_transfer >> ns->block_shift;
+	size_t remaining = count;
+	int outstanding = 0;
+	int failed = 0;
+	int i;
+
+	if (ctrl->failed)
+		return -1;
+	if (lba + count > ns->num_blocks) {
+		printf("nvme: Access beyond end of namespace %u.\n", ns->nsid);
+		return -1;
+	}
+	/* PRP entries need dword aligned data. */
+	if ((uintptr_t)buf & 3) {
+		printf("nvme: Unaligned buffer %p.\n", buf);
+		return -1;
+	}
+
+	u64 start = timer_us(0);
+	while (remaining || outstanding) {
+		/* Fill up all queues. */
+		for (i = 0; i < ctrl->num_io && remaining && !failed; ++i) {
+			nvme_queue_t *const q = &ctrl->io[ctrl->next_io];
+			int queued = 0;
+			int cid;
+
+			ctrl->next_io = (ctrl->next_io + 1) % ctrl->num_io;
+			while (remaining && (cid = nvme_alloc_cid(q)) >= 0) {
+				const size_t n = MIN(remaining, max_blocks);
+				const size_t bytes = n << ns->block_shift;
+				nvme_sqe_t cmd = {
+					.opc	= opc,
+					.cid	= cid,
+					.nsid	= ns->nsid,
+					.cdw10	= lba,
+					.cdw11	= lba >> 32,
+					.cdw12	= n - 1,
+				};
+				nvme_set_prps(q, cid, &cmd, buf, bytes);
+				nvme_submit(q, &cmd);
+
+				lba += n;
+				buf += bytes;
+				remaining -= n;
+				++outstanding;
+				++queued;
+			}
+			if (queued)
+				nvme_ring(q);
+		}
+
+		/* Reap whatever completed. */
+		int reaped = 0;
+		for (i = 0; i < ctrl->num_io; ++i) {
+			nvme_queue_t *const q = &ctrl->io[i];
+			const u64 busy = q->busy;
+			const int n = nvme_reap(q);
+			int cid;
+
+			if (!n)
+				continue;
+			for (cid = 0; cid < q->depth; ++cid) {
+				if ((busy & ~q->busy & (1ULL << cid)) &&
+				    q->status[cid]) {
+					printf("nvme: I/O failed, status "
+					       "0x%x.\n", q->status[cid]);
+					failed = 1;
+				}
+			}
+			reaped += n;
+			outstanding -= n;
+		}
+
+		if (reaped) {
+			start = timer_us(0);
+		} else if (timer_us(start) > NVME_CMD_TIMEOUT_US) {
+			/* The commands still own our buffer. */
+			printf("nvme: I/O timed out, giving up on controller.\n");
+			ctrl->failed = 1;
+			return -1;
+		}
+		if (failed)
+			remaining = 0;
+	}
+
+	return failed ? -1 : count;
+}
+
+/* The controller can only access DMA coherent memory. */
+static u8 *nvme_bounce(nvme_ns_t *const ns)
+{
+	if (!ns->bounce)
+		ns->bounce = dma_memalign(NVME_PAGE_SIZE,
+					  ns->ctrl->max_transfer);
+	if (!ns->bounce)
+		printf("nvme: Out of DMA memory for bounce buffer.\n");
+	return ns->bounce;
+}
+
+/*
+ * Like nvme_rw(), but buffers that aren't DMA coherent or dword aligned are
+ * copied through the bounce buffer, one command at a time.
+ */
+static ssize_t nvme_transfer(nvme_ns_t *const ns, const u8 opc, u64 lba,
+			     const size_t count, u8 *buf)
+{
+	const size_t max_blocks = ns->ctrl->max_transfer >> ns->block_shift;
+	const size_t len = count << ns->block_shift;
+	size_t done, n;
+
+	if (!count)
+		return 0;
+	if (!((uintptr_t)buf & 3) && dma_coherent(buf) &&
+	    dma_coherent(buf + len - 1))
+		return nvme_rw(ns, opc, lba, count, buf);
+
+	u8 *const bounce = nvme_bounce(ns);
+	if (!bounce)
+		return -1;
+	for (done = 0; done < count; done += n) {
+		n = MIN(count - done, max_blocks);
+		const size_t bytes = n << ns->block_shift;
+		if (opc == NVME_CMD_WRITE)
+			memcpy(bounce, buf, bytes);
+		if (nvme_rw(ns, opc, lba + done, n, bounce) < 0)
+			return -1;
+		if (opc == NVME_CMD_READ)
+			memcpy(buf, bounce, bytes);
+		buf += bytes;
+	}
+	return count;
+}
+
+static ssize_t nvme_read_unaligned(nvme_ns_t *const ns, const lba_t start,
+				   const size_t count, u8 *buf)
+{
+	const unsigned int shift = ns->block_shift - 9;
+	const size_t mask = (1 << shift) - 1;
+	lba_t blk = start;
+	size_t left = count;
+
+	while (left) {
+		const size_t offset = blk & mask;
+		/* Read whole blocks in one go. */
+		if (!offset && left > mask) {
+			const size_t n = left >> shift;
+			if (nvme_transfer(ns, NVME_CMD_READ, blk >> shift, n,
+					  buf) < 0)
+				return -1;
+			blk += n << shift;
+			buf += n << ns->block_shift;
+			left -= n << shift;
+			continue;
+		}
+
+		const size_t n = MIN(left, (mask + 1) - offset);
+		if (!nvme_bounce(ns) ||
+		    nvme_rw(ns, NVME_CMD_READ, blk >> shift, 1,
+			    ns->bounce) < 0)
+			return -1;
+		memcpy(buf, ns->bounce + (offset << 9), n << 9);
+		blk += n;
+		buf += n << 9;
+		left -= n;
+	}
+	return count;
+}
+
+static ssize_t nvme_read512(storage_dev_t *const dev, const lba_t start,
+			    const size_t count, unsigned char *const buf)
+{
+	nvme_ns_t *const ns = (nvme_ns_t *)dev;
+	const unsigned int shift = ns->block_shift - 9;
+	const size_t mask = (1 << shift) - 1;
+
+	if (!(start & mask) && !(count & mask)) {
+		const ssize_t ret = nvme_transfer(ns, NVME_CMD_READ,
+						  start >> shift,
+						  count >> shift, buf);
+		return ret < 0 ? ret : ret << shift;
+	}
+	return nvme_read_unaligned(ns, start, count, buf);
+}
+
+static ssize_t nvme_write512(storage_dev_t *const dev, const lba_t start,
+			     const size_t count,
+			     const unsigned char *const buf)
+{
+	nvme_ns_t *const ns = (nvme_ns_t *)dev;
+	const unsigned int shift = ns->block_shift - 9;
+	const size_t mask = (1 << shift) - 1;
+
+	if ((start & mask) || (count & mask)) {
+		printf("nvme: No support for unaligned writes.\n");
+		return -1;
+	}
+	const ssize_t ret = nvme_transfer(ns, NVME_CMD_WRITE, start >> shift,
+					  count >> shift, (u8 *)buf);
+	return ret < 0 ? ret : ret << shift;
+}
+
+static void nvme_attach_namespace(nvme_ctrl_t *const ctrl, const u32 nsid,
+				  const u8 *const id)
+{
+	u64 nsze;
+	memcpy(&nsze, id, sizeof(nsze));
+	if (!nsze)
+		return;
+
+	/* FLBAS selects one of the LBA formats starting at byte 128. */
+	const u8 flbas = id[26] & 0xf;
+	const unsigned int shift = id[128 + 4 * flbas + 2];
+	const u16 ms = id[128 + 4 * flbas] | id[128 + 4 * flbas + 1] << 8;
+	if (shift < 9 || shift > 12 || ms) {
+		printf("nvme: Namespace %u has unsupported format "
+		       "(2^%u byte blocks, %u bytes metadata).\n",
+		       nsid, shift, ms);
+		return;
+	}
+
+	nvme_ns_t *const ns = calloc(1, sizeof(*ns));
+	if (!ns)
+		return;
+	ns->ctrl = ctrl;
+	ns->nsid = nsid;
+	ns->num_blocks = nsze;
+	ns->block_shift = shift;
+	ns->storage_dev.port_type = PORT_TYPE_NVME;
+	ns->storage_dev.read_blocks512 = nvme_read512;
+	ns->storage_dev.write_blocks512 = nvme_write512;
+
+	printf("nvme: Namespace %u: %llu blocks of %u bytes.\n",
+	       nsid, (unsigned long long)nsze, 1 << shift);
+
+	if (storage_attach_device(&ns->storage_dev))
+		free(ns);
+}
+
+static int nvme_ctrl_init(nvme_ctrl_t *const ctrl)
+{
+	ctrl->cap = nvme_read64(ctrl, NVME_CAP);
+	if (!(ctrl->cap & NVME_CAP_CSS_NVM) || NVME_CAP_MPSMIN(ctrl->cap)) {
+		printf("nvme: Controller doesn't support NVM commands "
+		       "with 4KiB pages.\n");
+		return -1;
+	}
+
+	/* Disable the controller to set up the admin queues. */
+	nvme_write32(ctrl, NVME_CC, 0);
+	if (nvme_wait_ready(ctrl, 0))
+		return -1;
+
+	if (nvme_queue_alloc(ctrl, &ctrl->admin, 0, NVME_ADMIN_QUEUE_DEPTH))
+		return -1;
+	nvme_write32(ctrl, NVME_AQA, (NVME_ADMIN_QUEUE_DEPTH - 1) << 16 |
+				     (NVME_ADMIN_QUEUE_DEPTH - 1));
+	nvme_write64(ctrl, NVME_ASQ, virt_to_phys(ctrl->admin.sq));
+	nvme_write64(ctrl, NVME_ACQ, virt_to_phys((void *)ctrl->admin.cq));
+
+	nvme_write32(ctrl, NVME_CC, NVME_CC_IOCQES | NVME_CC_IOSQES |
+			NVME_CC_AMS_RR | NVME_CC_MPS_4K | NVME_CC_CSS_NVM |
+			NVME_CC_EN);
+	if (nvme_wait_ready(ctrl, 1))
+		return -1;
+
+	u8 *const id = dma_memalign(NVME_PAGE_SIZE, NVME_PAGE_SIZE);
+	if (!id)
+		return -1;
+
+	if (nvme_identify(ctrl, 0, NVME_IDENTIFY_CTRL, id)) {
+		free(id);
+		return -1;
+	}
+	/* MDTS is a power of two in units of the minimum page size. */
+	const u8 mdts = id[77];
+	ctrl->max_transfer = NVME_MAX_TRANSFER;
+	if (mdts && mdts < 16)
+		ctrl->max_transfer = MIN(ctrl->max_transfer,
+					 (size_t)NVME_PAGE_SIZE << mdts);
+	u32 nn;
+	memcpy(&nn, id + 516, sizeof(nn));
+
+	if (nvme_create_io_queues(ctrl)) {
+		free(id);
+		return -1;
+	}
+
+	printf("nvme: %d I/O queues of depth %u, %u namespaces.\n",
+	       ctrl->num_io, ctrl->io[0].depth, nn);
+
+	u32 nsid;
+	for (nsid = 1; nsid <= MIN(nn, NVME_MAX_NAMESPACES); ++nsid) {
+		if (!nvme_identify(ctrl, nsid, NVME_IDENTIFY_NS, id))
+			nvme_attach_namespace(ctrl, nsid, id);
+	}
+
+	free(id);
+	return 0;
+}
+
+static void nvme_init_pci(pcidev_t dev)
+{
+	/* Mass storage, non-volatile memory, NVMe */
+	if (pci_read_config16(dev, 0xa) != 0x0108 ||
+	    pci_read_config8(dev, 0x9) != 0x02)
+		return;
+	const u16 vendor = pci_read_config16(dev, 0x00);
+	const u16 device = pci_read_config16(dev, 0x02);
+
+	printf("nvme: Found NVMe controller %02x:%02x.%02x (%04x:%04x).\n",
+		PCI_BUS(dev), PCI_SLOT(dev), PCI_FUNC(dev), vendor, device);
+
+	u64 bar = pci_read_config32(dev, 0x10) & ~0xf;
+	if (pci_read_config32(dev, 0x10) & 0x4)
+		bar |= (u64)pci_read_config32(dev, 0x14) << 32;
+	if (bar != (uintptr_t)bar) {
+		printf("nvme: ERROR: BAR above 4GiB not reachable.\n");
+		return;
+	}
+
+	/* Enable memory space and bus mastering. */
+	const u16 command = pci_read_config16(dev, PCI_COMMAND);
+	pci_write_config16(dev, PCI_COMMAND,
+			   command | PCI_COMMAND_MEMORY | PCI_COMMAND_MASTER);
+
+	nvme_ctrl_t *const ctrl = calloc(1, sizeof(*ctrl));
+	if (!ctrl)
+		return;
+	ctrl->regs = phys_to_virt(bar);
+
+	/* Not freed on failure, the controller may still know our memory. */
+	if (nvme_ctrl_init(ctrl))
+		printf("nvme: ERROR: Failed to initialize controller.\n");
+}
+
+void nvme_initialize(void)
+{
+	int bus, dev, func;
+
+	for (bus = 0; bus < 256; ++bus) {
+		for (dev = 0; dev < 32; ++dev) {
+			const u16 class =
+				pci_read_config16(PCI_DEV(bus, dev, 0), 0xa);
+			if (class != 0xffff) {
+				for (func = 0; func < 8; ++func)
+					nvme_init_pci(PCI_DEV(bus, dev, func));
+			}
+		}
+	}
+}
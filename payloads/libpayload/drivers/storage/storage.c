@@ -31,6 +31,9 @@
 #if CONFIG(LP_STORAGE_AHCI)
 # include <storage/ahci.h>
 #endif
+#if CONFIG(LP_STORAGE_NVME)
+# include <storage/nvme.h>
+#endif
 #include <storage/storage.h>
 
 
@@ -38,6 +41,411 @@ static storage_dev_t **devices = NULL;
 static size_t devices_length = 0;
 static size_t dev_count = 0;
 
+#if CONFIG(LP_STORAGE_CACHE)
+
+/*
+ * Block cache shared by all devices. Blocks are CACHE_SECTORS sectors,
+ * aligned to their size, and kept in LRU order. Reads that continue where
+ * the last one stopped grow a read-ahead window, random reads shrink it
+ * again. With the write-back policy, writes only go to the cache and reach
+ * the device when their block is evicted or on storage_flush(). With
+ * write-through, they go to the device right away and update the cached
+ * copies of the blocks they cover.
+ */
+#define CACHE_SECTORS		CONFIG_LP_STORAGE_CACHE_BLOCK_SECTORS
+#define CACHE_BLOCK_SIZE	(CACHE_SECTORS * 512)
+#define CACHE_BLOCKS		CONFIG_LP_STORAGE_CACHE_BLOCKS
+#define CACHE_HASH_SIZE		64
+#define CACHE_RA_MAX		CONFIG_LP_STORAGE_CACHE_READAHEAD
+/* Blocks that are read or written in one go, requests this big bypass. */
+#define CACHE_STAGING_BLOCKS	MAX(MIN(CACHE_RA_MAX, CACHE_BLOCKS / 2), 1)
+
+typedef struct {
+	size_t dev_num;
+	lba_t block;		/* in units of CACHE_SECTORS */
+	u8 *data;
+	int valid;
+	int dirty;
+	int readahead;		/* read ahead and not used yet */
+	int prev, next;		/* LRU list, most recently used first */
+	int hash_next;
+} cache_entry_t;
+
+typedef struct {
+	lba_t next_sector;	/* where a sequential reader continues */
+	lba_t next_block;
+	size_t ra_blocks;	/* current read-ahead window */
+	storage_cache_stats_t stats;
+} cache_dev_t;
+
+static struct {
+	int state;		/* 0 not set up yet, 1 ready, -1 no memory */
+	cache_entry_t entries[CACHE_BLOCKS];
+	int hash[CACHE_HASH_SIZE];
+	int lru_head, lru_tail;
+	u8 *staging;		/* DMA buffer of CACHE_STAGING_BLOCKS */
+} cache;
+
+static cache_dev_t *cache_devs = NULL;
+
+static int cache_setup(void)
+{
+	int i;
+
+	if (cache.state)
+		return cache.state > 0;
+
+	u8 *const data = malloc(CACHE_BLOCKS * CACHE_BLOCK_SIZE);
+	cache.staging = dma_memalign(64,
+				     CACHE_STAGING_BLOCKS * CACHE_BLOCK_SIZE);
+	if (!data || !cache.staging) {
+		printf("storage: Not enough memory for block cache.\n");
+		free(data);
+		free(cache.staging);
+		cache.state = -1;
+		return 0;
+	}
+
+	for (i = 0; i < CACHE_HASH_SIZE; ++i)
+		cache.hash[i] = -1;
+	for (i = 0; i < CACHE_BLOCKS; ++i) {
+		cache.entries[i].data = data + i * CACHE_BLOCK_SIZE;
+		cache.entries[i].valid = 0;
+		cache.entries[i].prev = i - 1;
+		cache.entries[i].next = i + 1 < CACHE_BLOCKS ? i + 1 : -1;
+	}
+	cache.lru_head = 0;
+	cache.lru_tail = CACHE_BLOCKS - 1;
+	cache.state = 1;
+	return 1;
+}
+
+static inline int cache_hash(const size_t dev_num, const lba_t block)
+{
+	return ((u32)block * 2654435761u + dev_num) & (CACHE_HASH_SIZE - 1);
+}
+
+static int cache_lookup(const size_t dev_num, const lba_t block)
+{
+	int i;
+
+	for (i = cache.hash[cache_hash(dev_num, block)]; i >= 0;
+	     i = cache.entries[i].hash_next) {
+		if (cache.entries[i].dev_num == dev_num &&
+		    cache.entries[i].block == block)
+			return i;
+	}
+	return -1;
+}
+
+static void cache_lru_unlink(const int i)
+{
+	cache_entry_t *const e = &cache.entries[i];
+
+	if (e->prev >= 0)
+		cache.entries[e->prev].next = e->next;
+	else
+		cache.lru_head = e->next;
+	if (e->next >= 0)
+		cache.entries[e->next].prev = e->prev;
+	else
+		cache.lru_tail = e->prev;
+}
+
+/* Mark entry i most recently used. */
+static void cache_touch(const int i)
+{
+	cache_lru_unlink(i);
+	cache.entries[i].prev = -1;
+	cache.entries[i].next = cache.lru_head;
+	cache.entries[cache.lru_head].prev = i;
+	cache.lru_head = i;
+}
+
+/* Drop entry i from the cache, it will be reused next. */
+static void cache_drop(const int i)
+{
+	cache_entry_t *const e = &cache.entries[i];
+	int *link = &cache.hash[cache_hash(e->dev_num, e->block)];
+
+	while (*link != i)
+		link = &cache.entries[*link].hash_next;
+	*link = e->hash_next;
+	e->valid = 0;
+
+	cache_lru_unlink(i);
+	e->next = -1;
+	e->prev = cache.lru_tail;
+	cache.entries[cache.lru_tail].next = i;
+	cache.lru_tail = i;
+}
+
+/* Write the dirty blocks of a device in [first, last] back, in order. */
+static int cache_flush(const size_t dev_num, const lba_t first,
+		       const lba_t last)
+{
+	static int dirty[CACHE_BLOCKS];
+	storage_dev_t *const dev = devices[dev_num];
+	size_t num = 0, done, i, j;
+
+	for (i = 0; i < CACHE_BLOCKS; ++i) {
+		const cache_entry_t *const e = &cache.entries[i];
+		if (!e->valid || !e->dirty || e->dev_num != dev_num ||
+		    e->block < first || e->block > last)
+			continue;
+		/* Insertion sort by block number. */
+		for (j = num++; j > 0 &&
+		     cache.entries[dirty[j - 1]].block > e->block; --j)
+			dirty[j] = dirty[j - 1];
+		dirty[j] = i;
+	}
+	if (num && !dev->write_blocks512)
+		return -1;
+
+	/* Coalesce runs of consecutive blocks into one write each. */
+	for (done = 0; done < num; done += j) {
+		const lba_t block = cache.entries[dirty[done]].block;
+
+		for (j = 0; done + j < num && j < CACHE_STAGING_BLOCKS &&
+		     cache.entries[dirty[done + j]].block == block + j; ++j)
+			memcpy(cache.staging + j * CACHE_BLOCK_SIZE,
+			       cache.entries[dirty[done + j]].data,
+			       CACHE_BLOCK_SIZE);
+
+		const size_t count = j * CACHE_SECTORS;
+		if (dev->write_blocks512(dev, block * CACHE_SECTORS, count,
+					 cache.staging) != count) {
+			printf("storage: Writing back blocks %llu+%zu failed.\n",
+			       (unsigned long long)block, j);
+			return -1;
+		}
+		for (i = 0; i < j; ++i)
+			cache.entries[dirty[done + i]].dirty = 0;
+		cache_devs[dev_num].stats.writebacks += j;
+	}
+	return 0;
+}
+
+static void cache_invalidate(const size_t dev_num, const lba_t first,
+			     const lba_t last)
+{
+	int i;
+
+	for (i = 0; i < CACHE_BLOCKS; ++i) {
+		const cache_entry_t *const e = &cache.entries[i];
+		if (e->valid && e->dev_num == dev_num &&
+		    e->block >= first && e->block <= last)
+			cache_drop(i);
+	}
+}
+
+#if CONFIG(LP_STORAGE_CACHE_WRITE_THROUGH)
+/* Keep the cached copies of blocks that were written up to date. */
+static void cache_update(const size_t dev_num, const lba_t start,
+			 const size_t count, const unsigned char *const buf)
+{
+	int i;
+
+	for (i = 0; i < CACHE_BLOCKS; ++i) {
+		cache_entry_t *const e = &cache.entries[i];
+		const lba_t bstart = e->block * CACHE_SECTORS;
+		if (!e->valid || e->dev_num != dev_num ||
+		    bstart >= start + count || bstart + CACHE_SECTORS <= start)
+			continue;
+
+		const lba_t from = MAX(start, bstart);
+		const lba_t to = MIN(start + count, bstart + CACHE_SECTORS);
+		memcpy(e->data + (from - bstart) * 512, buf + (from - start) * 512,
+		       (to - from) * 512);
+	}
+}
+#endif
+
+/* Get the least recently used entry for a new block, or -1. */
+static int cache_alloc(const size_t dev_num, const lba_t block)
+{
+	const int i = cache.lru_tail;
+	cache_entry_t *const e = &cache.entries[i];
+
+	if (e->valid) {
+		cache_dev_t *const owner = &cache_devs[e->dev_num];
+
+		/* Write back all of it while we are at it, in few requests. */
+		if (e->dirty && cache_flush(e->dev_num, 0, (lba_t)-1) < 0)
+			return -1;
+		/* Read ahead too far, shrink the window. */
+		if (e->readahead) {
+			owner->stats.readahead_wasted++;
+			owner->ra_blocks /= 2;
+		}
+		cache_drop(i);
+	}
+
+	e->dev_num = dev_num;
+	e->block = block;
+	e->valid = 1;
+	e->dirty = 0;
+	e->readahead = 0;
+	e->hash_next = cache.hash[cache_hash(dev_num, block)];
+	cache.hash[cache_hash(dev_num, block)] = i;
+	cache_touch(i);
+	return i;
+}
+
+/*
+ * Read `count` uncached blocks from `block` on, followed by up to `ra`
+ * blocks of read-ahead, with a single request.
+ */
+static int cache_fill(const size_t dev_num, const lba_t block,
+		      const size_t count, size_t ra)
+{
+	static int fill[CACHE_BLOCKS];
+	storage_dev_t *const dev = devices[dev_num];
+	size_t n = count + ra;
+	size_t i;
+
+	/* Evict first, writing dirty blocks back goes through staging. */
+	for (i = 0; i < n; ++i) {
+		fill[i] = cache_alloc(dev_num, block + i);
+		if (fill[i] < 0)
+			goto drop;
+	}
+
+	if (dev->read_blocks512(dev, block * CACHE_SECTORS, n * CACHE_SECTORS,
+				cache.staging) != n * CACHE_SECTORS) {
+		/* Maybe we read ahead beyond the end of the device. */
+		if (!ra)
+			goto drop;
+		for (i = count; i < n; ++i)
+			cache_drop(fill[i]);
+		ra = 0;
+		i = n = count;
+		cache_devs[dev_num].ra_blocks = 0;
+		if (dev->read_blocks512(dev, block * CACHE_SECTORS,
+					n * CACHE_SECTORS, cache.staging) !=
+				n * CACHE_SECTORS)
+			goto drop;
+	}
+
+	for (i = 0; i < n; ++i) {
+		cache_entry_t *const e = &cache.entries[fill[i]];
+		memcpy(e->data, cache.staging + i * CACHE_BLOCK_SIZE,
+		       CACHE_BLOCK_SIZE);
+		e->readahead = i >= count;
+	}
+	cache_devs[dev_num].stats.readahead_blocks += ra;
+	return 0;
+
+drop:
+	while (i--)
+		cache_drop(fill[i]);
+	return -1;
+}
+
+static ssize_t cache_read(const size_t dev_num, const lba_t start,
+			  const size_t count, unsigned char *const buf)
+{
+	cache_dev_t *const cd = &cache_devs[dev_num];
+	const lba_t first = start / CACHE_SECTORS;
+	const lba_t last = (start + count - 1) / CACHE_SECTORS;
+	size_t filled = 0;
+	lba_t block;
+
+	/* Sequential readers get a growing read-ahead window. */
+	if (start == cd->next_sector || first == cd->next_block)
+		cd->ra_blocks = MIN(MAX(cd->ra_blocks * 2, (size_t)2),
+				    (size_t)CACHE_RA_MAX);
+	else
+		cd->ra_blocks = 0;
+	cd->next_sector = start + count;
+	cd->next_block = last + 1;
+
+	for (block = first; block <= last; ++block) {
+		int i = cache_lookup(dev_num, block);
+
+		if (i < 0) {
+			size_t n = 1, ra = 0;
+
+			while (block + n <= last && n < CACHE_STAGING_BLOCKS &&
+			       cache_lookup(dev_num, block + n) < 0)
+				++n;
+			/* Read ahead when this run finishes the request. */
+			if (block + n > last) {
+				while (ra < cd->ra_blocks &&
+				       n + ra < CACHE_STAGING_BLOCKS &&
+				       cache_lookup(dev_num, block + n + ra) < 0)
+					++ra;
+			}
+			if (cache_fill(dev_num, block, n, ra) < 0)
+				return -1;
+			cd->stats.misses += n;
+			filled = n;
+			i = cache_lookup(dev_num, block);
+		}
+
+		cache_entry_t *const e = &cache.entries[i];
+		if (filled) {
+			--filled;
+		} else {
+			cd->stats.hits++;
+			if (e->readahead) {
+				cd->stats.readahead_hits++;
+				e->readahead = 0;
+			}
+		}
+
+		const lba_t bstart = block * CACHE_SECTORS;
+		const lba_t from = MAX(start, bstart);
+		const lba_t to = MIN(start + count, bstart + CACHE_SECTORS);
+		memcpy(buf + (from - start) * 512, e->data + (from - bstart) * 512,
+		       (to - from) * 512);
+		cache_touch(i);
+	}
+
+	return count;
+}
+
+#if CONFIG(LP_STORAGE_CACHE_WRITE_BACK)
+static ssize_t cache_write(const size_t dev_num, const lba_t start,
+			   const size_t count, const unsigned char *const buf)
+{
+	const lba_t first = start / CACHE_SECTORS;
+	const lba_t last = (start + count - 1) / CACHE_SECTORS;
+	lba_t block;
+
+	for (block = first; block <= last; ++block) {
+		const lba_t bstart = block * CACHE_SECTORS;
+		const lba_t from = MAX(start, bstart);
+		const lba_t to = MIN(start + count, bstart + CACHE_SECTORS);
+		int i = cache_lookup(dev_num, block);
+
+		if (i < 0) {
+			/* Partial blocks need the rest read first. */
+			if (to - from < CACHE_SECTORS) {
+				if (cache_fill(dev_num, block, 1, 0) < 0)
+					return -1;
+				i = cache_lookup(dev_num, block);
+			} else {
+				i = cache_alloc(dev_num, block);
+				if (i < 0)
+					return -1;
+			}
+		}
+
+		cache_entry_t *const e = &cache.entries[i];
+		memcpy(e->data + (from - bstart) * 512, buf + (from - start) * 512,
+		       (to - from) * 512);
+		e->dirty = 1;
+		e->readahead = 0;
+		cache_touch(i);
+	}
+
+	return count;
+}
+#endif
+
+#endif
+
 int storage_attach_device(storage_dev_t *const dev)
 {
 	if (dev_count == devices_length) {
@@ -50,8 +458,20 @@ int storage_attach_device(storage_dev_t *const dev)
 		devices = new_devices;
 		memset(devices + devices_length, '\0',
 			(new_len - devices_length) * sizeof(storage_dev_t *));
+#if CONFIG(LP_STORAGE_CACHE)
+		cache_dev_t *const new_cache_devs =
+			realloc(cache_devs, new_len * sizeof(cache_dev_t));
+		if (!new_cache_devs)
+			return -1;
+		cache_devs = new_cache_devs;
+#endif
 		devices_length = new_len;
 	}
+#if CONFIG(LP_STORAGE_CACHE)
+	memset(&cache_devs[dev_count], 0, sizeof(cache_devs[dev_count]));
+	cache_devs[dev_count].next_sector = (lba_t)-1;
+	cache_devs[dev_count].next_block = (lba_t)-1;
+#endif
 	devices[dev_count++] = dev;
 
 	return 0;
@@ -74,10 +494,21 @@ storage_poll_t storage_probe(const size_t dev_num)
 {
 	if (dev_num >= dev_count)
 		return POLL_NO_DEVICE;
-	else if (devices[dev_num]->poll)
-		return devices[dev_num]->poll(devices[dev_num]);
-	else
+	else if (!devices[dev_num]->poll)
 		return POLL_MEDIUM_PRESENT;
+
+	const storage_poll_t ret = devices[dev_num]->poll(devices[dev_num]);
+#if CONFIG(LP_STORAGE_CACHE)
+	/* The medium may have been changed, forget about the old one.
+	   Dirty blocks are lost, there is nothing to write them to. */
+	if (ret != POLL_MEDIUM_PRESENT && cache.state > 0) {
+		cache_invalidate(dev_num, 0, (lba_t)-1);
+		cache_devs[dev_num].ra_blocks = 0;
+		cache_devs[dev_num].next_sector = (lba_t)-1;
+		cache_devs[dev_num].next_block = (lba_t)-1;
+	}
+#endif
+	return ret;
 }
 
 /**
@@ -95,11 +526,141 @@ ssize_t storage_read_blocks512(const size_t dev_num,
 			       const lba_t start, const size_t count,
 			       unsigned char *const buf)
 {
-	if ((dev_num < dev_count) && devices[dev_num]->read_blocks512)
-		return devices[dev_num]->read_blocks512(
-				devices[dev_num], start, count, buf);
-	else
+	if ((dev_num >= dev_count) || !devices[dev_num]->read_blocks512)
+		return -1;
+
+#if CONFIG(LP_STORAGE_CACHE)
+	if (count && cache_setup()) {
+		const lba_t first = start / CACHE_SECTORS;
+		const lba_t last = (start + count - 1) / CACHE_SECTORS;
+
+		if (last - first + 1 <= CACHE_STAGING_BLOCKS &&
+		    cache_read(dev_num, start, count, buf) >= 0)
+			return count;
+
+		/* Too big to cache, or e.g. a partial block at the end of
+		   the device. Dirty blocks have to reach the device first. */
+		cache_devs[dev_num].stats.bypassed++;
+		if (cache_flush(dev_num, first, last) < 0)
+			return -1;
+	}
+#endif
+
+	return devices[dev_num]->read_blocks512(
+			devices[dev_num], start, count, buf);
+}
+
+/**
+ * Write 512-byte blocks
+ *
+ * Writes count blocks of 512 bytes from buf to block start of drive
+ * dev_num. With the write-back block cache, the data may only reach the
+ * device on storage_flush().
+ *
+ * @dev_num device number counted from 0
+ * @start number of first block to write to
+ * @count number of blocks to write
+ * @buf buffer holding the data to write
+ */
+ssize_t storage_write_blocks512(const size_t dev_num,
+				const lba_t start, const size_t count,
+				const unsigned char *const buf)
+{
+	if ((dev_num >= dev_count) || !devices[dev_num]->write_blocks512)
 		return -1;
+
+#if CONFIG(LP_STORAGE_CACHE_WRITE_BACK)
+	if (count && cache_setup()) {
+		const lba_t first = start / CACHE_SECTORS;
+		const lba_t last = (start + count - 1) / CACHE_SECTORS;
+
+		if (last - first + 1 <= CACHE_STAGING_BLOCKS &&
+		    cache_write(dev_num, start, count, buf) >= 0)
+			return count;
+
+		/* Write through. Cached blocks written so far are flushed
+		   first, so the direct write below is the last word. */
+		cache_devs[dev_num].stats.bypassed++;
+		if (cache_flush(dev_num, first, last) < 0)
+			return -1;
+		cache_invalidate(dev_num, first, last);
+	}
+#endif
+
+	const ssize_t ret = devices[dev_num]->write_blocks512(
+			devices[dev_num], start, count, buf);
+
+#if CONFIG(LP_STORAGE_CACHE_WRITE_THROUGH)
+	/* If the write failed, we don't know what the device holds now. */
+	if (count && cache.state > 0) {
+		if (ret == count)
+			cache_update(dev_num, start, count, buf);
+		else
+			cache_invalidate(dev_num, start / CACHE_SECTORS,
+					 (start + count - 1) / CACHE_SECTORS);
+	}
+#endif
+	return ret;
+}
+
+/**
+ * Write cached data back
+ *
+ * Writes all blocks of drive dev_num that were written to the block
+ * cache only back to the device.
+ *
+ * @dev_num device number counted from 0
+ * @return 0 on success, -1 on error
+ */
+int storage_flush(const size_t dev_num)
+{
+	if (dev_num >= dev_count)
+		return -1;
+
+#if CONFIG(LP_STORAGE_CACHE)
+	if (cache.state > 0)
+		return cache_flush(dev_num, 0, (lba_t)-1);
+#endif
+	return 0;
+}
+
+/**
+ * Write cached data of all drives back
+ *
+ * Called by libpayload when the payload returns from main(), calls exit()
+ * or hands off control with exec(), so writes don't get lost in the
+ * block cache.
+ *
+ * @return 0 on success, -1 if any drive failed
+ */
+int storage_flush_all(void)
+{
+	size_t i;
+	int ret = 0;
+
+	for (i = 0; i < dev_count; ++i)
+		if (storage_flush(i) < 0)
+			ret = -1;
+	return ret;
+}
+
+/**
+ * Get block cache statistics
+ *
+ * @dev_num device number counted from 0
+ * @stats filled with the statistics of drive dev_num
+ * @return 0 on success, -1 if there is no such drive or no cache
+ */
+int storage_get_cache_stats(const size_t dev_num,
+			    storage_cache_stats_t *const stats)
+{
+#if CONFIG(LP_STORAGE_CACHE)
+	if (dev_num < dev_count) {
+		*stats = cache_devs[dev_num].stats;
+		return 0;
+	}
+#endif
+	return -1;
 }
 
 /**
@@ -113,4 +674,7 @@ void storage_initialize(void)
 #if CONFIG(LP_STORAGE_AHCI)
 	ahci_initialize();
 #endif
+#if CONFIG(LP_STORAGE_NVME)
+	nvme_initialize();
+#endif
 }
@@ -29,10 +29,82 @@
 
 //#define USB_DEBUG
 
+#include <inttypes.h>
+#include <libpayload.h>
 #include <stdlib.h>
 #include <usb/usb.h>
 #include "generic_hub.h"
 
+/*
+ * Each port is enumerated by a state machine that usb_poll() advances until
+ * all of them are idle again. Instead of blocking for the settle and reset
+ * times, a port remembers when it entered its current state, so the ports of
+ * all hubs on all controllers wait at the same time.
+ */
+#define POWER_ON_US		(20 * 1000)	/* wait once for all ports */
+#define DEBOUNCE_STEP_US	1000	/* linux uses 25ms, we're busy anyway */
+#define DEBOUNCE_STABLE_US	(100 * 1000)	/* usb20 spec 9.1.2 */
+#define DEBOUNCE_TIMEOUT_US	(1500 * 1000)	/* linux uses this value */
+/* usb20 spec 11.5.1.5: reset should take 10 to 20ms, USB 3 warm resets
+   can take longer */
+#define RESET_MIN_US		(10 * 1000)
+#define RESET_TIMEOUT_US	(150 * 1000)
+#define RESET_STEP_US		100
+#define ENABLE_TIMEOUT_US	(10 * 1000)
+#define ENABLE_STEP_US		10
+#define RECOVERY_US		(10 * 1000)	/* usb20 spec 7.1.7.5 */
+
+/* all generic hubs, so their ports can be run from usb_poll() */
+static generic_hub_t *generic_hubs;
+/* number of ports on all hubs that are not idle */
+static int generic_hub_busy_ports;
+
+static void
+generic_hub_set_state(generic_hub_t *const hub, const int port,
+		      const generic_hub_port_state_t state)
+{
+	generic_hub_port_t *const ps = &hub->port_state[port];
+
+	if (ps->state == PORT_IDLE && state != PORT_IDLE)
+		++generic_hub_busy_ports;
+	else if (ps->state != PORT_IDLE && state == PORT_IDLE)
+		--generic_hub_busy_ports;
+
+	ps->state = state;
+	ps->state_us = timer_us(0);
+	ps->next_us = ps->state_us;
+}
+
+/*
+ * After a reset, the device listens to the default address until it got its
+ * own. Only one device per bus may do that at a time, and all downstream ports
+ * of a hub share the bus of its upstream port. xHCI root hub ports each lead
+ * to a bus of their own.
+ */
+static int
+generic_hub_port_shares_bus(usbdev_t *const dev)
+{
+	return !(dev->controller->type == XHCI && dev->hub < 0);
+}
+
+static void
+generic_hub_release_bus(usbdev_t *const dev, const int port)
+{
+	generic_hub_port_t *const ps = &GEN_HUB(dev)->port_state[port];
+
+	if (ps->owns_bus) {
+		dev->controller->port_reset_busy = 0;
+		ps->owns_bus = 0;
+	}
+}
+
+static void
+generic_hub_port_idle(usbdev_t *const dev, const int port)
+{
+	generic_hub_release_bus(dev, port);
+	generic_hub_set_state(GEN_HUB(dev), port, PORT_IDLE);
+}
+
 void
 generic_hub_destroy(usbdev_t *const dev)
 {
@@ -43,6 +115,7 @@ generic_hub_destroy(usbdev_t *const dev)
 	/* First, detach all devices behind this hub */
 	int port;
 	for (port = 1; port <= hub->num_ports; ++port) {
+		generic_hub_port_idle(dev, port);
 		if (hub->ports[port] >= 0) {
 			usb_debug("generic_hub: Detachment at port %d\n", port);
 			usb_detach_device(dev->controller, hub->ports[port]);
@@ -56,41 +129,17 @@ generic_hub_destroy(usbdev_t *const dev)
 			hub->ops->disable_port(dev, port);
 	}
 
-	free(hub->ports);
-	free(hub);
-}
-
-static int
-generic_hub_debounce(usbdev_t *const dev, const int port)
-{
-	generic_hub_t *const hub = GEN_HUB(dev);
-
-	const int step_ms	= 1;	/* linux uses 25ms, we're busy anyway */
-	const int at_least_ms	= 100;	/* 100ms as in usb20 spec 9.1.2 */
-	const int timeout_ms	= 1500;	/* linux uses this value */
-
-	int total_ms = 0;
-	int stable_ms = 0;
-	while (stable_ms < at_least_ms && total_ms < timeout_ms) {
-		mdelay(step_ms);
-
-		const int changed = hub->ops->port_status_changed(dev, port);
-		const int connected = hub->ops->port_connected(dev, port);
-		if (changed < 0 || connected < 0)
-			return -1;
-
-		if (!changed && connected) {
-			stable_ms += step_ms;
-		} else {
-			usb_debug("generic_hub: Unstable connection at %d\n",
-				  port);
-			stable_ms = 0;
+	generic_hub_t **link;
+	for (link = &generic_hubs; *link; link = &(*link)->next) {
+		if (*link == hub) {
+			*link = hub->next;
+			break;
 		}
-		total_ms += step_ms;
 	}
-	if (total_ms >= timeout_ms)
-		usb_debug("generic_hub: Debouncing timed out at %d\n", port);
-	return 0; /* ignore timeouts, try to always go on */
+
+	free(hub->port_state);
+	free(hub->ports);
+	free(hub);
 }
 
 int
@@ -146,47 +195,222 @@ generic_hub_detach_dev(usbdev_t *const dev, const int port)
 	return 0;
 }
 
-static int
-generic_hub_attach_dev(usbdev_t *const dev, const int port)
+static void
+generic_hub_attach_dev(usbdev_t *const dev, const int port,
+		       const usb_speed speed)
 {
 	generic_hub_t *const hub = GEN_HUB(dev);
+	generic_hub_port_t *const ps = &hub->port_state[port];
 
-	if (generic_hub_debounce(dev, port) < 0)
-		return -1;
+	usb_debug("generic_hub: Success at port %d\n", port);
+	hub->ports[port] = usb_attach_device(
+			dev->controller, dev->address, port, speed);
+	generic_hub_port_idle(dev, port);
 
-	if (hub->ops->reset_port) {
-		if (hub->ops->reset_port(dev, port) < 0)
-			return -1;
+	usb_debug("generic_hub: Port %d connected at %"PRIu64"us, "
+		  "debounced at %"PRIu64"us, attached at %"PRIu64"us\n",
+		  port, ps->connect_us, ps->debounced_us, timer_us(0));
+}
+
+/* returns speed of the port after the reset, or a negative value */
+static int
+generic_hub_reset_done(usbdev_t *const dev, const int port)
+{
+	generic_hub_t *const hub = GEN_HUB(dev);
 
-		if (!hub->ops->port_connected(dev, port)) {
+	const int connected = hub->ops->port_connected(dev, port);
+	if (connected <= 0) {
+		if (!connected)
 			usb_debug(
 				"generic_hub: Port %d disconnected after "
 				"reset. Possibly upgraded, rescan required.\n",
 				port);
+		generic_hub_port_idle(dev, port);
+		return connected < 0 ? -1 : 0;
+	}
+
+	/* after reset the port will be enabled automatically */
+	generic_hub_set_state(hub, port, PORT_ENABLE);
+	return 0;
+}
+
+static int
+generic_hub_start_reset(usbdev_t *const dev, const int port)
+{
+	generic_hub_t *const hub = GEN_HUB(dev);
+	generic_hub_port_t *const ps = &hub->port_state[port];
+
+	if (generic_hub_port_shares_bus(dev)) {
+		if (dev->controller->port_reset_busy)
+			return 0;	/* try again later */
+		dev->controller->port_reset_busy = 1;
+		ps->owns_bus = 1;
+	}
+
+	if (!hub->ops->start_port_reset) {
+		/* only a blocking reset available */
+		if (hub->ops->reset_port(dev, port) < 0) {
+			generic_hub_port_idle(dev, port);
+			return -1;
+		}
+		return generic_hub_reset_done(dev, port);
+	}
+
+	if (hub->ops->start_port_reset(dev, port) < 0) {
+		generic_hub_port_idle(dev, port);
+		return -1;
+	}
+	generic_hub_set_state(hub, port, PORT_RESET);
+	return 0;
+}
+
+/* advance the port's state machine, never blocks */
+static int
+generic_hub_run_port(usbdev_t *const dev, const int port)
+{
+	generic_hub_t *const hub = GEN_HUB(dev);
+	generic_hub_port_t *const ps = &hub->port_state[port];
+	const uint64_t now = timer_us(0);
+	const uint64_t elapsed = now - ps->state_us;
+	int ret;
+
+	if (ps->state == PORT_IDLE || now < ps->next_us)
+		return 0;
+
+	switch (ps->state) {
+	case PORT_POWER:
+		if (elapsed < POWER_ON_US)
 			return 0;
+		/* Enumerate regardless of change bits. Some broken hubs
+		   don't set them if already connected during reset. */
+		ret = hub->ops->port_connected(dev, port);
+		if (ret <= 0) {
+			generic_hub_port_idle(dev, port);
+			return ret;
 		}
+		usb_debug("generic_hub: Port coldplug at %d\n", port);
+		ps->connect_us = now;
+		ps->stable_us = now;
+		generic_hub_set_state(hub, port, PORT_DEBOUNCE);
+		return 0;
 
-		/* after reset the port will be enabled automatically */
-		const int ret = generic_hub_wait_for_port(
-			/* time out after 1,000 * 10us = 10ms */
-			dev, port, 1, hub->ops->port_enabled, 1000, 10);
-		if (ret < 0)
+	case PORT_DEBOUNCE: {
+		ps->next_us = now + DEBOUNCE_STEP_US;
+
+		const int changed = hub->ops->port_status_changed(dev, port);
+		const int connected = hub->ops->port_connected(dev, port);
+		if (changed < 0 || connected < 0) {
+			generic_hub_port_idle(dev, port);
+			return -1;
+		}
+
+		if (changed || !connected) {
+			usb_debug("generic_hub: Unstable connection at %d\n",
+				  port);
+			ps->stable_us = now;
+		}
+		if (now - ps->stable_us < DEBOUNCE_STABLE_US) {
+			if (elapsed < DEBOUNCE_TIMEOUT_US)
+				return 0;
+			/* ignore timeouts, try to always go on */
+			usb_debug("generic_hub: Debouncing timed out at %d\n",
+				  port);
+		}
+		ps->debounced_us = now;
+		generic_hub_set_state(hub, port, PORT_WAIT_RESET);
+		return 0;
+	}
+	case PORT_WAIT_RESET:
+		if (hub->ops->reset_port)
+			return generic_hub_start_reset(dev, port);
+
+		ret = hub->ops->port_speed(dev, port);
+		if (ret >= 0)
+			generic_hub_attach_dev(dev, port, ret);
+		else
+			generic_hub_port_idle(dev, port);
+		return 0;
+
+	case PORT_RESET:
+		if (elapsed < RESET_MIN_US)
+			return 0;
+		ret = hub->ops->port_in_reset(dev, port);
+		if (ret < 0) {
+			generic_hub_port_idle(dev, port);
+			return -1;
+		}
+		if (ret) {
+			if (elapsed < RESET_TIMEOUT_US) {
+				ps->next_us = now + RESET_STEP_US;
+				return 0;
+			}
+			/* ignore timeouts, try to always go on */
+			usb_debug("generic_hub: Reset timed out at port %d\n",
+				  port);
+		}
+		return generic_hub_reset_done(dev, port);
+
+	case PORT_ENABLE:
+		ret = hub->ops->port_enabled(dev, port);
+		if (ret < 0) {
+			generic_hub_port_idle(dev, port);
 			return -1;
-		else if (!ret)
+		}
+		if (!ret) {
+			if (elapsed < ENABLE_TIMEOUT_US) {
+				ps->next_us = now + ENABLE_STEP_US;
+				return 0;
+			}
 			usb_debug("generic_hub: Port %d still "
 				  "disabled after 10ms\n", port);
+		}
+
+		ret = hub->ops->port_speed(dev, port);
+		if (ret < 0) {
+			generic_hub_port_idle(dev, port);
+			return 0;
+		}
+		ps->speed = ret;
+		generic_hub_set_state(hub, port, PORT_RECOVERY);
+		ps->next_us = ps->state_us + RECOVERY_US;
+		return 0;
+
+	case PORT_RECOVERY:
+		generic_hub_attach_dev(dev, port, ps->speed);
+		return 0;
+
+	default:
+		generic_hub_port_idle(dev, port);
+		return 0;
 	}
+}
 
-	const usb_speed speed = hub->ops->port_speed(dev, port);
-	if (speed >= 0) {
-		usb_debug("generic_hub: Success at port %d\n", port);
-		if (hub->ops->reset_port)
-			mdelay(10); /* Reset recovery time
-				       (usb20 spec 7.1.7.5) */
-		hub->ports[port] = usb_attach_device(
-				dev->controller, dev->address, port, speed);
+static void
+generic_hub_run_ports(usbdev_t *const dev)
+{
+	generic_hub_t *const hub = GEN_HUB(dev);
+	int port;
+
+	for (port = 1; port <= hub->num_ports; ++port) {
+		if (generic_hub_run_port(dev, port) < 0)
+			return;
 	}
-	return 0;
+}
+
+int
+generic_hub_run_all(void)
+{
+	generic_hub_t *hub, *next;
+
+	if (!generic_hub_busy_ports)
+		return 0;
+
+	/* Hubs attached meanwhile are added at the head, so `next` stays. */
+	for (hub = generic_hubs; hub; hub = next) {
+		next = hub->next;
+		generic_hub_run_ports(hub->dev);
+	}
+	return generic_hub_busy_ports;
 }
 
 int
@@ -202,10 +426,20 @@ generic_hub_scanport(usbdev_t *const dev, const int port)
 			return ret;
 	}
 
-	if (hub->ops->port_connected(dev, port)) {
+	/* restart enumeration if it was in progress */
+	generic_hub_port_idle(dev, port);
+
+	const int connected = hub->ops->port_connected(dev, port);
+	if (connected < 0)
+		return connected;
+	if (connected) {
 		usb_debug("generic_hub: Attachment at port %d\n", port);
 
-		return generic_hub_attach_dev(dev, port);
+		hub->port_state[port].connect_us = timer_us(0);
+		hub->port_state[port].stable_us =
+			hub->port_state[port].connect_us;
+		generic_hub_set_state(hub, port, PORT_DEBOUNCE);
+		return generic_hub_run_port(dev, port);
 	}
 
 	return 0;
@@ -224,6 +458,9 @@ generic_hub_poll(usbdev_t *const dev)
 
 	int port;
 	for (port = 1; port <= hub->num_ports; ++port) {
+		/* ports being enumerated watch their own changes */
+		if (hub->port_state[port].state != PORT_IDLE)
+			continue;
 		const int ret = hub->ops->port_status_changed(dev, port);
 		if (ret < 0) {
 			return;
@@ -252,9 +489,13 @@ generic_hub_init(usbdev_t *const dev, const int num_ports,
 	generic_hub_t *const hub = GEN_HUB(dev);
 	hub->num_ports = num_ports;
 	hub->ports = malloc(sizeof(*hub->ports) * (num_ports + 1));
+	hub->port_state = calloc(num_ports + 1, sizeof(*hub->port_state));
 	hub->ops = ops;
-	if (!hub->ports) {
+	hub->dev = dev;
+	if (!hub->ports || !hub->port_state) {
 		usb_debug("generic_hub: ERROR: Out of memory\n");
+		free(hub->ports);
+		free(hub->port_state);
 		free(dev->data);
 		dev->data = NULL;
 		return -1;
@@ -262,12 +503,17 @@ generic_hub_init(usbdev_t *const dev, const int num_ports,
 	for (port = 1; port <= num_ports; ++port)
 		hub->ports[port] = NO_DEV;
 
-	/* Enable all ports */
-	if (ops->enable_port) {
-		for (port = 1; port <= num_ports; ++port)
+	hub->next = generic_hubs;
+	generic_hubs = hub;
+
+	/* Enable all ports, then look for devices that are already
+	   connected once they all had time to power up. */
+	for (port = 1; port <= num_ports; ++port) {
+		if (ops->enable_port)
 			ops->enable_port(dev, port);
-		/* wait once for all ports */
-		mdelay(20);
+		generic_hub_set_state(hub, port, PORT_POWER);
+		if (!ops->enable_port)
+			hub->port_state[port].state_us -= POWER_ON_US;
 	}
 
 	return 0;
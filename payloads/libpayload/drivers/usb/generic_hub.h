@@ -52,13 +52,35 @@ typedef struct generic_hub_ops {
 	int (*enable_port)(usbdev_t *, int port);
 	/* disables (powers down) a port (optional) */
 	int (*disable_port)(usbdev_t *, int port);
-	/* starts a port reset (required if reset_port is set to a generic one from below) */
+	/* starts a port reset (required if reset_port is set to a generic one from below,
+	   if set, enumeration polls port_in_reset instead of calling reset_port) */
 	int (*start_port_reset)(usbdev_t *, int port);
 
 	/* performs a port reset (optional, generic implementations below) */
 	int (*reset_port)(usbdev_t *, int port);
 } generic_hub_ops_t;
 
+typedef enum {
+	PORT_IDLE = 0,
+	PORT_POWER,		/* waiting for the port to power up */
+	PORT_DEBOUNCE,		/* waiting for the connection to settle */
+	PORT_WAIT_RESET,	/* waiting for the bus to reset on */
+	PORT_RESET,		/* waiting for the reset to finish */
+	PORT_ENABLE,		/* waiting for the port to get enabled */
+	PORT_RECOVERY,		/* reset recovery time before attaching */
+} generic_hub_port_state_t;
+
+typedef struct generic_hub_port {
+	generic_hub_port_state_t state;
+	int owns_bus;		/* device listens to the default address */
+	usb_speed speed;
+	uint64_t state_us;	/* when the current state was entered */
+	uint64_t next_us;	/* don't look at the port before */
+	uint64_t stable_us;	/* connection hasn't changed since */
+	uint64_t connect_us;	/* when the connection was seen */
+	uint64_t debounced_us;	/* when the connection was stable */
+} generic_hub_port_t;
+
 typedef struct generic_hub {
 	int num_ports;
 	/* port numbers are always 1 based,
@@ -66,8 +88,13 @@ typedef struct generic_hub {
 	int *ports; /* allocated to sizeof(*ports)*(num_ports+1) */
 #define NO_DEV -1
 
+	generic_hub_port_t *port_state; /* same size as ports */
+
 	const generic_hub_ops_t *ops;
 
+	usbdev_t *dev;
+	struct generic_hub *next;
+
 	void *data;
 } generic_hub_t;
 
@@ -78,6 +105,8 @@ int generic_hub_wait_for_port(usbdev_t *const dev, const int port,
 			      int timeout_steps, const int step_us);
 int  generic_hub_resetport(usbdev_t *, int port);
 int  generic_hub_scanport(usbdev_t *, int port);
+/* advances enumeration on all hubs, returns number of ports still busy */
+int  generic_hub_run_all(void);
 /* the provided generic_hub_ops struct has to be static */
 int generic_hub_init(usbdev_t *, int num_ports, const generic_hub_ops_t *);
 
@@ -31,11 +31,20 @@
 
 #include <libpayload-config.h>
 #include <usb/usb.h>
+#if CONFIG(LP_USB_XHCI_MSI)
+#include <arch/apic.h>
+#include <arch/exception.h>
+#endif
+#include "generic_hub.h"
 
 #define DR_DESC gen_bmRequestType(device_to_host, standard_type, dev_recp)
 
 hci_t *usb_hcs = 0;
 
+#if CONFIG(LP_USB_XHCI_MSI)
+volatile u8 usb_irq_pending;
+#endif
+
 hci_t *
 new_controller (void)
 {
@@ -79,6 +88,19 @@ usb_exit (void)
 	return 0;
 }
 
+/**
+ * Allocates a buffer that bulk transfers can use in place
+ *
+ * Transfers from memory that isn't DMA coherent are bounced through a
+ * buffer of the controller, which costs a copy and limits their size.
+ * Buffers from here are DMA coherent. Release them with free().
+ */
+void *
+usb_alloc_bulk_buffer (size_t size)
+{
+	return dma_memalign (64, size);
+}
+
 /**
  * Polls all hubs on all USB controllers, to find out about device changes
  */
@@ -87,6 +109,10 @@ usb_poll (void)
 {
 	if (usb_hcs == 0)
 		return;
+#if CONFIG(LP_USB_XHCI_MSI)
+	/* Interrupts from here on may signal events we don't see yet. */
+	usb_irq_pending = 0;
+#endif
 	hci_t *controller = usb_hcs;
 	while (controller != NULL) {
 		int i;
@@ -97,6 +123,31 @@ usb_poll (void)
 		}
 		controller = controller->next;
 	}
+
+	/* Let the port enumeration of all hubs on all controllers progress
+	   together until it's done. */
+	while (generic_hub_run_all())
+		;
+}
+
+/**
+ * Waits up to usec microseconds for USB activity
+ *
+ * Input loops call this between calls to usb_poll() instead of spinning.
+ * With interrupt driven controllers, it halts the CPU until one of them
+ * signals an event that the last usb_poll() didn't see. Otherwise, it
+ * just waits.
+ */
+void
+usb_idle (unsigned int usec)
+{
+#if CONFIG(LP_USB_XHCI_MSI)
+	if (apic_initialized() && interrupts_enabled()) {
+		apic_wait(usec, &usb_irq_pending);
+		return;
+	}
+#endif
+	udelay(usec);
 }
 
 usbdev_t *
@@ -182,23 +182,6 @@ static const generic_hub_ops_t usb_hub_ops = {
 	.reset_port		= generic_hub_resetport,
 };
 
-/* Clear CSC if set and enumerate port if it's connected regardless of change
-   bits. Some broken hubs don't set CSC if already connected during reset. */
-static void
-usb_hub_port_initialize(usbdev_t *const dev, const int port)
-{
-	unsigned short buf[2];
-	int ret = get_status(dev, port, DR_PORT, sizeof(buf), buf);
-	if (ret < 0)
-		return;
-	if (buf[1] & PORT_CONNECTION)
-		clear_feature(dev, port, SEL_C_PORT_CONNECTION, DR_PORT);
-	if (buf[0] & PORT_CONNECTION) {
-		usb_debug("usbhub: Port coldplug at %d\n", port);
-		generic_hub_scanport(dev, port);
-	}
-}
-
 static int
 usb_hub_handle_port_change(usbdev_t *const dev, const int port)
 {
@@ -324,10 +307,6 @@ usb_hub_init(usbdev_t *const dev)
 		return;
 	}
 
-	int port;
-	for (port = 1; port <= num_ports; ++port)
-		usb_hub_port_initialize(dev, port);
-
 	GEN_HUB(dev)->data = intrq;
 	dev->poll = usb_hub_poll;
 	dev->destroy = usb_hub_destroy;
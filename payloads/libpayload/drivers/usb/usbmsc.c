@@ -88,6 +88,8 @@ usb_msc_destroy (usbdev_t *dev)
 {
 	if (dev->data) {
 		usb_msc_remove_disk (dev);
+		free (MSC_INST (dev)->cmd);
+		free (MSC_INST (dev)->bounce);
 		free (dev->data);
 	}
 	dev->data = 0;
@@ -121,6 +123,11 @@ typedef struct {
 	unsigned char bCSWStatus;
 } __packed csw_t;
 
+typedef struct {
+	cbw_t cbw;
+	csw_t csw;
+} __packed msc_cmd_t;
+
 enum {
 	/*
 	 * MSC commands can be
@@ -220,10 +227,11 @@ wrap_cbw (cbw_t *cbw, int datalen, cbw_direction dir, const u8 *cmd,
 }
 
 static int
-get_csw (endpoint_t *ep, csw_t *csw)
+get_csw (endpoint_t *ep, csw_t *csw, int queued)
 {
 	hci_t *ctrlr = ep->dev->controller;
-	int ret = ctrlr->bulk (ep, sizeof (csw_t), (u8 *) csw, 1);
+	int ret = queued ? ctrlr->bulk_wait (ep)
+			 : ctrlr->bulk (ep, sizeof (csw_t), (u8 *) csw, 1);
 
 	/* Some broken sticks send a zero-length packet at the end of their data
 	   transfer which would show up here. Skip it to get the actual CSW. */
@@ -245,19 +253,11 @@ get_csw (endpoint_t *ep, csw_t *csw)
 }
 
 static int
-execute_command (usbdev_t *dev, cbw_direction dir, const u8 *cb, int cblen,
-		 u8 *buf, int buflen, int residue_ok)
+transfer_command (usbdev_t *dev, msc_cmd_t *cmd, cbw_direction dir,
+		  u8 *buf, int buflen)
 {
-	cbw_t cbw;
-	csw_t csw;
-
-	int always_succeed = 0;
-	if ((cb[0] == 0x1b) && (cb[4] == 1)) {	//start command, always succeed
-		always_succeed = 1;
-	}
-	wrap_cbw (&cbw, buflen, dir, cb, cblen, MSC_INST (dev)->lun);
-	if (dev->controller->
-	    bulk (MSC_INST (dev)->bulk_out, sizeof (cbw), (u8 *) &cbw, 0) < 0) {
+	if (dev->controller->bulk (MSC_INST (dev)->bulk_out,
+				   sizeof (cmd->cbw), (u8 *) &cmd->cbw, 0) < 0) {
 		return reset_transport (dev);
 	}
 	if (buflen > 0) {
@@ -271,17 +271,90 @@ execute_command (usbdev_t *dev, cbw_direction dir, const u8 *cb, int cblen,
 				clear_stall (MSC_INST (dev)->bulk_out);
 		}
 	}
-	int ret = get_csw (MSC_INST (dev)->bulk_in, &csw);
+	return get_csw (MSC_INST (dev)->bulk_in, &cmd->csw, 0);
+}
+
+/*
+ * Like transfer_command, but queues the CBW, data and CSW transfers at once,
+ * so the controller moves from one phase to the next without waiting for us.
+ * Everything on the bulk-in pipe is queued before the CBW goes out. The data
+ * has to be DMA coherent, readwrite_chunk stages other buffers in
+ * MSC_INST (dev)->bounce. Returns -1 without having sent anything if the
+ * transfers can't be queued.
+ */
+static int
+transfer_command_queued (usbdev_t *dev, msc_cmd_t *cmd, cbw_direction dir,
+			 u8 *buf, int buflen)
+{
+	usbmsc_inst_t *msc = MSC_INST (dev);
+	hci_t *ctrlr = dev->controller;
+	endpoint_t *data_ep = (dir == cbw_direction_data_in)
+		? msc->bulk_in : msc->bulk_out;
+
+	if (!ctrlr->bulk_queue || cmd != msc->cmd ||
+	    (buflen > 0 && !dma_coherent (buf)))
+		return -1;
+
+	if (buflen > 0 && data_ep == msc->bulk_in &&
+	    ctrlr->bulk_queue (data_ep, buflen, buf) < 0)
+		return -1;
+	if (ctrlr->bulk_queue (msc->bulk_in, sizeof (cmd->csw),
+			       (u8 *) &cmd->csw) < 0 ||
+	    ctrlr->bulk_queue (msc->bulk_out, sizeof (cmd->cbw),
+			       (u8 *) &cmd->cbw) < 0) {
+		ctrlr->bulk_cancel (msc->bulk_in);
+		return -1;
+	}
+	if (buflen > 0 && data_ep == msc->bulk_out &&
+	    ctrlr->bulk_queue (data_ep, buflen, buf) < 0) {
+		/* The CBW is out already, get the device back in sync. */
+		ctrlr->bulk_cancel (msc->bulk_in);
+		ctrlr->bulk_cancel (msc->bulk_out);
+		return reset_transport (dev);
+	}
+
+	if (ctrlr->bulk_wait (msc->bulk_out) < 0) {
+		ctrlr->bulk_cancel (msc->bulk_in);
+		ctrlr->bulk_cancel (msc->bulk_out);
+		return reset_transport (dev);
+	}
+	if (buflen > 0 && ctrlr->bulk_wait (data_ep) < 0) {
+		clear_stall (data_ep);
+		/* The queued CSW transfer is stuck behind the failed one. */
+		if (data_ep == msc->bulk_in) {
+			ctrlr->bulk_cancel (msc->bulk_in);
+			return get_csw (msc->bulk_in, &cmd->csw, 0);
+		}
+	}
+	return get_csw (msc->bulk_in, &cmd->csw, 1);
+}
+
+static int
+execute_command (usbdev_t *dev, cbw_direction dir, const u8 *cb, int cblen,
+		 u8 *buf, int buflen, int residue_ok)
+{
+	msc_cmd_t stack_cmd;
+	msc_cmd_t *cmd = MSC_INST (dev)->cmd ? MSC_INST (dev)->cmd : &stack_cmd;
+	csw_t *csw = &cmd->csw;
+
+	int always_succeed = 0;
+	if ((cb[0] == 0x1b) && (cb[4] == 1)) {	//start command, always succeed
+		always_succeed = 1;
+	}
+	wrap_cbw (&cmd->cbw, buflen, dir, cb, cblen, MSC_INST (dev)->lun);
+	int ret = transfer_command_queued (dev, cmd, dir, buf, buflen);
+	if (ret < 0)
+		ret = transfer_command (dev, cmd, dir, buf, buflen);
 	if (ret) {
 		return ret;
 	} else if (always_succeed == 1) {
 		/* return success, regardless of message */
 		return MSC_COMMAND_OK;
-	} else if (csw.bCSWStatus == 2) {
+	} else if (csw->bCSWStatus == 2) {
 		/* phase error, reset transport */
 		return reset_transport (dev);
-	} else if (csw.bCSWStatus == 0) {
-		if ((csw.dCSWDataResidue == 0) || residue_ok)
+	} else if (csw->bCSWStatus == 0) {
+		if ((csw->dCSWDataResidue == 0) || residue_ok)
 			/* no error, exit */
 			return MSC_COMMAND_OK;
 		else
@@ -364,6 +437,18 @@ readwrite_blocks_512 (usbdev_t *dev, int start, int n,
 static int
 readwrite_chunk (usbdev_t *dev, int start, int n, cbw_direction dir, u8 *buf)
 {
+	const int len = n * MSC_INST(dev)->blocksize;
+	u8 *data = buf;
+	int ret;
+
+	/* Queued transfers need DMA coherent memory. Stage other buffers in
+	   ours, which is still cheaper than running the phases one by one. */
+	if (MSC_INST(dev)->bounce && !dma_coherent (buf)) {
+		data = MSC_INST(dev)->bounce;
+		if (dir == cbw_direction_data_out)
+			memcpy (data, buf, len);
+	}
+
 	cmdblock_t cb;
 	memset (&cb, 0, sizeof (cb));
 	if (dir == cbw_direction_data_in) {
@@ -376,9 +461,12 @@ readwrite_chunk (usbdev_t *dev, int start, int n, cbw_direction dir, u8 *buf)
 	cb.block = htonl (start);
 	cb.numblocks = htonw (n);
 
-	return execute_command (dev, dir, (u8 *) &cb, sizeof (cb), buf,
-				n * MSC_INST(dev)->blocksize, 0)
-		!= MSC_COMMAND_OK ? 1 : 0;
+	ret = execute_command (dev, dir, (u8 *) &cb, sizeof (cb), data, len, 0);
+	if (ret != MSC_COMMAND_OK)
+		return 1;	/* dev may be gone, don't touch it. */
+	if (data != buf && dir == cbw_direction_data_in)
+		memcpy (buf, data, len);
+	return 0;
 }
 
 /**
@@ -649,6 +737,12 @@ void usb_msc_force_init (usbdev_t *dev, u32 quirks)
 
 	MSC_INST (dev)->bulk_in = 0;
 	MSC_INST (dev)->bulk_out = 0;
+	MSC_INST (dev)->cmd = NULL;
+	MSC_INST (dev)->bounce = NULL;
+	if (dev->controller->bulk_queue) {
+		MSC_INST (dev)->cmd = dma_malloc (sizeof (msc_cmd_t));
+		MSC_INST (dev)->bounce = usb_alloc_bulk_buffer (MAX_CHUNK_BYTES);
+	}
 	MSC_INST (dev)->usbdisk_created = 0;
 	MSC_INST (dev)->quirks = quirks;
 
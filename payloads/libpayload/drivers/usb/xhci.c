@@ -32,6 +32,10 @@
 
 #include <inttypes.h>
 #include <arch/virtual.h>
+#if CONFIG(LP_USB_XHCI_MSI)
+#include <arch/apic.h>
+#include <exception.h>
+#endif
 #include "xhci_private.h"
 #include "xhci.h"
 
@@ -41,6 +45,9 @@ static void xhci_reset (hci_t *controller);
 static void xhci_reinit (hci_t *controller);
 static void xhci_shutdown (hci_t *controller);
 static int xhci_bulk (endpoint_t *ep, int size, u8 *data, int finalize);
+static int xhci_bulk_queue (endpoint_t *ep, int size, u8 *data);
+static int xhci_bulk_wait (endpoint_t *ep);
+static void xhci_bulk_cancel (endpoint_t *ep);
 static int xhci_control (usbdev_t *dev, direction_t dir, int drlen, void *devreq,
 			 int dalen, u8 *data);
 static void* xhci_create_intr_queue (endpoint_t *ep, int reqsize, int reqcount, int reqtiming);
@@ -85,6 +92,9 @@ xhci_init_cycle_ring(transfer_ring_t *const tr, const size_t ring_size)
 
 	tr->pcs = 1;
 	tr->cur = tr->ring;
+	tr->queued = 0;
+	tr->queued_first = 0;
+	tr->queued_total = 0;
 }
 
 /* On Panther Point: switch ports shared with EHCI to xHCI */
@@ -161,6 +171,9 @@ xhci_init (unsigned long physical_bar)
 	controller->init		= xhci_reinit;
 	controller->shutdown		= xhci_shutdown;
 	controller->bulk		= xhci_bulk;
+	controller->bulk_queue		= xhci_bulk_queue;
+	controller->bulk_wait		= xhci_bulk_wait;
+	controller->bulk_cancel		= xhci_bulk_cancel;
 	controller->control		= xhci_control;
 	controller->set_address		= xhci_set_address;
 	controller->finish_device_config= xhci_finish_device_config;
@@ -297,6 +310,153 @@ _free_xhci:
 	return NULL;
 }
 
+#if CONFIG(LP_USB_XHCI_MSI)
+#define PCI_STATUS_CAP_LIST		(1 << 4)
+#define PCI_COMMAND_INTX_DISABLE	(1 << 10)
+#define PCI_CAP_ID_MSI			0x05
+#define PCI_MSI_FLAGS			0x02
+#define  PCI_MSI_FLAGS_ENABLE		(1 << 0)
+#define  PCI_MSI_FLAGS_QSIZE		(7 << 4)
+#define  PCI_MSI_FLAGS_64BIT		(1 << 7)
+#define PCI_MSI_ADDRESS_LO		0x04
+#define PCI_MSI_ADDRESS_HI		0x08
+#define PCI_MSI_DATA_32			0x08
+#define PCI_MSI_DATA_64			0x0c
+
+#define XHCI_MSI_VECTOR_BASE		0x40
+#define XHCI_MSI_MAX_CONTROLLERS	8
+
+/* by vector - XHCI_MSI_VECTOR_BASE */
+static hci_t *xhci_msi_controllers[XHCI_MSI_MAX_CONTROLLERS];
+
+static u8
+xhci_find_msi_cap(const pcidev_t addr)
+{
+	int i;
+	u8 pos;
+
+	if (!(pci_read_config16(addr, REG_STATUS) & PCI_STATUS_CAP_LIST))
+		return 0;
+
+	pos = pci_read_config8(addr, REG_CAP_POINTER) & ~3;
+	/* Bound the walk, in case the list is broken and loops */
+	for (i = 0; pos && i < 48; ++i) {
+		if (pci_read_config8(addr, pos) == PCI_CAP_ID_MSI)
+			return pos;
+		pos = pci_read_config8(addr, pos + 1) & ~3;
+	}
+	return 0;
+}
+
+/*
+ * Only acknowledges the interrupt and wakes up waiters. Events are
+ * still handled by whoever waits for them, so none of the driver
+ * state has to be protected against the handler.
+ */
+static void
+xhci_interrupt_handler(const u8 vector)
+{
+	hci_t *const controller =
+		xhci_msi_controllers[vector - XHCI_MSI_VECTOR_BASE];
+	if (!controller)
+		return;
+
+	xhci_t *const xhci = XHCI_INST(controller);
+	xhci->hcrreg->intrrs[0].iman = IMAN_IE | IMAN_IP;
+	xhci->opreg->usbsts =
+		(xhci->opreg->usbsts & USBSTS_PRSRV_MASK) | USBSTS_EINT;
+
+	++xhci->irq_count;
+	xhci->irq_pending = 1;
+	usb_irq_pending = 1;
+}
+
+static void
+xhci_enable_interrupter(xhci_t *const xhci)
+{
+	/* Coalesce events that arrive in quick succession,
+	   IMODI counts in steps of 250ns. */
+	xhci->hcrreg->intrrs[0].imod = CONFIG_LP_USB_XHCI_IMOD_US * 4;
+	xhci->hcrreg->intrrs[0].iman = IMAN_IE | IMAN_IP;
+	xhci->opreg->usbcmd |= USBCMD_INTE;
+}
+
+static void
+xhci_enable_msi(hci_t *const controller)
+{
+	xhci_t *const xhci = XHCI_INST(controller);
+	const pcidev_t addr = controller->pcidev;
+	int i;
+
+	if (!apic_initialized())
+		return;
+
+	const u8 cap = xhci_find_msi_cap(addr);
+	if (!cap) {
+		xhci_debug("No MSI capability, polling for events\n");
+		return;
+	}
+
+	for (i = 0; i < XHCI_MSI_MAX_CONTROLLERS; ++i) {
+		if (!xhci_msi_controllers[i])
+			break;
+	}
+	if (i == XHCI_MSI_MAX_CONTROLLERS)
+		return;
+
+	const u8 vector = XHCI_MSI_VECTOR_BASE + i;
+	xhci_msi_controllers[i] = controller;
+	xhci->irq_vector = vector;
+	set_interrupt_handler(vector, xhci_interrupt_handler);
+
+	/* Fixed delivery of a single, edge triggered vector to this CPU */
+	u16 flags = pci_read_config16(addr, cap + PCI_MSI_FLAGS);
+	pci_write_config32(addr, cap + PCI_MSI_ADDRESS_LO,
+			   0xfee00000 | apic_id() << 12);
+	if (flags & PCI_MSI_FLAGS_64BIT) {
+		pci_write_config32(addr, cap + PCI_MSI_ADDRESS_HI, 0);
+		pci_write_config16(addr, cap + PCI_MSI_DATA_64, vector);
+	} else {
+		pci_write_config16(addr, cap + PCI_MSI_DATA_32, vector);
+	}
+	flags &= ~PCI_MSI_FLAGS_QSIZE;
+	pci_write_config16(addr, cap + PCI_MSI_FLAGS,
+			   flags | PCI_MSI_FLAGS_ENABLE);
+	pci_write_config16(addr, REG_COMMAND,
+			   pci_read_config16(addr, REG_COMMAND) |
+			   PCI_COMMAND_INTX_DISABLE);
+
+	xhci_enable_interrupter(xhci);
+	xhci_debug("Using MSI vector 0x%02x\n", vector);
+}
+
+static void
+xhci_disable_msi(hci_t *const controller)
+{
+	xhci_t *const xhci = XHCI_INST(controller);
+	const pcidev_t addr = controller->pcidev;
+
+	if (!xhci->irq_vector)
+		return;
+
+	xhci->opreg->usbcmd &= ~USBCMD_INTE;
+	xhci->hcrreg->intrrs[0].iman = IMAN_IP;
+
+	const u8 cap = xhci_find_msi_cap(addr);
+	pci_write_config16(addr, cap + PCI_MSI_FLAGS,
+			   pci_read_config16(addr, cap + PCI_MSI_FLAGS) &
+			   ~PCI_MSI_FLAGS_ENABLE);
+	pci_write_config16(addr, REG_COMMAND,
+			   pci_read_config16(addr, REG_COMMAND) &
+			   ~PCI_COMMAND_INTX_DISABLE);
+
+	/* The handler stays installed, it ignores late interrupts. */
+	xhci_msi_controllers[xhci->irq_vector - XHCI_MSI_VECTOR_BASE] = NULL;
+	xhci_debug("Handled %"PRIu32" interrupts\n", xhci->irq_count);
+	xhci->irq_vector = 0;
+}
+#endif
+
 #if CONFIG(LP_USB_PCI)
 hci_t *
 xhci_pci_init (pcidev_t addr)
@@ -314,6 +474,9 @@ xhci_pci_init (pcidev_t addr)
 		controller->pcidev = addr;
 
 		xhci_switch_ppt_ports(addr);
+#if CONFIG(LP_USB_XHCI_MSI)
+		xhci_enable_msi(controller);
+#endif
 	}
 
 	return controller;
@@ -393,6 +556,12 @@ xhci_reinit (hci_t *controller)
 
 	xhci_start(controller);
 
+#if CONFIG(LP_USB_XHCI_MSI)
+	/* Re-enable what was disabled above after a reset */
+	if (xhci->irq_vector)
+		xhci_enable_interrupter(xhci);
+#endif
+
 #ifdef USB_DEBUG
 	int i;
 	for (i = 0; i < 32; ++i) {
@@ -424,6 +593,9 @@ xhci_shutdown(hci_t *const controller)
 	detach_controller(controller);
 
 	xhci_t *const xhci = XHCI_INST(controller);
+#if CONFIG(LP_USB_XHCI_MSI)
+	xhci_disable_msi(controller);
+#endif
 	xhci_stop(controller);
 
 #if CONFIG(LP_USB_PCI)
@@ -545,7 +717,8 @@ xhci_ring_doorbell(endpoint_t *const ep)
 		xhci_ep_id(ep);
 }
 
-static void
+/* returns the number of TRBs used */
+static size_t
 xhci_enqueue_td(transfer_ring_t *const tr, const int ep, const size_t mps,
 		const int dalen, void *const data, const int dir)
 {
@@ -617,6 +790,8 @@ xhci_enqueue_td(transfer_ring_t *const tr, const int ep, const size_t mps,
 	TRB_SET(IOC, trb, 1);
 
 	xhci_enqueue_trb(tr);
+
+	return trb_count + 1;
 }
 
 static int
@@ -736,6 +911,7 @@ xhci_bulk(endpoint_t *const ep, const int size, u8 *const src,
 		return -1;
 	}
 
+	/* Buffers from usb_alloc_bulk_buffer() are used in place. */
 	if (!dma_coherent(src)) {
 		data = xhci->dma_buffer;
 		if (size > DMA_SIZE) {
@@ -746,6 +922,13 @@ xhci_bulk(endpoint_t *const ep, const int size, u8 *const src,
 			memcpy(data, src, size);
 	}
 
+	/* Their events would be taken for ours */
+	if (tr->queued) {
+		xhci_debug("Dropping %d queued TDs on ID %d EP %d\n",
+			   tr->queued, slot_id, ep_id);
+		xhci_bulk_cancel(ep);
+	}
+
 	/* Reset endpoint if it's not running */
 	const unsigned ep_state = EC_GET(STATE, epctx);
 	if (ep_state > 1) {
@@ -781,6 +964,112 @@ xhci_bulk(endpoint_t *const ep, const int size, u8 *const src,
 	return ret;
 }
 
+/*
+ * Queue a bulk TD without waiting for it. Unlike xhci_bulk(), this doesn't
+ * bounce through xhci->dma_buffer, so several TDs can be in flight and the
+ * controller moves from one to the next without a round trip through us.
+ * Returns 0 if the TD was queued, -1 if the caller has to use xhci_bulk().
+ */
+static int
+xhci_bulk_queue(endpoint_t *const ep, const int size, u8 *const data)
+{
+	xhci_t *const xhci = XHCI_INST(ep->dev->controller);
+	const int slot_id = ep->dev->address;
+	const int ep_id = xhci_ep_id(ep);
+	epctx_t *const epctx = xhci->dev[slot_id].ctx.ep[ep_id];
+	transfer_ring_t *const tr = xhci->dev[slot_id].transfer_rings[ep_id];
+
+	if (!dma_coherent(data))
+		return -1;
+
+	/* One TRB per 64KiB boundary crossed, plus the Event Data TRB */
+	const size_t off = (size_t)data & 0xffff;
+	const size_t trbs = MAX(1, (off + size + 0xffff) >> 16) + 1;
+	if (tr->queued == BULK_QUEUE_SIZE ||
+	    tr->queued_total + trbs > TRANSFER_RING_SIZE - 2)
+		return -1;
+
+	/* Reset endpoint if it's not running */
+	const unsigned ep_state = EC_GET(STATE, epctx);
+	if (ep_state > 1) {
+		/* Resetting would drop TDs the caller still waits for */
+		if (tr->queued || xhci_reset_endpoint(ep->dev, ep))
+			return -1;
+	}
+
+	const unsigned mps = EC_GET(MPS, epctx);
+	const unsigned dir = (ep->direction == OUT) ? TRB_DIR_OUT : TRB_DIR_IN;
+	const size_t used = xhci_enqueue_td(tr, ep_id, mps, size, data, dir);
+	xhci_ring_doorbell(ep);
+
+	tr->queued_trbs[(tr->queued_first + tr->queued) % BULK_QUEUE_SIZE] =
+		used;
+	tr->queued_total += used;
+	++tr->queued;
+
+	return 0;
+}
+
+/* returns amount of bytes transferred by the oldest queued TD,
+   negative CC on error */
+static int
+xhci_bulk_wait(endpoint_t *const ep)
+{
+	xhci_t *const xhci = XHCI_INST(ep->dev->controller);
+	const int slot_id = ep->dev->address;
+	const int ep_id = xhci_ep_id(ep);
+	transfer_ring_t *const tr = xhci->dev[slot_id].transfer_rings[ep_id];
+
+	if (!tr->queued) {
+		xhci_debug("No TD queued on ID %d EP %d\n", slot_id, ep_id);
+		return -1;
+	}
+
+	const int ret = xhci_wait_for_transfer(xhci, slot_id, ep_id);
+
+	tr->queued_total -= tr->queued_trbs[tr->queued_first];
+	tr->queued_first = (tr->queued_first + 1) % BULK_QUEUE_SIZE;
+	--tr->queued;
+
+	if (ret < 0) {
+		if (ret == TIMEOUT) {
+			xhci_debug("Stopping ID %d EP %d\n", slot_id, ep_id);
+			xhci_cmd_stop_endpoint(xhci, slot_id, ep_id);
+		}
+		xhci_debug("Queued bulk transfer failed: %d\n"
+			   "  ep state: %d\n"
+			   "  usbsts:   0x%08"PRIx32"\n",
+			   ret, EC_GET(STATE, xhci->dev[slot_id].ctx.ep[ep_id]),
+			   xhci->opreg->usbsts);
+	}
+	return ret;
+}
+
+/* drop all TDs still queued on the endpoint */
+static void
+xhci_bulk_cancel(endpoint_t *const ep)
+{
+	xhci_t *const xhci = XHCI_INST(ep->dev->controller);
+	const int slot_id = ep->dev->address;
+	const int ep_id = xhci_ep_id(ep);
+	epctx_t *const epctx = xhci->dev[slot_id].ctx.ep[ep_id];
+	transfer_ring_t *const tr = xhci->dev[slot_id].transfer_rings[ep_id];
+
+	if (!tr->queued)
+		return;
+
+	if (EC_GET(STATE, epctx) == 1)
+		xhci_cmd_stop_endpoint(xhci, slot_id, ep_id);
+
+	/* Reinitializes the transfer ring, which forgets the TDs */
+	if (xhci_reset_endpoint(ep->dev, ep))
+		xhci_debug("Failed to drop queued TDs on ID %d EP %d\n",
+			   slot_id, ep_id);
+
+	/* Events of TDs that completed meanwhile are stale now */
+	xhci_handle_events(xhci);
+}
+
 static trb_t *
 xhci_next_trb(trb_t *cur, int *const pcs)
 {
@@ -31,6 +31,10 @@
 
 #include <inttypes.h>
 #include <arch/virtual.h>
+#if CONFIG(LP_USB_XHCI_MSI)
+#include <arch/apic.h>
+#include <arch/exception.h>
+#endif
 #include "xhci_private.h"
 
 void
@@ -58,7 +62,10 @@ xhci_update_event_dq(xhci_t *const xhci)
 		xhci_spew("Updating dq ptr: @%p(0x%08"PRIx32") -> %p\n",
 			  phys_to_virt(xhci->hcrreg->intrrs[0].erdp_lo),
 			  xhci->hcrreg->intrrs[0].erdp_lo, xhci->er.cur);
-		xhci->hcrreg->intrrs[0].erdp_lo = virt_to_phys(xhci->er.cur);
+		/* Also clear the Event Handler Busy flag, so the
+		   controller may interrupt again. */
+		xhci->hcrreg->intrrs[0].erdp_lo =
+			virt_to_phys(xhci->er.cur) | ERDP_EHB;
 		xhci->hcrreg->intrrs[0].erdp_hi = 0;
 		xhci->er.adv = 0;
 	}
@@ -202,11 +209,46 @@ xhci_handle_events(xhci_t *const xhci)
 	xhci_update_event_dq(xhci);
 }
 
+#if CONFIG(LP_USB_XHCI_MSI)
+/* Upper bound for a single sleep, in case an interrupt gets lost. */
+#define XHCI_IRQ_WAIT_US 1000
+
 static unsigned long
-xhci_wait_for_event(const event_ring_t *const er,
-		    unsigned long *const timeout_us)
+xhci_sleep_for_event(xhci_t *const xhci, unsigned long *const timeout_us)
+{
+	while (*timeout_us) {
+		xhci->irq_pending = 0;
+		if (xhci_event_ready(&xhci->er))
+			break;
+
+		/* Hand consumed events back, so the controller interrupts
+		   for the next one. A moderated interrupt may have set EHB
+		   after we consumed its events, clear it in any case. */
+		xhci_update_event_dq(xhci);
+		if (xhci->hcrreg->intrrs[0].erdp_lo & ERDP_EHB) {
+			xhci->hcrreg->intrrs[0].erdp_lo =
+				virt_to_phys(xhci->er.cur) | ERDP_EHB;
+			xhci->hcrreg->intrrs[0].erdp_hi = 0;
+		}
+
+		const u64 start = timer_us(0);
+		apic_wait(MIN(*timeout_us, XHCI_IRQ_WAIT_US),
+			  &xhci->irq_pending);
+		*timeout_us -= MIN(*timeout_us, MAX(timer_us(start), 1));
+	}
+	return *timeout_us;
+}
+#endif
+
+static unsigned long
+xhci_wait_for_event(xhci_t *const xhci, unsigned long *const timeout_us)
 {
-	while (!xhci_event_ready(er) && *timeout_us) {
+#if CONFIG(LP_USB_XHCI_MSI)
+	/* apic_wait() needs interrupts, poll if they are off. */
+	if (xhci->irq_vector && apic_initialized() && interrupts_enabled())
+		return xhci_sleep_for_event(xhci, timeout_us);
+#endif
+	while (!xhci_event_ready(&xhci->er) && *timeout_us) {
 		--*timeout_us;
 		udelay(1);
 	}
@@ -218,7 +260,7 @@ xhci_wait_for_event_type(xhci_t *const xhci,
 		    const int trb_type,
 		    unsigned long *const timeout_us)
 {
-	while (xhci_wait_for_event(&xhci->er, timeout_us)) {
+	while (xhci_wait_for_event(xhci, timeout_us)) {
 		if (TRB_GET(TT, xhci->er.cur) == trb_type)
 			break;
 
@@ -161,10 +161,17 @@ typedef struct {
 
 /* Never raise this above 256 to prevent transfer event length overflow! */
 #define TRANSFER_RING_SIZE 32
+/* Max. number of bulk TDs queued on one transfer ring at once */
+#define BULK_QUEUE_SIZE 8
 typedef struct {
 	trb_t *ring;
 	trb_t *cur;
 	u8 pcs;
+	/* Bulk TDs queued by xhci_bulk_queue() and not waited for yet */
+	u8 queued;			/* number of TDs */
+	u8 queued_first;		/* index of the oldest in queued_trbs */
+	u8 queued_total;		/* number of TRBs used by all of them */
+	u8 queued_trbs[BULK_QUEUE_SIZE];/* number of TRBs used by each TD */
 } __packed transfer_ring_t;
 
 #define COMMAND_RING_SIZE 4
@@ -455,12 +462,15 @@ typedef struct xhci {
 		u8 res1[0x20-0x4];
 		struct {
 			u32 iman;
+#define IMAN_IP (1 << 0)
+#define IMAN_IE (1 << 1)
 			u32 imod;
 			u32 erstsz;
 			u32 res;
 			u32 erstba_lo;
 			u32 erstba_hi;
 			u32 erdp_lo;
+#define ERDP_EHB (1 << 3)
 			u32 erdp_hi;
 		} __packed intrrs[]; // up to 1024, but maximum host specific, given in capreg->MaxIntrs
 	} __packed *hcrreg;
@@ -483,6 +493,12 @@ typedef struct xhci {
 
 #define DMA_SIZE (64 * 1024)
 	void *dma_buffer;
+
+	/* MSI vector, 0 if events are polled */
+	u8 irq_vector;
+	/* set by the interrupt handler, cleared by waiters */
+	volatile u8 irq_pending;
+	u32 irq_count;
 } xhci_t;
 
 #define XHCI_INST(controller) ((xhci_t*)((controller)->instance))
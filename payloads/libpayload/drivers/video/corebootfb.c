@@ -65,9 +65,10 @@ static const u32 vga_colors[] = {
 static unsigned long fbinfo;
 static unsigned long fbaddr;
 static unsigned short *chars;
+static unsigned char *shadow;
 
 #define FI ((struct cb_framebuffer *) phys_to_virt(fbinfo))
-#define FB ((unsigned char *) phys_to_virt(fbaddr))
+#define FB (shadow ? shadow : (unsigned char *) phys_to_virt(fbaddr))
 #define CHARS (chars)
 
 static void corebootfb_scroll_up(void)
@@ -92,6 +93,9 @@ static void corebootfb_scroll_up(void)
 		dst += FI->bytes_per_line;
 	}
 
+	shadowfb_damage(0, 0, FI->x_resolution, FI->y_resolution);
+	shadowfb_flush();
+
 	/* And update the char buffer */
 	dst = (unsigned char *) CHARS;
 	src = (unsigned char *) (CHARS + coreboot_video_console.columns);
@@ -115,6 +119,9 @@ static void corebootfb_clear(void)
 		ptr += FI->bytes_per_line;
 	}
 
+	shadowfb_damage(0, 0, FI->x_resolution, FI->y_resolution);
+	shadowfb_flush();
+
 	/* And update the char buffer */
 	for(row = 0; row < coreboot_video_console.rows; row++)
 		for (column = 0; column < coreboot_video_console.columns; column++)
@@ -177,6 +184,11 @@ static void corebootfb_putchar(u8 row, u8 col, unsigned int ch)
 
 		dst += FI->bytes_per_line;
 	}
+
+	/* Glyphs are drawn one pixel to the right of the cell. */
+	shadowfb_damage(col * font_width, row * font_height, font_width + 1,
+			font_height);
+	shadowfb_flush();
 }
 
 static void corebootfb_putc(u8 row, u8 col, unsigned int ch)
@@ -238,6 +250,8 @@ static int corebootfb_init(void)
 	if (fbaddr == 0)
 		return -1;
 
+	shadow = shadowfb_init(FI);
+
 	font_init(FI->x_resolution);
 
 	coreboot_video_console.columns = FI->x_resolution / font_width;
@@ -121,40 +121,251 @@ static inline uint32_t calculate_color(const struct rgb_color *rgb,
 	return color;
 }
 
-/*
- * Plot a pixel in a framebuffer. This is called from tight loops. Keep it slim
- * and do the validation at callers' site.
- */
-static inline void set_pixel(struct vector *coord, uint32_t color)
+/* Translate screen coordinates to framebuffer coordinates. */
+static inline void rotate_vector(struct vector *out, const struct vector *in)
 {
-	const int bpp = fbinfo->bits_per_pixel;
-	const int bpl = fbinfo->bytes_per_line;
-	struct vector rcoord;
-	int i;
-
 	switch (fbinfo->orientation) {
 	case CB_FB_ORIENTATION_NORMAL:
 	default:
-		rcoord.x = coord->x;
-		rcoord.y = coord->y;
+		out->x = in->x;
+		out->y = in->y;
 		break;
 	case CB_FB_ORIENTATION_BOTTOM_UP:
-		rcoord.x = screen.size.width - 1 - coord->x;
-		rcoord.y = screen.size.height - 1 - coord->y;
+		out->x = screen.size.width - 1 - in->x;
+		out->y = screen.size.height - 1 - in->y;
 		break;
 	case CB_FB_ORIENTATION_LEFT_UP:
-		rcoord.x = coord->y;
-		rcoord.y = screen.size.width - 1 - coord->x;
+		out->x = in->y;
+		out->y = screen.size.width - 1 - in->x;
 		break;
 	case CB_FB_ORIENTATION_RIGHT_UP:
-		rcoord.x = screen.size.height - 1 - coord->y;
-		rcoord.y = coord->x;
+		out->x = screen.size.height - 1 - in->y;
+		out->y = in->x;
+		break;
+	}
+}
+
+/* Translate a box on the screen to a box in the framebuffer. */
+static void rotate_box(struct rect *out, const struct vector *top_left,
+		       const struct vector *size)
+{
+	struct vector bottom_right, a, b;
+
+	bottom_right.x = top_left->x + size->width - 1;
+	bottom_right.y = top_left->y + size->height - 1;
+	rotate_vector(&a, top_left);
+	rotate_vector(&b, &bottom_right);
+
+	out->offset.x = MIN(a.x, b.x);
+	out->offset.y = MIN(a.y, b.y);
+	out->size.width = ABS(a.x - b.x) + 1;
+	out->size.height = ABS(a.y - b.y) + 1;
+}
+
+/*
+ * Report a box on the screen as changed to the shadow framebuffer. Callers
+ * push it out with shadowfb_flush() once they are done drawing.
+ */
+static void damage_box(const struct vector *top_left, const struct vector *size)
+{
+	struct rect box;
+
+	if (size->width <= 0 || size->height <= 0)
+		return;
+
+	rotate_box(&box, top_left, size);
+	shadowfb_damage(box.offset.x, box.offset.y, box.size.width,
+			box.size.height);
+}
+
+/*
+ * Span backend. Drawing writes a whole run of pixels at a time, with the
+ * widest aligned stores the pixel format allows, instead of plotting single
+ * pixels and redoing the address math for each. Formats and framebuffers the
+ * wide stores don't cover fall back to byte stores.
+ */
+static int wide_stores_ok(const uint8_t *dst)
+{
+	const int bytes = fbinfo->bits_per_pixel / 8;
+
+	if (!CONFIG(LP_LITTLE_ENDIAN))
+		return 0;
+	return bytes == 3 || ((uintptr_t)dst % bytes == 0 &&
+			      fbinfo->bytes_per_line % bytes == 0);
+}
+
+static void fill_row_bytes(uint8_t *dst, size_t n, uint32_t color)
+{
+	const int bytes = fbinfo->bits_per_pixel / 8;
+	int i;
+
+	for (; n; n--, dst += bytes)
+		for (i = 0; i < bytes; i++)
+			dst[i] = color >> (i * 8);
+}
+
+static void fill_row32(uint32_t *dst, size_t n, uint32_t color)
+{
+	const uint64_t color2 = (uint64_t)color << 32 | color;
+	uint64_t *dst2;
+
+	if (n && ((uintptr_t)dst & 4)) {
+		*dst++ = color;
+		n--;
+	}
+	for (dst2 = (uint64_t *)dst; n >= 2; n -= 2)
+		*dst2++ = color2;
+	if (n)
+		*(uint32_t *)dst2 = color;
+}
+
+static void fill_row16(uint16_t *dst, size_t n, uint32_t color)
+{
+	if (n && ((uintptr_t)dst & 2)) {
+		*dst++ = color;
+		n--;
+	}
+	fill_row32((uint32_t *)dst, n / 2, (color & 0xffff) * 0x10001);
+	if (n & 1)
+		dst[n - 1] = color;
+}
+
+/* Four 24bpp pixels make up three 32-bit words. */
+static void fill_row24(uint8_t *dst, size_t n, uint32_t color)
+{
+	const uint32_t c = color & 0xffffff;
+	const uint32_t w0 = c | c << 24;
+	const uint32_t w1 = c >> 8 | c << 16;
+	const uint32_t w2 = c >> 16 | c << 8;
+	uint32_t *dst32;
+	size_t head = 0;
+
+	while (head < n && ((uintptr_t)dst + head * 3) % 4)
+		head++;
+	fill_row_bytes(dst, head, color);
+	dst += head * 3;
+	n -= head;
+
+	for (dst32 = (uint32_t *)dst; n >= 4; n -= 4) {
+		*dst32++ = w0;
+		*dst32++ = w1;
+		*dst32++ = w2;
+	}
+	fill_row_bytes((uint8_t *)dst32, n, color);
+}
+
+/* Fill n pixels of a framebuffer row, starting at dst. */
+static void fill_row(uint8_t *dst, size_t n, uint32_t color)
+{
+	if (!wide_stores_ok(dst)) {
+		fill_row_bytes(dst, n, color);
+		return;
+	}
+
+	switch (fbinfo->bits_per_pixel) {
+	case 32:
+		fill_row32((uint32_t *)dst, n, color);
+		break;
+	case 24:
+		fill_row24(dst, n, color);
 		break;
+	case 16:
+		fill_row16((uint16_t *)dst, n, color);
+		break;
+	default:
+		fill_row_bytes(dst, n, color);
+		break;
+	}
+}
+
+/*
+ * Fill a box on the screen. Any screen box is a box in the framebuffer as
+ * well, so this always fills whole framebuffer rows regardless of rotation.
+ */
+static void fill_box(const struct vector *top_left, const struct vector *size,
+		     uint32_t color)
+{
+	const int bpl = fbinfo->bytes_per_line;
+	struct rect box;
+	uint8_t *dst;
+	int32_t y;
+
+	if (size->width <= 0 || size->height <= 0)
+		return;
+
+	rotate_box(&box, top_left, size);
+	dst = fbaddr + box.offset.y * bpl +
+	      box.offset.x * fbinfo->bits_per_pixel / 8;
+	for (y = 0; y < box.size.height; y++, dst += bpl)
+		fill_row(dst, box.size.width, color);
+}
+
+/* Fill the screen pixels with x0 <= x < x1 and y0 <= y < y1. */
+static void fill_area(int32_t x0, int32_t y0, int32_t x1, int32_t y1,
+		      uint32_t color)
+{
+	const struct vector top_left = { .x = x0, .y = y0 };
+	const struct vector size = { .width = x1 - x0, .height = y1 - y0 };
+
+	fill_box(&top_left, &size, color);
+}
+
+/*
+ * Distance in the framebuffer between horizontally adjacent pixels on the
+ * screen, which depends on the rotation.
+ */
+static ptrdiff_t pixel_step(void)
+{
+	const int bytes = fbinfo->bits_per_pixel / 8;
+
+	switch (fbinfo->orientation) {
+	case CB_FB_ORIENTATION_NORMAL:
+	default:
+		return bytes;
+	case CB_FB_ORIENTATION_BOTTOM_UP:
+		return -bytes;
+	case CB_FB_ORIENTATION_LEFT_UP:
+		return -(ptrdiff_t)fbinfo->bytes_per_line;
+	case CB_FB_ORIENTATION_RIGHT_UP:
+		return fbinfo->bytes_per_line;
+	}
+}
+
+/* Write n horizontally adjacent screen pixels, starting at p. */
+static void write_span(const struct vector *p, const uint32_t *colors,
+		       size_t n)
+{
+	const int bytes = fbinfo->bits_per_pixel / 8;
+	const ptrdiff_t step = pixel_step();
+	struct vector r;
+	uint8_t *dst;
+	size_t i;
+	int j;
+
+	rotate_vector(&r, p);
+	dst = fbaddr + r.y * fbinfo->bytes_per_line + r.x * bytes;
+
+	if (!wide_stores_ok(dst) || bytes == 3) {
+		for (i = 0; i < n; i++, dst += step)
+			for (j = 0; j < bytes; j++)
+				dst[j] = colors[i] >> (j * 8);
+		return;
 	}
 
-	uint8_t * const pixel = fbaddr + rcoord.y * bpl + rcoord.x * bpp / 8;
-	for (i = 0; i < bpp / 8; i++)
-		pixel[i] = (color >> (i * 8));
+	switch (bytes) {
+	case 4:
+		for (i = 0; i < n; i++, dst += step)
+			*(uint32_t *)dst = colors[i];
+		break;
+	case 2:
+		for (i = 0; i < n; i++, dst += step)
+			*(uint16_t *)dst = colors[i];
+		break;
+	default:
+		for (i = 0; i < n; i++, dst += step)
+			*dst = colors[i];
+		break;
+	}
 }
 
 /*
@@ -174,6 +385,10 @@ static int cbgfx_init(void)
 	if (!fbaddr)
 		return CBGFX_ERROR_FRAMEBUFFER_ADDR;
 
+	uint8_t *shadow = shadowfb_init(fbinfo);
+	if (shadow)
+		fbaddr = shadow;
+
 	switch (fbinfo->orientation) {
 	default: /* Normal or rotated 180 degrees. */
 		screen.size.width = fbinfo->x_resolution;
@@ -213,7 +428,7 @@ int draw_box(const struct rect *box, const struct rgb_color *rgb)
 {
 	struct vector top_left;
 	struct vector size;
-	struct vector p, t;
+	struct vector t;
 
 	if (cbgfx_init())
 		return CBGFX_ERROR_INIT;
@@ -236,9 +451,10 @@ int draw_box(const struct rect *box, const struct rgb_color *rgb)
 		return CBGFX_ERROR_BOUNDARY;
 	}
 
-	for (p.y = top_left.y; p.y < t.y; p.y++)
-		for (p.x = top_left.x; p.x < t.x; p.x++)
-			set_pixel(&p, color);
+	fill_box(&top_left, &size, color);
+
+	damage_box(&top_left, &size);
+	shadowfb_flush();
 
 	return CBGFX_SUCCESS;
 }
@@ -250,7 +466,7 @@ int draw_rounded_box(const struct scale *pos_rel, const struct scale *dim_rel,
 {
 	struct vector top_left;
 	struct vector size;
-	struct vector p, t;
+	struct vector t;
 
 	if (cbgfx_init())
 		return CBGFX_ERROR_INIT;
@@ -296,42 +512,33 @@ int draw_rounded_box(const struct scale *pos_rel, const struct scale *dim_rel,
 		}
 	}
 
+	damage_box(&top_left, &size);
+
 	/* Step 1: Draw edges */
 	int32_t x_begin, x_end;
 	if (has_thickness) {
 		/* top */
-		for (p.y = top_left.y; p.y < top_left.y + d.y; p.y++)
-			for (p.x = top_left.x + r.x; p.x < t.x - r.x; p.x++)
-				set_pixel(&p, color);
+		fill_area(top_left.x + r.x, top_left.y, t.x - r.x,
+			  top_left.y + d.y, color);
 		/* bottom */
-		for (p.y = t.y - d.y; p.y < t.y; p.y++)
-			for (p.x = top_left.x + r.x; p.x < t.x - r.x; p.x++)
-				set_pixel(&p, color);
-		for (p.y = top_left.y + r.y; p.y < t.y - r.y; p.y++) {
-			/* left */
-			for (p.x = top_left.x; p.x < top_left.x + d.x; p.x++)
-				set_pixel(&p, color);
-			/* right */
-			for (p.x = t.x - d.x; p.x < t.x; p.x++)
-				set_pixel(&p, color);
-		}
+		fill_area(top_left.x + r.x, t.y - d.y, t.x - r.x, t.y, color);
+		/* left */
+		fill_area(top_left.x, top_left.y + r.y, top_left.x + d.x,
+			  t.y - r.y, color);
+		/* right */
+		fill_area(t.x - d.x, top_left.y + r.y, t.x, t.y - r.y, color);
 	} else {
 		/* Fill the regions except circular sectors */
-		for (p.y = top_left.y; p.y < t.y; p.y++) {
-			if (p.y >= top_left.y + r.y && p.y < t.y - r.y) {
-				x_begin = top_left.x;
-				x_end = t.x;
-			} else {
-				x_begin = top_left.x + r.x;
-				x_end = t.x - r.x;
-			}
-			for (p.x = x_begin; p.x < x_end; p.x++)
-				set_pixel(&p, color);
-		}
+		fill_area(top_left.x + r.x, top_left.y, t.x - r.x,
+			  top_left.y + r.y, color);
+		fill_area(top_left.x, top_left.y + r.y, t.x, t.y - r.y, color);
+		fill_area(top_left.x + r.x, t.y - r.y, t.x - r.x, t.y, color);
 	}
 
-	if (!has_radius)
+	if (!has_radius) {
+		shadowfb_flush();
 		return CBGFX_SUCCESS;
+	}
 
 	/*
 	 * Step 2: Draw rounded corners
@@ -365,37 +572,34 @@ int draw_rounded_box(const struct scale *pos_rel, const struct scale *dim_rel,
 		/* The inequality must be valid now: y^2 + x_begin >= s^2 */
 		x = x_begin;
 		/* Check yy/rry + xx/rrx < 1 */
-		while (x < x_end || yy * rrx + x * x * rry < rrx * rry) {
-			/*
-			 * Example sequence of (y, x) when s = (4, 4) and
-			 * r = (5, 5):
-			 *   [(4, 0), (4, 1), (4, 2), (3, 3), (2, 4),
-			 *    (1, 4), (0, 4)].
-			 * If s.x==s.y r.x==r.y, then the sequence will be
-			 * symmetric, and x and y will range from 0 to (r-1).
-			 */
-			/* top left */
-			p.y = top_left.y + r.y - 1 - y;
-			p.x = top_left.x + r.x - 1 - x;
-			set_pixel(&p, color);
-			/* top right */
-			p.y = top_left.y + r.y - 1 - y;
-			p.x = t.x - r.x + x;
-			set_pixel(&p, color);
-			/* bottom left */
-			p.y = t.y - r.y + y;
-			p.x = top_left.x + r.x - 1 - x;
-			set_pixel(&p, color);
-			/* bottom right */
-			p.y = t.y - r.y + y;
-			p.x = t.x - r.x + x;
-			set_pixel(&p, color);
+		while (x < x_end || yy * rrx + x * x * rry < rrx * rry)
 			x++;
-		}
+		/*
+		 * Example sequence of (y, x) when s = (4, 4) and r = (5, 5):
+		 *   [(4, 0), (4, 1), (4, 2), (3, 3), (2, 4), (1, 4), (0, 4)].
+		 * If s.x==s.y r.x==r.y, then the sequence will be symmetric,
+		 * and x and y will range from 0 to (r-1). Pixels x_begin up to
+		 * x are drawn in each corner.
+		 */
+		/* top left */
+		fill_area(top_left.x + r.x - x, top_left.y + r.y - 1 - y,
+			  top_left.x + r.x - x_begin, top_left.y + r.y - y,
+			  color);
+		/* top right */
+		fill_area(t.x - r.x + x_begin, top_left.y + r.y - 1 - y,
+			  t.x - r.x + x, top_left.y + r.y - y, color);
+		/* bottom left */
+		fill_area(top_left.x + r.x - x, t.y - r.y + y,
+			  top_left.x + r.x - x_begin, t.y - r.y + y + 1, color);
+		/* bottom right */
+		fill_area(t.x - r.x + x_begin, t.y - r.y + y, t.x - r.x + x,
+			  t.y - r.y + y + 1, color);
 		x_end = x;
 		/* (x_begin <= x_end) must hold now */
 	}
 
+	shadowfb_flush();
+
 	return CBGFX_SUCCESS;
 }
 
@@ -420,7 +624,6 @@ int clear_screen(const struct rgb_color *rgb)
 	if (cbgfx_init())
 		return CBGFX_ERROR_INIT;
 
-	struct vector p;
 	uint32_t color = calculate_color(rgb, 0);
 	const int bpp = fbinfo->bits_per_pixel;
 	const int bpl = fbinfo->bytes_per_line;
@@ -431,11 +634,12 @@ int clear_screen(const struct rgb_color *rgb)
 	    (((color >> 16) & 0xff) == (color & 0xff)))) {
 		memset(fbaddr, color & 0xff, fbinfo->y_resolution * bpl);
 	} else {
-		for (p.y = 0; p.y < screen.size.height; p.y++)
-			for (p.x = 0; p.x < screen.size.width; p.x++)
-				set_pixel(&p, color);
+		fill_area(0, 0, screen.size.width, screen.size.height, color);
 	}
 
+	shadowfb_damage(0, 0, fbinfo->x_resolution, fbinfo->y_resolution);
+	shadowfb_flush();
+
 	return CBGFX_SUCCESS;
 }
 
@@ -454,6 +658,12 @@ static uint32_t bli(uint32_t q00, uint32_t q10, uint32_t q01, uint32_t q11,
 	return p;
 }
 
+/* Bitmaps are converted and written to the framebuffer in runs of this many
+   pixels. */
+#define BITMAP_SPAN_PIXELS	256
+
+static uint32_t pal_colors[256];
+
 static int draw_bitmap_v3(const struct vector *top_left,
 			  const struct scale *scale,
 			  const struct vector *dim,
@@ -512,8 +722,30 @@ static int draw_bitmap_v3(const struct vector *top_left,
 	 * parse_bitmap_header_v3, s0 is guaranteed not to exceed pixel array
 	 * boundary.
 	 */
-	struct vector s0, s1, d;
+	struct vector s0, s1, d, span;
 	struct fraction tx, ty;
+	uint32_t row[BITMAP_SPAN_PIXELS];
+	size_t n = 0;
+	int ret = CBGFX_SUCCESS;
+
+	/*
+	 * Pixels that fall exactly on a bitmap pixel need no interpolation,
+	 * which is all of them for unscaled bitmaps. Convert the palette to
+	 * framebuffer colors once for those.
+	 */
+	const size_t colors = MIN(header->colors_used, ARRAY_SIZE(pal_colors));
+	size_t i;
+	for (i = 0; i < colors; i++) {
+		const struct rgb_color rgb = {
+			.red = pal[i].red,
+			.green = pal[i].green,
+			.blue = pal[i].blue,
+		};
+		pal_colors[i] = calculate_color(&rgb, invert);
+	}
+
+	damage_box(top_left, dim);
+
 	for (d.y = 0; d.y < dim->height; d.y++, p.y += dir) {
 		s0.y = d.y * scale->y.d / scale->y.n;
 		s1.y = s0.y;
@@ -524,6 +756,7 @@ static int draw_bitmap_v3(const struct vector *top_left,
 		const uint8_t *data0 = pixel_array + s0.y * y_stride;
 		const uint8_t *data1 = pixel_array + s1.y * y_stride;
 		p.x = top_left->x;
+		span = p;
 		for (d.x = 0; d.x < dim->width; d.x++, p.x++) {
 			s0.x = d.x * scale->x.d / scale->x.n;
 			s1.x = s0.x;
@@ -540,24 +773,42 @@ static int draw_bitmap_v3(const struct vector *top_left,
 					|| c01 >= header->colors_used
 					|| c11 >= header->colors_used) {
 				LOG("Color index exceeds palette boundary\n");
-				return CBGFX_ERROR_BITMAP_DATA;
+				write_span(&span, row, n);
+				ret = CBGFX_ERROR_BITMAP_DATA;
+				goto out;
+			}
+			if (tx.n == 0 && ty.n == 0) {
+				row[n] = pal_colors[c00];
+			} else {
+				const struct rgb_color rgb = {
+					.red = bli(pal[c00].red, pal[c10].red,
+						   pal[c01].red, pal[c11].red,
+						   &tx, &ty),
+					.green = bli(pal[c00].green,
+						     pal[c10].green,
+						     pal[c01].green,
+						     pal[c11].green,
+						     &tx, &ty),
+					.blue = bli(pal[c00].blue, pal[c10].blue,
+						    pal[c01].blue, pal[c11].blue,
+						    &tx, &ty),
+				};
+				row[n] = calculate_color(&rgb, invert);
+			}
+			if (++n == ARRAY_SIZE(row)) {
+				write_span(&span, row, n);
+				span.x += n;
+				n = 0;
 			}
-			const struct rgb_color rgb = {
-				.red = bli(pal[c00].red, pal[c10].red,
-					   pal[c01].red, pal[c11].red,
-					   &tx, &ty),
-				.green = bli(pal[c00].green, pal[c10].green,
-					     pal[c01].green, pal[c11].green,
-					     &tx, &ty),
-				.blue = bli(pal[c00].blue, pal[c10].blue,
-					    pal[c01].blue, pal[c11].blue,
-					    &tx, &ty),
-			};
-			set_pixel(&p, calculate_color(&rgb, invert));
 		}
+		write_span(&span, row, n);
+		n = 0;
 	}
 
-	return CBGFX_SUCCESS;
+out:
+	/* Whatever was drawn before an error stays on the screen. */
+	shadowfb_flush();
+	return ret;
 }
 
 static int get_bitmap_file_header(const void *bitmap, size_t size,
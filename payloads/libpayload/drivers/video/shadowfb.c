@@ -0,0 +1,130 @@
+/*
+ * This file is part of the libpayload project.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Shadow framebuffer. Reading from a write-combining or uncached framebuffer
+ * is very slow, so the video console and cbgfx draw into a copy of it in
+ * cached RAM instead. Drawing code marks what it touched as damaged and
+ * shadowfb_flush() copies the bounding rectangle of all damage out to the
+ * framebuffer. The framebuffer itself is only ever written to, in long runs
+ * of whole lines where possible.
+ */
+
+#include <libpayload-config.h>
+#include <libpayload.h>
+#include <coreboot_tables.h>
+
+static struct {
+	uint8_t *fb;
+	uint8_t *shadow;
+	unsigned int width;
+	unsigned int height;
+	unsigned int bytes_per_line;
+	unsigned int bytes_per_pixel;
+	/* Damaged rectangle in pixels, empty if x0 >= x1. */
+	unsigned int x0, y0, x1, y1;
+} sfb;
+
+void *shadowfb_init(const struct cb_framebuffer *fbinfo)
+{
+	uint8_t *fb = phys_to_virt(fbinfo->physical_address);
+	size_t size = fbinfo->bytes_per_line * fbinfo->y_resolution;
+
+	if (!CONFIG(LP_VIDEO_SHADOW_FB))
+		return NULL;
+
+	/* The console and cbgfx share one shadow of the same framebuffer. */
+	if (sfb.shadow && sfb.fb == fb)
+		return sfb.shadow;
+
+	free(sfb.shadow);
+	sfb.shadow = memalign(64, size);
+	if (!sfb.shadow) {
+		printf("shadowfb: Out of memory, drawing to the framebuffer\n");
+		return NULL;
+	}
+
+	sfb.fb = fb;
+	sfb.width = fbinfo->x_resolution;
+	sfb.height = fbinfo->y_resolution;
+	sfb.bytes_per_line = fbinfo->bytes_per_line;
+	sfb.bytes_per_pixel = fbinfo->bits_per_pixel >> 3;
+	sfb.x0 = sfb.x1 = 0;
+
+	/* Pick up what's on the screen already, like a boot splash. This is
+	   the only time the framebuffer is read. */
+	memcpy(sfb.shadow, fb, size);
+
+	return sfb.shadow;
+}
+
+void shadowfb_damage(unsigned int x, unsigned int y, unsigned int width,
+		     unsigned int height)
+{
+	unsigned int x1 = MIN(x + width, sfb.width);
+	unsigned int y1 = MIN(y + height, sfb.height);
+
+	if (!sfb.shadow || x >= x1 || y >= y1)
+		return;
+
+	if (sfb.x0 >= sfb.x1) {
+		sfb.x0 = x;
+		sfb.y0 = y;
+		sfb.x1 = x1;
+		sfb.y1 = y1;
+		return;
+	}
+
+	sfb.x0 = MIN(sfb.x0, x);
+	sfb.y0 = MIN(sfb.y0, y);
+	sfb.x1 = MAX(sfb.x1, x1);
+	sfb.y1 = MAX(sfb.y1, y1);
+}
+
+void shadowfb_flush(void)
+{
+	const unsigned int bpl = sfb.bytes_per_line;
+	size_t offset, len;
+	unsigned int y;
+
+	if (!sfb.shadow || sfb.x0 >= sfb.x1)
+		return;
+
+	offset = sfb.y0 * bpl + sfb.x0 * sfb.bytes_per_pixel;
+	len = (sfb.x1 - sfb.x0) * sfb.bytes_per_pixel;
+
+	if (sfb.x0 == 0 && sfb.x1 == sfb.width) {
+		/* Full lines are contiguous, padding at the end included. */
+		memcpy(sfb.fb + offset, sfb.shadow + offset,
+		       (sfb.y1 - sfb.y0) * bpl);
+	} else {
+		for (y = sfb.y0; y < sfb.y1; y++, offset += bpl)
+			memcpy(sfb.fb + offset, sfb.shadow + offset, len);
+	}
+
+	sfb.x0 = sfb.x1 = 0;
+}
@@ -155,6 +155,7 @@ void rtc_read_clock(struct tm *tm);
  * @{
  */
 void storage_initialize(void);
+int storage_flush_all(void);
 /** @} */
 
 /**
@@ -304,6 +305,18 @@ enum video_printf_align {
 };
 void video_printf(int foreground, int background, enum video_printf_align align,
 		  const char *fmt, ...);
+
+/*
+ * Shadow framebuffer in RAM (LP_VIDEO_SHADOW_FB). shadowfb_init() returns the
+ * buffer to draw into instead of the framebuffer, or NULL if there is none.
+ * Drawing code reports the pixels it changed with shadowfb_damage() and
+ * pushes them out with shadowfb_flush().
+ */
+struct cb_framebuffer;
+void *shadowfb_init(const struct cb_framebuffer *fbinfo);
+void shadowfb_damage(unsigned int x, unsigned int y, unsigned int width,
+		     unsigned int height);
+void shadowfb_flush(void);
 /** @} */
 
 /**
@@ -39,6 +39,7 @@
 enum {
 	ATA_READ_DMA			= 0xc8,
 	ATA_READ_DMA_EXT		= 0x25,
+	ATA_READ_FPDMA_QUEUED		= 0x60,
 	ATA_IDENTIFY_DEVICE		= 0xec,
 	ATA_PACKET			= 0xa0,
 	ATA_IDENTIFY_PACKET_DEVICE	= 0xa1,
@@ -46,6 +47,8 @@ enum {
 
 /* 16-bit-word indices into id structure from ATA_IDENTIFY_DEVICE */
 enum {
+	ATA_ID_QUEUE_DEPTH		=  75,
+	ATA_ID_SATA_CAPS		=  76,
 	ATA_CMDS_AND_FEATURE_SETS	=  82,
 	ATA_ID_SECTOR_SIZE		= 106,
 	ATA_ID_LOGICAL_SECTOR_SIZE	= 117,
@@ -62,6 +65,7 @@ typedef struct ata_dev {
 
 	u8 read_cmd;
 	u8 identify_cmd;
+	u8 queue_depth; /* NCQ queue depth, 0 if NCQ isn't supported */
 	size_t sector_size;
 	size_t sector_size_shift;
 
@@ -45,6 +45,7 @@ typedef enum {
 	PORT_TYPE_IDE	= (1 << 0),
 	PORT_TYPE_SATA	= (1 << 1),
 	PORT_TYPE_USB	= (1 << 2),
+	PORT_TYPE_NVME	= (1 << 3),
 } storage_port_t;
 
 typedef enum {
@@ -68,11 +69,25 @@ typedef struct storage_dev {
 	void (*detach_device)(struct storage_dev *);
 } storage_dev_t;
 
+/* Block cache statistics, counted in cache blocks unless noted otherwise */
+typedef struct {
+	u64 hits;
+	u64 misses;
+	u64 readahead_blocks;	/* blocks read ahead */
+	u64 readahead_hits;	/* of those, blocks that were used */
+	u64 readahead_wasted;	/* of those, blocks evicted unused */
+	u64 writebacks;		/* dirty blocks written back */
+	u64 bypassed;		/* requests that went to the device directly */
+} storage_cache_stats_t;
+
 int storage_device_count(void);
 int storage_attach_device(storage_dev_t *dev);
 
 
 storage_poll_t storage_probe(size_t dev_num);
 ssize_t storage_read_blocks512(size_t dev_num, lba_t start, size_t count, unsigned char *buf);
+ssize_t storage_write_blocks512(size_t dev_num, lba_t start, size_t count, const unsigned char *buf);
+int storage_flush(size_t dev_num);
+int storage_get_cache_stats(size_t dev_num, storage_cache_stats_t *stats);
 
 #endif
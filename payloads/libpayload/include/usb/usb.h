@@ -238,6 +238,7 @@ struct usbdev_hc {
 	pcidev_t pcidev; // 0 if not used (eg on ARM)
 	hc_type type;
 	int latest_address;
+	int port_reset_busy;	// a hub port is between reset and SET_ADDRESS
 	usbdev_t *devices[128];	// dev 0 is root hub, 127 is last addressable
 
 	/* start():     Resume operation. */
@@ -256,6 +257,18 @@ struct usbdev_hc {
 	void (*shutdown) (hci_t *controller);
 
 	int (*bulk) (endpoint_t *ep, int size, u8 *data, int finalize);
+	/* bulk_queue():	Optional. Start a bulk transfer without waiting
+				for it, so several can be in flight. `data`
+				has to be DMA coherent and stay valid until
+				the transfer is waited for. Returns 0 if the
+				transfer was queued, negative if the caller
+				has to use bulk() instead. */
+	int (*bulk_queue) (endpoint_t *ep, int size, u8 *data);
+	/* bulk_wait():	Wait for the oldest transfer queued on `ep`.
+				Returns like bulk(). */
+	int (*bulk_wait) (endpoint_t *ep);
+	/* bulk_cancel():	Drop all transfers still queued on `ep`. */
+	void (*bulk_cancel) (endpoint_t *ep);
 	int (*control) (usbdev_t *dev, direction_t pid, int dr_length,
 			void *devreq, int data_length, u8 *data);
 	void* (*create_intr_queue) (endpoint_t *ep, int reqsize, int reqcount, int reqtiming);
@@ -279,10 +292,17 @@ struct usbdev_hc {
 	void (*destroy_device) (hci_t *controller, int devaddr);
 };
 
+#if CONFIG(LP_USB_XHCI_MSI)
+/* Set by interrupt handlers of host controllers, cleared by usb_poll(). */
+extern volatile u8 usb_irq_pending;
+#endif
+
 hci_t *usb_add_mmio_hc(hc_type type, void *bar);
 hci_t *new_controller (void);
 void detach_controller (hci_t *controller);
 void usb_poll (void);
+void usb_idle (unsigned int usec);
+void *usb_alloc_bulk_buffer (size_t size);
 usbdev_t *init_device_entry (hci_t *controller, int num);
 
 int usb_decode_mps0 (usb_speed speed, u8 bMaxPacketSize0);
@@ -39,6 +39,8 @@ typedef struct {
 	s8 ready;
 	u8 lun;
 	u8 num_luns;
+	void *cmd; /* DMA coherent CBW and CSW, NULL if not available. */
+	u8 *bounce; /* DMA coherent buffer for one chunk, or NULL. */
 	void *data; /* For use by consumers of libpayload. */
 } usbmsc_inst_t;
 
@@ -42,4 +42,11 @@ void apic_eoi(uint8_t vector);
 
 void apic_delay(unsigned int usec);
 
+/**
+ * Like apic_delay(), but returns early once an interrupt handler has set
+ * *wakeup. The flag is checked with interrupts disabled before each hlt, so
+ * a wakeup can't get lost between the check and going to sleep.
+ */
+void apic_wait(unsigned int usec, const volatile uint8_t *wakeup);
+
 #endif /* __ARCH_X86_INCLUDES_ARCH_APIC_H__ */
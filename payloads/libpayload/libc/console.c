@@ -173,6 +173,10 @@ int getchar(void)
 				last_getchar_input_type = in->input_type;
 				return in->getchar();
 			}
+#if CONFIG(LP_USB_XHCI_MSI)
+		/* Short enough not to overrun the serial FIFO. */
+		usb_idle(100);
+#endif
 	}
 }
 
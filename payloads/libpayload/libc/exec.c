@@ -46,6 +46,12 @@ int exec(long addr, int argc, char **argv)
 {
 	int val = -1;
 
+#if CONFIG(LP_STORAGE)
+	/* Nothing may be left in the block cache when the new code takes
+	   over the devices. */
+	storage_flush_all();
+#endif
+
 #if CONFIG(LP_ARCH_X86)
 	i386_do_exec(addr, argc, argv, &val);
 #endif
@@ -116,6 +116,9 @@ void fatal(const char *msg)
 
 void exit(int status)
 {
+#if CONFIG(LP_STORAGE)
+	storage_flush_all();
+#endif
 	printf("exited with status %d\n", status);
 	halt();
 }
@@ -31,8 +31,10 @@
 /*
  * This is a classically weak malloc() implementation. We have a relatively
  * small and static heap, so we take the easy route with an O(N) loop
- * through the tree for every malloc() and free(). Obviously, this doesn't
- * scale past a few hundred KB (if that).
+ * through the tree for every malloc() and free() of a large block.
+ * Obviously, this doesn't scale past a few hundred KB (if that). Small
+ * objects come from slabs (see below) and take constant time, which also
+ * keeps the number of blocks in the tree small.
  *
  * We're also susceptible to the usual buffer overrun poisoning, though the
  * risk is within acceptable ranges for this implementation (don't overrun
@@ -47,6 +49,8 @@ struct memory_type {
 	void *start;
 	void *end;
 	struct align_region_t* align_regions;
+	/* There are no free blocks below this one. */
+	void *first_free;
 #if CONFIG(LP_DEBUG_MALLOC)
 	int magic_initialized;
 	size_t minimal_free;
@@ -57,7 +61,7 @@ struct memory_type {
 extern char _heap, _eheap;	/* Defined in the ldscript. */
 
 static struct memory_type default_type =
-	{ (void *)&_heap, (void *)&_eheap, NULL
+	{ (void *)&_heap, (void *)&_eheap, NULL, (void *)&_heap
 #if CONFIG(LP_DEBUG_MALLOC)
 	, 0, 0, "HEAP"
 #endif
@@ -83,6 +87,45 @@ typedef u64 hdrtype_t;
 #define IS_FREE(_h) (((_h) & (MAGIC | FLAG_FREE)) == (MAGIC | FLAG_FREE))
 #define HAS_MAGIC(_h) (((_h) & MAGIC) == MAGIC)
 
+/*
+ * Objects of up to SLAB_MAX bytes live in slabs, SLAB_SIZE heap blocks that
+ * are cut into objects of one power-of-two size class. Objects have a
+ * header like heap blocks, but with SLAB_MAGIC (which HAS_MAGIC() rejects)
+ * and the offset of their slab in place of the size. That lets free() find
+ * the slab without searching, and allocation just pops a free list.
+ */
+#define MAGIC_MASK (((hdrtype_t)0x3f) << (SIZE_BITS + 1))
+#define SLAB_MAGIC (((hdrtype_t)0x15) << (SIZE_BITS + 1))
+#define IS_SLAB_OBJ(_h) (((_h) & MAGIC_MASK) == SLAB_MAGIC)
+#define SLAB_OBJ(_o, _f) ((hdrtype_t) (SLAB_MAGIC | (_f) | ((_o) & MAX_SIZE)))
+
+#define SLAB_SIZE 2048
+#define SLAB_MIN_SHIFT 4
+#define SLAB_CLASSES 5
+#define SLAB_MAX (1 << (SLAB_MIN_SHIFT + SLAB_CLASSES - 1))
+#define SLAB_HDR_MAGIC 0x534c4142	/* 'SLAB' */
+
+struct slab {
+	u32 magic;
+	u16 class;
+	u16 used;
+	u16 total;
+	/* Slabs of the class with free objects, empty ones included. */
+	struct slab *prev, *next;
+	hdrtype_t *free_list;
+};
+
+#define SLAB_FIRST_OBJ ALIGN_UP(sizeof(struct slab), HDRSIZE)
+
+static struct slab_class {
+	struct slab *partial;
+#if CONFIG(LP_DEBUG_MALLOC)
+	unsigned int slabs;
+	unsigned long allocs;
+	unsigned long frees;
+#endif
+} slab_classes[SLAB_CLASSES];
+
 static int free_aligned(void* addr, struct memory_type *type);
 void print_malloc_map(void);
 
@@ -103,6 +146,7 @@ void init_dma_memory(void *start, u32 size)
 	dma->start = start;
 	dma->end = start + size;
 	dma->align_regions = NULL;
+	dma->first_free = start;
 
 #if CONFIG(LP_DEBUG_MALLOC)
 	dma->minimal_free = 0;
@@ -124,28 +168,67 @@ int dma_coherent(void *ptr)
 	return !dma_initialized() || (dma->start <= ptr && dma->end > ptr);
 }
 
-static void *alloc(int len, struct memory_type *type)
+/* Merge the free blocks following the free block at ptr into it. */
+static size_t merge_free(struct memory_type *type, hdrtype_t *ptr)
 {
-	hdrtype_t header;
-	hdrtype_t volatile *ptr = (hdrtype_t volatile *)type->start;
+	size_t size = SIZE(*ptr);
+	void *nptr = (void *)ptr + HDRSIZE + size;
 
-	/* Align the size. */
-	len = ALIGN_UP(len, HDRSIZE);
+	while (nptr < type->end) {
+		hdrtype_t nhdr = *((hdrtype_t *) nptr);
 
-	if (!len || len > MAX_SIZE)
-		return (void *)NULL;
+		if (!(IS_FREE(nhdr)))
+			break;
+
+		size += SIZE(nhdr) + HDRSIZE;
+
+		*((hdrtype_t *) nptr) = 0;
+
+		nptr += (HDRSIZE + SIZE(nhdr));
+	}
+
+	*ptr = FREE_BLOCK(size);
+	return size;
+}
+
+/* Make sure the region is setup correctly. */
+static void setup_type(struct memory_type *type)
+{
+	hdrtype_t volatile *ptr = (hdrtype_t volatile *)type->start;
 
-	/* Make sure the region is setup correctly. */
 	if (!HAS_MAGIC(*ptr)) {
 		size_t size = (type->end - type->start) - HDRSIZE;
 		*ptr = FREE_BLOCK(size);
+		type->first_free = type->start;
 #if CONFIG(LP_DEBUG_MALLOC)
 		type->magic_initialized = 1;
 		type->minimal_free = size;
 #endif
 	}
+}
 
-	/* Find some free space. */
+/*
+ * With top set, the block is taken from the end of the highest free space
+ * that fits, which keeps long lived slabs out of the way of large blocks.
+ */
+static void *alloc_from(int len, struct memory_type *type, int top)
+{
+	hdrtype_t header;
+	hdrtype_t volatile *ptr = (hdrtype_t volatile *)type->start;
+	hdrtype_t volatile *highest = NULL;
+	int highest_size = 0;
+	int seen_free = 0;
+
+	/* Align the size. */
+	len = ALIGN_UP(len, HDRSIZE);
+
+	if (!len || len > MAX_SIZE)
+		return (void *)NULL;
+
+	setup_type(type);
+
+	/* Find some free space, merging free neighbours on the way. */
+	ptr = type->first_free;
 	do {
 		header = *ptr;
 		int size = SIZE(header);
@@ -158,7 +241,16 @@ static void *alloc(int len, struct memory_type *type)
 		}
 
 		if (header & FLAG_FREE) {
-			if (len <= size) {
+			size = merge_free(type, (hdrtype_t *)ptr);
+			if (!seen_free) {
+				type->first_free = (void *)ptr;
+				seen_free = 1;
+			}
+
+			if (len <= size && top) {
+				highest = ptr;
+				highest_size = size;
+			} else if (len <= size) {
 				hdrtype_t volatile *nptr = (hdrtype_t volatile *)((uintptr_t)ptr + HDRSIZE + len);
 				int nsize = size - (HDRSIZE + len);
 
@@ -186,43 +278,504 @@ static void *alloc(int len, struct memory_type *type)
 
 	} while (ptr < (hdrtype_t *) type->end);
 
+	if (highest) {
+		int nsize = highest_size - (HDRSIZE + len);
+
+		if (nsize > 0) {
+			/* Keep the front of the block free. */
+			*highest = FREE_BLOCK(nsize);
+			highest = (hdrtype_t volatile *)((uintptr_t)highest + HDRSIZE + nsize);
+			*highest = USED_BLOCK(len);
+		} else {
+			*highest = USED_BLOCK(highest_size);
+		}
+
+		return (void *)((uintptr_t)highest + HDRSIZE);
+	}
+
 	/* Nothing available. */
 	return (void *)NULL;
 }
 
-static void _consolidate(struct memory_type *type)
+static void *alloc(int len, struct memory_type *type)
 {
-	void *ptr = type->start;
+	return alloc_from(len, type, 0);
+}
 
-	while (ptr < type->end) {
-		void *nptr;
-		hdrtype_t hdr = *((hdrtype_t *) ptr);
-		unsigned int size = 0;
+static void free_block(struct memory_type *type, hdrtype_t *ptr)
+{
+	*ptr = FREE_BLOCK(SIZE(*ptr));
+	merge_free(type, ptr);
+	if ((void *)ptr < type->first_free)
+		type->first_free = ptr;
+}
+
+static inline size_t slab_obj_size(int class)
+{
+	return 1 << (SLAB_MIN_SHIFT + class);
+}
+
+static struct slab *slab_new(int class)
+{
+	const size_t stride = HDRSIZE + slab_obj_size(class);
+	struct slab *s;
+	hdrtype_t *obj;
+	size_t off;
+	int i;
+
+	s = alloc_from(SLAB_SIZE, heap, 1);
+	if (s == NULL)
+		return NULL;
 
-		if (!IS_FREE(hdr)) {
-			ptr += HDRSIZE + SIZE(hdr);
+	s->magic = SLAB_HDR_MAGIC;
+	s->class = class;
+	s->used = 0;
+	s->total = 0;
+	s->free_list = NULL;
+
+	/* Build the free list back to front, so it hands out objects in
+	   address order. */
+	for (i = (SLAB_SIZE - SLAB_FIRST_OBJ) / stride - 1; i >= 0; i--) {
+		off = SLAB_FIRST_OBJ + i * stride;
+		obj = (void *)s + off;
+		*obj = SLAB_OBJ(off, FLAG_FREE);
+		*(hdrtype_t **)(obj + 1) = s->free_list;
+		s->free_list = obj;
+		s->total++;
+	}
+
+	s->prev = NULL;
+	s->next = slab_classes[class].partial;
+	if (s->next)
+		s->next->prev = s;
+	slab_classes[class].partial = s;
+#if CONFIG(LP_DEBUG_MALLOC)
+	slab_classes[class].slabs++;
+#endif
+
+	return s;
+}
+
+static void slab_unlink(struct slab *s)
+{
+	if (s->prev)
+		s->prev->next = s->next;
+	else
+		slab_classes[s->class].partial = s->next;
+	if (s->next)
+		s->next->prev = s->prev;
+}
+
+static void *slab_alloc(size_t size)
+{
+	int class = 0;
+	struct slab *s;
+	hdrtype_t *obj;
+
+	while (slab_obj_size(class) < size)
+		class++;
+
+	s = slab_classes[class].partial;
+	if (s == NULL) {
+		s = slab_new(class);
+		if (s == NULL)
+			return NULL;
+	}
+
+	obj = s->free_list;
+	s->free_list = *(hdrtype_t **)(obj + 1);
+	*obj = SLAB_OBJ(SIZE(*obj), 0);
+
+	if (++s->used == s->total)
+		slab_unlink(s);
+#if CONFIG(LP_DEBUG_MALLOC)
+	slab_classes[class].allocs++;
+#endif
+
+	return obj + 1;
+}
+
+static void slab_free(hdrtype_t *obj)
+{
+	struct slab *s = (void *)obj - SIZE(*obj);
+
+	/* Not our slab (we're probably poisoned). */
+	if (s->magic != SLAB_HDR_MAGIC)
+		return;
+
+	/* Double free. */
+	if (*obj & FLAG_FREE)
+		return;
+
+	*obj = SLAB_OBJ(SIZE(*obj), FLAG_FREE);
+	*(hdrtype_t **)(obj + 1) = s->free_list;
+	s->free_list = obj;
+#if CONFIG(LP_DEBUG_MALLOC)
+	slab_classes[s->class].frees++;
+#endif
+
+	if (s->used-- == s->total) {
+		s->prev = NULL;
+		s->next = slab_classes[s->class].partial;
+		if (s->next)
+			s->next->prev = s;
+		slab_classes[s->class].partial = s;
+	}
+
+	/* Give empty slabs back, but keep one per class around. */
+	if (s->used == 0 && (s->prev || s->next)) {
+		slab_unlink(s);
+		s->magic = 0;
+#if CONFIG(LP_DEBUG_MALLOC)
+		slab_classes[s->class].slabs--;
+#endif
+		free_block(heap, (hdrtype_t *)((void *)s - HDRSIZE));
+	}
+}
+
+/*
+ * Take a block aligned to align straight from the tree. Unlike
+ * alloc_aligned(), this doesn't allocate align bytes extra.
+ */
+static void *alloc_block_aligned(size_t len, size_t align,
+				 struct memory_type *type)
+{
+	hdrtype_t *ptr;
+	size_t size;
+
+	setup_type(type);
+
+	for (ptr = type->first_free; (void *)ptr < type->end;
+	     ptr = (void *)ptr + HDRSIZE + size) {
+		size = SIZE(*ptr);
+		if (!IS_FREE(*ptr))
 			continue;
+		size = merge_free(type, ptr);
+
+		const uintptr_t start = (uintptr_t)ptr + HDRSIZE;
+		const uintptr_t end = start + size;
+		uintptr_t data = ALIGN_UP(start, align);
+
+		/* A free block in front needs room for a header and data. */
+		if (data != start && data - start < 2 * HDRSIZE)
+			data += align;
+		if (data + len > end)
+			continue;
+
+		hdrtype_t *const used = (hdrtype_t *)(data - HDRSIZE);
+		if (data != start)
+			*ptr = FREE_BLOCK(data - HDRSIZE - start);
+		if (end - (data + len) > HDRSIZE) {
+			*used = USED_BLOCK(len);
+			*(hdrtype_t *)(data + len) =
+				FREE_BLOCK(end - (data + len) - HDRSIZE);
+		} else {
+			*used = USED_BLOCK(end - data);
 		}
+		return (void *)data;
+	}
+
+	return NULL;
+}
 
-		size = SIZE(hdr);
-		nptr = ptr + HDRSIZE + SIZE(hdr);
+/*
+ * DMA pool. With a DMA region, dma_memalign() and small dma_malloc()
+ * requests are served from 64KiB chunks of it. Chunks are aligned to their
+ * size, so no block crosses a 64KiB boundary.
+ *
+ * Blocks of up to 2KiB are cut from pages of one size class, like slabs, so
+ * they never cross a page either, which is what controllers want from rings
+ * and contexts. The classes are the powers of two and three steps between
+ * each, so a block is at most 25% larger than requested unless the
+ * alignment asks for more. Larger requests get a run of whole pages within
+ * one chunk. Chunks whose pages are all free go back to the DMA region,
+ * except for the last one.
+ */
+#define DMA_POOL_CHUNK		(64 * 1024)
+#define DMA_POOL_PAGE		4096
+#define DMA_POOL_PAGES		(DMA_POOL_CHUNK / DMA_POOL_PAGE)
+#define DMA_POOL_MAX_CHUNKS	16
+#define DMA_POOL_MIN_SHIFT	6
+#define DMA_POOL_CLASSES	21	/* 64 bytes to 2KiB */
+#define DMA_POOL_MAX_BLOCK	2048
+
+#define DMA_PAGE_FREE		0xff
+#define DMA_PAGE_RUN		0xfe	/* first page of a run */
+#define DMA_PAGE_TAIL		0xfd	/* other pages of a run */
+
+struct dma_page {
+	void *free_list;
+	u16 used;
+	u8 class;
+	u8 run;			/* number of pages, for DMA_PAGE_RUN */
+	s16 prev, next;		/* free pages, or pages with free blocks */
+};
 
-		while (nptr < type->end) {
-			hdrtype_t nhdr = *((hdrtype_t *) nptr);
+struct dma_chunk {
+	void *base;
+	int free_pages;
+	struct dma_page pages[DMA_POOL_PAGES];
+};
 
-			if (!(IS_FREE(nhdr)))
-				break;
+static struct {
+	struct dma_chunk *chunks[DMA_POOL_MAX_CHUNKS];	/* NULL if unused */
+	int num_chunks;
+	s16 free_pages;
+	s16 partial[DMA_POOL_CLASSES];
+} dma_pool = {
+	.free_pages = -1,
+	.partial = { [0 ... DMA_POOL_CLASSES - 1] = -1 },
+};
+
+/* 64, 80, 96, 112, 128, 160, ... 2048 */
+static inline size_t dma_class_size(int class)
+{
+	return (size_t)(4 + class % 4) << (DMA_POOL_MIN_SHIFT - 2 + class / 4);
+}
+
+static inline struct dma_page *dma_page(int id)
+{
+	return &dma_pool.chunks[id / DMA_POOL_PAGES]->pages[id % DMA_POOL_PAGES];
+}
+
+static inline void *dma_page_addr(int id)
+{
+	return dma_pool.chunks[id / DMA_POOL_PAGES]->base +
+		(id % DMA_POOL_PAGES) * DMA_POOL_PAGE;
+}
+
+static void dma_page_unlink(s16 *head, int id)
+{
+	struct dma_page *const page = dma_page(id);
+
+	if (page->prev >= 0)
+		dma_page(page->prev)->next = page->next;
+	else
+		*head = page->next;
+	if (page->next >= 0)
+		dma_page(page->next)->prev = page->prev;
+}
+
+static void dma_page_push(s16 *head, int id)
+{
+	struct dma_page *const page = dma_page(id);
 
-			size += SIZE(nhdr) + HDRSIZE;
+	page->prev = -1;
+	page->next = *head;
+	if (*head >= 0)
+		dma_page(*head)->prev = id;
+	*head = id;
+}
+
+static void dma_page_take(int id)
+{
+	dma_page_unlink(&dma_pool.free_pages, id);
+	dma_pool.chunks[id / DMA_POOL_PAGES]->free_pages--;
+}
 
-			*((hdrtype_t *) nptr) = 0;
+static void dma_page_release(int id)
+{
+	dma_page(id)->class = DMA_PAGE_FREE;
+	dma_page_push(&dma_pool.free_pages, id);
+	dma_pool.chunks[id / DMA_POOL_PAGES]->free_pages++;
+}
+
+static int dma_pool_grow(void)
+{
+	struct dma_chunk *chunk;
+	int c, i;
+
+	for (c = 0; c < DMA_POOL_MAX_CHUNKS && dma_pool.chunks[c]; c++)
+		;
+	if (c == DMA_POOL_MAX_CHUNKS)
+		return -1;
+
+	chunk = malloc(sizeof(*chunk));
+	if (chunk == NULL)
+		return -1;
+	chunk->base = alloc_block_aligned(DMA_POOL_CHUNK, DMA_POOL_CHUNK, dma);
+	if (chunk->base == NULL) {
+		free(chunk);
+		return -1;
+	}
+	chunk->free_pages = 0;
+
+	dma_pool.chunks[c] = chunk;
+	dma_pool.num_chunks++;
+	for (i = DMA_POOL_PAGES - 1; i >= 0; i--)
+		dma_page_release(c * DMA_POOL_PAGES + i);
+
+	return 0;
+}
+
+/* Give chunk c back to the DMA region if all of its pages are free. */
+static void dma_pool_shrink(int c)
+{
+	struct dma_chunk *const chunk = dma_pool.chunks[c];
+	int i;
 
-			nptr += (HDRSIZE + SIZE(nhdr));
+	/* Keep the last chunk, so that a single block being allocated and
+	   freed over and over doesn't take and return a chunk every time. */
+	if (chunk->free_pages < DMA_POOL_PAGES || dma_pool.num_chunks == 1)
+		return;
+
+	for (i = 0; i < DMA_POOL_PAGES; i++)
+		dma_page_unlink(&dma_pool.free_pages, c * DMA_POOL_PAGES + i);
+	dma_pool.chunks[c] = NULL;
+	dma_pool.num_chunks--;
+	free(chunk->base);
+	free(chunk);
+}
+
+/*
+ * Find `pages` free pages within a chunk, starting at a multiple of `step`
+ * pages.
+ */
+static void *dma_pool_alloc_run(int pages, int step)
+{
+	int c, first, i;
+
+	for (c = 0; c < DMA_POOL_MAX_CHUNKS; c++) {
+		if (dma_pool.chunks[c] == NULL ||
+		    dma_pool.chunks[c]->free_pages < pages)
+			continue;
+		for (first = c * DMA_POOL_PAGES;
+		     first + pages <= (c + 1) * DMA_POOL_PAGES; first += step) {
+			for (i = 0; i < pages; i++) {
+				if (dma_page(first + i)->class != DMA_PAGE_FREE)
+					break;
+			}
+			if (i < pages)
+				continue;
+
+			for (i = 0; i < pages; i++) {
+				dma_page_take(first + i);
+				dma_page(first + i)->class = DMA_PAGE_TAIL;
+			}
+			dma_page(first)->class = DMA_PAGE_RUN;
+			dma_page(first)->run = pages;
+			return dma_page_addr(first);
 		}
+	}
+
+	return NULL;
+}
 
-		*((hdrtype_t *) ptr) = FREE_BLOCK(size);
-		ptr = nptr;
+static void *dma_pool_alloc_block(int class)
+{
+	const size_t bsize = dma_class_size(class);
+	const int blocks = DMA_POOL_PAGE / bsize;
+	struct dma_page *page;
+	void *ptr;
+	int id, i;
+
+	id = dma_pool.partial[class];
+	if (id < 0) {
+		if (dma_pool.free_pages < 0 && dma_pool_grow() < 0)
+			return NULL;
+		id = dma_pool.free_pages;
+		dma_page_take(id);
+
+		/* Cut the page into blocks. */
+		page = dma_page(id);
+		page->class = class;
+		page->used = 0;
+		page->free_list = NULL;
+		for (i = blocks - 1; i >= 0; i--) {
+			ptr = dma_page_addr(id) + i * bsize;
+			*(void **)ptr = page->free_list;
+			page->free_list = ptr;
+		}
+		dma_page_push(&dma_pool.partial[class], id);
 	}
+
+	page = dma_page(id);
+	ptr = page->free_list;
+	page->free_list = *(void **)ptr;
+	if (++page->used == blocks)
+		dma_page_unlink(&dma_pool.partial[class], id);
+
+	return ptr;
+}
+
+static void *dma_pool_alloc(size_t align, size_t size)
+{
+	void *ptr;
+	int class, pages, step;
+
+	if (align == 0)
+		align = 1;
+	if (size > DMA_POOL_CHUNK || align > DMA_POOL_CHUNK)
+		return NULL;
+
+	/* The smallest class whose blocks are all aligned. */
+	if (size <= DMA_POOL_MAX_BLOCK && align <= DMA_POOL_MAX_BLOCK) {
+		for (class = 0; class < DMA_POOL_CLASSES - 1; class++) {
+			const size_t bsize = dma_class_size(class);
+			if (bsize >= size && !(bsize & (align - 1)))
+				break;
+		}
+		return dma_pool_alloc_block(class);
+	}
+
+	pages = ALIGN_UP(size, DMA_POOL_PAGE) / DMA_POOL_PAGE;
+	step = MAX(align / DMA_POOL_PAGE, (size_t)1);
+	ptr = dma_pool_alloc_run(pages, step);
+	if (ptr == NULL && dma_pool_grow() == 0)
+		ptr = dma_pool_alloc_run(pages, step);
+	return ptr;
+}
+
+/* Returns 1 if ptr was from the pool. */
+static int dma_pool_free(void *ptr)
+{
+	struct dma_chunk *chunk = NULL;
+	struct dma_page *page;
+	int c, id, i;
+
+	for (c = 0; c < DMA_POOL_MAX_CHUNKS; c++) {
+		chunk = dma_pool.chunks[c];
+		if (chunk && ptr >= chunk->base &&
+		    ptr < chunk->base + DMA_POOL_CHUNK)
+			break;
+	}
+	if (c == DMA_POOL_MAX_CHUNKS)
+		return 0;
+
+	id = c * DMA_POOL_PAGES + (ptr - chunk->base) / DMA_POOL_PAGE;
+	page = dma_page(id);
+
+	if (page->class == DMA_PAGE_RUN) {
+		if (ptr != dma_page_addr(id))
+			return 1;
+		for (i = page->run - 1; i >= 0; i--)
+			dma_page_release(id + i);
+		dma_pool_shrink(c);
+		return 1;
+	}
+
+	/* Not an allocated block (double free or poisoned). */
+	if (page->class >= DMA_POOL_CLASSES || !page->used)
+		return 1;
+
+	const size_t bsize = dma_class_size(page->class);
+	const int blocks = DMA_POOL_PAGE / bsize;
+	const size_t offset = ptr - dma_page_addr(id);
+	if (offset % bsize || offset / bsize >= blocks)
+		return 1;
+
+	if (page->used-- == blocks)
+		dma_page_push(&dma_pool.partial[page->class], id);
+	*(void **)ptr = page->free_list;
+	page->free_list = ptr;
+
+	if (page->used == 0) {
+		dma_page_unlink(&dma_pool.partial[page->class], id);
+		dma_page_release(id);
+		dma_pool_shrink(c);
+	}
+
+	return 1;
 }
 
 void free(void *ptr)
@@ -237,11 +790,19 @@ void free(void *ptr)
 			return;
 	}
 
+	if (type != heap && dma_pool_free(ptr))
+		return;
+
 	if (free_aligned(ptr, type)) return;
 
 	ptr -= HDRSIZE;
 	hdr = *((hdrtype_t *) ptr);
 
+	if (type == heap && IS_SLAB_OBJ(hdr)) {
+		slab_free(ptr);
+		return;
+	}
+
 	/* Not our header (we're probably poisoned). */
 	if (!HAS_MAGIC(hdr))
 		return;
@@ -250,24 +811,39 @@ void free(void *ptr)
 	if (hdr & FLAG_FREE)
 		return;
 
-	*((hdrtype_t *) ptr) = FREE_BLOCK(SIZE(hdr));
-	_consolidate(type);
+	free_block(type, ptr);
 }
 
 void *malloc(size_t size)
 {
+	void *ptr;
+
+	if (size && size <= SLAB_MAX) {
+		ptr = slab_alloc(size);
+		if (ptr)
+			return ptr;
+	}
+
 	return alloc(size, heap);
 }
 
 void *dma_malloc(size_t size)
 {
+	void *ptr;
+
+	if (dma_initialized() && size && size <= DMA_POOL_PAGE) {
+		ptr = dma_pool_alloc(HDRSIZE, size);
+		if (ptr)
+			return ptr;
+	}
+
 	return alloc(size, dma);
 }
 
 void *calloc(size_t nmemb, size_t size)
 {
 	size_t total = nmemb * size;
-	void *ptr = alloc(total, heap);
+	void *ptr = malloc(total);
 
 	if (ptr)
 		memset(ptr, 0, total);
@@ -279,39 +855,51 @@ void *realloc(void *ptr, size_t size)
 {
 	void *ret, *pptr;
 	unsigned int osize;
+	hdrtype_t hdr;
 	struct memory_type *type = heap;
 
 	if (ptr == NULL)
-		return alloc(size, type);
+		return malloc(size);
 
 	pptr = ptr - HDRSIZE;
+	hdr = *((hdrtype_t *) pptr);
 
-	if (!HAS_MAGIC(*((hdrtype_t *) pptr)))
+	if (IS_SLAB_OBJ(hdr)) {
+		const struct slab *s = pptr - SIZE(hdr);
+		osize = slab_obj_size(s->class);
+	} else if (HAS_MAGIC(hdr)) {
+		osize = SIZE(hdr);
+	} else {
 		return NULL;
+	}
 
 	if (ptr < type->start || ptr >= type->end)
 		type = dma;
 
-	/* Get the original size of the block. */
-	osize = SIZE(*((hdrtype_t *) pptr));
+	if (size && size <= osize) {
+		const size_t len = ALIGN_UP(size, HDRSIZE);
 
-	/*
-	 * Free the memory to update the tables - this won't touch the actual
-	 * memory, so we can still use it for the copy after we have
-	 * reallocated the new space.
-	 */
-	free(ptr);
-	ret = alloc(size, type);
+		/* Give the tail of a heap block back if there is room. */
+		if (!IS_SLAB_OBJ(hdr) && len + HDRSIZE < osize) {
+			hdrtype_t *nptr = ptr + len;
+
+			*nptr = USED_BLOCK(osize - len - HDRSIZE);
+			*((hdrtype_t *) pptr) = USED_BLOCK(len);
+			free_block(type, nptr);
+		}
+		return ptr;
+	}
 
 	/*
-	 * if ret == NULL, then doh - failure.
-	 * if ret == ptr then woo-hoo! no copy needed.
+	 * Allocate before freeing, as alloc() may merge the freed block with
+	 * its neighbours and put a new header right into the data.
 	 */
-	if (ret == NULL || ret == ptr)
-		return ret;
+	ret = size ? (type == heap ? malloc(size) : alloc(size, type)) : NULL;
 
-	/* Copy the memory to the new location. */
-	memcpy(ret, ptr, osize > size ? size : osize);
+	if (ret != NULL)
+		memcpy(ret, ptr, osize > size ? size : osize);
+	if (ret != NULL || !size)
+		free(ptr);
 
 	return ret;
 }
@@ -535,6 +1123,14 @@ void *memalign(size_t align, size_t size)
 
 void *dma_memalign(size_t align, size_t size)
 {
+	void *ptr;
+
+	if (dma_initialized() && size) {
+		ptr = dma_pool_alloc(align, size);
+		if (ptr)
+			return ptr;
+	}
+
 	return alloc_aligned(align, size, dma);
 }
 
@@ -567,6 +1163,24 @@ again:
 		       (unsigned int)(ptr - type->start),
 		       hdr & FLAG_FREE ? "FREE" : "USED", SIZE(hdr));
 
+		/* List the objects in use, to find leaks. */
+		struct slab *s = ptr + HDRSIZE;
+		if (type == heap && !(hdr & FLAG_FREE) &&
+		    SIZE(hdr) == SLAB_SIZE && s->magic == SLAB_HDR_MAGIC) {
+			const size_t stride = HDRSIZE + slab_obj_size(s->class);
+			size_t off;
+
+			printf("%s   slab of %zu byte objects, %u of %u used\n",
+			       type->name, slab_obj_size(s->class), s->used,
+			       s->total);
+			for (off = SLAB_FIRST_OBJ; off + stride <= SLAB_SIZE;
+			     off += stride) {
+				if (!(*(hdrtype_t *)((void *)s + off) & FLAG_FREE))
+					printf("%s   %p: USED\n", type->name,
+					       (void *)s + off + HDRSIZE);
+			}
+		}
+
 		if (hdr & FLAG_FREE)
 			free_memory += SIZE(hdr);
 
@@ -578,9 +1192,29 @@ again:
 	printf("%s: Maximum memory consumption: %zu bytes\n", type->name,
 		(type->end - type->start) - HDRSIZE - type->minimal_free);
 
+	if (type == heap) {
+		int class;
+
+		for (class = 0; class < SLAB_CLASSES; class++)
+			printf("%s: %zu byte objects: %u slabs, %lu allocations, "
+			       "%lu frees\n", type->name, slab_obj_size(class),
+			       slab_classes[class].slabs,
+			       slab_classes[class].allocs,
+			       slab_classes[class].frees);
+	}
+
 	if (type != dma) {
 		type = dma;
 		goto again;
 	}
+
+	if (dma_pool.num_chunks) {
+		int i, free_pages = 0;
+
+		for (i = dma_pool.free_pages; i >= 0; i = dma_page(i)->next)
+			free_pages++;
+		printf("DMA pool: %d chunks of %d pages, %d pages free\n",
+		       dma_pool.num_chunks, DMA_POOL_PAGES, free_pages);
+	}
 }
 #endif
@@ -0,0 +1,275 @@
+/*
+ * Host benchmark for the cbgfx drawing code. graphics.c is built against a
+ * framebuffer in RAM, checked against a plain per-pixel reference for every
+ * orientation and pixel format, and then timed.
+ */
+
+/* system headers */
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <endian.h>
+
+typedef uint8_t u8;
+typedef uint16_t u16;
+typedef uint32_t u32;
+typedef uint64_t u64;
+typedef int8_t s8;
+typedef int16_t s16;
+typedef int32_t s32;
+typedef int64_t s64;
+
+/* Keep the libpayload headers that clash with the host C library out. */
+#define _ARCH_TYPES_H
+#define _LIBPAYLOAD_H
+#define _CBFS_H_
+#define _SYSINFO_H
+
+#include "libpayload-config.h"
+#include "kconfig.h"
+
+#define MIN(a, b) ((a) < (b) ? (a) : (b))
+#define MAX(a, b) ((a) > (b) ? (a) : (b))
+#define ARRAY_SIZE(a) (sizeof(a) / sizeof((a)[0]))
+#define __packed __attribute__((packed))
+#define phys_to_virt(x) ((void *)(uintptr_t)(x))
+
+/* libpayload headers */
+#include "coreboot_tables.h"
+#include "cbgfx.h"
+
+static struct {
+	struct cb_framebuffer *framebuffer;
+} lib_sysinfo;
+
+void *shadowfb_init(const struct cb_framebuffer *fbinfo) { return NULL; }
+void shadowfb_damage(unsigned int x, unsigned int y, unsigned int width,
+		     unsigned int height) {}
+void shadowfb_flush(void) {}
+
+#include "../drivers/video/graphics.c"
+
+#define WIDTH	1920
+#define HEIGHT	1080
+
+static struct cb_framebuffer fb;
+static uint8_t *ref;
+
+static int fail(const char *str)
+{
+	fprintf(stderr, "%s", str);
+	exit(1);
+}
+
+static void setup(int bpp, int orientation)
+{
+	memset(&fb, 0, sizeof(fb));
+	fb.x_resolution = WIDTH;
+	fb.y_resolution = HEIGHT;
+	fb.bits_per_pixel = bpp;
+	fb.bytes_per_line = (WIDTH * bpp / 8 + 63) & ~63;
+	fb.orientation = orientation;
+	fb.red_mask_size = bpp == 16 ? 5 : 8;
+	fb.green_mask_size = bpp == 16 ? 6 : 8;
+	fb.blue_mask_size = bpp == 16 ? 5 : 8;
+	fb.red_mask_pos = bpp == 16 ? 11 : 16;
+	fb.green_mask_pos = bpp == 16 ? 5 : 8;
+	fb.blue_mask_pos = 0;
+
+	free(phys_to_virt(fb.physical_address));
+	fb.physical_address = (uintptr_t)calloc(1, fb.bytes_per_line * HEIGHT);
+	free(ref);
+	ref = calloc(1, fb.bytes_per_line * HEIGHT);
+	if (!fb.physical_address || !ref)
+		fail("could not allocate framebuffer\n");
+
+	lib_sysinfo.framebuffer = &fb;
+	initialized = 0;
+	if (cbgfx_init())
+		fail("could not initialize cbgfx\n");
+}
+
+/* What set_pixel() used to do. */
+static void ref_pixel(const struct vector *p, uint32_t color)
+{
+	const int bytes = fb.bits_per_pixel / 8;
+	struct vector r;
+	int i;
+
+	rotate_vector(&r, p);
+	for (i = 0; i < bytes; i++)
+		ref[r.y * fb.bytes_per_line + r.x * bytes + i] = color >> (i * 8);
+}
+
+static void check(const char *what)
+{
+	if (memcmp(ref, fbaddr, fb.bytes_per_line * HEIGHT)) {
+		fprintf(stderr, "%s: %d bpp, orientation %d differs\n", what,
+			fb.bits_per_pixel, fb.orientation);
+		exit(1);
+	}
+}
+
+static uint8_t *make_bitmap(int width, int height, size_t *size)
+{
+	struct bitmap_file_header *fh;
+	struct bitmap_header_v3 *h;
+	struct bitmap_palette_element_v3 *pal;
+	uint8_t *bmp, *pixels;
+	const size_t header_size = sizeof(*fh) + sizeof(*h) + 256 * sizeof(*pal);
+	int i;
+
+	*size = header_size + width * height;
+	bmp = calloc(1, *size);
+	if (!bmp)
+		fail("could not allocate bitmap\n");
+
+	fh = (void *)bmp;
+	h = (void *)(fh + 1);
+	pal = (void *)(h + 1);
+	pixels = bmp + header_size;
+
+	fh->signature[0] = 'B';
+	fh->signature[1] = 'M';
+	fh->file_size = htole32(*size);
+	fh->bitmap_offset = htole32(header_size);
+	h->header_size = htole32(sizeof(*h));
+	h->width = htole32(width);
+	h->height = htole32(-height);
+	h->planes = htole16(1);
+	h->bits_per_pixel = htole16(8);
+	h->size = htole32(width * height);
+	h->colors_used = htole32(256);
+	for (i = 0; i < 256; i++) {
+		pal[i].red = i;
+		pal[i].green = 255 - i;
+		pal[i].blue = i * 7;
+	}
+	for (i = 0; i < width * height; i++)
+		pixels[i] = (i * 31) ^ (i >> 8);
+
+	return bmp;
+}
+
+static void verify(int bpp, int orientation, const uint8_t *bmp,
+		   size_t bmp_size)
+{
+	const struct rgb_color rgb = { .red = 0x12, .green = 0x34, .blue = 0x56 };
+	const struct rect box = {
+		.offset = { .x = 13, .y = 7 },
+		.size = { .width = 51, .height = 77 },
+	};
+	const struct vector top_left = { .x = 101, .y = 33 };
+	const uint8_t *pixels = bmp + sizeof(struct bitmap_file_header) +
+		sizeof(struct bitmap_header_v3) +
+		256 * sizeof(struct bitmap_palette_element_v3);
+	struct vector p, tl, size, t;
+
+	setup(bpp, orientation);
+
+	const struct scale tl_s = {
+		.x = { .n = box.offset.x, .d = CANVAS_SCALE, },
+		.y = { .n = box.offset.y, .d = CANVAS_SCALE, }
+	};
+	const struct scale size_s = {
+		.x = { .n = box.size.x, .d = CANVAS_SCALE, },
+		.y = { .n = box.size.y, .d = CANVAS_SCALE, }
+	};
+	transform_vector(&tl, &canvas.size, &tl_s, &canvas.offset);
+	transform_vector(&size, &canvas.size, &size_s, &vzero);
+	add_vectors(&t, &tl, &size);
+	for (p.y = tl.y; p.y < t.y; p.y++)
+		for (p.x = tl.x; p.x < t.x; p.x++)
+			ref_pixel(&p, calculate_color(&rgb, 0));
+	if (draw_box(&box, &rgb))
+		fail("draw_box failed\n");
+	check("draw_box");
+
+	for (p.y = 0; p.y < 64; p.y++) {
+		for (p.x = 0; p.x < 300; p.x++) {
+			uint8_t c = pixels[p.y * 300 + p.x];
+			const struct rgb_color prgb = {
+				.red = c, .green = 255 - c, .blue = c * 7,
+			};
+			struct vector q = { .x = top_left.x + p.x,
+					    .y = top_left.y + p.y };
+			ref_pixel(&q, calculate_color(&prgb, 0));
+		}
+	}
+	if (draw_bitmap_direct(bmp, bmp_size, &top_left))
+		fail("draw_bitmap_direct failed\n");
+	check("draw_bitmap_direct");
+}
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void bench(int bpp, const uint8_t *bmp, size_t bmp_size)
+{
+	const struct rgb_color rgb = { .red = 0x12, .green = 0x34, .blue = 0x56 };
+	const struct scale pos = {
+		.x = { .n = 1, .d = 10 }, .y = { .n = 1, .d = 10 },
+	};
+	const struct scale dim = {
+		.x = { .n = 8, .d = 10 }, .y = { .n = 6, .d = 10 },
+	};
+	const struct fraction thickness = { .n = 1, .d = 50 };
+	const struct fraction radius = { .n = 1, .d = 10 };
+	const int loops = 50;
+	double start;
+	int i;
+
+	setup(bpp, CB_FB_ORIENTATION_NORMAL);
+
+	start = now();
+	for (i = 0; i < loops; i++)
+		clear_canvas(&rgb);
+	printf("%2d bpp clear_canvas:     %8.3f ms\n", bpp,
+	       (now() - start) * 1000 / loops);
+
+	start = now();
+	for (i = 0; i < loops; i++)
+		draw_rounded_box(&pos, &dim, &rgb, &thickness, &radius);
+	printf("%2d bpp draw_rounded_box: %8.3f ms\n", bpp,
+	       (now() - start) * 1000 / loops);
+
+	start = now();
+	for (i = 0; i < loops; i++)
+		draw_bitmap(bmp, bmp_size, &pos, &dim, PIVOT_H_LEFT | PIVOT_V_TOP);
+	printf("%2d bpp draw_bitmap:      %8.3f ms\n", bpp,
+	       (now() - start) * 1000 / loops);
+
+	start = now();
+	for (i = 0; i < loops; i++)
+		draw_bitmap_direct(bmp, bmp_size, &canvas.offset);
+	printf("%2d bpp draw_bitmap_direct: %6.3f ms\n", bpp,
+	       (now() - start) * 1000 / loops);
+}
+
+int main(int argc, char **argv)
+{
+	static const int bpps[] = { 16, 24, 32 };
+	size_t bmp_size;
+	uint8_t *bmp;
+	int i, orientation;
+
+	bmp = make_bitmap(300, 64, &bmp_size);
+	for (i = 0; i < ARRAY_SIZE(bpps); i++)
+		for (orientation = 0; orientation < 4; orientation++)
+			verify(bpps[i], orientation, bmp, bmp_size);
+	free(bmp);
+
+	bmp = make_bitmap(1000, 1000, &bmp_size);
+	for (i = 0; i < ARRAY_SIZE(bpps); i++)
+		bench(bpps[i], bmp, bmp_size);
+
+	return 0;
+}
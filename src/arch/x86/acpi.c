@@ -39,6 +39,9 @@
 
 static acpi_rsdp_t *valid_rsdp(acpi_rsdp_t *rsdp);
 
+/* End of the area write_acpi_tables() writes to, see MAX_ACPI_SIZE. */
+static unsigned long acpi_tables_end;
+
 u8 acpi_checksum(u8 *table, u32 length)
 {
 	u8 ret = 0;
@@ -419,6 +422,7 @@ static void acpi_ssdt_write_cbtable(void)
 void acpi_create_ssdt_generator(acpi_header_t *ssdt, const char *oem_table_id)
 {
 	unsigned long current = (unsigned long)ssdt + sizeof(acpi_header_t);
+	struct acpigen_buf buf, *prev;
 
 	memset((void *)ssdt, 0, sizeof(acpi_header_t));
 
@@ -431,7 +435,14 @@ void acpi_create_ssdt_generator(acpi_header_t *ssdt, const char *oem_table_id)
 	ssdt->asl_compiler_revision = asl_revision;
 	ssdt->length = sizeof(acpi_header_t);
 
-	acpigen_set_current((char *) current);
+	/*
+	 * The SSDT grows with the number of devices and CPUs, so it is
+	 * generated into a buffer bounded by the end of the ACPI area. If it
+	 * doesn't fit, the SSDT is left empty rather than spilling past it.
+	 */
+	acpigen_buf_init(&buf, (char *)current,
+			 acpi_tables_end > current ? acpi_tables_end - current : 0);
+	prev = acpigen_buf_select(&buf);
 
 	/* Write object to declare coreboot tables */
 	acpi_ssdt_write_cbtable();
@@ -441,7 +452,16 @@ void acpi_create_ssdt_generator(acpi_header_t *ssdt, const char *oem_table_id)
 		for (dev = all_devices; dev; dev = dev->next)
 			if (dev->ops && dev->ops->acpi_fill_ssdt_generator)
 				dev->ops->acpi_fill_ssdt_generator(dev);
-		current = (unsigned long) acpigen_get_current();
+	}
+
+	acpigen_buf_select(prev);
+	if (buf.current > buf.end) {
+		printk(BIOS_ERR, "ERROR: SSDT of %zu bytes doesn't fit, increase "
+		       "MAX_ACPI_SIZE\n", acpigen_buf_used(&buf));
+	} else if (acpigen_buf_overflowed(&buf)) {
+		printk(BIOS_ERR, "ERROR: SSDT has unbalanced scopes\n");
+	} else {
+		current += acpigen_buf_used(&buf);
 	}
 
 	/* (Re)calculate length and checksum. */
@@ -1258,6 +1278,7 @@ unsigned long write_acpi_tables(unsigned long start)
 	char oem_id[6], oem_table_id[8];
 
 	current = start;
+	acpi_tables_end = start + MAX_ACPI_SIZE;
 
 	/* Align ACPI tables to 16byte */
 	current = acpi_align_current(current);
@@ -0,0 +1,440 @@
+/*
+ * This file is part of the coreboot project.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+/*
+ * ACPI table cache. On a boot whose inputs to ACPI table generation match the
+ * ones of the boot that filled the cache, the tables are copied back from
+ * flash instead of being generated. The inputs are the firmware build, the
+ * device tree including all resources, and the cbmem layout, which also pins
+ * down where the tables and everything they point to live. CBMEM entries
+ * created while generating the tables are recorded and created again on
+ * restore, so the restored tables point to allocated memory. Values that
+ * side effects of table generation need, like the address of the IGD
+ * OpRegion, are recorded too, so acpi_table_cache_restored() can redo them.
+ */
+
+#include <arch/acpi.h>
+#include <boot_device.h>
+#include <bootstate.h>
+#include <cbmem.h>
+#include <console/console.h>
+#include <device/device.h>
+#include <fmap.h>
+#include <region_file.h>
+#include <string.h>
+#include <version.h>
+
+#define ACPI_CACHE_REGION		"RW_ACPI_CACHE"
+#define ACPI_CACHE_SIGNATURE		0x43504341	/* 'ACPC' */
+#define ACPI_CACHE_VERSION		2
+#define ACPI_CACHE_MAX_CBMEM_IDS	64
+#define ACPI_CACHE_MAX_NEW_ENTRIES	16
+#define ACPI_CACHE_MAX_RECORDS		8
+
+struct acpi_cache_header {
+	uint32_t signature;
+	uint32_t version;
+	uint64_t key;		/* Hash of the generation inputs */
+	uint64_t checksum;	/* Hash of the entries and tables that follow */
+	uint64_t base;		/* Address the tables were generated at */
+	uint32_t size;		/* Size of the tables */
+	uint32_t num_entries;	/* Number of struct acpi_cache_entry */
+	uint32_t num_records;	/* Number of struct acpi_cache_record */
+	uint32_t reserved;
+};
+
+/* A cbmem entry that was added while generating the tables. */
+struct acpi_cache_entry {
+	uint32_t id;
+	uint32_t size;
+	uint64_t start;
+};
+
+/* A value recorded with acpi_table_cache_record(). */
+struct acpi_cache_record {
+	uint32_t tag;
+	uint32_t reserved;
+	uint64_t value;
+};
+
+static struct {
+	uint64_t key;
+	uint32_t ids[ACPI_CACHE_MAX_CBMEM_IDS];
+	size_t num_ids;
+	int overflow;
+	/* Set when freshly generated tables should be written to flash. */
+	int pending;
+	struct acpi_cache_header header;
+	struct acpi_cache_entry entries[ACPI_CACHE_MAX_NEW_ENTRIES];
+	struct acpi_cache_record records[ACPI_CACHE_MAX_RECORDS];
+} cache;
+
+/* FNV-1a, which is plenty for detecting changed inputs and torn data. */
+#define FNV_OFFSET_BASIS	0xcbf29ce484222325ULL
+#define FNV_PRIME		0x100000001b3ULL
+
+static uint64_t hash_update(uint64_t h, const void *data, size_t size)
+{
+	const uint8_t *p = data;
+
+	while (size--) {
+		h ^= *p++;
+		h *= FNV_PRIME;
+	}
+	return h;
+}
+
+void acpi_table_cache_hash_input(const void *data, size_t size)
+{
+	cache.key = hash_update(cache.key, data, size);
+}
+
+static void hash_u64(uint64_t v)
+{
+	acpi_table_cache_hash_input(&v, sizeof(v));
+}
+
+static void hash_str(const char *s)
+{
+	acpi_table_cache_hash_input(s, strlen(s) + 1);
+}
+
+/* Platforms with inputs not covered by the device tree can mix them in here. */
+__weak void acpi_table_cache_platform_inputs(void) {}
+
+/* Platforms redo side effects of table generation here, such as filling GNVS. */
+__weak void acpi_table_cache_restored(void) {}
+
+void acpi_table_cache_record(uint32_t tag, uint64_t value)
+{
+	struct acpi_cache_header *h = &cache.header;
+	size_t i;
+
+	for (i = 0; i < h->num_records; i++) {
+		if (cache.records[i].tag == tag) {
+			cache.records[i].value = value;
+			return;
+		}
+	}
+
+	if (h->num_records == ARRAY_SIZE(cache.records)) {
+		cache.overflow = 1;
+		return;
+	}
+
+	cache.records[h->num_records].tag = tag;
+	cache.records[h->num_records].value = value;
+	h->num_records++;
+}
+
+int acpi_table_cache_lookup(uint32_t tag, uint64_t *value)
+{
+	const struct acpi_cache_header *h = &cache.header;
+	size_t i;
+
+	for (i = 0; i < h->num_records; i++) {
+		if (cache.records[i].tag == tag) {
+			*value = cache.records[i].value;
+			return 0;
+		}
+	}
+
+	return -1;
+}
+
+static void record_cbmem_id(u32 id, void *start, u64 size, void *arg)
+{
+	hash_u64(id);
+	hash_u64((uintptr_t)start);
+	hash_u64(size);
+
+	if (cache.num_ids == ARRAY_SIZE(cache.ids)) {
+		cache.overflow = 1;
+		return;
+	}
+	cache.ids[cache.num_ids++] = id;
+}
+
+static void hash_devices(void)
+{
+	struct device *dev;
+	const struct resource *res;
+
+	for (dev = all_devices; dev; dev = dev->next) {
+		hash_str(dev_path(dev));
+		hash_u64(dev->enabled);
+		hash_u64(dev->vendor);
+		hash_u64(dev->device);
+		hash_u64(dev->class);
+		hash_u64(dev->subsystem_vendor << 16 | dev->subsystem_device);
+
+		for (res = dev->resource_list; res; res = res->next) {
+			hash_u64(res->index);
+			hash_u64(res->flags);
+			hash_u64(res->base);
+			hash_u64(res->size);
+		}
+	}
+}
+
+static uint64_t compute_key(unsigned long start, size_t max_size)
+{
+	cache.key = FNV_OFFSET_BASIS;
+	cache.num_ids = 0;
+	cache.overflow = 0;
+
+	hash_str(coreboot_version);
+	hash_str(coreboot_extra_version);
+	hash_str(coreboot_build);
+	hash_u64(start);
+	hash_u64(max_size);
+	hash_u64((uintptr_t)cbmem_top());
+
+	if (cbmem_walk(record_cbmem_id, NULL) < 0)
+		cache.overflow = 1;
+
+	hash_devices();
+	acpi_table_cache_platform_inputs();
+
+	return cache.key;
+}
+
+static int cache_rdev(struct region_device *rdev)
+{
+	struct region_file file;
+
+	if (fmap_locate_area_as_rdev(ACPI_CACHE_REGION, rdev) < 0) {
+		printk(BIOS_DEBUG, "ACPI cache: no %s region\n",
+			ACPI_CACHE_REGION);
+		return -1;
+	}
+
+	if (region_file_init(&file, rdev) < 0)
+		return -1;
+
+	return region_file_data(&file, rdev);
+}
+
+static uint64_t cache_checksum(const struct acpi_cache_header *header,
+				const void *tables)
+{
+	uint64_t h = FNV_OFFSET_BASIS;
+
+	h = hash_update(h, cache.entries,
+			header->num_entries * sizeof(cache.entries[0]));
+	h = hash_update(h, cache.records,
+			header->num_records * sizeof(cache.records[0]));
+	return hash_update(h, tables, header->size);
+}
+
+/* Entries are handed back zeroed like a new cbmem_add() would, except for
+   RAMOOPS which is meant to survive reboots. */
+static int recreate_entries(const struct acpi_cache_entry *entries,
+				size_t num_entries)
+{
+	const struct cbmem_entry *e;
+	size_t i;
+
+	for (i = 0; i < num_entries; i++) {
+		e = cbmem_entry_add(entries[i].id, entries[i].size);
+		if (e == NULL ||
+		    (uintptr_t)cbmem_entry_start(e) != entries[i].start ||
+		    cbmem_entry_size(e) != entries[i].size) {
+			printk(BIOS_DEBUG, "ACPI cache: cbmem %08x moved\n",
+				entries[i].id);
+			return -1;
+		}
+
+		if (entries[i].id != CBMEM_ID_RAM_OOPS)
+			memset(cbmem_entry_start(e), 0, entries[i].size);
+	}
+
+	return 0;
+}
+
+static unsigned long restore_tables(unsigned long start, size_t max_size)
+{
+	struct region_device rdev;
+	struct acpi_cache_header *h = &cache.header;
+	size_t entries_size, records_size, offset;
+
+	if (cache_rdev(&rdev) < 0)
+		return 0;
+
+	if (rdev_readat(&rdev, h, 0, sizeof(*h)) != sizeof(*h))
+		goto fail;
+
+	if (h->signature != ACPI_CACHE_SIGNATURE ||
+	    h->version != ACPI_CACHE_VERSION)
+		goto fail;
+
+	if (h->key != cache.key || h->base != start) {
+		printk(BIOS_DEBUG, "ACPI cache: inputs changed\n");
+		goto fail;
+	}
+
+	entries_size = h->num_entries * sizeof(cache.entries[0]);
+	records_size = h->num_records * sizeof(cache.records[0]);
+	if (h->num_entries > ARRAY_SIZE(cache.entries) ||
+	    h->num_records > ARRAY_SIZE(cache.records) || h->size > max_size ||
+	    sizeof(*h) + entries_size + records_size + h->size >
+			region_device_sz(&rdev))
+		goto fail;
+
+	offset = sizeof(*h);
+	if (rdev_readat(&rdev, cache.entries, offset, entries_size) !=
+			entries_size)
+		goto fail;
+
+	offset += entries_size;
+	if (rdev_readat(&rdev, cache.records, offset, records_size) !=
+			records_size)
+		goto fail;
+
+	offset += records_size;
+	if (rdev_readat(&rdev, (void *)start, offset, h->size) != h->size)
+		goto fail;
+
+	if (cache_checksum(h, (void *)start) != h->checksum) {
+		printk(BIOS_ERR, "ACPI cache: checksum mismatch\n");
+		goto fail;
+	}
+
+	if (recreate_entries(cache.entries, h->num_entries) < 0)
+		goto fail;
+
+	return start + h->size;
+
+fail:
+	/* Don't leave records of the cached boot behind for generation. */
+	memset(h, 0, sizeof(*h));
+	return 0;
+}
+
+static int is_known_id(u32 id)
+{
+	size_t i;
+
+	for (i = 0; i < cache.num_ids; i++) {
+		if (cache.ids[i] == id)
+			return 1;
+	}
+	return 0;
+}
+
+static void record_new_entry(u32 id, void *start, u64 size, void *arg)
+{
+	struct acpi_cache_header *h = &cache.header;
+
+	if (is_known_id(id))
+		return;
+
+	if (h->num_entries == ARRAY_SIZE(cache.entries)) {
+		cache.overflow = 1;
+		return;
+	}
+
+	cache.entries[h->num_entries].id = id;
+	cache.entries[h->num_entries].start = (uintptr_t)start;
+	cache.entries[h->num_entries].size = size;
+	h->num_entries++;
+}
+
+unsigned long acpi_table_cache_write_tables(unsigned long start,
+						size_t max_size)
+{
+	struct acpi_cache_header *h = &cache.header;
+	unsigned long end;
+
+	compute_key(start, max_size);
+
+	if (!cache.overflow) {
+		end = restore_tables(start, max_size);
+		if (end) {
+			printk(BIOS_INFO, "ACPI: Restored tables from cache.\n");
+			acpi_table_cache_restored();
+			return end;
+		}
+	}
+
+	end = write_acpi_tables(start);
+
+	h->num_entries = 0;
+	if (cbmem_walk(record_new_entry, NULL) < 0)
+		cache.overflow = 1;
+
+	if (cache.overflow || end - start > max_size)
+		return end;
+
+	h->signature = ACPI_CACHE_SIGNATURE;
+	h->version = ACPI_CACHE_VERSION;
+	h->key = cache.key;
+	h->base = start;
+	h->size = end - start;
+	cache.pending = 1;
+
+	return end;
+}
+
+/*
+ * Nothing may modify the tables before the payload runs, so writing them
+ * out here stores the same tables the OS gets to see.
+ */
+static void acpi_table_cache_save(void *unused)
+{
+	struct acpi_cache_header *h = &cache.header;
+	struct region region;
+	struct region_device read_rdev;
+	struct region_device write_rdev;
+	struct region_file file;
+	struct incoherent_rdev backing_irdev;
+	const struct region_device *backing_rdev;
+	const void *tables = (const void *)(uintptr_t)h->base;
+	const struct update_region_file_entry data[] = {
+		{ .size = sizeof(*h), .data = h },
+		{ .size = h->num_entries * sizeof(cache.entries[0]),
+		  .data = cache.entries },
+		{ .size = h->num_records * sizeof(cache.records[0]),
+		  .data = cache.records },
+		{ .size = h->size, .data = tables },
+	};
+
+	if (!cache.pending)
+		return;
+
+	h->checksum = cache_checksum(h, tables);
+
+	if (fmap_locate_area(ACPI_CACHE_REGION, &region) < 0)
+		return;
+
+	if (boot_device_ro_subregion(&region, &read_rdev) < 0)
+		return;
+
+	if (boot_device_rw_subregion(&region, &write_rdev) < 0)
+		return;
+
+	backing_rdev = incoherent_rdev_init(&backing_irdev, &region, &read_rdev,
+						&write_rdev);
+	if (backing_rdev == NULL)
+		return;
+
+	if (region_file_init(&file, backing_rdev) < 0)
+		return;
+
+	if (region_file_update_data_arr(&file, data, ARRAY_SIZE(data)) < 0)
+		printk(BIOS_ERR, "ACPI cache: update failed\n");
+	else
+		printk(BIOS_DEBUG, "ACPI cache: updated, %u bytes\n", h->size);
+}
+
+BOOT_STATE_INIT_ENTRY(BS_WRITE_TABLES, BS_ON_EXIT, acpi_table_cache_save, NULL);
@@ -27,18 +27,22 @@
 #define ACPI_DP_UUID		"daffd814-6eba-4d8c-8a91-bc9bbf4aa301"
 #define ACPI_DP_CHILD_UUID	"dbb8e3e6-5886-4ba6-8795-1319f52a966b"
 
-/* Write empty word value and return pointer to it */
+/* Write empty word value and return pointer to it, NULL if it didn't fit */
 static void *acpi_device_write_zero_len(void)
 {
 	char *p = acpigen_get_current();
 	acpigen_emit_word(0);
-	return p;
+	return acpigen_patch_ptr(p, sizeof(uint16_t));
 }
 
 /* Fill in length value from start to current at specified location */
 static void acpi_device_fill_from_len(char *ptr, char *start)
 {
-	uint16_t len = acpigen_get_current() - start;
+	uint16_t len;
+
+	if (!ptr)
+		return;
+	len = acpigen_get_current() - start;
 	ptr[0] = len & 0xff;
 	ptr[1] = (len >> 8) & 0xff;
 }
@@ -50,7 +54,8 @@ static void acpi_device_fill_from_len(char *ptr, char *start)
  */
 static void acpi_device_fill_len(void *ptr)
 {
-	acpi_device_fill_from_len(ptr, ptr + sizeof(uint16_t));
+	if (ptr)
+		acpi_device_fill_from_len(ptr, ptr + sizeof(uint16_t));
 }
 
 /* Locate and return the ACPI name for this device */
@@ -641,7 +646,8 @@ static void acpi_dp_write_array(const struct acpi_dp *array)
 	 */
 	for (dp = array->next; dp; dp = dp->next) {
 		acpi_dp_write_value(dp);
-		(*pkg_count)++;
+		if (pkg_count)
+			(*pkg_count)++;
 	}
 
 	acpigen_pop_len();
@@ -672,7 +678,7 @@ void acpi_dp_write(struct acpi_dp *table)
 {
 	struct acpi_dp *dp, *prop;
 	char *dp_count, *prop_count = NULL;
-	int child_count = 0;
+	int child_count = 0, prop_pkg = 0;
 
 	if (!table || table->type != ACPI_DP_TYPE_TABLE)
 		return;
@@ -697,8 +703,10 @@ void acpi_dp_write(struct acpi_dp *table)
 			 * is to avoid creating a zero-length package
 			 * in situations where there are only children.
 			 */
-			if (!prop_count) {
-				*dp_count += 2;
+			if (!prop_pkg) {
+				prop_pkg = 1;
+				if (dp_count)
+					*dp_count += 2;
 				/* ToUUID (ACPI_DP_UUID) */
 				acpigen_write_uuid(ACPI_DP_UUID);
 				/*
@@ -707,18 +715,20 @@ void acpi_dp_write(struct acpi_dp *table)
 				 */
 				prop_count = acpigen_write_package(0);
 			}
-			(*prop_count)++;
+			if (prop_count)
+				(*prop_count)++;
 			acpi_dp_write_property(dp);
 		}
 	}
-	if (prop_count) {
+	if (prop_pkg) {
 		/* Package (PROP) length, if a package was written */
 		acpigen_pop_len();
 	}
 
 	if (child_count) {
 		/* Update DP package count to 2 or 4 */
-		*dp_count += 2;
+		if (dp_count)
+			*dp_count += 2;
 		/* ToUUID (ACPI_DP_CHILD_UUID) */
 		acpigen_write_uuid(ACPI_DP_CHILD_UUID);
 
@@ -11,9 +11,6 @@
  * GNU General Public License for more details.
  */
 
-/* How much nesting do we support? */
-#define ACPIGEN_LENSTACK_SIZE 10
-
 /*
  * If you need to change this, change acpigen_write_len_f and
  * acpigen_pop_len
@@ -28,15 +25,73 @@
 #include <console/console.h>
 #include <device/device.h>
 
-static char *gencurrent;
+/* Buffer used by acpigen_set_current(), which has no capacity limit. */
+static struct acpigen_buf default_buf = {
+	.end = (char *)(uintptr_t)-1,
+};
+static struct acpigen_buf *active_buf = &default_buf;
+
+void acpigen_buf_init(struct acpigen_buf *b, void *start, size_t size)
+{
+	b->start = start;
+	b->current = start;
+	b->end = b->start + size;
+	b->overflow = false;
+	b->ltop = 0;
+}
+
+struct acpigen_buf *acpigen_buf_select(struct acpigen_buf *b)
+{
+	struct acpigen_buf *prev = active_buf;
+
+	active_buf = b;
+	return prev;
+}
+
+char *acpigen_patch_ptr(char *p, size_t len)
+{
+	const uintptr_t start = (uintptr_t)active_buf->start;
+	const uintptr_t end = (uintptr_t)active_buf->end;
+
+	if (p && (uintptr_t)p >= start && (uintptr_t)p < end &&
+	    len <= end - (uintptr_t)p)
+		return p;
+	active_buf->overflow = true;
+	return NULL;
+}
+
+/*
+ * Nesting deeper than the length stack is still counted, so that the pops
+ * stay paired with their pushes. Its lengths can't be patched though.
+ */
+static void acpigen_push_len(char *p)
+{
+	if (active_buf->ltop >= ACPIGEN_LENSTACK_SIZE) {
+		if (active_buf->ltop == ACPIGEN_LENSTACK_SIZE)
+			printk(BIOS_ERR, "ACPI: acpigen nesting too deep\n");
+		active_buf->overflow = true;
+	} else {
+		active_buf->len_stack[active_buf->ltop] = p;
+	}
+	active_buf->ltop++;
+}
 
-char *len_stack[ACPIGEN_LENSTACK_SIZE];
-int ltop = 0;
+/* Returns NULL if the length field can't be patched. */
+static char *acpigen_pop_len_ptr(void)
+{
+	if (active_buf->ltop == 0) {
+		printk(BIOS_ERR, "ACPI: acpigen length stack underflow\n");
+		active_buf->overflow = true;
+		return NULL;
+	}
+	if (--active_buf->ltop >= ACPIGEN_LENSTACK_SIZE)
+		return NULL;
+	return active_buf->len_stack[active_buf->ltop];
+}
 
 void acpigen_write_len_f(void)
 {
-	ASSERT(ltop < (ACPIGEN_LENSTACK_SIZE - 1))
-	len_stack[ltop++] = gencurrent;
+	acpigen_push_len(active_buf->current);
 	acpigen_emit_byte(0);
 	acpigen_emit_byte(0);
 	acpigen_emit_byte(0);
@@ -45,9 +100,11 @@ void acpigen_write_len_f(void)
 void acpigen_pop_len(void)
 {
 	int len;
-	ASSERT(ltop > 0)
-	char *p = len_stack[--ltop];
-	len = gencurrent - p;
+	char *p = acpigen_patch_ptr(acpigen_pop_len_ptr(), 3);
+
+	if (!p)
+		return;
+	len = active_buf->current - p;
 	ASSERT(len <= ACPIGEN_MAXLEN)
 	/* generate store length for 0xfffff max */
 	p[0] = (0x80 | (len & 0xf));
@@ -58,17 +115,23 @@ void acpigen_pop_len(void)
 
 void acpigen_set_current(char *curr)
 {
-	gencurrent = curr;
+	active_buf = &default_buf;
+	active_buf->start = curr;
+	active_buf->current = curr;
 }
 
 char *acpigen_get_current(void)
 {
-	return gencurrent;
+	return active_buf->current;
 }
 
 void acpigen_emit_byte(unsigned char b)
 {
-	(*gencurrent++) = b;
+	if (active_buf->current < active_buf->end)
+		*active_buf->current = b;
+	else
+		active_buf->overflow = true;
+	active_buf->current++;
 }
 
 void acpigen_emit_ext_op(uint8_t op)
@@ -98,7 +161,7 @@ char *acpigen_write_package(int nr_el)
 	acpigen_write_len_f();
 	p = acpigen_get_current();
 	acpigen_emit_byte(nr_el);
-	return p;
+	return acpigen_patch_ptr(p, 1);
 }
 
 void acpigen_write_byte(unsigned int data)
@@ -276,7 +339,7 @@ static void acpigen_emit_multi_namestring(const char *name)
 	unsigned char *pathlen;
 	acpigen_emit_byte(MULTI_NAME_PREFIX);
 	acpigen_emit_byte(ZERO_OP);
-	pathlen = ((unsigned char *) acpigen_get_current()) - 1;
+	pathlen = (unsigned char *)acpigen_patch_ptr(acpigen_get_current() - 1, 1);
 
 	while (name[0] != '\0') {
 		acpigen_emit_simple_namestring(name);
@@ -289,7 +352,8 @@ static void acpigen_emit_multi_namestring(const char *name)
 		count++;
 	}
 
-	pathlen[0] = count;
+	if (pathlen)
+		pathlen[0] = count;
 }
 
 
@@ -1004,7 +1068,7 @@ void acpigen_write_resourcetemplate_header(void)
 	acpigen_emit_byte(BUFFER_OP);
 	acpigen_write_len_f();
 	acpigen_emit_byte(WORD_PREFIX);
-	len_stack[ltop++] = acpigen_get_current();
+	acpigen_push_len(acpigen_get_current());
 	/* Add 2 dummy bytes for the ACPI word (keep aligned with
 	   the calculation in acpigen_write_resourcetemplate() below). */
 	acpigen_emit_byte(0x00);
@@ -1013,7 +1077,7 @@ void acpigen_write_resourcetemplate_header(void)
 
 void acpigen_write_resourcetemplate_footer(void)
 {
-	char *p = len_stack[--ltop];
+	char *p = acpigen_patch_ptr(acpigen_pop_len_ptr(), 2);
 	int len;
 	/*
 	 * end tag (acpi 4.0 Section 6.4.2.8)
@@ -1024,13 +1088,15 @@ void acpigen_write_resourcetemplate_footer(void)
 	acpigen_emit_byte(0x79);
 	acpigen_emit_byte(0x00);
 
-	/* Start counting past the 2-bytes length added in
-	   acpigen_write_resourcetemplate() above. */
-	len = acpigen_get_current() - (p + 2);
+	if (p) {
+		/* Start counting past the 2-bytes length added in
+		   acpigen_write_resourcetemplate() above. */
+		len = acpigen_get_current() - (p + 2);
 
-	/* patch len word */
-	p[0] = len & 0xff;
-	p[1] = (len >> 8) & 0xff;
+		/* patch len word */
+		p[0] = len & 0xff;
+		p[1] = (len >> 8) & 0xff;
+	}
 	/* patch len field */
 	acpigen_pop_len();
 }
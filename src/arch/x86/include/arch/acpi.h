@@ -818,8 +818,52 @@ struct acpi_spmi {
 
 unsigned long fw_cfg_acpi_tables(unsigned long start);
 
+/*
+ * Size of the CBMEM area the tables are written to. write_acpi_tables()
+ * bounds the generated SSDT by it.
+ */
+#define MAX_ACPI_SIZE (144 * 1024)
+
 /* These are implemented by the target port or north/southbridge. */
 unsigned long write_acpi_tables(unsigned long addr);
+
+#if CONFIG(ACPI_TABLE_CACHE)
+/*
+ * Restore the ACPI tables at addr from the table cache if the inputs to table
+ * generation didn't change, or generate them with write_acpi_tables() and
+ * queue them for the cache otherwise. Returns the end of the tables.
+ */
+unsigned long acpi_table_cache_write_tables(unsigned long addr,
+						size_t max_size);
+/* Mix additional data that affects the generated tables into the cache key. */
+void acpi_table_cache_hash_input(const void *data, size_t size);
+/* Called from the cache key computation for platform specific inputs. */
+void acpi_table_cache_platform_inputs(void);
+/* Called after restoring tables to redo side effects of table generation. */
+void acpi_table_cache_restored(void);
+/*
+ * Record a value that a side effect of table generation needs to be redone
+ * from acpi_table_cache_restored(), e.g. an address inside the tables. It is
+ * stored along with the tables and returned by acpi_table_cache_lookup()
+ * after they have been restored. Returns 0 if the tag was found.
+ */
+void acpi_table_cache_record(uint32_t tag, uint64_t value);
+int acpi_table_cache_lookup(uint32_t tag, uint64_t *value);
+#else
+static inline unsigned long acpi_table_cache_write_tables(unsigned long addr,
+							size_t max_size)
+{
+	return write_acpi_tables(addr);
+}
+static inline void acpi_table_cache_record(uint32_t tag, uint64_t value) {}
+static inline int acpi_table_cache_lookup(uint32_t tag, uint64_t *value)
+{
+	return -1;
+}
+#endif
+
+/* Tags for acpi_table_cache_record() */
+#define ACPI_CACHE_TAG_IGD_OPREGION	1
 unsigned long acpi_fill_madt(unsigned long current);
 unsigned long acpi_fill_mcfg(unsigned long current);
 unsigned long acpi_fill_ivrs_ioapic(acpi_ivrs_t *ivrs, unsigned long current);
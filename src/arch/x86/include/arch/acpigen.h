@@ -14,6 +14,8 @@
 #ifndef LIBACPI_H
 #define LIBACPI_H
 
+#include <stdbool.h>
+#include <stddef.h>
 #include <stdint.h>
 #include <arch/acpi.h>
 #include <arch/acpi_device.h>
@@ -287,10 +289,50 @@ struct cppc_config {
 
 void acpigen_write_return_integer(uint64_t arg);
 void acpigen_write_return_string(const char *arg);
+/* How much nesting do we support? */
+#define ACPIGEN_LENSTACK_SIZE 10
+
+/*
+ * Output buffer of the AML emitter. Bytes past the end are counted but not
+ * written, and mark the buffer as overflowed.
+ */
+struct acpigen_buf {
+	char *start;
+	char *current;
+	char *end;
+	bool overflow;
+	int ltop;
+	char *len_stack[ACPIGEN_LENSTACK_SIZE];
+};
+
+void acpigen_buf_init(struct acpigen_buf *buf, void *start, size_t size);
+/* Send all acpigen output to buf. Returns the previously used buffer. */
+struct acpigen_buf *acpigen_buf_select(struct acpigen_buf *buf);
+
+static inline size_t acpigen_buf_used(const struct acpigen_buf *buf)
+{
+	return buf->current - buf->start;
+}
+
+/* True if output didn't fit or the nesting of scopes was unbalanced. */
+static inline bool acpigen_buf_overflowed(const struct acpigen_buf *buf)
+{
+	return buf->overflow;
+}
+
+/*
+ * Return p if len bytes at p can be patched after having been emitted. If
+ * they were dropped because the buffer overflowed, mark the buffer as such
+ * and return NULL.
+ */
+char *acpigen_patch_ptr(char *p, size_t len);
+
 void acpigen_write_len_f(void);
 void acpigen_pop_len(void);
+/* Write to curr through the default buffer, which has no size limit. */
 void acpigen_set_current(char *curr);
 char *acpigen_get_current(void);
+/* Returns the element count to patch, NULL if it didn't fit the buffer. */
 char *acpigen_write_package(int nr_el);
 void acpigen_write_zero(void);
 void acpigen_write_one(void);
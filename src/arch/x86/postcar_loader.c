@@ -19,7 +19,6 @@
 #include <cpu/x86/mtrr.h>
 #include <cpu/x86/smm.h>
 #include <program_loading.h>
-#include <reset.h>
 #include <rmodule.h>
 #include <romstage_handoff.h>
 #include <stage_cache.h>
@@ -175,7 +174,7 @@ static void load_postcar_cbfs(struct prog *prog, struct postcar_frame *pcf)
 
 	vboot_run_logic();
 
-	if (prog_locate(prog))
+	if (prog_locate_deferred(prog))
 		die_with_post_code(POST_INVALID_ROM,
 				   "Failed to locate after CAR program.\n");
 	if (rmodule_stage_load(&rsl))
@@ -209,12 +208,6 @@ void postcar_enable_tseg_cache(struct postcar_frame *pcf)
 				MTRR_TYPE_WRBACK);
 }
 
-static void postcar_cache_invalid(void)
-{
-	printk(BIOS_ERR, "postcar cache invalid.\n");
-	board_reset();
-}
-
 void run_postcar_phase(struct postcar_frame *pcf)
 {
 	struct prog prog =
@@ -225,15 +218,18 @@ void run_postcar_phase(struct postcar_frame *pcf)
 	if (!CONFIG(NO_STAGE_CACHE) &&
 				romstage_handoff_is_resume()) {
 		stage_cache_load_stage(STAGE_POSTCAR, &prog);
+		if (prog_entry(&prog) == NULL)
+			printk(BIOS_ERR, "postcar cache invalid, loading from CBFS.\n");
+	}
+
+	if (prog_entry(&prog) != NULL) {
 		/* This is here to allow platforms to pass different stack
 		   parameters between S3 resume and normal boot. On the
 		   platforms where the values are the same it's a nop. */
 		finalize_load(prog.arg, pcf->stack);
-
-		if (prog_entry(&prog) == NULL)
-			postcar_cache_invalid();
-	} else
+	} else {
 		load_postcar_cbfs(&prog, pcf);
+	}
 
 	/* As postcar exist, it's end of romstage here */
 	timestamp_add_now(TS_END_ROMSTAGE);
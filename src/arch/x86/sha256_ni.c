@@ -0,0 +1,37 @@
+/*
+ * This file is part of the coreboot project.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#include <arch/cpu.h>
+#include <cpu/x86/cr.h>
+#include <security/vboot/sha256_cpu.h>
+
+#define CPUID_1_ECX_SSSE3	(1 << 9)
+#define CPUID_1_ECX_SSE41	(1 << 19)
+#define CPUID_7_EBX_SHA		(1 << 29)
+
+int sha256_cpu_supported(void)
+{
+	const uint32_t ecx_needed = CPUID_1_ECX_SSSE3 | CPUID_1_ECX_SSE41;
+
+	/* The xmm registers can only be used once SSE has been enabled. */
+	if (!(read_cr4() & CR4_OSFXSR) || (read_cr0() & (CR0_EM | CR0_TS)))
+		return 0;
+
+	if (cpuid_get_max_func() < 7)
+		return 0;
+
+	if ((cpuid_ecx(1) & ecx_needed) != ecx_needed)
+		return 0;
+
+	return !!(cpuid_ext(7, 0).ebx & CPUID_7_EBX_SHA);
+}
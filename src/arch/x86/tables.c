@@ -89,8 +89,6 @@ static unsigned long write_acpi_table(unsigned long rom_table_end)
 {
 	unsigned long high_table_pointer;
 
-#define MAX_ACPI_SIZE (144 * 1024)
-
 	post_code(0x9c);
 
 	/* Write ACPI tables to F segment and high tables area */
@@ -112,7 +110,8 @@ static unsigned long write_acpi_table(unsigned long rom_table_end)
 		unsigned long new_high_table_pointer;
 
 		rom_table_end = ALIGN_UP(rom_table_end, 16);
-		new_high_table_pointer = write_acpi_tables(high_table_pointer);
+		new_high_table_pointer = acpi_table_cache_write_tables(
+			high_table_pointer, MAX_ACPI_SIZE);
 		if (new_high_table_pointer > (high_table_pointer
 			+ MAX_ACPI_SIZE))
 			printk(BIOS_ERR, "ERROR: Increase ACPI size\n");
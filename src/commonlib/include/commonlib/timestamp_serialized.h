@@ -59,10 +59,21 @@ enum timestamp_id {
 	TS_WRITE_TABLES = 80,
 	TS_FINALIZE_CHIPS = 85,
 	TS_LOAD_PAYLOAD = 90,
+	TS_START_PAYLOAD_SEGMENT = 91,
+	TS_END_PAYLOAD_SEGMENT = 92,
 	TS_ACPI_WAKE_JUMP = 98,
 	TS_SELFBOOT_JUMP = 99,
 	TS_START_POSTCAR = 100,
 	TS_END_POSTCAR = 101,
+	TS_START_MP_INIT = 110,
+	TS_END_AP_STARTUP = 111,
+	TS_START_SMM_INSTALL = 112,
+	TS_END_SMM_INSTALL = 113,
+	TS_START_SMM_RELOCATION = 114,
+	TS_END_SMM_RELOCATION = 115,
+	TS_END_MP_INIT = 116,
+	TS_AP_START = 117,
+	TS_AP_DONE = 118,
 
 	/* 500+ reserved for vendorcode extensions (500-600: google/chromeos) */
 	TS_START_COPYVER = 501,
@@ -184,6 +195,8 @@ static const struct timestamp_id_to_name {
 	{ TS_WRITE_TABLES,	"write tables" },
 	{ TS_FINALIZE_CHIPS,	"finalize chips" },
 	{ TS_LOAD_PAYLOAD,	"load payload" },
+	{ TS_START_PAYLOAD_SEGMENT,	"starting to load payload segment" },
+	{ TS_END_PAYLOAD_SEGMENT,	"finished loading payload segment" },
 	{ TS_ACPI_WAKE_JUMP,	"ACPI wake jump" },
 	{ TS_SELFBOOT_JUMP,	"selfboot jump" },
 
@@ -268,6 +281,15 @@ static const struct timestamp_id_to_name {
 		"returning from FspNotify(EndOfFirmware)" },
 	{ TS_START_POSTCAR,	"start of postcar" },
 	{ TS_END_POSTCAR,	"end of postcar" },
+	{ TS_START_MP_INIT,	"starting MP initialization" },
+	{ TS_END_AP_STARTUP,	"finished starting APs" },
+	{ TS_START_SMM_INSTALL,	"starting to install SMM handlers" },
+	{ TS_END_SMM_INSTALL,	"finished installing SMM handlers" },
+	{ TS_START_SMM_RELOCATION, "starting SMM relocation" },
+	{ TS_END_SMM_RELOCATION, "finished SMM relocation" },
+	{ TS_END_MP_INIT,	"finished MP initialization" },
+	{ TS_AP_START,		"AP entered ramstage" },
+	{ TS_AP_DONE,		"AP finished CPU initialization" },
 };
 
 #endif
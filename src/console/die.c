@@ -13,6 +13,7 @@
  */
 
 #include <console/console.h>
+#include <elog.h>
 #include <halt.h>
 
 /*
@@ -35,5 +36,10 @@ void __noreturn die(const char *fmt, ...)
 	va_end(args);
 
 	die_notify();
+
+	/* Write out any event log entries still held back. */
+	if (CONFIG(ELOG_DEFER_SYNC) && ENV_RAMSTAGE)
+		elog_flush();
+
 	halt();
 }
@@ -772,6 +772,7 @@ static const struct mp_ops mp_ops = {
 	.get_microcode_info = get_microcode_info,
 	.pre_mp_smm_init = smm_initialize,
 	.per_cpu_smm_trigger = per_cpu_smm_trigger,
+	.smm_relocation_parallel = smm_relocation_parallel,
 	.relocation_handler = smm_relocation_handler,
 	.post_mp_init = post_mp_init,
 };
@@ -16,6 +16,7 @@
 #include <console/console.h>
 #include <bootmem.h>
 #include <program_loading.h>
+#include <security/vboot/vboot_crtm.h>
 #include <types.h>
 
 void mirror_payload(struct prog *payload)
@@ -60,6 +61,10 @@ void mirror_payload(struct prog *payload)
 	 */
 	memcpy(buffer, src, size);
 
+	/* Let a pending measurement use the copy instead of rereading. */
+	vboot_measure_cbfs_data(prog_rdev(payload), &buffer[alignment_diff], 0,
+				prog_size(payload));
+
 	/* Update the payload's backing store. */
 	prog_set_area(payload, &buffer[alignment_diff], prog_size(payload));
 }
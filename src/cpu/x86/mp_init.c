@@ -33,9 +33,11 @@
 #include <device/device.h>
 #include <device/path.h>
 #include <smp/atomic.h>
+#include <smp/node.h>
 #include <smp/spinlock.h>
 #include <symbols.h>
 #include <timer.h>
+#include <timestamp.h>
 #include <thread.h>
 
 #include <security/intel/stm/SmmStm.h>
@@ -139,6 +141,41 @@ static struct mp_flight_plan mp_info;
 /* Keep track of device structure for each CPU. */
 static struct device *cpus_dev[CONFIG_MAX_CPUS];
 
+#if CONFIG(MP_AP_TIMESTAMPS)
+/* Filled in by the APs, turned into timestamps by the BSP. */
+static struct {
+	uint64_t start;
+	uint64_t done;
+} ap_times[CONFIG_MAX_CPUS];
+
+static void record_ap_start(int cpu)
+{
+	ap_times[cpu].start = timestamp_get();
+}
+
+static void record_ap_done(int cpu)
+{
+	ap_times[cpu].done = timestamp_get();
+}
+
+/* The timestamp table isn't safe to update from several CPUs at once. */
+static void add_ap_timestamps(int num_cpus)
+{
+	int i;
+
+	for (i = 1; i < MIN(num_cpus, CONFIG_MAX_CPUS); i++) {
+		if (ap_times[i].start)
+			timestamp_add(TS_AP_START, ap_times[i].start);
+		if (ap_times[i].done)
+			timestamp_add(TS_AP_DONE, ap_times[i].done);
+	}
+}
+#else
+static void record_ap_start(int cpu) {}
+static void record_ap_done(int cpu) {}
+static void add_ap_timestamps(int num_cpus) {}
+#endif
+
 static inline void barrier_wait(atomic_t *b)
 {
 	while (atomic_read(b) == 0)
@@ -196,6 +233,8 @@ static void asmlinkage ap_init(unsigned int cpu)
 {
 	struct cpu_info *info;
 
+	record_ap_start(cpu);
+
 	/* Ensure the local APIC is enabled */
 	enable_lapic();
 
@@ -252,11 +291,19 @@ static inline struct saved_msr *save_msr(int index, struct saved_msr *entry)
 	return entry;
 }
 
+/*
+ * Build the table of MSR writes the APs replay in the SIPI vector before
+ * they enable caching. The table is computed once here and shared by all
+ * APs, so it is kept as short as possible: a variable MTRR that is not
+ * valid on the BSP only needs its mask written, as the base of an invalid
+ * range is never looked at.
+ */
 static int save_bsp_msrs(char *start, int size)
 {
 	int msr_count;
 	int num_var_mtrrs;
 	struct saved_msr *msr_entry;
+	struct saved_msr *table;
 	int i;
 	msr_t msr;
 
@@ -274,12 +321,15 @@ static int save_bsp_msrs(char *start, int size)
 
 	fixed_mtrrs_expose_amd_rwdram();
 
-	msr_entry = (void *)start;
+	table = (void *)start;
+	msr_entry = table;
 	for (i = 0; i < NUM_FIXED_MTRRS; i++)
 		msr_entry = save_msr(fixed_mtrrs[i], msr_entry);
 
 	for (i = 0; i < num_var_mtrrs; i++) {
-		msr_entry = save_msr(MTRR_PHYS_BASE(i), msr_entry);
+		msr = rdmsr(MTRR_PHYS_MASK(i));
+		if (msr.lo & MTRR_PHYS_MASK_VALID)
+			msr_entry = save_msr(MTRR_PHYS_BASE(i), msr_entry);
 		msr_entry = save_msr(MTRR_PHYS_MASK(i), msr_entry);
 	}
 
@@ -287,8 +337,8 @@ static int save_bsp_msrs(char *start, int size)
 
 	fixed_mtrrs_hide_amd_rwdram();
 
-	/* Tell static analysis we know value is left unused. */
-	(void)msr_entry;
+	msr_count = msr_entry - table;
+	printk(BIOS_DEBUG, "Mirroring %d MSRs to the APs.\n", msr_count);
 
 	return msr_count;
 }
@@ -606,6 +656,7 @@ static void init_bsp(struct bus *cpu_bus)
  */
 static int mp_init(struct bus *cpu_bus, struct mp_params *p)
 {
+	int ret;
 	int num_cpus;
 	atomic_t *ap_count;
 
@@ -647,9 +698,14 @@ static int mp_init(struct bus *cpu_bus, struct mp_params *p)
 		       atomic_read(ap_count), global_num_aps);
 		return -1;
 	}
+	timestamp_add_now(TS_END_AP_STARTUP);
 
 	/* Walk the flight plan for the BSP. */
-	return bsp_do_flight_plan(p);
+	ret = bsp_do_flight_plan(p);
+
+	add_ap_timestamps(p->num_cpus);
+
+	return ret;
 }
 
 /* Calls cpu_initialize(info->index) which calls the coreboot CPU drivers. */
@@ -658,6 +714,9 @@ static void mp_initialize_cpu(void)
 	/* Call back into driver infrastructure for the AP initialization.   */
 	struct cpu_info *info = cpu_info();
 	cpu_initialize(info->index);
+
+	if (info->index != 0)
+		record_ap_done(info->index);
 }
 
 void smm_initiate_relocation_parallel(void)
@@ -676,7 +735,7 @@ void smm_initiate_relocation_parallel(void)
 	if (apic_wait_timeout(1000 /* 1 ms */, 100 /* us */))
 		printk(BIOS_DEBUG, "SMI Relocation timed out.\n");
 	else
-		printk(BIOS_DEBUG, "Relocation complete.\n");
+		printk(BIOS_SPEW, "Relocation complete.\n");
 }
 
 DECLARE_SPIN_LOCK(smm_relocation_lock);
@@ -696,6 +755,10 @@ struct mp_state {
 	size_t perm_smsize;
 	size_t smm_save_state_size;
 	int do_smm;
+	int smm_reloc_parallel;
+	struct stopwatch smm_reloc_sw;
+	/* Permanent SMBASE of each CPU, laid out before any CPU relocates. */
+	uintptr_t smbase[CONFIG_MAX_CPUS];
 } mp_state;
 
 static int is_smm_enabled(void)
@@ -734,14 +797,14 @@ static void asmlinkage smm_do_relocation(void *arg)
 	}
 
 	/*
-	 * The permanent handler runs with all cpus concurrently. Precalculate
-	 * the location of the new SMBASE. If using SMM modules then this
-	 * calculation needs to match that of the module loader.
+	 * The permanent handler runs with all cpus concurrently. The location
+	 * of each new SMBASE was taken from the module loader's layout when
+	 * the permanent handler was installed, so nothing here depends on
+	 * other CPUs and relocation can run on all of them at once.
 	 */
-	perm_smbase = mp_state.perm_smbase;
-	perm_smbase -= cpu * runtime->save_state_size;
+	perm_smbase = mp_state.smbase[cpu];
 
-	printk(BIOS_DEBUG, "New SMBASE 0x%08lx\n", perm_smbase);
+	printk(BIOS_SPEW, "New SMBASE 0x%08lx\n", perm_smbase);
 
 	/* Setup code checks this callback for validity. */
 	mp_state.ops.relocation_handler(cpu, curr_smbase, perm_smbase);
@@ -790,6 +853,22 @@ static int install_relocation_handler(int num_cpus, size_t save_state_size)
 	return 0;
 }
 
+/*
+ * Each CPU gets its own save state area in the permanent handler. The entry
+ * points are staggered down from the top one by the save state size, so the
+ * SMBASE of each CPU is known before any of them goes through relocation.
+ */
+static void layout_smbases(const struct smm_loader_params *smm_params,
+				int num_cpus)
+{
+	const struct smm_runtime *runtime = smm_params->runtime;
+	int i;
+
+	for (i = 0; i < MIN(num_cpus, CONFIG_MAX_CPUS); i++)
+		mp_state.smbase[i] = runtime->smbase -
+			i * smm_params->per_cpu_save_state_size;
+}
+
 static int install_permanent_handler(int num_cpus, uintptr_t smbase,
 					size_t smsize, size_t save_state_size)
 {
@@ -812,6 +891,7 @@ static int install_permanent_handler(int num_cpus, uintptr_t smbase,
 		return -1;
 
 	adjust_smm_apic_id_map(&smm_params);
+	layout_smbases(&smm_params, num_cpus);
 
 	return 0;
 }
@@ -825,6 +905,8 @@ static void load_smm_handlers(void)
 	if (!is_smm_enabled())
 		return;
 
+	timestamp_add_now(TS_START_SMM_INSTALL);
+
 	/* Install handlers. */
 	if (install_relocation_handler(mp_state.cpu_count,
 		smm_save_state_size) < 0) {
@@ -847,18 +929,61 @@ static void load_smm_handlers(void)
 	 */
 	if (is_smm_enabled() && mp_state.ops.pre_mp_smm_init != NULL)
 		mp_state.ops.pre_mp_smm_init();
+
+	timestamp_add_now(TS_END_SMM_INSTALL);
+
+	if (!is_smm_enabled())
+		return;
+
+	if (mp_state.ops.smm_relocation_parallel != NULL &&
+	    mp_state.ops.smm_relocation_parallel())
+		mp_state.smm_reloc_parallel = 1;
+
+	timestamp_add_now(TS_START_SMM_RELOCATION);
+	stopwatch_init(&mp_state.smm_reloc_sw);
 }
 
 /* Trigger SMM as part of MP flight record. */
 static void trigger_smm_relocation(void)
 {
 	/* Do nothing if SMM is disabled.*/
-	if (!is_smm_enabled() || mp_state.ops.per_cpu_smm_trigger == NULL)
+	if (!is_smm_enabled())
+		return;
+
+	if (mp_state.smm_reloc_parallel) {
+		/* The BSP is relocated once all APs are through. */
+		if (!boot_cpu())
+			smm_initiate_relocation_parallel();
+		return;
+	}
+
+	if (mp_state.ops.per_cpu_smm_trigger == NULL)
 		return;
 	/* Trigger SMM mode for the currently running processor. */
 	mp_state.ops.per_cpu_smm_trigger();
 }
 
+/* Called on the BSP once all APs are through relocation. */
+static void smm_relocation_done(void)
+{
+	if (!is_smm_enabled())
+		return;
+
+	/*
+	 * With parallel relocation the BSP goes last. Its pass through the
+	 * relocation handler is where platforms that keep the save state in
+	 * MSRs during relocation switch back to the save state in SMRAM.
+	 */
+	if (mp_state.smm_reloc_parallel)
+		smm_initiate_relocation_parallel();
+
+	timestamp_add_now(TS_END_SMM_RELOCATION);
+	printk(BIOS_DEBUG, "SMM relocation of %d CPUs (%s) took %ld usecs.\n",
+	       mp_state.cpu_count,
+	       mp_state.smm_reloc_parallel ? "parallel" : "serialized",
+	       stopwatch_duration_usecs(&mp_state.smm_reloc_sw));
+}
+
 static struct mp_callback *ap_callbacks[CONFIG_MAX_CPUS];
 
 static struct mp_callback *read_callback(struct mp_callback **slot)
@@ -1015,6 +1140,8 @@ static struct mp_flight_record mp_steps[] = {
 	MP_FR_BLOCK_APS(NULL, load_smm_handlers),
 	/* Perform SMM relocation. */
 	MP_FR_NOBLOCK_APS(trigger_smm_relocation, trigger_smm_relocation),
+	/* Wait for all CPUs to be relocated. */
+	MP_FR_BLOCK_APS(NULL, smm_relocation_done),
 	/* Initialize each CPU through the driver framework. */
 	MP_FR_BLOCK_APS(mp_initialize_cpu, mp_initialize_cpu),
 	/* Wait for APs to finish then optionally start looking for work. */
@@ -1059,6 +1186,8 @@ int mp_init_with_smm(struct bus *cpu_bus, const struct mp_ops *mp_ops)
 	void *default_smm_area;
 	struct mp_params mp_params;
 
+	timestamp_add_now(TS_START_MP_INIT);
+
 	if (mp_ops->pre_mp_init != NULL)
 		mp_ops->pre_mp_init();
 
@@ -1098,5 +1227,7 @@ int mp_init_with_smm(struct bus *cpu_bus, const struct mp_ops *mp_ops)
 	if (ret == 0 && mp_state.ops.post_mp_init != NULL)
 		mp_state.ops.post_mp_init();
 
+	timestamp_add_now(TS_END_MP_INIT);
+
 	return ret;
 }
@@ -306,19 +306,15 @@ static void calc_fixed_mtrrs(void)
 	fixed_mtrr_types_initialized = 1;
 }
 
-static void commit_fixed_mtrrs(void)
+static void calc_fixed_mtrr_msrs(msr_t fixed_msrs[NUM_FIXED_MTRRS],
+				unsigned long msr_index[NUM_FIXED_MTRRS])
 {
 	int i;
 	int j;
 	int msr_num;
 	int type_index;
-	/* 8 ranges per msr. */
-	msr_t fixed_msrs[NUM_FIXED_MTRRS];
-	unsigned long msr_index[NUM_FIXED_MTRRS];
-
-	fixed_mtrrs_expose_amd_rwdram();
 
-	memset(&fixed_msrs, 0, sizeof(fixed_msrs));
+	memset(fixed_msrs, 0, NUM_FIXED_MTRRS * sizeof(msr_t));
 
 	msr_num = 0;
 	type_index = 0;
@@ -354,9 +350,21 @@ static void commit_fixed_mtrrs(void)
 	/* Ensure that both arrays were fully initialized */
 	ASSERT(msr_num == NUM_FIXED_MTRRS)
 
-	for (i = 0; i < ARRAY_SIZE(fixed_msrs); i++)
+	for (i = 0; i < NUM_FIXED_MTRRS; i++)
 		printk(BIOS_DEBUG, "MTRR: Fixed MSR 0x%lx 0x%08x%08x\n",
 		       msr_index[i], fixed_msrs[i].hi, fixed_msrs[i].lo);
+}
+
+static void commit_fixed_mtrrs(void)
+{
+	int i;
+	/* 8 ranges per msr. */
+	msr_t fixed_msrs[NUM_FIXED_MTRRS];
+	unsigned long msr_index[NUM_FIXED_MTRRS];
+
+	fixed_mtrrs_expose_amd_rwdram();
+
+	calc_fixed_mtrr_msrs(fixed_msrs, msr_index);
 
 	disable_cache();
 	for (i = 0; i < ARRAY_SIZE(fixed_msrs); i++)
@@ -767,7 +775,8 @@ static int commit_var_mtrrs(const struct var_mtrr_solution *sol)
 	return 0;
 }
 
-void x86_setup_var_mtrrs(unsigned int address_bits, unsigned int above4gb)
+static const struct var_mtrr_solution *get_var_mtrr_solution(
+			unsigned int address_bits, unsigned int above4gb)
 {
 	static struct var_mtrr_solution *sol = NULL;
 	struct memranges *addr_space;
@@ -782,19 +791,119 @@ void x86_setup_var_mtrrs(unsigned int address_bits, unsigned int above4gb)
 				  !!above4gb, address_bits, sol);
 	}
 
-	commit_var_mtrrs(sol);
+	return sol;
 }
 
-void x86_setup_mtrrs(void)
+void x86_setup_var_mtrrs(unsigned int address_bits, unsigned int above4gb)
+{
+	commit_var_mtrrs(get_var_mtrr_solution(address_bits, above4gb));
+}
+
+/*
+ * The complete MTRR setup done by x86_setup_mtrrs(), as a list of MSR
+ * writes. It is computed on the first call, normally on the BSP, and then
+ * replayed by every CPU within a single cache-disable sequence instead of
+ * one for the fixed and one for the variable MTRRs.
+ */
+struct mtrr_program_entry {
+	uint32_t index;
+	msr_t value;
+};
+
+static struct mtrr_program {
+	int num_fixed;
+	int num_msrs;
+	int var_valid;
+	unsigned char def_type;
+	struct mtrr_program_entry msrs[NUM_FIXED_MTRRS +
+					2 * NUM_MTRR_STATIC_STORAGE];
+} mtrr_program;
+
+static void program_add(struct mtrr_program *prog, uint32_t index,
+			msr_t value)
 {
+	prog->msrs[prog->num_msrs].index = index;
+	prog->msrs[prog->num_msrs].value = value;
+	prog->num_msrs++;
+}
+
+static void prepare_mtrr_program(struct mtrr_program *prog)
+{
+	const struct var_mtrr_solution *sol;
+	msr_t fixed_msrs[NUM_FIXED_MTRRS];
+	unsigned long msr_index[NUM_FIXED_MTRRS];
+	const msr_t zero = { .lo = 0, .hi = 0 };
 	int address_size;
+	int i;
+
+	calc_fixed_mtrrs();
+	calc_fixed_mtrr_msrs(fixed_msrs, msr_index);
+	for (i = 0; i < NUM_FIXED_MTRRS; i++)
+		program_add(prog, msr_index[i], fixed_msrs[i]);
+	prog->num_fixed = prog->num_msrs;
 
-	x86_setup_fixed_mtrrs();
 	address_size = cpu_phys_address_size();
 	printk(BIOS_DEBUG, "CPU physical address size: %d bits\n",
 		address_size);
 	/* Always handle addresses above 4GiB. */
-	x86_setup_var_mtrrs(address_size, 1);
+	sol = get_var_mtrr_solution(address_size, 1);
+
+	if (sol->num_used > total_mtrrs) {
+		printk(BIOS_WARNING, "Not enough MTRRs: %d vs %d\n",
+			sol->num_used, total_mtrrs);
+		return;
+	}
+
+	for (i = 0; i < sol->num_used; i++) {
+		program_add(prog, MTRR_PHYS_BASE(i), sol->regs[i].base);
+		program_add(prog, MTRR_PHYS_MASK(i), sol->regs[i].mask);
+	}
+	/* Clear the ones that are unused. */
+	for (; i < total_mtrrs; i++) {
+		program_add(prog, MTRR_PHYS_BASE(i), zero);
+		program_add(prog, MTRR_PHYS_MASK(i), zero);
+	}
+
+	prog->def_type = sol->mtrr_default_type;
+	prog->var_valid = 1;
+}
+
+static void commit_mtrr_program(const struct mtrr_program *prog)
+{
+	msr_t msr;
+	int i;
+
+	fixed_mtrrs_expose_amd_rwdram();
+	disable_cache();
+
+	for (i = 0; i < prog->num_fixed; i++)
+		wrmsr(prog->msrs[i].index, prog->msrs[i].value);
+	fixed_mtrrs_hide_amd_rwdram();
+
+	for (; i < prog->num_msrs; i++)
+		wrmsr(prog->msrs[i].index, prog->msrs[i].value);
+
+	msr = rdmsr(MTRR_DEF_TYPE_MSR);
+	msr.lo |= MTRR_DEF_TYPE_EN | MTRR_DEF_TYPE_FIX_EN;
+	if (prog->var_valid) {
+		msr.lo &= ~0xff;
+		msr.lo |= prog->def_type;
+	}
+	wrmsr(MTRR_DEF_TYPE_MSR, msr);
+
+	enable_cache();
+}
+
+void x86_setup_mtrrs(void)
+{
+	static int mtrr_program_prepared;
+
+	if (!mtrr_program_prepared) {
+		prepare_mtrr_program(&mtrr_program);
+		mtrr_program_prepared = 1;
+	}
+
+	commit_mtrr_program(&mtrr_program);
 }
 
 void x86_setup_mtrrs_with_detect(void)
@@ -219,61 +219,129 @@ static void read_resources(struct bus *bus)
 	       dev_path(bus->dev), bus->secondary, bus->link_num);
 }
 
-struct pick_largest_state {
-	struct resource *last;
-	const struct device *result_dev;
-	struct resource *result;
-	int seen_last;
+struct sorted_resource {
+	const struct device *dev;
+	struct resource *res;
 };
 
-static void pick_largest_resource(void *gp, struct device *dev,
-				  struct resource *resource)
+struct sorted_resource_list {
+	struct sorted_resource *entries;
+	size_t count;
+};
+
+static void count_sortable_resource(void *gp, struct device *dev,
+				    struct resource *resource)
 {
-	struct pick_largest_state *state = gp;
-	struct resource *last;
+	struct sorted_resource_list *list = gp;
 
-	last = state->last;
+	if (resource->flags & IORESOURCE_FIXED)
+		return;	/* Skip it. */
+	list->count++;
+}
+
+static void add_sortable_resource(void *gp, struct device *dev,
+				  struct resource *resource)
+{
+	struct sorted_resource_list *list = gp;
 
-	/* Be certain to pick the successor to last. */
-	if (resource == last) {
-		state->seen_last = 1;
-		return;
-	}
 	if (resource->flags & IORESOURCE_FIXED)
 		return;	/* Skip it. */
-	if (last && ((last->align < resource->align) ||
-		     ((last->align == resource->align) &&
-		      (last->size < resource->size)) ||
-		     ((last->align == resource->align) &&
-		      (last->size == resource->size) && (!state->seen_last)))) {
-		return;
-	}
-	if (!state->result ||
-	    (state->result->align < resource->align) ||
-	    ((state->result->align == resource->align) &&
-	     (state->result->size < resource->size))) {
-		state->result_dev = dev;
-		state->result = resource;
+	list->entries[list->count].dev = dev;
+	list->entries[list->count].res = resource;
+	list->count++;
+}
+
+/* Resources with larger alignment go first, then larger size. */
+static int resource_sorts_before(const struct resource *a,
+				 const struct resource *b)
+{
+	if (a->align != b->align)
+		return a->align > b->align;
+	return a->size > b->size;
+}
+
+/*
+ * Stable bottom-up merge sort. Resources with equal alignment and size keep
+ * the order in which search_bus_resources() found them, so the allocation
+ * result matches picking the largest remaining resource one at a time.
+ */
+static void sort_resources(struct sorted_resource *entries,
+			   struct sorted_resource *tmp, size_t count)
+{
+	struct sorted_resource *src = entries;
+	struct sorted_resource *dst = tmp;
+	struct sorted_resource *swap;
+	size_t width;
+
+	for (width = 1; width < count; width *= 2) {
+		size_t lo;
+
+		for (lo = 0; lo < count; lo += 2 * width) {
+			size_t mid = MIN(lo + width, count);
+			size_t hi = MIN(lo + 2 * width, count);
+			size_t i = lo, j = mid, k = lo;
+
+			while (i < mid && j < hi) {
+				if (resource_sorts_before(src[j].res,
+							  src[i].res))
+					dst[k++] = src[j++];
+				else
+					dst[k++] = src[i++];
+			}
+			while (i < mid)
+				dst[k++] = src[i++];
+			while (j < hi)
+				dst[k++] = src[j++];
+		}
+
+		swap = src;
+		src = dst;
+		dst = swap;
 	}
+
+	if (src != entries)
+		memcpy(entries, src, count * sizeof(*entries));
 }
 
-static const struct device *largest_resource(struct bus *bus,
-				       struct resource **result_res,
-				       unsigned long type_mask,
-				       unsigned long type)
+/**
+ * Gather all non-fixed resources of the given type on a bus, sorted from
+ * largest to smallest alignment and size.
+ *
+ * The returned list must be released with free_sorted_resources() before
+ * any other heap allocation is made so the heap space gets reclaimed.
+ *
+ * @param bus The bus to search.
+ * @param list The list to fill in.
+ * @param type_mask This value gets ANDed with the resource type.
+ * @param type This value must match the result of the AND.
+ */
+static void get_sorted_resources(struct bus *bus,
+				 struct sorted_resource_list *list,
+				 unsigned long type_mask, unsigned long type)
 {
-	struct pick_largest_state state;
+	list->entries = NULL;
+	list->count = 0;
 
-	state.last = *result_res;
-	state.result_dev = NULL;
-	state.result = NULL;
-	state.seen_last = 0;
+	search_bus_resources(bus, type_mask, type, count_sortable_resource,
+			     list);
+	if (!list->count)
+		return;
 
-	search_bus_resources(bus, type_mask, type, pick_largest_resource,
-			     &state);
+	/* The second half of the buffer is scratch space for the sort. */
+	list->entries = malloc(2 * list->count * sizeof(*list->entries));
+	list->count = 0;
+
+	search_bus_resources(bus, type_mask, type, add_sortable_resource,
+			     list);
+	sort_resources(list->entries, list->entries + list->count,
+		       list->count);
+}
 
-	*result_res = state.result;
-	return state.result_dev;
+static void free_sorted_resources(struct sorted_resource_list *list)
+{
+	free(list->entries);
+	list->entries = NULL;
+	list->count = 0;
 }
 
 /**
@@ -314,7 +382,9 @@ static void compute_resources(struct bus *bus, struct resource *bridge,
 {
 	const struct device *dev;
 	struct resource *resource;
+	struct sorted_resource_list list;
 	resource_t base;
+	size_t i;
 	base = round(bridge->base, bridge->align);
 
 	if (!bus)
@@ -366,15 +436,20 @@ static void compute_resources(struct bus *bus, struct resource *bridge,
 		}
 	}
 
-	/* Remember we haven't found anything yet. */
-	resource = NULL;
+	/*
+	 * Sort the resources on the current bus once, now that the child
+	 * bridges know their sizes and alignments.
+	 */
+	get_sorted_resources(bus, &list, type_mask, type);
 
 	/*
 	 * Walk through all the resources on the current bus and compute the
 	 * amount of address space taken by them. Take granularity and
 	 * alignment into account.
 	 */
-	while ((dev = largest_resource(bus, &resource, type_mask, type))) {
+	for (i = 0; i < list.count; i++) {
+		dev = list.entries[i].dev;
+		resource = list.entries[i].res;
 
 		/* Size 0 resources can be skipped. */
 		if (!resource->size)
@@ -427,6 +502,8 @@ static void compute_resources(struct bus *bus, struct resource *bridge,
 		       resource2str(resource));
 	}
 
+	free_sorted_resources(&list);
+
 	/*
 	 * A PCI bridge resource does not need to be a power of two size, but
 	 * it does have a minimum granularity. Round the size up to that
@@ -461,7 +538,9 @@ static void allocate_resources(struct bus *bus, struct resource *bridge,
 {
 	const struct device *dev;
 	struct resource *resource;
+	struct sorted_resource_list list;
 	resource_t base;
+	size_t i;
 	base = bridge->base;
 
 	if (!bus)
@@ -472,14 +551,15 @@ static void allocate_resources(struct bus *bus, struct resource *bridge,
 	       resource2str(bridge),
 	       base, bridge->size, bridge->align, bridge->gran, bridge->limit);
 
-	/* Remember we haven't found anything yet. */
-	resource = NULL;
+	get_sorted_resources(bus, &list, type_mask, type);
 
 	/*
 	 * Walk through all the resources on the current bus and allocate them
 	 * address space.
 	 */
-	while ((dev = largest_resource(bus, &resource, type_mask, type))) {
+	for (i = 0; i < list.count; i++) {
+		dev = list.entries[i].dev;
+		resource = list.entries[i].res;
 
 		/* Propagate the bridge limit to the resource register. */
 		if (resource->limit > bridge->limit)
@@ -544,6 +624,8 @@ static void allocate_resources(struct bus *bus, struct resource *bridge,
 		       resource->base, resource2str(resource));
 	}
 
+	free_sorted_resources(&list);
+
 	/*
 	 * A PCI bridge resource does not need to be a power of two size, but
 	 * it does have a minimum granularity. Round the size up to that
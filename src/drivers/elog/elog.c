@@ -62,6 +62,19 @@ struct elog_state {
 	/* Device that mirrors the eventlog in memory. */
 	struct mem_region_device mirror_dev;
 
+	/*
+	 * State of the index at the end of the NV storage. The index covers
+	 * the NV contents up to index_last_write and the next entry is
+	 * programmed into index_next_slot.
+	 */
+	size_t index_last_write;
+	size_t index_next_slot;
+
+	/* Set once the last deferred batch for this boot has been written. */
+	bool defer_done;
+	/* Set while a deferred batch is being written. */
+	bool flushing;
+
 	enum elog_init_state elog_initialized;
 };
 
@@ -81,13 +94,28 @@ static size_t elog_events_start(void)
 	return sizeof(struct elog_header);
 }
 
+static size_t elog_index_size(void)
+{
+	if (!CONFIG(ELOG_INDEX))
+		return 0;
+	return ELOG_INDEX_ENTRIES * sizeof(struct elog_index_entry);
+}
+
+static size_t elog_events_end(void)
+{
+	/* The index, if any, lives at the end of the area. */
+	return region_device_sz(&elog_state.nv_dev) - elog_index_size();
+}
+
 static size_t elog_events_total_space(void)
 {
-	return region_device_sz(&elog_state.nv_dev) - elog_events_start();
+	return elog_events_end() - elog_events_start();
 }
 
 static struct event_header *elog_get_event_buffer(size_t offset, size_t size)
 {
+	if (offset + size > elog_events_end())
+		return NULL;
 	return rdev_mmap(mirror_dev_get(), offset, size);
 }
 
@@ -218,13 +246,13 @@ static u8 elog_checksum_event(struct event_header *event)
 
 /*
  * Check if mirrored buffer is filled with ELOG_TYPE_EOL byte from the
- * provided offset to the end of the mirrored buffer.
+ * provided offset to the end of the event area.
  */
 static int elog_is_buffer_clear(size_t offset)
 {
 	size_t i;
 	const struct region_device *rdev = mirror_dev_get();
-	size_t size = region_device_sz(rdev) - offset;
+	size_t size = elog_events_end() - offset;
 	uint8_t *buffer = rdev_mmap(rdev, offset, size);
 	int ret = 1;
 
@@ -243,6 +271,28 @@ static int elog_is_buffer_clear(size_t offset)
 	return ret;
 }
 
+/*
+ * Fill the mirrored buffer with ELOG_TYPE_EOL from the provided offset to the
+ * end of the event area.
+ */
+static int elog_fill_eol(size_t offset)
+{
+	const struct region_device *rdev = mirror_dev_get();
+	size_t size = elog_events_end() - offset;
+	uint8_t *buffer;
+
+	if (!size)
+		return 0;
+
+	buffer = rdev_mmap(rdev, offset, size);
+	if (buffer == NULL)
+		return -1;
+
+	memset(buffer, ELOG_TYPE_EOL, size);
+	rdev_munmap(rdev, buffer);
+	return 0;
+}
+
 /*
  * Verify if the mirrored elog structure is valid.
  * Returns 1 if the header is valid, 0 otherwise
@@ -357,15 +407,199 @@ static void elog_nv_erase(void)
 		printk(BIOS_ERR, "ELOG: erase failure.\n");
 }
 
+static void elog_index_reset(void)
+{
+	elog_state.index_last_write = 0;
+	elog_state.index_next_slot = 0;
+}
+
+/* Same CRC32 as crc32_byte(), looked up 4 bits at a time */
+static const uint32_t elog_index_crc_table[16] = {
+	0x00000000, 0x04c11db7, 0x09823b6e, 0x0d4326d9,
+	0x130476dc, 0x17c56b6b, 0x1a864db2, 0x1e475005,
+	0x2608edb8, 0x22c9f00f, 0x2f8ad6d6, 0x2b4bcb61,
+	0x350c9b64, 0x31cd86d3, 0x3c8ea00a, 0x384fbdbd,
+};
+
+/*
+ * Compute the index checksum over 'size' bytes of the mirrored elog starting
+ * at 'offset'.
+ */
+static int elog_index_checksum(size_t offset, size_t size, uint32_t *checksum)
+{
+	const struct region_device *rdev = mirror_dev_get();
+	const uint32_t *table = elog_index_crc_table;
+	uint32_t crc = 0;
+	uint8_t *buffer;
+	size_t i;
+
+	if (size) {
+		buffer = rdev_mmap(rdev, offset, size);
+		if (buffer == NULL)
+			return -1;
+
+		for (i = 0; i < size; i++) {
+			crc = (crc << 4) ^ table[(crc >> 28) ^ (buffer[i] >> 4)];
+			crc = (crc << 4) ^ table[(crc >> 28) ^ (buffer[i] & 0xf)];
+		}
+		rdev_munmap(rdev, buffer);
+	}
+
+	*checksum = crc;
+	return 0;
+}
+
+static int elog_index_read(size_t slot, struct elog_index_entry *entry)
+{
+	if (rdev_readat(mirror_dev_get(), entry, elog_events_end() +
+			slot * sizeof(*entry), sizeof(*entry)) != sizeof(*entry))
+		return -1;
+	return 0;
+}
+
+static bool elog_index_slot_free(const struct elog_index_entry *entry)
+{
+	const uint8_t *p = (const uint8_t *)entry;
+	size_t i;
+
+	/* Erased flash reads as 0xff. */
+	for (i = 0; i < sizeof(*entry); i++) {
+		if (p[i] != 0xff)
+			return false;
+	}
+	return true;
+}
+
+/*
+ * Check that an index entry continues the chain of entries before it and
+ * that its part of the events is unchanged.
+ */
+static bool elog_index_entry_valid(size_t slot,
+				   const struct elog_index_entry *entry)
+{
+	struct elog_index_entry prev;
+	uint32_t checksum;
+
+	if (entry->start >= entry->last_write ||
+	    entry->last_write < elog_events_start() ||
+	    entry->last_write > elog_events_end())
+		return false;
+
+	if (entry->start != 0) {
+		if (slot == 0 || elog_index_read(slot - 1, &prev) < 0 ||
+		    prev.last_write != entry->start)
+			return false;
+	}
+
+	if (elog_index_checksum(entry->start,
+				entry->last_write - entry->start,
+				&checksum) < 0)
+		return false;
+
+	return checksum == entry->checksum;
+}
+
+/*
+ * Look up the newest valid index entry in the mirrored elog. Each entry only
+ * checksums the events added since the entry before it, as the flash can't
+ * change underneath older entries without erasing the index as well. Returns
+ * the offset up to which the events are known to be valid, or the start of
+ * the events if no entry can be trusted.
+ */
+static size_t elog_scan_index(void)
+{
+	struct elog_index_entry entry;
+	const size_t start = elog_events_start();
+	size_t slot;
+
+	elog_index_reset();
+
+	if (!CONFIG(ELOG_INDEX))
+		return start;
+
+	for (slot = 0; slot < ELOG_INDEX_ENTRIES; slot++) {
+		if (elog_index_read(slot, &entry) < 0)
+			return start;
+		if (elog_index_slot_free(&entry))
+			break;
+	}
+	elog_state.index_next_slot = slot;
+
+	/* Fall back to older entries if the newest one is torn. */
+	while (slot--) {
+		if (elog_index_read(slot, &entry) < 0)
+			return start;
+		if (elog_index_entry_valid(slot, &entry)) {
+			elog_debug("ELOG: index valid up to offset 0x%x\n",
+				   entry.last_write);
+			/*
+			 * The next entry can only continue the chain from
+			 * the newest one, otherwise it starts it over.
+			 */
+			if (slot == elog_state.index_next_slot - 1)
+				elog_state.index_last_write = entry.last_write;
+			return entry.last_write;
+		}
+		printk(BIOS_WARNING, "ELOG: index entry %zu mismatch.\n", slot);
+	}
+
+	return start;
+}
+
+/*
+ * Program a new index entry covering what was written to the NV storage
+ * since the previous entry. Once all entries are used, no more are added
+ * and newer events are validated one by one, until the area is shrunk or
+ * erased, which starts the index over.
+ */
+static void elog_index_update(void)
+{
+	struct elog_index_entry entry;
+	size_t last_write = elog_state.nv_last_write;
+	size_t offset;
+
+	if (!CONFIG(ELOG_INDEX))
+		return;
+
+	if (elog_nv_needs_erase() || last_write <= elog_state.index_last_write)
+		return;
+
+	if (elog_state.index_next_slot >= ELOG_INDEX_ENTRIES)
+		return;
+
+	entry.start = elog_state.index_last_write;
+	entry.last_write = last_write;
+	if (elog_index_checksum(entry.start, entry.last_write - entry.start,
+				&entry.checksum) < 0)
+		return;
+
+	offset = elog_events_end() +
+		 elog_state.index_next_slot * sizeof(entry);
+	elog_state.index_next_slot++;
+
+	if (rdev_writeat(&elog_state.nv_dev, &entry, offset, sizeof(entry)) !=
+	    sizeof(entry)) {
+		printk(BIOS_ERR, "ELOG: index write failed at 0x%zx\n",
+		       offset);
+		return;
+	}
+
+	elog_state.index_last_write = last_write;
+}
+
 /*
  * Scan the event area and validate each entry and update the ELOG state.
+ * Events covered by a valid index are not validated again.
  */
 static int elog_update_event_buffer_state(void)
 {
-	size_t offset = elog_events_start();
+	size_t offset = elog_scan_index();
 
 	elog_debug("elog_update_event_buffer_state()\n");
 
+	/* Skip the events already known to be valid. */
+	elog_tandem_increment_last_write(offset - elog_events_start());
+
 	/* Go through each event and validate it */
 	while (1) {
 		uint8_t type;
@@ -396,11 +630,18 @@ static int elog_update_event_buffer_state(void)
 		offset += len;
 	}
 
-	/* Ensure the remaining buffer is empty */
+	/*
+	 * Ensure the remaining buffer is empty. Appended data is committed by
+	 * writing its first byte last, so data after the end marker comes
+	 * from an interrupted write. Drop it and rewrite the area on the next
+	 * sync instead of discarding the committed events.
+	 */
 	if (!elog_is_buffer_clear(offset)) {
-		printk(BIOS_ERR, "ELOG: buffer not cleared from 0x%zx\n",
+		printk(BIOS_WARNING, "ELOG: uncommitted data at 0x%zx dropped\n",
 			offset);
-		return -1;
+		if (elog_fill_eol(offset) < 0)
+			return -1;
+		elog_nv_needs_possible_erase();
 	}
 
 	return 0;
@@ -483,15 +724,8 @@ static void elog_move_events_to_front(size_t offset, size_t size)
 	rdev_munmap(rdev, src);
 
 	/* Mark EOL for previously used buffer until the end. */
-	offset = start_offset + size;
-	size = region_device_sz(rdev) - offset;
-	dest = rdev_mmap(rdev, offset, size);
-	if (dest == NULL) {
+	if (elog_fill_eol(start_offset + size) < 0)
 		printk(BIOS_ERR, "ELOG: failure filling EOL!\n");
-		return;
-	}
-	memset(dest, ELOG_TYPE_EOL, size);
-	rdev_munmap(rdev, dest);
 }
 
 /* Perform the shrink and move events returning the size of bytes shrunk. */
@@ -690,7 +924,8 @@ static int elog_find_flash(void)
 	total_size = MIN(ELOG_SIZE, region_device_sz(rdev));
 	rdev_chain(rdev, rdev, 0, total_size);
 
-	elog_state.full_threshold = total_size - reserved_space;
+	elog_state.full_threshold = total_size - elog_index_size() -
+				    reserved_space;
 	elog_state.shrink_size = total_size * ELOG_SHRINK_PERCENTAGE / 100;
 
 	if (reserved_space > elog_state.shrink_size) {
@@ -716,12 +951,24 @@ static int elog_sync_to_nv(void)
 	if (erase_needed) {
 		elog_nv_erase();
 		elog_nv_reset_last_write();
+		elog_index_reset();
 	}
 
 	size = elog_nv_region_to_update(&offset);
 
-	elog_nv_write(offset, size);
+	/*
+	 * Write the first byte of appended data last. Until it is programmed
+	 * the data reads as ELOG_TYPE_EOL, so a write torn by a power loss is
+	 * seen as uncommitted by the next scan.
+	 */
+	if (offset && size > 1) {
+		elog_nv_write(offset + 1, size - 1);
+		elog_nv_write(offset, 1);
+	} else {
+		elog_nv_write(offset, size);
+	}
 	elog_nv_increment_last_write(size);
+	elog_index_update();
 
 	/*
 	 * If erase wasn't performed then don't rescan. Assume the appended
@@ -771,6 +1018,34 @@ static void elog_add_boot_count(void)
 	}
 }
 
+/*
+ * With ELOG_DEFER_SYNC ramstage batches events until the next flush point.
+ * Other stages and the SMI handler have no flush points and always sync.
+ */
+static bool elog_defer_sync(void)
+{
+	return CONFIG(ELOG_DEFER_SYNC) && ENV_RAMSTAGE &&
+		!elog_state.defer_done && !elog_state.flushing;
+}
+
+int elog_flush(void)
+{
+	int ret;
+
+	if (elog_state.elog_initialized != ELOG_INITIALIZED)
+		return -1;
+
+	/* Don't recurse when dying while writing the batch. */
+	if (elog_state.flushing)
+		return -1;
+
+	elog_state.flushing = true;
+	ret = elog_sync_to_nv();
+	elog_state.flushing = false;
+
+	return ret;
+}
+
 /*
  * Event log main entry point
  */
@@ -815,6 +1090,9 @@ int elog_init(void)
 		return -1;
 	}
 
+	/* Make sure the next scan can skip the events validated just now. */
+	elog_index_update();
+
 	printk(BIOS_INFO, "ELOG: area is %zu bytes, full threshold %d,"
 	       " shrink size %d\n", region_device_sz(&elog_state.nv_dev),
 	       elog_state.full_threshold, elog_state.shrink_size);
@@ -913,6 +1191,10 @@ int elog_add_event_raw(u8 event_type, void *data, u8 data_size)
 	if (elog_shrink() < 0)
 		return -1;
 
+	/* Leave the updates in the mirror until the next flush point. */
+	if (elog_defer_sync())
+		return 0;
+
 	/* Ensure the updates hit the non-volatile storage. */
 	return elog_sync_to_nv();
 }
@@ -960,3 +1242,19 @@ int elog_add_extended_event(u8 type, u32 complement)
 /* Make sure elog_init() runs at least once to log System Boot event. */
 static void elog_bs_init(void *unused) { elog_init(); }
 BOOT_STATE_INIT_ENTRY(BS_POST_DEVICE, BS_ON_ENTRY, elog_bs_init, NULL);
+
+#if CONFIG(ELOG_DEFER_SYNC)
+static void elog_bs_flush(void *unused) { elog_flush(); }
+
+/* Events after the last flush point are written out immediately. */
+static void elog_bs_flush_final(void *unused)
+{
+	elog_flush();
+	elog_state.defer_done = true;
+}
+
+BOOT_STATE_INIT_ENTRY(BS_POST_DEVICE, BS_ON_EXIT, elog_bs_flush, NULL);
+BOOT_STATE_INIT_ENTRY(BS_OS_RESUME, BS_ON_ENTRY, elog_bs_flush_final, NULL);
+BOOT_STATE_INIT_ENTRY(BS_PAYLOAD_BOOT, BS_ON_ENTRY, elog_bs_flush_final,
+		      NULL);
+#endif
@@ -28,6 +28,21 @@ struct elog_header {
 #define ELOG_MIN_AVAILABLE_ENTRIES	2  /* Shrink when this many can't fit */
 #define ELOG_SHRINK_PERCENTAGE		25 /* Percent of total area to remove */
 
+/*
+ * ELOG index entry. With ELOG_INDEX the end of the ELOG area holds an array
+ * of these, programmed in order after each sync to flash. Each entry covers
+ * the area from the end of the previous entry, or from the start of the
+ * area for the first one, to the end of the events known to be valid, with
+ * a CRC32 over that part. Erased entries read as 0xff.
+ */
+struct elog_index_entry {
+	u16 start;
+	u16 last_write;
+	u32 checksum;
+} __packed;
+
+#define ELOG_INDEX_ENTRIES		16
+
 /* SMBIOS event log header */
 struct event_header {
 	u8 type;
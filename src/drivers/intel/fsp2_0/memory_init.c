@@ -102,10 +102,42 @@ static void do_fsp_post_memory_init(bool s3wake, uint32_t fsp_version)
 	romstage_handoff_init(s3wake);
 }
 
-static void fsp_fill_mrc_cache(FSPM_ARCH_UPD *arch_upd, uint32_t fsp_version)
+#if CONFIG(FSP2_0_MRC_CACHE_COPY)
+static uint8_t mrc_cache_buf[CONFIG_MRC_SETTINGS_CACHE_SIZE]
+	__aligned(sizeof(uint64_t));
+
+static void *fsp_get_mrc_cache(uint32_t fsp_version, size_t *size)
+{
+	ssize_t data_size;
+
+	data_size = mrc_cache_load_current(MRC_TRAINING_DATA, fsp_version,
+					   mrc_cache_buf, sizeof(mrc_cache_buf));
+	if (data_size < 0)
+		return NULL;
+
+	*size = data_size;
+	return mrc_cache_buf;
+}
+#else
+static void *fsp_get_mrc_cache(uint32_t fsp_version, size_t *size)
 {
 	struct region_device rdev;
+
+	if (mrc_cache_get_current(MRC_TRAINING_DATA, fsp_version, &rdev) < 0)
+		return NULL;
+
+	/* Assume boot device is memory mapped. */
+	assert(CONFIG(BOOT_DEVICE_MEMORY_MAPPED));
+
+	*size = region_device_sz(&rdev);
+	return rdev_mmap_full(&rdev);
+}
+#endif
+
+static void fsp_fill_mrc_cache(FSPM_ARCH_UPD *arch_upd, uint32_t fsp_version)
+{
 	void *data;
+	size_t size;
 
 	arch_upd->NvsBufferPtr = NULL;
 
@@ -124,25 +156,19 @@ static void fsp_fill_mrc_cache(FSPM_ARCH_UPD *arch_upd, uint32_t fsp_version)
 			return;
 	}
 
-	if (mrc_cache_get_current(MRC_TRAINING_DATA, fsp_version, &rdev) < 0)
-		return;
-
-	/* Assume boot device is memory mapped. */
-	assert(CONFIG(BOOT_DEVICE_MEMORY_MAPPED));
-	data = rdev_mmap_full(&rdev);
+	data = fsp_get_mrc_cache(fsp_version, &size);
 
 	if (data == NULL)
 		return;
 
 	if (CONFIG(FSP2_0_USES_TPM_MRC_HASH) &&
-	    !mrc_cache_verify_hash(data, region_device_sz(&rdev)))
+	    !mrc_cache_verify_hash(data, size))
 		return;
 
 	/* MRC cache found */
 	arch_upd->NvsBufferPtr = data;
 
-	printk(BIOS_SPEW, "MRC cache found, size %zx\n",
-			region_device_sz(&rdev));
+	printk(BIOS_SPEW, "MRC cache found, size %zx\n", size);
 }
 
 static enum cb_err check_region_overlap(const struct memranges *ranges,
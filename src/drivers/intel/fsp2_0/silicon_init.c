@@ -109,10 +109,11 @@ void fsps_load(bool s3wake)
 	if (s3wake && !CONFIG(NO_STAGE_CACHE)) {
 		printk(BIOS_DEBUG, "Loading FSPS from stage_cache\n");
 		stage_cache_load_stage(STAGE_REFCODE, &fsps);
-		if (fsp_validate_component(hdr, prog_rdev(&fsps)) != CB_SUCCESS)
-			die("On resume fsps header is invalid\n");
-		load_done = 1;
-		return;
+		if (fsp_validate_component(hdr, prog_rdev(&fsps)) == CB_SUCCESS) {
+			load_done = 1;
+			return;
+		}
+		printk(BIOS_ERR, "FSPS stage cache invalid, loading from CBFS\n");
 	}
 
 	if (cbfs_boot_locate(&file_desc, name, NULL)) {
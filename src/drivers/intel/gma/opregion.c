@@ -361,5 +361,21 @@ intel_gma_init_igd_opregion(igd_opregion_t *opregion)
 	/* Write ASLS PCI register and prepare SWSCI register. */
 	intel_gma_opregion_register((uintptr_t)opregion);
 
+	acpi_table_cache_record(ACPI_CACHE_TAG_IGD_OPREGION, (uintptr_t)opregion);
+
 	return CB_SUCCESS;
 }
+
+/*
+ * The OpRegion is part of ACPI tables restored from the table cache, but the
+ * Ext VBT in cbmem and the IGD registers still have to be set up again.
+ */
+void intel_gma_restore_cached_opregion(void)
+{
+	uint64_t opregion;
+
+	if (acpi_table_cache_lookup(ACPI_CACHE_TAG_IGD_OPREGION, &opregion))
+		return;
+
+	intel_gma_init_igd_opregion((igd_opregion_t *)(uintptr_t)opregion);
+}
@@ -241,6 +241,14 @@ static int mrc_data_valid(const struct region_device *rdev,
 	return 0;
 }
 
+static int mrc_cache_file_init(struct region_file *cache_file,
+				const struct region_device *rdev)
+{
+	if (CONFIG(MRC_SETTINGS_CACHE_BANKED))
+		return region_file_init_banked(cache_file, rdev);
+	return region_file_init(cache_file, rdev);
+}
+
 static int mrc_cache_latest(const char *name,
 				const struct region_device *backing_rdev,
 				struct mrc_metadata *md,
@@ -249,7 +257,7 @@ static int mrc_cache_latest(const char *name,
 				bool fail_bad_data)
 {
 	/* Init and obtain a handle to the file data. */
-	if (region_file_init(cache_file, backing_rdev) < 0) {
+	if (mrc_cache_file_init(cache_file, backing_rdev) < 0) {
 		printk(BIOS_ERR, "MRC: region file invalid in '%s'\n", name);
 		return -1;
 	}
@@ -265,48 +273,64 @@ static int mrc_cache_latest(const char *name,
 	}
 
 	/* Validate header and resize region to reflect actual usage on the
-	 * saved medium (including metadata and data). */
+	 * saved medium (including metadata and data). The data itself is
+	 * left for the caller to validate, so it's only read once. */
 	if (mrc_header_valid(rdev, md) < 0) {
 		printk(BIOS_ERR, "MRC: invalid header in '%s'\n", name);
 		return fail_bad_data ? -1 : 0;
 	}
 
-	/* Validate Data */
-	if (mrc_data_valid(rdev, md) < 0) {
-		printk(BIOS_ERR, "MRC: invalid data in '%s'\n", name);
-		return fail_bad_data ? -1 : 0;
-	}
-
 	return 0;
 }
 
-int mrc_cache_get_current(int type, uint32_t version,
-				struct region_device *rdev)
+/* Locate the latest data with a valid header matching the version. */
+static const struct cache_region *mrc_cache_find_current(int type,
+				uint32_t version, struct region_device *rdev,
+				struct mrc_metadata *md)
 {
 	const struct cache_region *cr;
 	struct region region;
 	struct region_device read_rdev;
 	struct region_file cache_file;
-	struct mrc_metadata md;
-	size_t data_size;
-	const size_t md_size = sizeof(md);
 	const bool fail_bad_data = true;
 
 	cr = lookup_region(&region, type);
 
 	if (cr == NULL)
-		return -1;
+		return NULL;
 
 	if (boot_device_ro_subregion(&region, &read_rdev) < 0)
-		return -1;
+		return NULL;
 
-	if (mrc_cache_latest(cr->name, &read_rdev, &md, &cache_file, rdev,
+	if (mrc_cache_latest(cr->name, &read_rdev, md, &cache_file, rdev,
 		fail_bad_data) < 0)
-		return -1;
+		return NULL;
 
-	if (version != md.version) {
+	if (version != md->version) {
 		printk(BIOS_INFO, "MRC: version mismatch: %x vs %x\n",
-			md.version, version);
+			md->version, version);
+		return NULL;
+	}
+
+	return cr;
+}
+
+int mrc_cache_get_current(int type, uint32_t version,
+				struct region_device *rdev)
+{
+	const struct cache_region *cr;
+	struct mrc_metadata md;
+	size_t data_size;
+	const size_t md_size = sizeof(md);
+
+	cr = mrc_cache_find_current(type, version, rdev, &md);
+
+	if (cr == NULL)
+		return -1;
+
+	/* Validate Data */
+	if (mrc_data_valid(rdev, &md) < 0) {
+		printk(BIOS_ERR, "MRC: invalid data in '%s'\n", cr->name);
 		return -1;
 	}
 
@@ -315,6 +339,47 @@ int mrc_cache_get_current(int type, uint32_t version,
 	return rdev_chain(rdev, rdev, md_size, data_size);
 }
 
+ssize_t mrc_cache_load_current(int type, uint32_t version, void *buffer,
+				size_t buffer_size)
+{
+	const struct cache_region *cr;
+	struct region_device rdev;
+	struct mrc_metadata md;
+	uint16_t checksum;
+	const size_t md_size = sizeof(md);
+	size_t data_size;
+
+	cr = mrc_cache_find_current(type, version, &rdev, &md);
+
+	if (cr == NULL)
+		return -1;
+
+	data_size = md.data_size;
+
+	if (data_size > buffer_size) {
+		printk(BIOS_ERR, "MRC: '%s' data too large: %zx vs %zx\n",
+			cr->name, data_size, buffer_size);
+		return -1;
+	}
+
+	/* Read the data once and validate the copy. */
+	if (rdev_readat(&rdev, buffer, md_size, data_size) != data_size) {
+		printk(BIOS_ERR, "MRC: couldn't read data in '%s'\n",
+			cr->name);
+		return -1;
+	}
+
+	checksum = compute_ip_checksum(buffer, data_size);
+
+	if (md.data_checksum != checksum) {
+		printk(BIOS_ERR, "MRC: data checksum mismatch: %x vs %x\n",
+			md.data_checksum, checksum);
+		return -1;
+	}
+
+	return data_size;
+}
+
 static bool mrc_cache_needs_update(const struct region_device *rdev,
 				const struct cbmem_entry *to_be_updated)
 {
@@ -409,6 +474,10 @@ static void update_mrc_cache_by_type(int type)
 
 	if (!mrc_cache_needs_update(&latest_rdev, to_be_updated)) {
 		log_event_cache_update(cr->elog_slot, ALREADY_UPTODATE);
+		/* Nothing to write, so prepare the next bank switch now. */
+		if (region_file_erase_ahead(&cache_file) < 0)
+			printk(BIOS_ERR, "MRC: erase ahead failed for '%s'.\n",
+				cr->name);
 		return;
 	}
 
@@ -530,7 +599,7 @@ static void invalidate_normal_cache(void)
 		return;
 	}
 
-	if (region_file_init(&cache_file, &rdev) < 0) {
+	if (mrc_cache_file_init(&cache_file, &rdev) < 0) {
 		printk(BIOS_ERR, "MRC: region file invalid for '%s'. Invalidation failed\n",
 			name);
 		return;
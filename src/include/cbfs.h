@@ -30,6 +30,11 @@ void *cbfs_boot_map_optionrom(uint16_t vendor, uint16_t device);
 void *cbfs_boot_load_stage_by_name(const char *name);
 /* Locate file by name and optional type. Return 0 on success. < 0 on error. */
 int cbfs_boot_locate(struct cbfsf *fh, const char *name, uint32_t *type);
+/* Like cbfs_boot_locate(), but with measured boot the file is measured from
+ * the data read to load it. The caller must complete the measurement with
+ * vboot_measure_cbfs_flush() before using the data. */
+int cbfs_boot_locate_deferred(struct cbfsf *fh, const char *name,
+			      uint32_t *type);
 /* Map file into memory leaking the mapping. Only should be used when
  * leaking mappings are a no-op. Returns NULL on error, else returns
  * the mapping and sets the size of the file. */
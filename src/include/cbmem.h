@@ -119,6 +119,12 @@ void cbmem_add_bootmem(void);
 void cbmem_get_region(void **baseptr, size_t *size);
 void cbmem_list(void);
 void cbmem_add_records_to_cbtable(struct lb_header *header);
+/*
+ * Call walker for every cbmem entry. Entries of each size tier are visited in
+ * the order they were added. Returns < 0 on error.
+ */
+int cbmem_walk(void (*walker)(u32 id, void *start, u64 size, void *arg),
+		void *arg);
 
 #if ENV_RAMSTAGE
 #define ROMSTAGE_CBMEM_INIT_HOOK(init_fn_) __attribute__((unused)) \
@@ -49,6 +49,8 @@ void northbridge_write_smram(u8 smram);
 
 void smm_lock(void);
 void smm_relocate(void);
+/* Returns 1 if the APs can be relocated in parallel, see struct mp_ops. */
+int smm_relocation_parallel(void);
 
 /* The initialization of the southbridge is split into 2 components. One is
  * for clearing the state in the SMM registers. The other is for enabling
@@ -79,6 +79,18 @@ struct mp_ops {
 	 * not provided, smm_initiate_relocation() is used.
 	 */
 	void (*per_cpu_smm_trigger)(void);
+	/*
+	 * Optionally report whether all CPUs can go through the relocation
+	 * handler at the same time, e.g. because the new SMBASE is written
+	 * to an MSR rather than to the save state all CPUs share at the
+	 * default SMBASE. It is called after pre_mp_smm_init(). If it returns
+	 * non-zero, all APs call smm_initiate_relocation_parallel() at once
+	 * instead of per_cpu_smm_trigger(), and the BSP is relocated after
+	 * all of them. Anything the relocation handler needs to set up on
+	 * the BSP before the APs, like the STM, has to be done from
+	 * pre_mp_smm_init().
+	 */
+	int (*smm_relocation_parallel)(void);
 	/*
 	 * This function is called while each CPU is in the SMM relocation
 	 * handler. Its primary purpose is to adjust the SMBASE for the
@@ -109,10 +121,11 @@ struct mp_ops {
  * 6. adjust_smm_params(is_perm = 0)
  * 7. adjust_smm_params(is_perm = 1)
  * 8. pre_mp_smm_init()
- * 9. per_cpu_smm_trigger() in parallel for all cpus which calls
- *    relocation_handler() in SMM.
- * 10. mp_initialize_cpu() for each cpu
- * 11. post_mp_init()
+ * 9. smm_relocation_parallel()
+ * 10. per_cpu_smm_trigger() in parallel for all cpus which calls
+ *     relocation_handler() in SMM.
+ * 11. mp_initialize_cpu() for each cpu
+ * 12. post_mp_init()
  */
 int mp_init_with_smm(struct bus *cpu_bus, const struct mp_ops *mp_ops);
 
@@ -225,6 +225,8 @@ extern int elog_add_event_dword(u8 event_type, u32 data);
 extern int elog_add_event_wake(u8 source, u32 instance);
 extern int elog_smbios_write_type15(unsigned long *current, int handle);
 extern int elog_add_extended_event(u8 type, u32 complement);
+/* Write out events held back by ELOG_DEFER_SYNC. */
+extern int elog_flush(void);
 #else
 /* Stubs to help avoid littering sources with #if CONFIG_ELOG */
 static inline int elog_init(void) { return -1; }
@@ -241,6 +243,7 @@ static inline int elog_smbios_write_type15(unsigned long *current,
 	return 0;
 }
 static inline int elog_add_extended_event(u8 type, u32 complement) { return 0; }
+static inline int elog_flush(void) { return 0; }
 #endif
 
 #if CONFIG(ELOG_GSMI)
@@ -41,4 +41,12 @@ int mrc_cache_get_current(int type, uint32_t version,
 int mrc_cache_stash_data(int type, uint32_t version, const void *data,
 			size_t size);
 
+/*
+ * Copy the current data of the provided type into a buffer, validating the
+ * copy rather than the data in the boot device, so the data is only read
+ * once. Returns the size of the data on success, < 0 on error.
+ */
+ssize_t mrc_cache_load_current(int type, uint32_t version, void *buffer,
+				size_t buffer_size);
+
 #endif /* _COMMON_MRC_CACHE_H_ */
@@ -144,6 +144,10 @@ static inline void prog_set_arg(struct prog *prog, void *arg)
 
 /* Locate the identified program to run. Return 0 on success. < 0 on error. */
 int prog_locate(struct prog *prog);
+/* Like prog_locate(), but with measured boot the program is measured from the
+ * data read while loading it. Only for programs started through prog_run(),
+ * which completes the measurement. */
+int prog_locate_deferred(struct prog *prog);
 /* The prog_locate_hook() is called prior to CBFS traversal. The hook can be
  * used to implement policy that allows or prohibits further progress through
  * prog_locate(). The type and name field within struct prog are the only valid
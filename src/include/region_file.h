@@ -37,6 +37,24 @@ struct region_file;
  */
 int region_file_init(struct region_file *f, const struct region_device *p);
 
+/*
+ * Initialize a region file that is split into two banks. When the active
+ * bank is full the next update goes to the other bank, which leaves the
+ * latest data intact until the update completed. The inactive bank can be
+ * erased ahead of time with region_file_erase_ahead() so that switching
+ * banks doesn't erase inline. The on-media layout differs from the one
+ * used by region_file_init(). Each half of the region needs to be aligned
+ * to the erase block size. Returns < 0 on error, 0 on success.
+ */
+int region_file_init_banked(struct region_file *f,
+				const struct region_device *p);
+
+/*
+ * Erase the inactive bank of a banked region file if it isn't known to be
+ * erased already. Returns < 0 on error, 0 on success.
+ */
+int region_file_erase_ahead(struct region_file *f);
+
 /*
  * Initialize region device object associated with latest update of file data.
  * Returns < 0 on error, 0 on success.
@@ -47,6 +65,20 @@ int region_file_data(const struct region_file *f, struct region_device *rdev);
 int region_file_update_data(struct region_file *f, const void *buf,
 				size_t size);
 
+/* A piece of data to be written as part of a single region file update. */
+struct update_region_file_entry {
+	size_t size;
+	const void *data;
+};
+
+/*
+ * Update region file with the concatenation of the provided entries as the
+ * latest data. Returns < 0 on error, 0 on success.
+ */
+int region_file_update_data_arr(struct region_file *f,
+				const struct update_region_file_entry *entries,
+				size_t num_entries);
+
 /* Declared here for easy object allocation. */
 struct region_file {
 	/* Region device covering file */
@@ -57,6 +89,18 @@ struct region_file {
 	uint16_t data_blocks[2];
 	/* Current slot in metadata marking end of data. */
 	int slot;
+	/* Region device covering both banks of a banked file. */
+	struct region_device parent;
+	/* Generation of the active bank. */
+	uint32_t generation;
+	/* Set for files initialized with region_file_init_banked(). */
+	uint8_t banked;
+	/* Active bank. */
+	uint8_t bank;
+	/* Inactive bank is known to be erased. */
+	uint8_t other_bank_clean;
+	/* Active bank header still has to be written. */
+	uint8_t commit_pending;
 };
 
 #endif /* REGION_FILE_H */
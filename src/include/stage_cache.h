@@ -59,6 +59,23 @@ struct stage_cache {
 	uint64_t load_addr;
 	uint64_t entry_addr;
 	uint64_t arg;
+	uint64_t checksum;	/* Over the uncompressed stage, or 0 */
+	uint32_t size;		/* Uncompressed size */
+	uint32_t compression;	/* CBFS_COMPRESS_NONE or CBFS_COMPRESS_LZ4 */
 };
 
+/*
+ * Helpers shared by the stage cache backends. stage_cache_pack_size() fills
+ * in the metadata for the stage and returns how many bytes the cache entry
+ * needs, stage_cache_pack() then stores the stage in an entry of that size.
+ * stage_cache_unpack() restores the stage to its load address and returns
+ * non-zero if it can't be decompressed or, with STAGE_CACHE_CHECKSUM,
+ * doesn't match the checksum.
+ */
+size_t stage_cache_pack_size(const struct prog *stage, struct stage_cache *meta);
+int stage_cache_pack(void *dst, size_t packed_size, const struct prog *stage,
+		     const struct stage_cache *meta);
+int stage_cache_unpack(const void *src, size_t src_size,
+		       const struct stage_cache *meta);
+
 #endif /* _STAGE_CACHE_H_ */
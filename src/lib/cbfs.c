@@ -37,7 +37,8 @@
 #define DEBUG(x...)
 #endif
 
-int cbfs_boot_locate(struct cbfsf *fh, const char *name, uint32_t *type)
+static int cbfs_boot_locate_file(struct cbfsf *fh, const char *name,
+				 uint32_t *type)
 {
 	struct region_device rdev;
 
@@ -61,6 +62,13 @@ int cbfs_boot_locate(struct cbfsf *fh, const char *name, uint32_t *type)
 		ret = cbfs_locate_file_in_region(fh, "COREBOOT", name, type);
 	}
 
+	return ret;
+}
+
+int cbfs_boot_locate(struct cbfsf *fh, const char *name, uint32_t *type)
+{
+	int ret = cbfs_boot_locate_file(fh, name, type);
+
 	if (!ret)
 		if (vboot_measure_cbfs_hook(fh, name))
 			return -1;
@@ -68,12 +76,25 @@ int cbfs_boot_locate(struct cbfsf *fh, const char *name, uint32_t *type)
 	return ret;
 }
 
+int cbfs_boot_locate_deferred(struct cbfsf *fh, const char *name,
+			      uint32_t *type)
+{
+	int ret = cbfs_boot_locate_file(fh, name, type);
+
+	if (!ret)
+		if (vboot_measure_cbfs_defer(fh, name))
+			return -1;
+
+	return ret;
+}
+
 void *cbfs_boot_map_with_leak(const char *name, uint32_t type, size_t *size)
 {
 	struct cbfsf fh;
 	size_t fsize;
+	void *map;
 
-	if (cbfs_boot_locate(&fh, name, &type))
+	if (cbfs_boot_locate_deferred(&fh, name, &type))
 		return NULL;
 
 	fsize = region_device_sz(&fh.data);
@@ -81,7 +102,14 @@ void *cbfs_boot_map_with_leak(const char *name, uint32_t type, size_t *size)
 	if (size != NULL)
 		*size = fsize;
 
-	return rdev_mmap(&fh.data, 0, fsize);
+	map = rdev_mmap(&fh.data, 0, fsize);
+	if (map)
+		vboot_measure_cbfs_data(&fh.data, map, 0, fsize);
+
+	if (vboot_measure_cbfs_flush())
+		return NULL;
+
+	return map;
 }
 
 int cbfs_locate_file_in_region(struct cbfsf *fh, const char *region_name,
@@ -109,6 +137,7 @@ size_t cbfs_load_and_decompress(const struct region_device *rdev, size_t offset,
 			return 0;
 		if (rdev_readat(rdev, buffer, offset, in_size) != in_size)
 			return 0;
+		vboot_measure_cbfs_data(rdev, buffer, offset, in_size);
 		return in_size;
 
 	case CBFS_COMPRESS_LZ4:
@@ -123,6 +152,7 @@ size_t cbfs_load_and_decompress(const struct region_device *rdev, size_t offset,
 		void *compr_start = buffer + buffer_size - in_size;
 		if (rdev_readat(rdev, compr_start, offset, in_size) != in_size)
 			return 0;
+		vboot_measure_cbfs_data(rdev, compr_start, offset, in_size);
 
 		timestamp_add_now(TS_START_ULZ4F);
 		out_size = ulz4fn(compr_start, in_size, buffer, buffer_size);
@@ -141,6 +171,7 @@ size_t cbfs_load_and_decompress(const struct region_device *rdev, size_t offset,
 		void *map = rdev_mmap(rdev, offset, in_size);
 		if (map == NULL)
 			return 0;
+		vboot_measure_cbfs_data(rdev, map, offset, in_size);
 
 		/* Note: timestamp not useful for memory-mapped media (x86) */
 		timestamp_add_now(TS_START_ULZMA);
@@ -185,7 +216,7 @@ void *cbfs_boot_load_stage_by_name(const char *name)
 	struct prog stage = PROG_INIT(PROG_UNKNOWN, name);
 	uint32_t type = CBFS_TYPE_STAGE;
 
-	if (cbfs_boot_locate(&fh, name, &type))
+	if (cbfs_boot_locate_deferred(&fh, name, &type))
 		return NULL;
 
 	/* Chain data portion in the prog. */
@@ -194,6 +225,10 @@ void *cbfs_boot_load_stage_by_name(const char *name)
 	if (cbfs_prog_stage_load(&stage))
 		return NULL;
 
+	/* The caller jumps to the entry point without prog_run(). */
+	if (vboot_measure_cbfs_flush())
+		return NULL;
+
 	return prog_entry(&stage);
 }
 
@@ -203,18 +238,27 @@ size_t cbfs_boot_load_file(const char *name, void *buf, size_t buf_size,
 	struct cbfsf fh;
 	uint32_t compression_algo;
 	size_t decompressed_size;
+	size_t out_size;
 
-	if (cbfs_boot_locate(&fh, name, &type) < 0)
+	if (cbfs_boot_locate_deferred(&fh, name, &type) < 0)
 		return 0;
 
 	if (cbfsf_decompression_info(&fh, &compression_algo,
 				     &decompressed_size)
 		    < 0
 	    || decompressed_size > buf_size)
+		out_size = 0;
+	else
+		out_size = cbfs_load_and_decompress(&fh.data, 0,
+						    region_device_sz(&fh.data),
+						    buf, buf_size,
+						    compression_algo);
+
+	/* Measure even if loading failed, the file was located. */
+	if (vboot_measure_cbfs_flush())
 		return 0;
 
-	return cbfs_load_and_decompress(&fh.data, 0, region_device_sz(&fh.data),
-					buf, buf_size, compression_algo);
+	return out_size;
 }
 
 size_t cbfs_prog_stage_section(struct prog *pstage, uintptr_t *base)
@@ -241,6 +285,8 @@ int cbfs_prog_stage_load(struct prog *pstage)
 	if (rdev_readat(fh, &stage, 0, sizeof(stage)) != sizeof(stage))
 		return -1;
 
+	vboot_measure_cbfs_data(fh, &stage, 0, sizeof(stage));
+
 	fsize = region_device_sz(fh);
 	fsize -= sizeof(stage);
 	foffset = 0;
@@ -258,6 +304,8 @@ int cbfs_prog_stage_load(struct prog *pstage)
 	if ((ENV_BOOTBLOCK || ENV_VERSTAGE) && !CONFIG(NO_XIP_EARLY_STAGES) &&
 		CONFIG(BOOT_DEVICE_MEMORY_MAPPED)) {
 		void *mapping = rdev_mmap(fh, foffset, fsize);
+		if (mapping)
+			vboot_measure_cbfs_data(fh, mapping, foffset, fsize);
 		rdev_munmap(fh, mapping);
 		if (mapping == load)
 			goto out;
@@ -21,27 +21,34 @@
 /* Stage cache uses cbmem. */
 void stage_cache_add(int stage_id, const struct prog *stage)
 {
-	struct stage_cache *meta;
-	void *c;
+	const struct cbmem_entry *e;
+	struct stage_cache meta;
+	struct stage_cache *m;
+	size_t size;
 
-	meta = cbmem_add(CBMEM_ID_STAGEx_META + stage_id, sizeof(*meta));
-	if (meta == NULL) {
-		printk(BIOS_ERR, "Error: Can't add %x metadata to cbmem\n",
-				CBMEM_ID_STAGEx_META + stage_id);
+	size = stage_cache_pack_size(stage, &meta);
+
+	e = cbmem_entry_add(CBMEM_ID_STAGEx_CACHE + stage_id, size);
+	if (e == NULL || cbmem_entry_size(e) < size) {
+		printk(BIOS_ERR, "Error: Can't add stage_cache %x to cbmem\n",
+				CBMEM_ID_STAGEx_CACHE + stage_id);
 		return;
 	}
-	meta->load_addr = (uintptr_t)prog_start(stage);
-	meta->entry_addr = (uintptr_t)prog_entry(stage);
-	meta->arg = (uintptr_t)prog_entry_arg(stage);
 
-	c = cbmem_add(CBMEM_ID_STAGEx_CACHE + stage_id, prog_size(stage));
-	if (c == NULL) {
-		printk(BIOS_ERR, "Error: Can't add stage_cache %x to cbmem\n",
+	if (stage_cache_pack(cbmem_entry_start(e), size, stage, &meta)) {
+		printk(BIOS_ERR, "Error: Can't pack stage_cache %x\n",
 				CBMEM_ID_STAGEx_CACHE + stage_id);
 		return;
 	}
 
-	memcpy(c, prog_start(stage), prog_size(stage));
+	m = cbmem_add(CBMEM_ID_STAGEx_META + stage_id, sizeof(*m));
+	if (m == NULL) {
+		printk(BIOS_ERR, "Error: Can't add %x metadata to cbmem\n",
+				CBMEM_ID_STAGEx_META + stage_id);
+		return;
+	}
+
+	memcpy(m, &meta, sizeof(*m));
 }
 
 void stage_cache_add_raw(int stage_id, const void *base, const size_t size)
@@ -79,7 +86,6 @@ void stage_cache_load_stage(int stage_id, struct prog *stage)
 	const struct cbmem_entry *e;
 	void *c;
 	size_t size;
-	void *load_addr;
 
 	prog_set_entry(stage, NULL, NULL);
 
@@ -100,11 +106,14 @@ void stage_cache_load_stage(int stage_id, struct prog *stage)
 
 	c = cbmem_entry_start(e);
 	size = cbmem_entry_size(e);
-	load_addr = (void *)(uintptr_t)meta->load_addr;
 
-	memcpy(load_addr, c, size);
+	if (stage_cache_unpack(c, size, meta)) {
+		printk(BIOS_ERR, "Error: stage_cache %x is corrupted\n",
+				CBMEM_ID_STAGEx_CACHE + stage_id);
+		return;
+	}
 
-	prog_set_area(stage, load_addr, size);
+	prog_set_area(stage, (void *)(uintptr_t)meta->load_addr, meta->size);
 	prog_set_entry(stage, (void *)(uintptr_t)meta->entry_addr,
 			(void *)(uintptr_t)meta->arg);
 }
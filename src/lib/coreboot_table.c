@@ -315,6 +315,22 @@ static void lb_mmc_info(struct lb_header *header)
 	rec->early_cmd1_status = *ms_cbmem;
 }
 
+/* Add a pointer record for one CBMEM entry, if the entry exists. */
+static void add_cbmem_pointer(struct lb_header *header, uint32_t tag,
+				uint32_t cbmem_id)
+{
+	struct lb_cbmem_ref *cbmem_ref;
+	void *cbmem_addr = cbmem_find(cbmem_id);
+
+	if (!cbmem_addr)
+		return;
+
+	cbmem_ref = (struct lb_cbmem_ref *)lb_new_record(header);
+	cbmem_ref->tag = tag;
+	cbmem_ref->size = sizeof(*cbmem_ref);
+	cbmem_ref->cbmem_addr = (unsigned long)cbmem_addr;
+}
+
 static void add_cbmem_pointers(struct lb_header *header)
 {
 	/*
@@ -336,23 +352,9 @@ static void add_cbmem_pointers(struct lb_header *header)
 	};
 	int i;
 
-	for (i = 0; i < ARRAY_SIZE(section_ids); i++) {
-		const struct section_id *sid = section_ids + i;
-		struct lb_cbmem_ref *cbmem_ref;
-		void *cbmem_addr = cbmem_find(sid->cbmem_id);
-
-		if (!cbmem_addr)
-			continue;  /* This section is not present */
-
-		cbmem_ref = (struct lb_cbmem_ref *)lb_new_record(header);
-		if (!cbmem_ref) {
-			printk(BIOS_ERR, "No more room in coreboot table!\n");
-			break;
-		}
-		cbmem_ref->tag = sid->table_tag;
-		cbmem_ref->size = sizeof(*cbmem_ref);
-		cbmem_ref->cbmem_addr = (unsigned long)cbmem_addr;
-	}
+	for (i = 0; i < ARRAY_SIZE(section_ids); i++)
+		add_cbmem_pointer(header, section_ids[i].table_tag,
+				  section_ids[i].cbmem_id);
 }
 
 static struct lb_mainboard *lb_mainboard(struct lb_header *header)
@@ -485,7 +487,8 @@ size_t write_coreboot_forwarding_table(uintptr_t entry, uintptr_t target)
 	return (uintptr_t)lb_table_fini(head) - entry;
 }
 
-static uintptr_t write_coreboot_table(uintptr_t rom_table_end)
+static uintptr_t write_coreboot_table(uintptr_t rom_table_end,
+					size_t max_size)
 {
 	struct lb_header *head;
 
@@ -496,18 +499,22 @@ static uintptr_t write_coreboot_table(uintptr_t rom_table_end)
 
 #if CONFIG(USE_OPTION_TABLE)
 	{
-		struct cmos_option_table *option_table =
-			cbfs_boot_map_with_leak("cmos_layout.bin",
-				CBFS_COMPONENT_CMOS_LAYOUT, NULL);
-		if (option_table) {
-			struct lb_record *rec_dest = lb_new_record(head);
-			/* Copy the option config table, it's already a
-			 * lb_record...
-			 */
-			memcpy(rec_dest,  option_table, option_table->size);
+		/*
+		 * The option config table is already a lb_record, so load it
+		 * straight into the table. Mapping it first would go through
+		 * a heap copy on boot media that isn't memory mapped. If it
+		 * can't be loaded the record stays an LB_TAG_UNUSED one.
+		 */
+		struct lb_record *rec_dest = lb_new_record(head);
+		size_t room = rom_table_end + max_size - (uintptr_t)rec_dest;
+
+		if (cbfs_boot_load_file("cmos_layout.bin", rec_dest, room,
+					CBFS_COMPONENT_CMOS_LAYOUT)) {
 			/* Create CMOS checksum entry in coreboot table */
 			lb_cmos_checksum(head);
 		} else {
+			rec_dest->tag = LB_TAG_UNUSED;
+			rec_dest->size = sizeof(*rec_dest);
 			printk(BIOS_ERR,
 				"cmos_layout.bin could not be found!\n");
 		}
@@ -593,7 +600,7 @@ void *write_tables(void)
 	arch_write_tables(cbtable_start);
 
 	/* Write the coreboot table. */
-	cbtable_end = write_coreboot_table(cbtable_start);
+	cbtable_end = write_coreboot_table(cbtable_start, max_table_size);
 	cbtable_size = cbtable_end - cbtable_start;
 
 	if (cbtable_size > max_table_size) {
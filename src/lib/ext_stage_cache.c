@@ -55,36 +55,36 @@ void stage_cache_add(int stage_id, const struct prog *stage)
 {
 	struct imd *imd;
 	const struct imd_entry *e;
-	struct stage_cache *meta;
-	void *c;
+	struct stage_cache meta;
+	size_t size;
 
 	imd = &imd_stage_cache;
-	e = imd_entry_add(imd, CBMEM_ID_STAGEx_META + stage_id, sizeof(*meta));
+	size = stage_cache_pack_size(stage, &meta);
 
-	if (e == NULL) {
-		printk(BIOS_DEBUG, "Error: Can't add %x metadata to imd\n",
-				CBMEM_ID_STAGEx_META + stage_id);
+	e = imd_entry_find_or_add(imd, CBMEM_ID_STAGEx_CACHE + stage_id, size);
+
+	if (e == NULL || imd_entry_size(imd, e) < size) {
+		printk(BIOS_DEBUG, "Error: Can't add stage_cache %x to imd\n",
+				CBMEM_ID_STAGEx_CACHE + stage_id);
 		return;
 	}
 
-	meta = imd_entry_at(imd, e);
-
-	meta->load_addr = (uintptr_t)prog_start(stage);
-	meta->entry_addr = (uintptr_t)prog_entry(stage);
-	meta->arg = (uintptr_t)prog_entry_arg(stage);
+	if (stage_cache_pack(imd_entry_at(imd, e), size, stage, &meta)) {
+		printk(BIOS_DEBUG, "Error: Can't pack stage_cache %x\n",
+				CBMEM_ID_STAGEx_CACHE + stage_id);
+		return;
+	}
 
-	e = imd_entry_add(imd, CBMEM_ID_STAGEx_CACHE + stage_id,
-				prog_size(stage));
+	e = imd_entry_find_or_add(imd, CBMEM_ID_STAGEx_META + stage_id,
+				sizeof(meta));
 
 	if (e == NULL) {
-		printk(BIOS_DEBUG, "Error: Can't add stage_cache %x to imd\n",
-				CBMEM_ID_STAGEx_CACHE + stage_id);
+		printk(BIOS_DEBUG, "Error: Can't add %x metadata to imd\n",
+				CBMEM_ID_STAGEx_META + stage_id);
 		return;
 	}
 
-	c = imd_entry_at(imd, e);
-
-	memcpy(c, prog_start(stage), prog_size(stage));
+	memcpy(imd_entry_at(imd, e), &meta, sizeof(meta));
 }
 
 void stage_cache_add_raw(int stage_id, const void *base, const size_t size)
@@ -157,9 +157,13 @@ void stage_cache_load_stage(int stage_id, struct prog *stage)
 	c = imd_entry_at(imd, e);
 	size = imd_entry_size(imd, e);
 
-	memcpy((void *)(uintptr_t)meta->load_addr, c, size);
+	if (stage_cache_unpack(c, size, meta)) {
+		printk(BIOS_DEBUG, "Error: stage_cache %x is corrupted\n",
+				CBMEM_ID_STAGEx_CACHE + stage_id);
+		return;
+	}
 
-	prog_set_area(stage, (void *)(uintptr_t)meta->load_addr, size);
+	prog_set_area(stage, (void *)(uintptr_t)meta->load_addr, meta->size);
 	prog_set_entry(stage, (void *)(uintptr_t)meta->entry_addr,
 			(void *)(uintptr_t)meta->arg);
 }
@@ -259,3 +259,31 @@ void cbmem_add_records_to_cbtable(struct lb_header *header)
 		lbe->id = id;
 	}
 }
+
+int cbmem_walk(void (*walker)(u32 id, void *start, u64 size, void *arg),
+		void *arg)
+{
+	struct imd_cursor cursor;
+
+	if (imd_cursor_init(&imd, &cursor))
+		return -1;
+
+	while (1) {
+		const struct imd_entry *e;
+		uint32_t id;
+
+		e = imd_cursor_next(&cursor);
+
+		if (e == NULL)
+			break;
+
+		id = imd_entry_id(&imd, e);
+		/* Skip metadata entries. */
+		if (id == CBMEM_ID_IMD_ROOT || id == CBMEM_ID_IMD_SMALL)
+			continue;
+
+		walker(id, imd_entry_at(&imd, e), imd_entry_size(&imd, e), arg);
+	}
+
+	return 0;
+}
@@ -36,14 +36,19 @@
 const struct mem_region_device addrspace_32bit =
 	MEM_REGION_DEV_RO_INIT(0, ~0UL);
 
-int prog_locate(struct prog *prog)
+static int __prog_locate(struct prog *prog, bool defer_measure)
 {
 	struct cbfsf file;
+	int ret;
 
 	if (prog_locate_hook(prog))
 		return -1;
 
-	if (cbfs_boot_locate(&file, prog_name(prog), NULL))
+	if (defer_measure)
+		ret = cbfs_boot_locate_deferred(&file, prog_name(prog), NULL);
+	else
+		ret = cbfs_boot_locate(&file, prog_name(prog), NULL);
+	if (ret)
 		return -1;
 
 	cbfsf_file_type(&file, &prog->cbfs_type);
@@ -53,6 +58,16 @@ int prog_locate(struct prog *prog)
 	return 0;
 }
 
+int prog_locate(struct prog *prog)
+{
+	return __prog_locate(prog, false);
+}
+
+int prog_locate_deferred(struct prog *prog)
+{
+	return __prog_locate(prog, true);
+}
+
 void run_romstage(void)
 {
 	struct prog romstage =
@@ -104,7 +119,10 @@ static void run_ramstage_from_resume(struct prog *ramstage)
 	}
 
 	printk(BIOS_ERR, "ramstage cache invalid.\n");
-	board_reset();
+
+	/* A relocatable ramstage reloads into the same reserved CBMEM area. */
+	if (!CONFIG(RELOCATABLE_RAMSTAGE))
+		board_reset();
 }
 
 static int load_relocatable_ramstage(struct prog *ramstage)
@@ -139,7 +157,7 @@ void run_ramstage(void)
 
 	vboot_run_logic();
 
-	if (prog_locate(&ramstage))
+	if (prog_locate_deferred(&ramstage))
 		goto fail;
 
 	timestamp_add_now(TS_START_COPYRAM);
@@ -180,7 +198,7 @@ void payload_load(void)
 
 	timestamp_add_now(TS_LOAD_PAYLOAD);
 
-	if (prog_locate(payload))
+	if (prog_locate_deferred(payload))
 		goto out;
 
 	mirror_payload(payload);
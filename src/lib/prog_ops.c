@@ -14,7 +14,9 @@
  * GNU General Public License for more details.
  */
 
+#include <console/console.h>
 #include <program_loading.h>
+#include <security/vboot/vboot_crtm.h>
 
 /* For each segment of a program loaded this function is called*/
 void prog_segment_loaded(uintptr_t start, size_t size, int flags)
@@ -37,6 +39,9 @@ void __weak arch_segment_loaded(uintptr_t start, size_t size,
 
 void prog_run(struct prog *prog)
 {
+	if (vboot_measure_cbfs_flush())
+		die("Failed to measure %s.\n", prog_name(prog));
+
 	platform_prog_run(prog);
 	arch_prog_run(prog);
 }
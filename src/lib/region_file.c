@@ -60,6 +60,28 @@ struct metadata_block {
 	uint16_t blocks[REGF_UPDATES_PER_METADATA_BLOCK];
 };
 
+/*
+ * With region_file_init_banked() the region is split in two halves. Each
+ * half starts with a bank header followed by a region file as described
+ * above. The header fields are programmed in order:
+ *  - magic: the bank was completely erased.
+ *  - in_use: the bank is about to receive data.
+ *  - generation: the first update in the bank completed.
+ * A bank is active once its header carries a generation, and the newest
+ * generation wins. A bank with only the magic written was erased ahead of
+ * time, so switching to it doesn't require an erase.
+ */
+#define REGF_BANK_MAGIC			0x4b4e4252 /* 'RBNK' */
+#define REGF_BANK_ERASED		0xffffffff
+#define REGF_BANK_IN_USE		0
+
+struct bank_header {
+	uint32_t magic;
+	uint32_t in_use;
+	uint32_t generation;
+	uint32_t reserved;
+};
+
 static size_t block_to_bytes(uint16_t offset)
 {
 	return (size_t)offset << REGF_BLOCK_SHIFT;
@@ -196,7 +218,8 @@ static int fill_data_boundaries(struct region_file *f)
 	return 0;
 }
 
-int region_file_init(struct region_file *f, const struct region_device *p)
+static int region_file_init_rdev(struct region_file *f,
+				const struct region_device *p)
 {
 	struct metadata_block mb;
 
@@ -204,7 +227,6 @@ int region_file_init(struct region_file *f, const struct region_device *p)
 	 * block offset as the metadata is allocated first. At least one
 	 * metadata block is available. */
 
-	memset(f, 0, sizeof(*f));
 	f->slot = RF_FATAL;
 
 	/* Keep parent around for accessing data later. */
@@ -253,6 +275,212 @@ int region_file_init(struct region_file *f, const struct region_device *p)
 	return 0;
 }
 
+int region_file_init(struct region_file *f, const struct region_device *p)
+{
+	memset(f, 0, sizeof(*f));
+
+	return region_file_init_rdev(f, p);
+}
+
+/* Bank header state. See region_file_init_banked(). */
+enum {
+	BANK_DIRTY,
+	BANK_CLEAN,
+	BANK_VALID,
+};
+
+static int bank_rdev(const struct region_file *f, int bank,
+			struct region_device *rdev)
+{
+	size_t size = region_device_sz(&f->parent) / 2;
+
+	return rdev_chain(rdev, &f->parent, bank * size, size);
+}
+
+static int read_bank_state(const struct region_file *f, int bank,
+				uint32_t *generation)
+{
+	struct region_device rdev;
+	struct bank_header hdr;
+
+	if (bank_rdev(f, bank, &rdev))
+		return -1;
+
+	if (rdev_readat(&rdev, &hdr, 0, sizeof(hdr)) < 0)
+		return -1;
+
+	/* An erased header doesn't prove the rest of the bank is erased. */
+	if (hdr.magic != REGF_BANK_MAGIC)
+		return BANK_DIRTY;
+
+	if (hdr.generation != REGF_BANK_ERASED) {
+		*generation = hdr.generation;
+		return BANK_VALID;
+	}
+
+	if (hdr.in_use == REGF_BANK_ERASED)
+		return BANK_CLEAN;
+
+	return BANK_DIRTY;
+}
+
+/* Program the bank header. Fields left as REGF_BANK_ERASED are untouched. */
+static int write_bank_header(const struct region_file *f, int bank,
+				uint32_t in_use, uint32_t generation)
+{
+	struct region_device rdev;
+	struct bank_header hdr;
+
+	memset(&hdr, 0xff, sizeof(hdr));
+	hdr.magic = REGF_BANK_MAGIC;
+	hdr.in_use = in_use;
+	hdr.generation = generation;
+
+	if (bank_rdev(f, bank, &rdev))
+		return -1;
+
+	if (rdev_writeat(&rdev, &hdr, 0, sizeof(hdr)) < 0)
+		return -1;
+
+	return 0;
+}
+
+/* Point the file at the data area of the active bank. */
+static int chain_bank_data(struct region_file *f)
+{
+	struct region_device rdev;
+
+	if (bank_rdev(f, f->bank, &rdev))
+		return -1;
+
+	return rdev_chain(&f->rdev, &rdev, sizeof(struct bank_header),
+			region_device_sz(&rdev) - sizeof(struct bank_header));
+}
+
+int region_file_init_banked(struct region_file *f,
+				const struct region_device *p)
+{
+	uint32_t gen[2] = { 0, 0 };
+	int state[2];
+	int i;
+
+	memset(f, 0, sizeof(*f));
+	f->slot = RF_FATAL;
+	f->banked = 1;
+
+	if (rdev_chain_full(&f->parent, p))
+		return -1;
+
+	for (i = 0; i < 2; i++) {
+		state[i] = read_bank_state(f, i, &gen[i]);
+		if (state[i] < 0) {
+			printk(BIOS_ERR, "REGF fail reading bank %d header.\n",
+				i);
+			return -1;
+		}
+	}
+
+	if (state[0] != BANK_VALID && state[1] != BANK_VALID) {
+		/* Nothing committed yet. Switch into a clean bank if there is
+		 * one on the first update. */
+		f->bank = (state[0] == BANK_CLEAN) ? 1 : 0;
+		f->other_bank_clean = state[!f->bank] == BANK_CLEAN;
+		f->generation = 0;
+		if (chain_bank_data(f))
+			return -1;
+		f->slot = RF_NEED_TO_EMPTY;
+		return 0;
+	}
+
+	if (state[0] == BANK_VALID && state[1] == BANK_VALID)
+		f->bank = (int32_t)(gen[1] - gen[0]) > 0;
+	else
+		f->bank = (state[1] == BANK_VALID);
+
+	f->generation = gen[f->bank];
+	f->other_bank_clean = state[!f->bank] == BANK_CLEAN;
+
+	if (chain_bank_data(f))
+		return -1;
+
+	return region_file_init_rdev(f, &f->rdev);
+}
+
+/*
+ * Make the inactive bank the active one. The old bank keeps the latest
+ * committed data until the new bank header is written after the first
+ * update in it.
+ */
+static int switch_bank(struct region_file *f)
+{
+	struct region_device rdev;
+	int next = !f->bank;
+
+	if (bank_rdev(f, next, &rdev))
+		return -1;
+
+	if (!f->other_bank_clean) {
+		printk(BIOS_INFO, "REGF erasing bank %d inline.\n", next);
+		if (rdev_eraseat(&rdev, 0, region_device_sz(&rdev)) < 0) {
+			printk(BIOS_ERR, "REGF bank erase failed.\n");
+			return -1;
+		}
+	}
+
+	/* The bank is no longer clean once data may have been written. */
+	if (write_bank_header(f, next, REGF_BANK_IN_USE, REGF_BANK_ERASED)) {
+		printk(BIOS_ERR, "REGF failed to claim bank %d.\n", next);
+		return -1;
+	}
+
+	f->bank = next;
+	f->other_bank_clean = 0;
+	f->generation++;
+	if (f->generation == REGF_BANK_ERASED)
+		f->generation = 0;
+	f->commit_pending = 1;
+
+	if (chain_bank_data(f))
+		return -1;
+
+	f->slot = RF_EMPTY;
+
+	return 0;
+}
+
+int region_file_erase_ahead(struct region_file *f)
+{
+	struct region_device rdev;
+	int other = !f->bank;
+
+	if (!f->banked || f->other_bank_clean)
+		return 0;
+
+	/* The other bank still holds the latest committed data. */
+	if (f->commit_pending || f->slot == RF_FATAL)
+		return 0;
+
+	if (bank_rdev(f, other, &rdev))
+		return -1;
+
+	printk(BIOS_DEBUG, "REGF erasing bank %d ahead of time.\n", other);
+
+	if (rdev_eraseat(&rdev, 0, region_device_sz(&rdev)) < 0) {
+		printk(BIOS_ERR, "REGF bank erase failed.\n");
+		return -1;
+	}
+
+	/* Mark the bank as completely erased. */
+	if (write_bank_header(f, other, REGF_BANK_ERASED, REGF_BANK_ERASED)) {
+		printk(BIOS_ERR, "REGF failed to mark bank %d clean.\n", other);
+		return -1;
+	}
+
+	f->other_bank_clean = 1;
+
+	return 0;
+}
+
 int region_file_data(const struct region_file *f, struct region_device *rdev)
 {
 
@@ -378,12 +606,19 @@ static int commit_data_allocation(struct region_file *f, size_t data_blks)
 	return 0;
 }
 
-static int commit_data(const struct region_file *f, const void *buf,
-			size_t size)
+static int commit_data(const struct region_file *f,
+			const struct update_region_file_entry *entries,
+			size_t num_entries)
 {
 	size_t offset = block_to_bytes(region_file_data_begin(f));
-	if (rdev_writeat(&f->rdev, buf, offset, size) < 0)
-		return -1;
+	size_t i;
+
+	for (i = 0; i < num_entries; i++) {
+		if (rdev_writeat(&f->rdev, entries[i].data, offset,
+					entries[i].size) < 0)
+			return -1;
+		offset += entries[i].size;
+	}
 	return 0;
 }
 
@@ -402,6 +637,10 @@ static int handle_empty(struct region_file *f, size_t data_blks)
 
 static int handle_need_to_empty(struct region_file *f)
 {
+	/* Banked files never erase the bank holding the latest data. */
+	if (f->banked)
+		return switch_bank(f);
+
 	if (rdev_eraseat(&f->rdev, 0, region_device_sz(&f->rdev)) < 0) {
 		printk(BIOS_ERR, "REGF empty failed.\n");
 		return -1;
@@ -412,8 +651,9 @@ static int handle_need_to_empty(struct region_file *f)
 	return 0;
 }
 
-static int handle_update(struct region_file *f, size_t blocks, const void *buf,
-				size_t size)
+static int handle_update(struct region_file *f, size_t blocks,
+				const struct update_region_file_entry *entries,
+				size_t num_entries)
 {
 	if (!update_can_fit(f, blocks)) {
 		printk(BIOS_INFO, "REGF update can't fit. Will empty.\n");
@@ -426,19 +666,36 @@ static int handle_update(struct region_file *f, size_t blocks, const void *buf,
 		return -1;
 	}
 
-	if (commit_data(f, buf, size)) {
+	if (commit_data(f, entries, num_entries)) {
 		printk(BIOS_ERR, "REGF failed to commit data.\n");
 		return -1;
 	}
 
+	/* Writing the bank header makes the new bank the active one. */
+	if (f->commit_pending) {
+		if (write_bank_header(f, f->bank, REGF_BANK_IN_USE,
+					f->generation)) {
+			printk(BIOS_ERR, "REGF failed to commit bank %d.\n",
+				f->bank);
+			return -1;
+		}
+		f->commit_pending = 0;
+	}
+
 	return 0;
 }
 
-int region_file_update_data(struct region_file *f, const void *buf, size_t size)
+int region_file_update_data_arr(struct region_file *f,
+				const struct update_region_file_entry *entries,
+				size_t num_entries)
 {
 	int ret;
 	size_t blocks;
+	size_t size = 0;
+	size_t i;
 
+	for (i = 0; i < num_entries; i++)
+		size += entries[i].size;
 	blocks = bytes_to_block(ALIGN_UP(size, REGF_BLOCK_GRANULARITY));
 
 	while (1) {
@@ -455,7 +712,7 @@ int region_file_update_data(struct region_file *f, const void *buf, size_t size)
 			ret = -1;
 			break;
 		default:
-			ret = handle_update(f, blocks, buf, size);
+			ret = handle_update(f, blocks, entries, num_entries);
 			break;
 		}
 
@@ -472,3 +729,13 @@ int region_file_update_data(struct region_file *f, const void *buf, size_t size)
 
 	return ret;
 }
+
+int region_file_update_data(struct region_file *f, const void *buf, size_t size)
+{
+	struct update_region_file_entry entry = {
+		.size = size,
+		.data = buf,
+	};
+
+	return region_file_update_data_arr(f, &entry, 1);
+}
@@ -15,12 +15,18 @@
 
 #include <arch/cache.h>
 #include <console/console.h>
+#include <elog.h>
 #include <halt.h>
 #include <reset.h>
 
 __noreturn void board_reset(void)
 {
 	printk(BIOS_INFO, "%s() called!\n", __func__);
+
+	/* Write out any event log entries still held back. */
+	if (CONFIG(ELOG_DEFER_SYNC) && ENV_RAMSTAGE)
+		elog_flush();
+
 	dcache_clean_all();
 	do_board_reset();
 	halt();
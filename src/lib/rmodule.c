@@ -21,6 +21,7 @@
 #include <console/console.h>
 #include <program_loading.h>
 #include <rmodule.h>
+#include <security/vboot/vboot_crtm.h>
 
 /* Change this define to get more verbose debugging for module loading. */
 #define PK_ADJ_LEVEL BIOS_NEVER
@@ -267,6 +268,8 @@ int rmodule_stage_load(struct rmod_stage_load *rsl)
 	if (rdev_readat(fh, &stage, 0, sizeof(stage)) != sizeof(stage))
 		return -1;
 
+	vboot_measure_cbfs_data(fh, &stage, 0, sizeof(stage));
+
 	rmodule_offset =
 		rmodule_calc_region(DYN_CBMEM_ALIGN_SIZE,
 				    stage.memlen, &region_size, &load_offset);
@@ -26,11 +26,35 @@
 #include <lib.h>
 #include <bootmem.h>
 #include <program_loading.h>
+#include <security/vboot/vboot_crtm.h>
 #include <timestamp.h>
 #include <cbmem.h>
 
+/*
+ * SELF payloads are loaded from a plan of all their segments that is built
+ * before anything is written to memory. The payload is never mapped as a
+ * whole, so media that aren't memory mapped don't need a bounce buffer for
+ * it: uncompressed segments are read straight to their destination and LZ4
+ * segments are staged at the end of their own destination and decompressed
+ * in place. Every byte of the payload is read from the boot media once.
+ *
+ * The plan keeps the headers of the first SELF_PLAN_SEGMENTS segments. The
+ * headers of payloads with more segments are read again while loading, and
+ * such payloads are decompressed from mappings.
+ */
+#define SELF_PLAN_SEGMENTS	32
+
+struct self_plan {
+	struct cbfs_payload_segment segs[SELF_PLAN_SEGMENTS];
+	size_t num_segs;
+	uintptr_t entry;
+	/* Staging in the destination is only safe if no segments overlap. */
+	bool in_place;
+};
+
 /* The type syntax for C is essentially unparsable. -- Rob Pike */
-typedef int (*checker_t)(struct cbfs_payload_segment *cbfssegs, void *args);
+typedef int (*checker_t)(const struct region_device *rdev,
+			 const struct self_plan *plan, void *args);
 
 /* Decode a serialized cbfs payload segment
  * from memory into native endianness.
@@ -61,160 +85,96 @@ static int segment_targets_type(void *dest, unsigned long memsz,
 	return 0;
 }
 
-static int load_one_segment(uint8_t *dest,
-			    uint8_t *src,
-			    size_t len,
-			    size_t memsz,
-			    uint32_t compression,
-			    int flags)
+static bool segments_overlap(const struct cbfs_payload_segment *a,
+			     const struct cbfs_payload_segment *b)
 {
-		unsigned char *middle, *end;
-		printk(BIOS_DEBUG, "Loading Segment: addr: %p memsz: 0x%016zx filesz: 0x%016zx\n",
-		       dest, memsz, len);
-
-		/* Compute the boundaries of the segment */
-		end = dest + memsz;
-
-		/* Copy data from the initial buffer */
-		switch (compression) {
-		case CBFS_COMPRESS_LZMA: {
-			printk(BIOS_DEBUG, "using LZMA\n");
-			timestamp_add_now(TS_START_ULZMA);
-			len = ulzman(src, len, dest, memsz);
-			timestamp_add_now(TS_END_ULZMA);
-			if (!len) /* Decompression Error. */
-				return 0;
-			break;
-		}
-		case CBFS_COMPRESS_LZ4: {
-			printk(BIOS_DEBUG, "using LZ4\n");
-			timestamp_add_now(TS_START_ULZ4F);
-			len = ulz4fn(src, len, dest, memsz);
-			timestamp_add_now(TS_END_ULZ4F);
-			if (!len) /* Decompression Error. */
-				return 0;
-			break;
-		}
-		case CBFS_COMPRESS_NONE: {
-			printk(BIOS_DEBUG, "it's not compressed!\n");
-			memcpy(dest, src, len);
-			break;
-		}
-		default:
-			printk(BIOS_INFO,  "CBFS:  Unknown compression type %d\n", compression);
-			return 0;
-		}
-		/* Calculate middle after any changes to len. */
-		middle = dest + len;
-		printk(BIOS_SPEW, "[ 0x%08lx, %08lx, 0x%08lx) <- %08lx\n",
-			(unsigned long)dest,
-			(unsigned long)middle,
-			(unsigned long)end,
-			(unsigned long)src);
-
-		/* Zero the extra bytes between middle & end */
-		if (middle < end) {
-			printk(BIOS_DEBUG,
-				"Clearing Segment: addr: 0x%016lx memsz: 0x%016lx\n",
-				(unsigned long)middle,
-				(unsigned long)(end - middle));
-
-			/* Zero the extra bytes */
-			memset(middle, 0, end - middle);
-		}
-
-		/*
-		 * Each architecture can perform additional operations
-		 * on the loaded segment
-		 */
-		prog_segment_loaded((uintptr_t)dest, memsz, flags);
-
-
-	return 1;
+	return a->load_addr < b->load_addr + b->mem_len &&
+	       b->load_addr < a->load_addr + a->mem_len;
 }
 
-/* Note: this function is a bit dangerous so is not exported.
- * It assumes you're smart enough not to call it with the very
- * last segment, since it uses seg + 1 */
-static int last_loadable_segment(struct cbfs_payload_segment *seg)
+/*
+ * Read the header of segment i and bring it into the form it is loaded in.
+ * Returns the segment type, or -1 if the header can't be read.
+ */
+static int read_payload_segment(const struct region_device *rdev, size_t i,
+				struct cbfs_payload_segment *segment,
+				bool measure)
 {
-	return read_be32(&(seg + 1)->type) == PAYLOAD_SEGMENT_ENTRY;
+	struct cbfs_payload_segment raw;
+	const size_t offset = i * sizeof(raw);
+
+	if (rdev_readat(rdev, &raw, offset, sizeof(raw)) != sizeof(raw))
+		return -1;
+	if (measure)
+		vboot_measure_cbfs_data(rdev, &raw, offset, sizeof(raw));
+	cbfs_decode_payload_segment(segment, &raw);
+
+	switch (segment->type) {
+	case PAYLOAD_SEGMENT_CODE:
+	case PAYLOAD_SEGMENT_DATA:
+		/* Clean up the values */
+		segment->len = MIN(segment->len, segment->mem_len);
+		break;
+	case PAYLOAD_SEGMENT_BSS:
+		segment->len = 0;
+		segment->compression = CBFS_COMPRESS_NONE;
+		break;
+	}
+	return segment->type;
 }
 
-static int check_payload_segments(struct cbfs_payload_segment *cbfssegs,
-		void *args)
+static int get_payload_segment(const struct region_device *rdev,
+			       const struct self_plan *plan, size_t i,
+			       struct cbfs_payload_segment *segment)
 {
-	uint8_t *dest;
-	size_t memsz;
-	struct cbfs_payload_segment *seg, segment;
-	enum bootmem_type dest_type = *(enum bootmem_type *)args;
-
-	for (seg = cbfssegs;; ++seg) {
-		printk(BIOS_DEBUG, "Checking segment from ROM address %p\n", seg);
-		cbfs_decode_payload_segment(&segment, seg);
-		dest = (uint8_t *)(uintptr_t)segment.load_addr;
-		memsz = segment.mem_len;
-		if (segment.type == PAYLOAD_SEGMENT_ENTRY)
-			break;
-		if (!segment_targets_type(dest, memsz, dest_type))
-			return -1;
+	if (i < ARRAY_SIZE(plan->segs)) {
+		*segment = plan->segs[i];
+		return 0;
 	}
-	return 0;
+	return read_payload_segment(rdev, i, segment, false) < 0 ? -1 : 0;
 }
 
-static int load_payload_segments(struct cbfs_payload_segment *cbfssegs, uintptr_t *entry)
+static int plan_payload_segments(const struct region_device *rdev,
+				 struct self_plan *plan)
 {
-	uint8_t *dest, *src;
-	size_t filesz, memsz;
-	uint32_t compression;
-	struct cbfs_payload_segment *first_segment, *seg, segment;
-	int flags = 0;
-
-	for (first_segment = seg = cbfssegs;; ++seg) {
-		printk(BIOS_DEBUG, "Loading segment from ROM address %p\n", seg);
-
-		cbfs_decode_payload_segment(&segment, seg);
-		dest = (uint8_t *)(uintptr_t)segment.load_addr;
-		memsz = segment.mem_len;
-		compression = segment.compression;
-		filesz = segment.len;
-
-		switch (segment.type) {
+	struct cbfs_payload_segment segment;
+	size_t i, j;
+
+	plan->num_segs = 0;
+	plan->in_place = !CONFIG(BOOT_DEVICE_MEMORY_MAPPED);
+
+	for (;;) {
+		switch (read_payload_segment(rdev, plan->num_segs, &segment,
+					     true)) {
 		case PAYLOAD_SEGMENT_CODE:
 		case PAYLOAD_SEGMENT_DATA:
 			printk(BIOS_DEBUG, "  %s (compression=%x)\n",
 				segment.type == PAYLOAD_SEGMENT_CODE
 				?  "code" : "data", segment.compression);
-			src = ((uint8_t *)first_segment) + segment.offset;
 			printk(BIOS_DEBUG,
-				"  New segment dstaddr %p memsize 0x%zx srcaddr %p filesize 0x%zx\n",
-			       dest, memsz, src, filesz);
-
-			/* Clean up the values */
-			if (filesz > memsz)  {
-				filesz = memsz;
-				printk(BIOS_DEBUG, "  cleaned up filesize 0x%zx\n", filesz);
-			}
+				"  New segment dstaddr 0x%llx memsize 0x%x srcoffset 0x%x filesize 0x%x\n",
+				(unsigned long long)segment.load_addr, segment.mem_len,
+				segment.offset, segment.len);
 			break;
 
 		case PAYLOAD_SEGMENT_BSS:
 			printk(BIOS_DEBUG, "  BSS %p (%d byte)\n", (void *)
 				(intptr_t)segment.load_addr, segment.mem_len);
-			filesz = 0;
-			src = ((uint8_t *)first_segment) + segment.offset;
-			compression = CBFS_COMPRESS_NONE;
 			break;
 
 		case PAYLOAD_SEGMENT_ENTRY:
 			printk(BIOS_DEBUG, "  Entry Point %p\n", (void *)
 				(intptr_t)segment.load_addr);
 
-			*entry = segment.load_addr;
+			plan->entry = segment.load_addr;
 			/* Per definition, a payload always has the entry point
 			 * as last segment. Thus, we use the occurrence of the
 			 * entry point as break condition for the loop.
 			 */
-			return 0;
+			goto done;
+
+		case -1:
+			return -1;
 
 		default:
 			/* We found something that we don't know about. Throw
@@ -223,59 +183,268 @@ static int load_payload_segments(struct cbfs_payload_segment *cbfssegs, uintptr_
 			printk(BIOS_EMERG, "Bad segment type %x\n", segment.type);
 			return -1;
 		}
-		/* Note that the 'seg + 1' is safe as we only call this
-		 * function on "not the last" * items, since entry
-		 * is always last. */
-		if (last_loadable_segment(seg))
-			flags = SEG_FINAL;
-		if (!load_one_segment(dest, src, filesz, memsz, compression, flags))
-			return -1;
+
+		if (plan->num_segs < ARRAY_SIZE(plan->segs))
+			plan->segs[plan->num_segs] = segment;
+		plan->num_segs++;
+	}
+
+done:
+	if (plan->num_segs > ARRAY_SIZE(plan->segs)) {
+		printk(BIOS_DEBUG, "SELF payload has %zu segments, not staging\n",
+			plan->num_segs);
+		plan->in_place = false;
+	}
+
+	/*
+	 * Segments are loaded in the order they are listed in, so a later
+	 * segment that overlaps an earlier one still wins like it always did.
+	 * Staging compressed data in a destination could clobber an already
+	 * loaded segment though, so don't do that for such payloads.
+	 */
+	for (i = 0; i < plan->num_segs && plan->in_place; i++) {
+		for (j = i + 1; j < plan->num_segs; j++) {
+			if (segments_overlap(&plan->segs[i], &plan->segs[j])) {
+				printk(BIOS_DEBUG, "SELF segments %zu and %zu overlap\n",
+					i, j);
+				plan->in_place = false;
+				break;
+			}
+		}
+	}
+
+	return 0;
+}
+
+static size_t decompress_mapped(const struct region_device *rdev,
+				const struct cbfs_payload_segment *seg,
+				uint8_t *dest)
+{
+	void *src;
+	size_t len;
+
+	src = rdev_mmap(rdev, seg->offset, seg->len);
+	if (src == NULL)
+		return 0;
+
+	vboot_measure_cbfs_data(rdev, src, seg->offset, seg->len);
+
+	if (seg->compression == CBFS_COMPRESS_LZMA) {
+		timestamp_add_now(TS_START_ULZMA);
+		len = ulzman(src, seg->len, dest, seg->mem_len);
+		timestamp_add_now(TS_END_ULZMA);
+	} else {
+		timestamp_add_now(TS_START_ULZ4F);
+		len = ulz4fn(src, seg->len, dest, seg->mem_len);
+		timestamp_add_now(TS_END_ULZ4F);
+	}
+
+	rdev_munmap(rdev, src);
+	return len;
+}
+
+/* Start of the LZ4 frame header, with the optional content size */
+struct lz4_frame_start {
+	uint32_t magic;
+	uint8_t flags;
+	uint8_t block_descriptor;
+	uint64_t content_size;
+} __packed;
+
+#define LZ4F_MAGIC		0x184d2204
+#define LZ4F_CONTENT_SIZE	(1 << 3)
+
+/*
+ * Size of the decompressed data if the frame header records it, which
+ * cbfstool does. Returns 0 if it doesn't.
+ */
+static uint64_t lz4_content_size(const void *frame, size_t len)
+{
+	const struct lz4_frame_start *h = frame;
+
+	if (len < sizeof(*h) || read_le32(&h->magic) != LZ4F_MAGIC ||
+	    !(h->flags & LZ4F_CONTENT_SIZE))
+		return 0;
+	return read_le64(&h->content_size);
+}
+
+/*
+ * Decompressing in place overwrites the staged input behind the point it is
+ * read from. That is safe if the destination exceeds the decompressed size
+ * by 8 + 1/255 of it (see compression.h).
+ */
+static bool lz4_in_place_fits(uint64_t content_size, size_t memsz)
+{
+	return content_size && content_size <= memsz &&
+	       memsz - content_size >= 8 + content_size / 255;
+}
+
+static size_t decompress_lz4(const struct region_device *rdev,
+			     const struct cbfs_payload_segment *seg,
+			     uint8_t *dest, bool in_place)
+{
+	struct lz4_frame_start h;
+	uint64_t content_size = 0;
+	uint8_t *staged = dest + seg->mem_len - seg->len;
+	size_t len;
+
+	if (in_place && seg->len >= sizeof(h) &&
+	    rdev_readat(rdev, &h, seg->offset, sizeof(h)) == sizeof(h))
+		content_size = lz4_content_size(&h, sizeof(h));
+
+	if (!lz4_in_place_fits(content_size, seg->mem_len))
+		return decompress_mapped(rdev, seg, dest);
+
+	if (rdev_readat(rdev, staged, seg->offset, seg->len) != seg->len)
+		return 0;
+
+	vboot_measure_cbfs_data(rdev, staged, seg->offset, seg->len);
+
+	/* Only trust the size in the data that was measured. */
+	if (lz4_content_size(staged, seg->len) != content_size) {
+		printk(BIOS_DEBUG, "LZ4 header changed, decompressing from mapping\n");
+		return decompress_mapped(rdev, seg, dest);
 	}
 
+	timestamp_add_now(TS_START_ULZ4F);
+	len = ulz4fn(staged, seg->len, dest, seg->mem_len);
+	timestamp_add_now(TS_END_ULZ4F);
+	return len;
+}
+
+static int load_one_segment(const struct region_device *rdev,
+			    const struct cbfs_payload_segment *seg,
+			    bool in_place, int flags)
+{
+	uint8_t *dest = (uint8_t *)(uintptr_t)seg->load_addr;
+	size_t memsz = seg->mem_len;
+	size_t len = seg->len;
+	unsigned char *middle, *end;
+
+	printk(BIOS_DEBUG, "Loading Segment: addr: %p memsz: 0x%016zx filesz: 0x%016zx\n",
+	       dest, memsz, len);
+
+	/* Compute the boundaries of the segment */
+	end = dest + memsz;
+
+	switch (seg->compression) {
+	case CBFS_COMPRESS_LZMA:
+		printk(BIOS_DEBUG, "using LZMA\n");
+		len = decompress_mapped(rdev, seg, dest);
+		if (!len) /* Decompression Error. */
+			return 0;
+		break;
+	case CBFS_COMPRESS_LZ4:
+		printk(BIOS_DEBUG, "using LZ4\n");
+		len = decompress_lz4(rdev, seg, dest, in_place);
+		if (!len) /* Decompression Error. */
+			return 0;
+		break;
+	case CBFS_COMPRESS_NONE:
+		printk(BIOS_DEBUG, "it's not compressed!\n");
+		if (len && rdev_readat(rdev, dest, seg->offset, len) != len)
+			return 0;
+		if (len)
+			vboot_measure_cbfs_data(rdev, dest, seg->offset, len);
+		break;
+	default:
+		printk(BIOS_INFO,  "CBFS:  Unknown compression type %d\n",
+			seg->compression);
+		return 0;
+	}
+	/* Calculate middle after any changes to len. */
+	middle = dest + len;
+	printk(BIOS_SPEW, "[ 0x%08lx, %08lx, 0x%08lx) <- offset 0x%08x\n",
+		(unsigned long)dest,
+		(unsigned long)middle,
+		(unsigned long)end,
+		seg->offset);
+
+	/* Zero the extra bytes between middle & end */
+	if (middle < end) {
+		printk(BIOS_DEBUG,
+			"Clearing Segment: addr: 0x%016lx memsz: 0x%016lx\n",
+			(unsigned long)middle,
+			(unsigned long)(end - middle));
+
+		/* Zero the extra bytes */
+		memset(middle, 0, end - middle);
+	}
+
+	/*
+	 * Each architecture can perform additional operations
+	 * on the loaded segment
+	 */
+	prog_segment_loaded((uintptr_t)dest, memsz, flags);
+
 	return 1;
 }
 
-__weak int payload_arch_usable_ram_quirk(uint64_t start, uint64_t size)
+static int check_payload_segments(const struct region_device *rdev,
+				  const struct self_plan *plan, void *args)
 {
+	struct cbfs_payload_segment seg;
+	enum bootmem_type dest_type = *(enum bootmem_type *)args;
+	size_t i;
+
+	for (i = 0; i < plan->num_segs; i++) {
+		if (get_payload_segment(rdev, plan, i, &seg))
+			return -1;
+		if (!segment_targets_type((void *)(uintptr_t)seg.load_addr,
+					  seg.mem_len, dest_type))
+			return -1;
+	}
 	return 0;
 }
 
-static void *selfprepare(struct prog *payload)
+static int load_payload_segments(const struct region_device *rdev,
+				 const struct self_plan *plan)
 {
-	void *data;
-	data = rdev_mmap_full(prog_rdev(payload));
-	return data;
+	struct cbfs_payload_segment seg;
+	size_t i;
+	int flags;
+
+	for (i = 0; i < plan->num_segs; i++) {
+		flags = i == plan->num_segs - 1 ? SEG_FINAL : 0;
+
+		if (get_payload_segment(rdev, plan, i, &seg))
+			return -1;
+
+		timestamp_add_now(TS_START_PAYLOAD_SEGMENT);
+		if (!load_one_segment(rdev, &seg, plan->in_place, flags))
+			return -1;
+		timestamp_add_now(TS_END_PAYLOAD_SEGMENT);
+	}
+
+	return 0;
+}
+
+__weak int payload_arch_usable_ram_quirk(uint64_t start, uint64_t size)
+{
+	return 0;
 }
 
 static bool _selfload(struct prog *payload, checker_t f, void *args)
 {
-	uintptr_t entry = 0;
-	struct cbfs_payload_segment *cbfssegs;
-	void *data;
+	/* Too large for the stack of some stages. */
+	static struct self_plan plan;
+	const struct region_device *rdev = prog_rdev(payload);
 
-	data = selfprepare(payload);
-	if (data == NULL)
+	if (plan_payload_segments(rdev, &plan))
 		return false;
 
-	cbfssegs = &((struct cbfs_payload *)data)->segments;
-
-	if (f && f(cbfssegs, args))
-		goto out;
+	if (f && f(rdev, &plan, args))
+		return false;
 
-	if (load_payload_segments(cbfssegs, &entry))
-		goto out;
+	if (load_payload_segments(rdev, &plan))
+		return false;
 
 	printk(BIOS_SPEW, "Loaded segments\n");
 
-	rdev_munmap(prog_rdev(payload), data);
-
 	/* Pass cbtables to payload if architecture desires it. */
-	prog_set_entry(payload, (void *)entry, cbmem_find(CBMEM_ID_CBTABLE));
+	prog_set_entry(payload, (void *)plan.entry, cbmem_find(CBMEM_ID_CBTABLE));
 
 	return true;
-out:
-	rdev_munmap(prog_rdev(payload), data);
-	return false;
 }
 
 bool selfload_check(struct prog *payload, enum bootmem_type dest_type)
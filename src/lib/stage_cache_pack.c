@@ -0,0 +1,287 @@
+/*
+ * This file is part of the coreboot project.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#include <commonlib/bsd/cbfs_serialized.h>
+#include <commonlib/bsd/compression.h>
+#include <console/console.h>
+#include <stage_cache.h>
+#include <string.h>
+#include <timestamp.h>
+
+/*
+ * Stages are stored as a single LZ4 frame holding one block, which is what
+ * ulz4fn() expects. The compressor below is a plain greedy LZ4 block encoder
+ * with a small hash table. It only needs to be good at what a loaded stage
+ * looks like (code, and large runs of zeroed .bss/heap), not to match the
+ * ratio of the reference implementation.
+ */
+#define LZ4_FRAME_MAGIC		0x184D2204
+#define LZ4_FRAME_FLG		0x60	/* version 1, independent blocks */
+#define LZ4_FRAME_BD		0x70	/* 4MiB max block size */
+#define LZ4_FRAME_OVERHEAD	(4 + 3 + 4 + 4)	/* header, block size, end mark */
+
+#define LZ4_MINMATCH		4
+#define LZ4_LASTLITERALS	5
+#define LZ4_MFLIMIT		12
+#define LZ4_MAX_OFFSET		0xffff
+#define LZ4_HASH_BITS		10
+#define LZ4_SKIP_TRIGGER	6
+
+static uint32_t lz4_hash_table[1 << LZ4_HASH_BITS];
+
+static inline uint32_t read_u32(const uint8_t *p)
+{
+	uint32_t v;
+
+	memcpy(&v, p, sizeof(v));
+	return v;
+}
+
+static inline uint32_t lz4_hash(uint32_t seq)
+{
+	return (seq * 2654435761U) >> (32 - LZ4_HASH_BITS);
+}
+
+static size_t lz4_put_len(uint8_t *op, size_t len)
+{
+	size_t n = 0;
+
+	for (; len >= 255; len -= 255, n++)
+		if (op)
+			op[n] = 255;
+	if (op)
+		op[n] = len;
+	return n + 1;
+}
+
+/*
+ * Emit one sequence. A match_len of 0 emits the trailing literals that end
+ * every block. With op == NULL only the encoded size is returned.
+ */
+static size_t lz4_put_sequence(uint8_t *op, const uint8_t *lit, size_t lit_len,
+			       size_t offset, size_t match_len)
+{
+	size_t ml = match_len ? match_len - LZ4_MINMATCH : 0;
+	size_t n = 1;
+
+	if (op)
+		op[0] = (MIN(lit_len, 15) << 4) | MIN(ml, 15);
+	if (lit_len >= 15)
+		n += lz4_put_len(op ? op + n : NULL, lit_len - 15);
+	if (op)
+		memcpy(op + n, lit, lit_len);
+	n += lit_len;
+
+	if (!match_len)
+		return n;
+
+	if (op) {
+		op[n] = offset & 0xff;
+		op[n + 1] = offset >> 8;
+	}
+	n += 2;
+	if (ml >= 15)
+		n += lz4_put_len(op ? op + n : NULL, ml - 15);
+
+	return n;
+}
+
+/*
+ * Encode src as a single LZ4 block into dst. With dst == NULL nothing is
+ * written and only the size of the encoded block is returned, so the caller
+ * can size the cache entry exactly before running the real pass.
+ */
+static size_t lz4_compress_block(uint8_t *dst, const uint8_t *src, size_t size)
+{
+	const uint8_t *ip = src;
+	const uint8_t *anchor = src;
+	const uint8_t *const end = src + size;
+	const uint8_t *const match_limit = end - LZ4_LASTLITERALS;
+	size_t out = 0;
+	unsigned int misses = 0;
+
+	memset(lz4_hash_table, 0, sizeof(lz4_hash_table));
+
+	while (size > LZ4_MFLIMIT && ip < end - LZ4_MFLIMIT) {
+		const uint32_t seq = read_u32(ip);
+		const uint32_t h = lz4_hash(seq);
+		const uint8_t *ref = src + lz4_hash_table[h];
+		size_t len;
+
+		lz4_hash_table[h] = ip - src;
+
+		if (ref >= ip || ip - ref > LZ4_MAX_OFFSET || read_u32(ref) != seq) {
+			/* Step faster through data that doesn't compress. */
+			ip += 1 + (misses++ >> LZ4_SKIP_TRIGGER);
+			continue;
+		}
+		misses = 0;
+
+		len = LZ4_MINMATCH;
+		while (ip + len < match_limit && ref[len] == ip[len])
+			len++;
+
+		out += lz4_put_sequence(dst ? dst + out : NULL, anchor,
+					ip - anchor, ip - ref, len);
+		ip += len;
+		anchor = ip;
+	}
+
+	out += lz4_put_sequence(dst ? dst + out : NULL, anchor, end - anchor,
+				0, 0);
+
+	return out;
+}
+
+static void put_le32(uint8_t *p, uint32_t v)
+{
+	p[0] = v;
+	p[1] = v >> 8;
+	p[2] = v >> 16;
+	p[3] = v >> 24;
+}
+
+/*
+ * Fletcher-64 over 32-bit words. The sums are only reduced once per chunk,
+ * which keeps the inner loop to two additions per word.
+ */
+#define CHECKSUM_CHUNK_WORDS	16384
+
+static uint64_t stage_cache_checksum(const void *data, size_t size)
+{
+	const uint8_t *p = data;
+	uint64_t a = 0;
+	uint64_t b = 0;
+
+	while (size) {
+		size_t words = MIN(size / sizeof(uint32_t),
+				   (size_t)CHECKSUM_CHUNK_WORDS);
+
+		if (!words) {
+			uint32_t tail = 0;
+
+			memcpy(&tail, p, size);
+			a += tail;
+			b += a;
+			size = 0;
+		}
+
+		size -= words * sizeof(uint32_t);
+		while (words--) {
+			a += read_u32(p);
+			b += a;
+			p += sizeof(uint32_t);
+		}
+
+		a %= 0xffffffff;
+		b %= 0xffffffff;
+	}
+
+	return (b << 32) | a;
+}
+
+size_t stage_cache_pack_size(const struct prog *stage, struct stage_cache *meta)
+{
+	const size_t size = prog_size(stage);
+	size_t packed;
+
+	meta->load_addr = (uintptr_t)prog_start(stage);
+	meta->entry_addr = (uintptr_t)prog_entry(stage);
+	meta->arg = (uintptr_t)prog_entry_arg(stage);
+	meta->size = size;
+	meta->checksum = 0;
+	if (CONFIG(STAGE_CACHE_CHECKSUM))
+		meta->checksum = stage_cache_checksum(prog_start(stage), size);
+	meta->compression = CBFS_COMPRESS_NONE;
+
+	if (!CONFIG(STAGE_CACHE_COMPRESS))
+		return size;
+
+	packed = lz4_compress_block(NULL, prog_start(stage), size) +
+		LZ4_FRAME_OVERHEAD;
+	if (packed >= size)
+		return size;
+
+	meta->compression = CBFS_COMPRESS_LZ4;
+	return packed;
+}
+
+int stage_cache_pack(void *dst, size_t packed_size, const struct prog *stage,
+		     const struct stage_cache *meta)
+{
+	uint8_t *p = dst;
+	size_t block;
+
+	if (meta->compression == CBFS_COMPRESS_NONE) {
+		if (packed_size != meta->size)
+			return -1;
+		memcpy(dst, prog_start(stage), meta->size);
+		return 0;
+	}
+
+	if (packed_size < LZ4_FRAME_OVERHEAD)
+		return -1;
+	/* The encoder is deterministic, so this matches stage_cache_pack_size(). */
+	block = packed_size - LZ4_FRAME_OVERHEAD;
+
+	/* The header checksum byte is not checked by ulz4fn(). */
+	put_le32(p, LZ4_FRAME_MAGIC);
+	p[4] = LZ4_FRAME_FLG;
+	p[5] = LZ4_FRAME_BD;
+	p[6] = 0;
+	put_le32(p + 7, block);
+	lz4_compress_block(p + 11, prog_start(stage), meta->size);
+	put_le32(p + 11 + block, 0);
+
+	printk(BIOS_DEBUG, "Stage cache: compressed %u bytes to %zu\n",
+	       meta->size, packed_size);
+
+	return 0;
+}
+
+int stage_cache_unpack(const void *src, size_t src_size,
+		       const struct stage_cache *meta)
+{
+	void *load_addr = (void *)(uintptr_t)meta->load_addr;
+	size_t size;
+
+	switch (meta->compression) {
+	case CBFS_COMPRESS_NONE:
+		if (src_size < meta->size)
+			return -1;
+		memcpy(load_addr, src, meta->size);
+		size = meta->size;
+		break;
+	case CBFS_COMPRESS_LZ4:
+		timestamp_add_now(TS_START_ULZ4F);
+		size = ulz4fn(src, src_size, load_addr, meta->size);
+		timestamp_add_now(TS_END_ULZ4F);
+		break;
+	default:
+		return -1;
+	}
+
+	if (size != meta->size) {
+		printk(BIOS_ERR, "Stage cache: restored %zu of %u bytes\n",
+		       size, meta->size);
+		return -1;
+	}
+
+	if (CONFIG(STAGE_CACHE_CHECKSUM) &&
+	    stage_cache_checksum(load_addr, size) != meta->checksum) {
+		printk(BIOS_ERR, "Stage cache: checksum mismatch\n");
+		return -1;
+	}
+
+	return 0;
+}
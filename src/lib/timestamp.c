@@ -24,7 +24,12 @@
 #include <timestamp.h>
 #include <smp/node.h>
 
+#if CONFIG(MP_AP_TIMESTAMPS)
+/* Make room for the per-AP entries added by MP init. */
+#define MAX_TIMESTAMPS (192 + 2 * CONFIG_MAX_CPUS)
+#else
 #define MAX_TIMESTAMPS 192
+#endif
 
 DECLARE_OPTIONAL_REGION(timestamp);
 
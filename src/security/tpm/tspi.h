@@ -22,6 +22,8 @@
 #include <commonlib/tcpa_log_serialized.h>
 #include <commonlib/region.h>
 #include <vb2_api.h>
+#include <vb2_sha.h>
+#include <security/vboot/sha256_cpu.h>
 
 #define TPM_PCR_MAX_LEN 64
 #define HASH_DATA_CHUNK_SIZE 1024
@@ -86,4 +88,46 @@ uint32_t tpm_setup(int s3flag);
 uint32_t tpm_measure_region(const struct region_device *rdev, uint8_t pcr,
 			    const char *rname);
 
+/*
+ * Incremental variant of tpm_measure_region(), for callers that already
+ * read the data for another purpose and want to hash it on the way.
+ */
+struct tpm_measure_ctx {
+	enum vb2_hash_algorithm hash_alg;
+	bool cpu_sha256;
+	union {
+		struct vb2_digest_context ctx;
+		struct sha256_cpu_ctx cpu;
+	};
+};
+
+/**
+ * Initialize the TPM library and start a new digest.
+ * @return TPM error code in case of error otherwise TPM_SUCCESS
+ */
+uint32_t tpm_measure_init(struct tpm_measure_ctx *m);
+
+/**
+ * Add data to the digest.
+ * @return TPM error code in case of error otherwise TPM_SUCCESS
+ */
+uint32_t tpm_measure_update(struct tpm_measure_ctx *m, const void *buf,
+			    size_t size);
+
+/**
+ * Add the part of a region device from offset to its end to the digest.
+ * @param *rname Name of the region, used for error messages
+ * @return TPM error code in case of error otherwise TPM_SUCCESS
+ */
+uint32_t tpm_measure_update_region(struct tpm_measure_ctx *m,
+				   const struct region_device *rdev,
+				   size_t offset, const char *rname);
+
+/**
+ * Finalize the digest and extend the given PCR and TCPA log with it.
+ * @return TPM error code in case of error otherwise TPM_SUCCESS
+ */
+uint32_t tpm_measure_finish(struct tpm_measure_ctx *m, uint8_t pcr,
+			    const char *rname);
+
 #endif /* TSPI_H_ */
@@ -225,57 +225,95 @@ uint32_t tpm_extend_pcr(int pcr, enum vb2_hash_algorithm digest_algo,
 }
 
 #if CONFIG(VBOOT)
-uint32_t tpm_measure_region(const struct region_device *rdev, uint8_t pcr,
-			    const char *rname)
+uint32_t tpm_measure_init(struct tpm_measure_ctx *m)
 {
-	uint8_t digest[TPM_PCR_MAX_LEN], digest_len;
-	uint8_t buf[HASH_DATA_CHUNK_SIZE];
-	uint32_t result, offset;
-	size_t len;
-	struct vb2_digest_context ctx;
-	enum vb2_hash_algorithm hash_alg;
+	uint32_t result;
 
-	if (!rdev || !rname)
-		return TPM_E_INVALID_ARG;
 	result = tlcl_lib_init();
 	if (result != TPM_SUCCESS) {
 		printk(BIOS_ERR, "TPM: Can't initialize library.\n");
 		return result;
 	}
 	if (CONFIG(TPM1)) {
-		hash_alg = VB2_HASH_SHA1;
+		m->hash_alg = VB2_HASH_SHA1;
 	} else { /* CONFIG_TPM2 */
-		hash_alg = VB2_HASH_SHA256;
+		m->hash_alg = VB2_HASH_SHA256;
 	}
 
-	digest_len = vb2_digest_size(hash_alg);
-	assert(digest_len <= sizeof(digest));
-	if (vb2_digest_init(&ctx, hash_alg)) {
+	m->cpu_sha256 = m->hash_alg == VB2_HASH_SHA256 &&
+			sha256_cpu_available();
+	if (m->cpu_sha256) {
+		sha256_cpu_init(&m->cpu);
+		return TPM_SUCCESS;
+	}
+
+	if (vb2_digest_init(&m->ctx, m->hash_alg)) {
 		printk(BIOS_ERR, "TPM: Error initializing hash.\n");
 		return TPM_E_HASH_ERROR;
 	}
+
+	return TPM_SUCCESS;
+}
+
+uint32_t tpm_measure_update(struct tpm_measure_ctx *m, const void *buf,
+			    size_t size)
+{
+	if (m->cpu_sha256) {
+		sha256_cpu_update(&m->cpu, buf, size);
+		return TPM_SUCCESS;
+	}
+
+	if (vb2_digest_extend(&m->ctx, buf, size)) {
+		printk(BIOS_ERR, "TPM: Error extending hash.\n");
+		return TPM_E_HASH_ERROR;
+	}
+
+	return TPM_SUCCESS;
+}
+
+uint32_t tpm_measure_update_region(struct tpm_measure_ctx *m,
+				   const struct region_device *rdev,
+				   size_t offset, const char *rname)
+{
+	uint8_t buf[HASH_DATA_CHUNK_SIZE];
+	uint32_t result;
+	size_t len;
+
 	/*
 	 * Though one can mmap the full needed region on x86 this is not the
 	 * case for e.g. ARM. In order to make this code as universal as
 	 * possible across different platforms read the data to hash in chunks.
 	 */
-	for (offset = 0; offset < region_device_sz(rdev); offset += len) {
+	for (; offset < region_device_sz(rdev); offset += len) {
 		len = MIN(sizeof(buf), region_device_sz(rdev) - offset);
 		if (rdev_readat(rdev, buf, offset, len) < 0) {
 			printk(BIOS_ERR, "TPM: Not able to read region %s.\n",
 			       rname);
 			return TPM_E_READ_FAILURE;
 		}
-		if (vb2_digest_extend(&ctx, buf, len)) {
-			printk(BIOS_ERR, "TPM: Error extending hash.\n");
-			return TPM_E_HASH_ERROR;
-		}
+		result = tpm_measure_update(m, buf, len);
+		if (result != TPM_SUCCESS)
+			return result;
 	}
-	if (vb2_digest_finalize(&ctx, digest, digest_len)) {
+
+	return TPM_SUCCESS;
+}
+
+uint32_t tpm_measure_finish(struct tpm_measure_ctx *m, uint8_t pcr,
+			    const char *rname)
+{
+	uint8_t digest[TPM_PCR_MAX_LEN], digest_len;
+	uint32_t result;
+
+	digest_len = vb2_digest_size(m->hash_alg);
+	assert(digest_len <= sizeof(digest));
+	if (m->cpu_sha256) {
+		sha256_cpu_final(&m->cpu, digest);
+	} else if (vb2_digest_finalize(&m->ctx, digest, digest_len)) {
 		printk(BIOS_ERR, "TPM: Error finalizing hash.\n");
 		return TPM_E_HASH_ERROR;
 	}
-	result = tpm_extend_pcr(pcr, hash_alg, digest, digest_len, rname);
+	result = tpm_extend_pcr(pcr, m->hash_alg, digest, digest_len, rname);
 	if (result != TPM_SUCCESS) {
 		printk(BIOS_ERR, "TPM: Extending hash into PCR failed.\n");
 		return result;
@@ -283,4 +321,24 @@ uint32_t tpm_measure_region(const struct region_device *rdev, uint8_t pcr,
 	printk(BIOS_DEBUG, "TPM: Measured %s into PCR %d\n", rname, pcr);
 	return TPM_SUCCESS;
 }
+
+uint32_t tpm_measure_region(const struct region_device *rdev, uint8_t pcr,
+			    const char *rname)
+{
+	struct tpm_measure_ctx m;
+	uint32_t result;
+
+	if (!rdev || !rname)
+		return TPM_E_INVALID_ARG;
+
+	result = tpm_measure_init(&m);
+	if (result != TPM_SUCCESS)
+		return result;
+
+	result = tpm_measure_update_region(&m, rdev, 0, rname);
+	if (result != TPM_SUCCESS)
+		return result;
+
+	return tpm_measure_finish(&m, pcr, rname);
+}
 #endif /* VBOOT */
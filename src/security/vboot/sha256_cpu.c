@@ -0,0 +1,126 @@
+/*
+ * This file is part of the coreboot project.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#include <commonlib/helpers.h>
+#include <console/console.h>
+#include <security/vboot/sha256_cpu.h>
+#include <string.h>
+#include <vb2_api.h>
+
+static const uint32_t sha256_h0[8] = {
+	0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a,
+	0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19,
+};
+
+void sha256_cpu_init(struct sha256_cpu_ctx *ctx)
+{
+	memcpy(ctx->state, sha256_h0, sizeof(ctx->state));
+	ctx->block_used = 0;
+	ctx->total = 0;
+}
+
+void sha256_cpu_update(struct sha256_cpu_ctx *ctx, const void *data,
+		       size_t size)
+{
+	const uint8_t *p = data;
+	size_t len;
+
+	ctx->total += size;
+
+	if (ctx->block_used) {
+		len = MIN(size, sizeof(ctx->block) - ctx->block_used);
+		memcpy(&ctx->block[ctx->block_used], p, len);
+		ctx->block_used += len;
+		p += len;
+		size -= len;
+
+		if (ctx->block_used < sizeof(ctx->block))
+			return;
+
+		sha256_cpu_blocks(ctx->state, ctx->block, 1);
+		ctx->block_used = 0;
+	}
+
+	/* Whole blocks are hashed straight from the caller's buffer. */
+	len = size / SHA256_CPU_BLOCK_SIZE;
+	if (len) {
+		sha256_cpu_blocks(ctx->state, p, len);
+		p += len * SHA256_CPU_BLOCK_SIZE;
+		size -= len * SHA256_CPU_BLOCK_SIZE;
+	}
+
+	memcpy(ctx->block, p, size);
+	ctx->block_used = size;
+}
+
+void sha256_cpu_final(struct sha256_cpu_ctx *ctx,
+		      uint8_t digest[SHA256_CPU_DIGEST_SIZE])
+{
+	uint64_t bits = ctx->total * 8;
+	int i;
+
+	ctx->block[ctx->block_used++] = 0x80;
+	if (ctx->block_used > sizeof(ctx->block) - sizeof(bits)) {
+		memset(&ctx->block[ctx->block_used], 0,
+		       sizeof(ctx->block) - ctx->block_used);
+		sha256_cpu_blocks(ctx->state, ctx->block, 1);
+		ctx->block_used = 0;
+	}
+	memset(&ctx->block[ctx->block_used], 0,
+	       sizeof(ctx->block) - sizeof(bits) - ctx->block_used);
+	for (i = 0; i < sizeof(bits); i++)
+		ctx->block[sizeof(ctx->block) - 1 - i] = bits >> (i * 8);
+	sha256_cpu_blocks(ctx->state, ctx->block, 1);
+
+	for (i = 0; i < ARRAY_SIZE(ctx->state); i++) {
+		digest[i * 4 + 0] = ctx->state[i] >> 24;
+		digest[i * 4 + 1] = ctx->state[i] >> 16;
+		digest[i * 4 + 2] = ctx->state[i] >> 8;
+		digest[i * 4 + 3] = ctx->state[i];
+	}
+}
+
+/*
+ * vboot only hashes one firmware body at a time, so the hwcrypto interface
+ * is backed by a single context.
+ */
+static struct sha256_cpu_ctx hwcrypto_ctx;
+
+vb2_error_t vb2ex_hwcrypto_digest_init(enum vb2_hash_algorithm hash_alg,
+				       uint32_t data_size)
+{
+	if (hash_alg != VB2_HASH_SHA256 || !sha256_cpu_available())
+		return VB2_ERROR_EX_HWCRYPTO_UNSUPPORTED;
+
+	printk(BIOS_DEBUG, "Using CPU SHA256 instructions for %u bytes\n",
+	       data_size);
+
+	sha256_cpu_init(&hwcrypto_ctx);
+	return VB2_SUCCESS;
+}
+
+vb2_error_t vb2ex_hwcrypto_digest_extend(const uint8_t *buf, uint32_t size)
+{
+	sha256_cpu_update(&hwcrypto_ctx, buf, size);
+	return VB2_SUCCESS;
+}
+
+vb2_error_t vb2ex_hwcrypto_digest_finalize(uint8_t *digest,
+					   uint32_t digest_size)
+{
+	if (digest_size < SHA256_CPU_DIGEST_SIZE)
+		return VB2_ERROR_UNKNOWN;
+
+	sha256_cpu_final(&hwcrypto_ctx, digest);
+	return VB2_SUCCESS;
+}
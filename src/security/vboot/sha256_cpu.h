@@ -0,0 +1,58 @@
+/*
+ * This file is part of the coreboot project.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#ifndef __SECURITY_VBOOT_SHA256_CPU_H__
+#define __SECURITY_VBOOT_SHA256_CPU_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define SHA256_CPU_BLOCK_SIZE	64
+#define SHA256_CPU_DIGEST_SIZE	32
+
+/* SHA-256 computed with the CPU's SHA instructions. */
+struct sha256_cpu_ctx {
+	uint32_t state[8];
+	uint8_t block[SHA256_CPU_BLOCK_SIZE];
+	size_t block_used;
+	uint64_t total;
+};
+
+/*
+ * Implemented by the architecture (SHA-NI on x86, the ARMv8 Cryptography
+ * Extensions on arm64). sha256_cpu_supported() returns 1 if the instructions
+ * exist and may be used right now, 0 otherwise. sha256_cpu_blocks() runs the
+ * compression function over the given number of 64 byte blocks.
+ */
+int sha256_cpu_supported(void);
+void sha256_cpu_blocks(uint32_t state[8], const uint8_t *data, size_t blocks);
+
+#if CONFIG(VBOOT_HWCRYPTO_CPU_SHA256)
+static inline int sha256_cpu_available(void)
+{
+	return sha256_cpu_supported();
+}
+#else
+static inline int sha256_cpu_available(void)
+{
+	return 0;
+}
+#endif
+
+void sha256_cpu_init(struct sha256_cpu_ctx *ctx);
+void sha256_cpu_update(struct sha256_cpu_ctx *ctx, const void *data,
+		       size_t size);
+void sha256_cpu_final(struct sha256_cpu_ctx *ctx,
+		      uint8_t digest[SHA256_CPU_DIGEST_SIZE]);
+
+#endif /* __SECURITY_VBOOT_SHA256_CPU_H__ */
@@ -55,6 +55,22 @@ int vboot_retrieve_hash(void *digest, size_t digest_size);
  */
 int vboot_platform_is_resuming(void);
 
+/* ========================== FIRMWARE BODY READ =========================== */
+/*
+ * With VBOOT_ASYNC_BODY_READ the platform can transfer the next block of the
+ * RW firmware body from the boot device while the current one is hashed.
+ *
+ * vboot_body_read_start() starts reading size bytes at offset of rdev into
+ * buf. Returns 0 when the read has been started (or completed), < 0 on error.
+ * The default implementation reads synchronously.
+ *
+ * vboot_body_read_wait() waits for the read into buf to complete. Returns 0
+ * on success, < 0 on error. Only one read is outstanding at any time.
+ */
+int vboot_body_read_start(const struct region_device *rdev, void *buf,
+			  size_t offset, size_t size);
+int vboot_body_read_wait(void *buf);
+
 /* ============================= VERSTAGE ================================== */
 /*
  * Main logic for verified boot. verstage_main() is just the core vboot logic.
@@ -13,10 +13,12 @@
  * GNU General Public License for more details.
  */
 
+#include <commonlib/helpers.h>
 #include <console/console.h>
 #include <fmap.h>
 #include <cbfs.h>
 #include <security/vboot/vboot_crtm.h>
+#include <rules.h>
 #include <security/vboot/misc.h>
 #include <string.h>
 
@@ -157,39 +159,160 @@ static bool is_runtime_data(const char *name)
 	return false;
 }
 
-uint32_t vboot_measure_cbfs_hook(struct cbfsf *fh, const char *name)
+static int cbfs_measure_info(struct cbfsf *fh, const char *name,
+			     const struct region_device *rdev, uint8_t *pcr,
+			     char tcpa_metadata[TCPA_PCR_HASH_NAME])
 {
-	uint32_t pcr_index;
 	uint32_t cbfs_type;
-	struct region_device rdev;
-	char tcpa_metadata[TCPA_PCR_HASH_NAME];
-
-	if (!vboot_logic_executed())
-		return 0;
 
 	cbfsf_file_type(fh, &cbfs_type);
-	cbfs_file_data(&rdev, fh);
 
 	switch (cbfs_type) {
 	case CBFS_TYPE_MRC:
 	case CBFS_TYPE_MRC_CACHE:
-		pcr_index = TPM_RUNTIME_DATA_PCR;
+		*pcr = TPM_RUNTIME_DATA_PCR;
 		break;
 	case CBFS_TYPE_STAGE:
 	case CBFS_TYPE_SELF:
 	case CBFS_TYPE_FIT:
-		pcr_index = TPM_CRTM_PCR;
+		*pcr = TPM_CRTM_PCR;
 		break;
 	default:
 		if (is_runtime_data(name))
-			pcr_index = TPM_RUNTIME_DATA_PCR;
+			*pcr = TPM_RUNTIME_DATA_PCR;
 		else
-			pcr_index = TPM_CRTM_PCR;
+			*pcr = TPM_CRTM_PCR;
 		break;
 	}
 
-	if (create_tcpa_metadata(&rdev, name, tcpa_metadata) < 0)
+	return create_tcpa_metadata(rdev, name, tcpa_metadata);
+}
+
+uint32_t vboot_measure_cbfs_hook(struct cbfsf *fh, const char *name)
+{
+	uint8_t pcr_index;
+	struct region_device rdev;
+	char tcpa_metadata[TCPA_PCR_HASH_NAME];
+	uint32_t result;
+
+	if (!vboot_logic_executed())
+		return 0;
+
+	/* Keep the PCR extends in the order the files were located. */
+	result = vboot_measure_cbfs_flush();
+	if (result)
+		return result;
+
+	cbfs_file_data(&rdev, fh);
+
+	if (cbfs_measure_info(fh, name, &rdev, &pcr_index, tcpa_metadata) < 0)
 		return VB2_ERROR_UNKNOWN;
 
 	return tpm_measure_region(&rdev, pcr_index, tcpa_metadata);
 }
+
+/*
+ * A program located through vboot_measure_cbfs_defer(). Its loader hands
+ * the bytes it reads to vboot_measure_cbfs_data() and whatever wasn't seen
+ * in order is read back from the boot device by vboot_measure_cbfs_flush().
+ */
+static struct {
+	bool pending;
+	bool failed;
+	struct region_device rdev;
+	size_t hashed;
+	uint8_t pcr;
+	char tcpa_metadata[TCPA_PCR_HASH_NAME];
+	struct tpm_measure_ctx ctx;
+} deferred;
+
+static bool measure_while_loading(void)
+{
+	/* Stages running from CAR can't keep the digest state around. */
+	return CONFIG(VBOOT_MEASURE_WHILE_LOADING) &&
+		ENV_STAGE_HAS_DATA_SECTION;
+}
+
+uint32_t vboot_measure_cbfs_defer(struct cbfsf *fh, const char *name)
+{
+	uint32_t result;
+
+	if (!measure_while_loading())
+		return vboot_measure_cbfs_hook(fh, name);
+
+	if (!vboot_logic_executed())
+		return 0;
+
+	/* Only one program is tracked at a time. */
+	result = vboot_measure_cbfs_flush();
+	if (result)
+		return result;
+
+	cbfs_file_data(&deferred.rdev, fh);
+
+	if (cbfs_measure_info(fh, name, &deferred.rdev, &deferred.pcr,
+			      deferred.tcpa_metadata) < 0)
+		return VB2_ERROR_UNKNOWN;
+
+	result = tpm_measure_init(&deferred.ctx);
+	if (result)
+		return result;
+
+	deferred.hashed = 0;
+	deferred.failed = false;
+	deferred.pending = true;
+
+	return 0;
+}
+
+void vboot_measure_cbfs_data(const struct region_device *rdev,
+			     const void *buf, size_t offset, size_t size)
+{
+	ssize_t base;
+
+	if (!measure_while_loading() || !deferred.pending || deferred.failed)
+		return;
+
+	base = rdev_relative_offset(&deferred.rdev, rdev);
+	if (base < 0)
+		return;
+
+	/* Only data continuing the digest can be used, the rest is reread. */
+	if (base + offset != deferred.hashed)
+		return;
+
+	size = MIN(size, region_device_sz(&deferred.rdev) - deferred.hashed);
+	if (tpm_measure_update(&deferred.ctx, buf, size)) {
+		deferred.failed = true;
+		return;
+	}
+
+	deferred.hashed += size;
+}
+
+uint32_t vboot_measure_cbfs_flush(void)
+{
+	uint32_t result;
+
+	if (!measure_while_loading() || !deferred.pending)
+		return 0;
+
+	deferred.pending = false;
+
+	if (deferred.failed)
+		return TPM_E_HASH_ERROR;
+
+	if (deferred.hashed < region_device_sz(&deferred.rdev))
+		printk(BIOS_DEBUG, "VBOOT: Reading %zu bytes of %s to measure it.\n",
+		       region_device_sz(&deferred.rdev) - deferred.hashed,
+		       deferred.tcpa_metadata);
+
+	result = tpm_measure_update_region(&deferred.ctx, &deferred.rdev,
+					   deferred.hashed,
+					   deferred.tcpa_metadata);
+	if (result)
+		return result;
+
+	return tpm_measure_finish(&deferred.ctx, deferred.pcr,
+				  deferred.tcpa_metadata);
+}
@@ -54,8 +54,36 @@ uint32_t vboot_init_crtm(void);
  */
 uint32_t vboot_measure_cbfs_hook(struct cbfsf *fh, const char *name);
 
+/*
+ * Like vboot_measure_cbfs_hook(), but with VBOOT_MEASURE_WHILE_LOADING the
+ * digest is computed from the data the loader reads anyway, reported via
+ * vboot_measure_cbfs_data(). The PCR is extended by
+ * vboot_measure_cbfs_flush(), which must be called before the data is
+ * trusted or executed. Locating another file flushes the previous one.
+ * return 0 if successful, else an error
+ */
+uint32_t vboot_measure_cbfs_defer(struct cbfsf *fh, const char *name);
+
+/*
+ * Report data read from rdev at offset to the deferred measurement. Data
+ * that doesn't belong to the file or doesn't continue the digest in order
+ * is ignored.
+ */
+void vboot_measure_cbfs_data(const struct region_device *rdev,
+			     const void *buf, size_t offset, size_t size);
+
+/*
+ * Complete the deferred measurement, hashing any part of the file the
+ * loader didn't report, and extend the PCR with it.
+ * return 0 if successful or nothing is pending, else an error
+ */
+uint32_t vboot_measure_cbfs_flush(void);
+
 #else
 #define vboot_measure_cbfs_hook(fh, name) 0
+#define vboot_measure_cbfs_defer(fh, name) 0
+#define vboot_measure_cbfs_data(rdev, buf, offset, size) do { } while (0)
+#define vboot_measure_cbfs_flush() 0
 #endif
 
 #endif /* __VBOOT_VBOOT_CRTM_H__ */
@@ -31,7 +31,11 @@
 /* The max hash size to expect is for SHA512. */
 #define VBOOT_MAX_HASH_SIZE VB2_SHA512_DIGEST_SIZE
 
-#define TODO_BLOCK_SIZE 1024
+#define HASH_BLOCK_SIZE CONFIG_VBOOT_HASH_BLOCK_SIZE
+#define HASH_BUFFERS (CONFIG(VBOOT_ASYNC_BODY_READ) ? 2 : 1)
+
+/* hash_body() never gets to the end with empty blocks. */
+_Static_assert(HASH_BLOCK_SIZE > 0, "VBOOT_HASH_BLOCK_SIZE must not be 0");
 
 /* exports */
 
@@ -151,16 +155,48 @@ static int handle_digest_result(void *slot_hash, size_t slot_hash_sz)
 	return 0;
 }
 
+int __weak vboot_body_read_start(const struct region_device *rdev, void *buf,
+				 size_t offset, size_t size)
+{
+	if (rdev_readat(rdev, buf, offset, size) != size)
+		return -1;
+
+	return 0;
+}
+
+int __weak vboot_body_read_wait(void *buf)
+{
+	return 0;
+}
+
+static int start_body_read(const struct region_device *fw_body, void *buf,
+			   size_t offset, size_t size, uint64_t *load_ts)
+{
+	uint64_t temp_ts;
+	int ret;
+
+	if (!size)
+		return 0;
+
+	temp_ts = timestamp_get();
+	ret = vboot_body_read_start(fw_body, buf, offset, size);
+	*load_ts += timestamp_get() - temp_ts;
+
+	return ret < 0 ? -1 : 0;
+}
+
 static vb2_error_t hash_body(struct vb2_context *ctx,
 			     struct region_device *fw_body)
 {
 	uint64_t load_ts;
 	uint32_t remaining;
-	uint8_t block[TODO_BLOCK_SIZE];
+	uint8_t block[HASH_BUFFERS][HASH_BLOCK_SIZE];
 	uint8_t hash_digest[VBOOT_MAX_HASH_SIZE];
 	const size_t hash_digest_sz = sizeof(hash_digest);
-	size_t block_size = sizeof(block);
+	size_t block_size, next_size;
 	size_t offset;
+	uint64_t temp_ts;
+	int cur = 0, next;
 	vb2_error_t rv;
 
 	/* Clear the full digest so that any hash digests less than the
@@ -172,6 +208,8 @@ static vb2_error_t hash_body(struct vb2_context *ctx,
 	 * we use this little trick to measure them separately and pretend it
 	 * was first loaded and then hashed in one piece with the timestamps.
 	 * (This split won't make sense with memory-mapped media like on x86.)
+	 * With asynchronous reads only the time spent waiting for the boot
+	 * device is counted as loading.
 	 */
 	load_ts = timestamp_get();
 	timestamp_add(TS_START_HASH_BODY, load_ts);
@@ -184,23 +222,41 @@ static vb2_error_t hash_body(struct vb2_context *ctx,
 	if (rv)
 		return rv;
 
+	block_size = MIN(sizeof(block[0]), remaining);
+	if (start_body_read(fw_body, block[cur], offset, block_size, &load_ts))
+		return VB2_ERROR_UNKNOWN;
+
 	/* Extend over the body */
 	while (remaining) {
-		uint64_t temp_ts;
-		if (block_size > remaining)
-			block_size = remaining;
-
 		temp_ts = timestamp_get();
-		if (rdev_readat(fw_body, block, offset, block_size) < 0)
+		if (vboot_body_read_wait(block[cur]) < 0)
 			return VB2_ERROR_UNKNOWN;
 		load_ts += timestamp_get() - temp_ts;
 
-		rv = vb2api_extend_hash(ctx, block, block_size);
-		if (rv)
+		next = (cur + 1) % HASH_BUFFERS;
+		next_size = MIN(sizeof(block[0]), remaining - block_size);
+
+		/* With a spare buffer the next read overlaps the hashing. */
+		if (next != cur && start_body_read(fw_body, block[next],
+				offset + block_size, next_size, &load_ts))
+			return VB2_ERROR_UNKNOWN;
+
+		rv = vb2api_extend_hash(ctx, block[cur], block_size);
+		if (rv) {
+			/* Don't leave a transfer into the stack behind. */
+			if (next != cur && next_size)
+				vboot_body_read_wait(block[next]);
 			return rv;
+		}
+
+		if (next == cur && start_body_read(fw_body, block[next],
+				offset + block_size, next_size, &load_ts))
+			return VB2_ERROR_UNKNOWN;
 
 		remaining -= block_size;
 		offset += block_size;
+		block_size = next_size;
+		cur = next;
 	}
 
 	timestamp_add(TS_DONE_LOADING, load_ts);
@@ -230,17 +230,23 @@ void smm_initialize(void)
 		printk(BIOS_DEBUG, "Doing parallel SMM relocation.\n");
 }
 
+/*
+ * If smm_save_state_in_msrs is non-zero then the APs are relocated in
+ * parallel by mp_init. It runs the relocation handler a second time on the
+ * BSP after them to do the final move.
+ */
+int smm_relocation_parallel(void)
+{
+	return smm_reloc_params.smm_save_state_in_msrs;
+}
+
 void smm_relocate(void)
 {
 	/*
-	 * If smm_save_state_in_msrs is non-zero then parallel SMM relocation
-	 * shall take place. Run the relocation handler a second time on the
-	 * BSP to do * the final move. For APs, a relocation handler always
-	 * needs to be run.
+	 * Serialized SMM relocation: the BSP was relocated in
+	 * smm_initialize(), the APs go one after another.
 	 */
-	if (smm_reloc_params.smm_save_state_in_msrs)
-		smm_initiate_relocation_parallel();
-	else if (!boot_cpu())
+	if (!boot_cpu())
 		smm_initiate_relocation();
 }
 
@@ -24,6 +24,7 @@
 #include <cpu/intel/turbo.h>
 #include <cpu/x86/msr.h>
 #include <cpu/x86/smm.h>
+#include <drivers/intel/gma/opregion.h>
 #include <intelblocks/acpi.h>
 #include <intelblocks/msr.h>
 #include <intelblocks/pmclib.h>
@@ -228,7 +229,7 @@ __weak void acpi_create_gnvs(struct global_nvs_t *gnvs)
 {
 }
 
-void southbridge_inject_dsdt(struct device *device)
+static struct global_nvs_t *setup_gnvs(void)
 {
 	struct global_nvs_t *gnvs;
 
@@ -243,7 +244,32 @@ void southbridge_inject_dsdt(struct device *device)
 		acpi_create_gnvs(gnvs);
 		/* And tell SMI about it */
 		smm_setup_structures(gnvs, NULL, NULL);
+	}
 
+	return gnvs;
+}
+
+#if CONFIG(ACPI_TABLE_CACHE)
+/*
+ * Cached tables still need GNVS to be filled in and handed to SMM, and the
+ * IGD OpRegion to be registered.
+ */
+void acpi_table_cache_restored(void)
+{
+	setup_gnvs();
+
+	if (CONFIG(INTEL_GMA_ACPI))
+		intel_gma_restore_cached_opregion();
+}
+#endif
+
+void southbridge_inject_dsdt(struct device *device)
+{
+	struct global_nvs_t *gnvs;
+
+	gnvs = setup_gnvs();
+
+	if (gnvs) {
 		/* Add it to DSDT.  */
 		acpigen_write_scope("\\");
 		acpigen_write_name_dword("NVSA", (uintptr_t) gnvs);
@@ -17,11 +17,13 @@
 
 #include <device/mmio.h>
 #include <assert.h>
+#include <boot_device.h>
 #include <console/console.h>
 #include <spi_flash.h>
 #include <spi-generic.h>
 #include <stdint.h>
 #include <string.h>
+#include <security/vboot/vboot_common.h>
 #include <symbols.h>
 #include <timer.h>
 #include <soc/symbols.h>
@@ -108,15 +110,8 @@ static int sector_erase(int offset)
 	return 0;
 }
 
-static int dma_read(u32 addr, u8 *buf, u32 len, uintptr_t dma_buf,
-		    size_t dma_buf_len)
+static void dma_read_start(u32 addr, u32 len, uintptr_t dma_buf)
 {
-	struct stopwatch sw;
-
-	assert(IS_ALIGNED((uintptr_t)buf, SFLASH_DMA_ALIGN) &&
-	       IS_ALIGNED(len, SFLASH_DMA_ALIGN) &&
-	       len <= dma_buf_len);
-
 	/* do dma reset */
 	write32(&mt8173_nor->fdma_ctl, SFLASH_DMA_SW_RESET);
 	write32(&mt8173_nor->fdma_ctl, SFLASH_DMA_WDLE_EN);
@@ -126,6 +121,11 @@ static int dma_read(u32 addr, u8 *buf, u32 len, uintptr_t dma_buf,
 	write32(&mt8173_nor->fdma_end_dadr, (dma_buf + len));
 	/* start dma */
 	write32(&mt8173_nor->fdma_ctl, SFLASH_DMA_TRIGGER | SFLASH_DMA_WDLE_EN);
+}
+
+static int dma_read_wait(void)
+{
+	struct stopwatch sw;
 
 	stopwatch_init_usecs_expire(&sw, SFLASH_POLLINGREG_US);
 	while ((read32(&mt8173_nor->fdma_ctl) & SFLASH_DMA_TRIGGER) != 0) {
@@ -135,6 +135,20 @@ static int dma_read(u32 addr, u8 *buf, u32 len, uintptr_t dma_buf,
 		}
 	}
 
+	return 0;
+}
+
+static int dma_read(u32 addr, u8 *buf, u32 len, uintptr_t dma_buf,
+		    size_t dma_buf_len)
+{
+	assert(IS_ALIGNED((uintptr_t)buf, SFLASH_DMA_ALIGN) &&
+	       IS_ALIGNED(len, SFLASH_DMA_ALIGN) &&
+	       len <= dma_buf_len);
+
+	dma_read_start(addr, len, dma_buf);
+	if (dma_read_wait())
+		return -1;
+
 	memcpy(buf, (const void *)dma_buf, len);
 	return 0;
 }
@@ -152,6 +166,17 @@ static int pio_read(u32 addr, u8 *buf, u32 len)
 	return 0;
 }
 
+static void get_dma_buf(uintptr_t *dma_buf, size_t *dma_buf_len)
+{
+	if (ENV_BOOTBLOCK || ENV_VERSTAGE) {
+		*dma_buf = (uintptr_t)_dma_coherent;
+		*dma_buf_len = REGION_SIZE(dma_coherent);
+	} else {
+		*dma_buf = (uintptr_t)_dram_dma;
+		*dma_buf_len = REGION_SIZE(dram_dma);
+	}
+}
+
 static int nor_read(const struct spi_flash *flash, u32 addr, size_t len,
 		void *buf)
 {
@@ -169,13 +194,7 @@ static int nor_read(const struct spi_flash *flash, u32 addr, size_t len,
 		done += next;
 	}
 
-	if (ENV_BOOTBLOCK || ENV_VERSTAGE) {
-		dma_buf = (uintptr_t)_dma_coherent;
-		dma_buf_len = REGION_SIZE(dma_coherent);
-	} else {
-		dma_buf = (uintptr_t)_dram_dma;
-		dma_buf_len = REGION_SIZE(dram_dma);
-	}
+	get_dma_buf(&dma_buf, &dma_buf_len);
 
 	while (len - done >= SFLASH_DMA_ALIGN) {
 		next = MIN(dma_buf_len, ALIGN_DOWN(len - done,
@@ -234,6 +253,56 @@ const struct spi_flash_ops spi_flash_ops = {
 	.erase = nor_erase,
 };
 
+#if CONFIG(VBOOT_ASYNC_BODY_READ)
+/*
+ * The RW firmware body is read by DMA into the DMA buffer while verstage
+ * hashes the previous block, and only copied out once it is waited for.
+ * Reads the DMA engine can't do go through the boot device right away.
+ */
+static struct {
+	bool busy;
+	uintptr_t dma_buf;
+	u32 len;
+} body_read;
+
+int vboot_body_read_start(const struct region_device *rdev, void *buf,
+			  size_t offset, size_t size)
+{
+	ssize_t base = rdev_relative_offset(boot_device_ro(), rdev);
+	size_t dma_buf_len;
+
+	assert(!body_read.busy);
+
+	get_dma_buf(&body_read.dma_buf, &dma_buf_len);
+
+	if (base < 0 || !IS_ALIGNED(size, SFLASH_DMA_ALIGN) ||
+	    size > dma_buf_len) {
+		if (rdev_readat(rdev, buf, offset, size) != size)
+			return -1;
+		return 0;
+	}
+
+	body_read.busy = true;
+	body_read.len = size;
+	dma_read_start(base + offset, size, body_read.dma_buf);
+
+	return 0;
+}
+
+int vboot_body_read_wait(void *buf)
+{
+	if (!body_read.busy)
+		return 0;
+
+	body_read.busy = false;
+	if (dma_read_wait())
+		return -1;
+
+	memcpy(buf, (const void *)body_read.dma_buf, body_read.len);
+	return 0;
+}
+#endif
+
 int mtk_spi_flash_probe(const struct spi_slave *spi,
 				struct spi_flash *flash)
 {
@@ -33,6 +33,12 @@ static int lz4_compress(char *in, int in_len, char *out, int *out_len)
 			.blockSizeID = max4MB,
 			.blockMode = blockIndependent,
 			.contentChecksumFlag = noContentChecksum,
+			/*
+			 * Record the size, so that loaders can tell if there
+			 * is room to decompress in place. Set to the input
+			 * size by LZ4F_compressFrame().
+			 */
+			.contentSize = 1,
 		},
 	};
 	size_t worst_size = LZ4F_compressFrameBound(in_len, &prefs);
@@ -0,0 +1,274 @@
+/*
+ * This file is part of the coreboot project.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+/*
+ * Host harness for the bounded output buffer of src/arch/x86/acpigen.c. It
+ * generates random AML of nested scopes, devices, methods, packages and
+ * resource templates into the unbounded default buffer, like the table
+ * code did so far, and again into bounded buffers of random size. A buffer
+ * that is large enough must get the same bytes. A smaller one must be
+ * marked as overflowed, report the size the AML needs and leave the memory
+ * past its end untouched. Nesting deeper than the length stack and
+ * unbalanced scopes must be reported the same way.
+ */
+
+#include "../../src/arch/x86/acpigen.c"
+
+#include "harness.h"
+
+/* Used by generators the harness doesn't run */
+
+void search_global_resources(unsigned long type_mask, unsigned long type,
+			     resource_search_t search, void *gp)
+{
+	exit(1);
+}
+
+size_t hexstrtobin(const char *str, uint8_t *buf, size_t len)
+{
+	exit(1);
+}
+
+int acpi_pld_to_buffer(const struct acpi_pld *pld, uint8_t *buf, int buf_len)
+{
+	exit(1);
+}
+
+/*
+ * The same AML is generated several times, so it is driven by a generator
+ * of its own that is seeded from next().
+ */
+static uint32_t aml_state;
+
+static unsigned int aml_next(unsigned int range)
+{
+	aml_state = aml_state * 1103515245 + 12345;
+	return (aml_state >> 16) % range;
+}
+
+static const char *const names[] = {
+	"\\_SB", "PCI0", "\\_SB.PCI0", "\\_SB.PCI0.LPCB", "\\_SB.PCI0.LPCB.EC0",
+	"_HID", "_STA", "DEV0",
+};
+
+static int max_depth;
+
+static void gen_objects(int depth);
+
+static void gen_object(int depth)
+{
+	const char *name = names[aml_next(ARRAY_SIZE(names))];
+	unsigned int i, n;
+	char *count;
+
+	switch (aml_next(depth < max_depth ? 7 : 4)) {
+	case 0:
+		acpigen_write_name_integer(name, (uint64_t)aml_next(65536) <<
+					   aml_next(48));
+		break;
+	case 1:
+		acpigen_write_name(name);
+		acpigen_write_string(names[aml_next(ARRAY_SIZE(names))]);
+		break;
+	case 2:
+		acpigen_write_resourcetemplate_header();
+		n = aml_next(4);
+		for (i = 0; i < n; i++) {
+			if (aml_next(2))
+				acpigen_write_mem32fixed(1, aml_next(65536) << 12,
+							 4096);
+			else
+				acpigen_write_io16(0x60, 0x64, 1, 1, 1);
+		}
+		acpigen_write_resourcetemplate_footer();
+		break;
+	case 3:
+		/* A package whose element count is patched as it grows */
+		acpigen_write_name(name);
+		count = acpigen_write_package(0);
+		n = aml_next(8);
+		for (i = 0; i < n; i++) {
+			acpigen_write_integer(aml_next(300));
+			if (count)
+				(*count)++;
+		}
+		acpigen_pop_len();
+		break;
+	case 4:
+		acpigen_write_scope(name);
+		gen_objects(depth + 1);
+		acpigen_pop_len();
+		break;
+	case 5:
+		acpigen_write_device(name);
+		gen_objects(depth + 1);
+		acpigen_pop_len();
+		break;
+	default:
+		acpigen_write_method(name, aml_next(3));
+		acpigen_write_return_integer(aml_next(2));
+		acpigen_pop_len();
+		break;
+	}
+}
+
+static void gen_objects(int depth)
+{
+	unsigned int n = aml_next(depth ? 4 : 12) + 1;
+
+	while (n--)
+		gen_object(depth);
+}
+
+/* All of it goes into one scope, whose length is checked as well. */
+static void gen_aml(uint32_t seed)
+{
+	aml_state = seed;
+	acpigen_write_scope("\\_SB");
+	gen_objects(1);
+	acpigen_pop_len();
+}
+
+#define MAX_AML		(512 * 1024)
+#define GUARD		64
+
+static char ref[MAX_AML];
+static char out[MAX_AML + GUARD];
+static unsigned long generated, bounded;
+
+static void fail(const char *what, size_t size)
+{
+	printf("FAIL: %s for %zu bytes of AML\n", what, size);
+	exit(1);
+}
+
+static size_t pkg_length(const char *p)
+{
+	const uint8_t *b = (const uint8_t *)p;
+	const unsigned int extra = b[0] >> 6;
+
+	if (!extra)
+		return b[0] & 0x3f;
+	/* acpigen always writes the 3 byte form. */
+	return (b[0] & 0xf) | b[1] << 4 | b[2] << 12;
+}
+
+static void check_aml(void)
+{
+	const uint32_t seed = next(65536) << 16 | next(65536);
+	struct acpigen_buf buf, *prev;
+	size_t size, room;
+	int i;
+
+	max_depth = next(ACPIGEN_LENSTACK_SIZE - 1);
+
+	/* Reference into the unbounded default buffer */
+	acpigen_set_current(ref);
+	gen_aml(seed);
+	size = acpigen_get_current() - ref;
+	if (size > MAX_AML)
+		fail("reference overran its buffer", size);
+	if (ref[0] != SCOPE_OP || pkg_length(&ref[1]) != size - 1)
+		fail("wrong length of the outer scope", size);
+	generated++;
+
+	for (i = 0; i < 4; i++) {
+		switch (next(4)) {
+		case 0:
+			room = size;
+			break;
+		case 1:
+			room = size + next(GUARD);
+			break;
+		default:
+			room = next(size + 1);
+			break;
+		}
+
+		memset(out, 0xa5, sizeof(out));
+		acpigen_buf_init(&buf, out, room);
+		prev = acpigen_buf_select(&buf);
+		gen_aml(seed);
+		if (acpigen_buf_select(prev) != &buf)
+			fail("other buffer selected", size);
+
+		if (acpigen_buf_used(&buf) != size)
+			fail("used size differs from the reference", size);
+		if (acpigen_buf_overflowed(&buf) != (room < size))
+			fail(room < size ? "overflow not reported" :
+			     "overflow reported although it fits", size);
+		if (memcmp(out, ref, MIN(room, size)) && room >= size)
+			fail("output differs from the reference", size);
+		for (; room < size + GUARD; room++)
+			if (out[room] != (char)0xa5)
+				fail("write past the end of the buffer", size);
+		bounded++;
+	}
+}
+
+/* Too deep nesting and unbalanced scopes are reported, not followed. */
+static void check_nesting(void)
+{
+	const int depth = ACPIGEN_LENSTACK_SIZE + 1 + next(8);
+	struct acpigen_buf buf, *prev;
+	const size_t room = next(256);
+	int i;
+
+	memset(out, 0xa5, sizeof(out));
+	acpigen_buf_init(&buf, out, room);
+	prev = acpigen_buf_select(&buf);
+	for (i = 0; i < depth; i++)
+		acpigen_write_scope("DEV0");
+	for (i = 0; i < depth; i++)
+		acpigen_pop_len();
+	acpigen_buf_select(prev);
+	if (!acpigen_buf_overflowed(&buf) || buf.ltop)
+		fail("too deep nesting not reported", acpigen_buf_used(&buf));
+
+	acpigen_buf_init(&buf, out, room);
+	prev = acpigen_buf_select(&buf);
+	acpigen_write_scope("DEV0");
+	acpigen_pop_len();
+	acpigen_pop_len();
+	acpigen_write_resourcetemplate_footer();
+	acpigen_buf_select(prev);
+	if (!acpigen_buf_overflowed(&buf))
+		fail("unbalanced scopes not reported", acpigen_buf_used(&buf));
+
+	for (i = room; i < (int)room + GUARD; i++)
+		if (out[i] != (char)0xa5)
+			fail("write past the end of the buffer", room);
+}
+
+int main(int argc, char **argv)
+{
+	unsigned int seed;
+	int i;
+
+	if (read_input(argc, argv)) {
+		check_aml();
+		check_nesting();
+		return 0;
+	}
+
+	for (seed = 0; seed < 20; seed++) {
+		srand(seed);
+		for (i = 0; i < 50; i++) {
+			check_aml();
+			check_nesting();
+		}
+	}
+	printf("acpigen-buf-test: %lu AML objects, %lu bounded buffers ok\n",
+	       generated, bounded);
+	return 0;
+}
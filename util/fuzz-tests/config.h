@@ -0,0 +1,15 @@
+/*
+ * Stands in for the build/config.h of a coreboot build, so that host
+ * harnesses can include coreboot sources. Only the options that the
+ * included headers need unconditionally are defined here. Harnesses add
+ * the ones they test with -D.
+ */
+#ifndef FUZZ_TESTS_CONFIG_H
+#define FUZZ_TESTS_CONFIG_H
+
+#define CONFIG_DEFAULT_CONSOLE_LOGLEVEL 0
+#define CONFIG_STACK_SIZE 0x1000
+#define CONFIG_MMCONF_BASE_ADDRESS 0xe0000000
+#define CONFIG_MMCONF_BUS_NUMBER 256
+
+#endif
@@ -0,0 +1,87 @@
+/*
+ * This file is part of the coreboot project.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+/*
+ * Common part of the host harnesses. They are built against the coreboot
+ * headers instead of the C library's, so the few C library functions they
+ * use are declared here. Include it after the coreboot sources under test.
+ */
+#ifndef FUZZ_TESTS_HARNESS_H
+#define FUZZ_TESTS_HARNESS_H
+
+#include <console/console.h>
+#include <stddef.h>
+#include <stdint.h>
+
+int printf(const char *fmt, ...);
+int rand(void);
+void srand(unsigned int seed);
+void exit(int status) __attribute__((noreturn));
+void *fopen(const char *path, const char *mode);
+size_t fread(void *ptr, size_t size, size_t n, void *f);
+
+/* Console output is dropped, errors are only counted. */
+static int errors_printed;
+
+int do_printk(int msg_level, const char *fmt, ...)
+{
+	if (msg_level <= BIOS_ERR)
+		errors_printed++;
+	return 0;
+}
+
+/* Source of the test cases: fuzzer input, or rand() if there is none */
+
+static const uint8_t *input;
+static size_t input_size;
+
+static unsigned int next(unsigned int range)
+{
+	unsigned int v;
+
+	if (input) {
+		if (!input_size)
+			return 0;
+		v = *input++;
+		input_size--;
+		if (range > 256 && input_size) {
+			v = v << 8 | *input++;
+			input_size--;
+		}
+	} else {
+		v = rand();
+	}
+	return range ? v % range : 0;
+}
+
+/*
+ * Make the file given as argument the input of next(), so afl-fuzz can
+ * drive the harness. Returns 0 if there is none and the harness should run
+ * on random seeds instead.
+ */
+static int read_input(int argc, char **argv)
+{
+	static uint8_t buf[65536];
+	void *f;
+
+	if (argc < 2)
+		return 0;
+	f = fopen(argv[1], "rb");
+	if (!f)
+		exit(1);
+	input = buf;
+	input_size = fread(buf, 1, sizeof(buf), f);
+	return 1;
+}
+
+#endif
@@ -0,0 +1,351 @@
+/*
+ * This file is part of the coreboot project.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+/*
+ * Power-cut harness for the banked mode of src/lib/region_file.c. The file
+ * lives on a simulated NOR flash where writes can only clear bits and erases
+ * work on whole sectors. Every update and erase-ahead is first run to the
+ * end to count its flash operations, then run again with the power cut at
+ * each of those points. A cut write leaves its last byte half programmed and
+ * a cut erase leaves its sector with random contents. After every cut the
+ * file is opened again like on the next boot and must return the previously
+ * committed data or the new data, if the update switched banks or was an
+ * erase-ahead. Updates within a bank behave like a plain region file: a cut
+ * may also leave torn data, which users like mrc_cache catch with their own
+ * checksum, or no data at all if the metadata write was torn. In any case
+ * the file must keep taking updates afterwards.
+ */
+
+#include "../../src/commonlib/region.c"
+#include "../../src/lib/region_file.c"
+
+#include "harness.h"
+
+void *mem_pool_alloc(struct mem_pool *mp, size_t sz)
+{
+	return NULL;
+}
+
+void mem_pool_free(struct mem_pool *mp, void *p) {}
+
+/* Simulated NOR flash */
+
+#define SECTOR_SIZE	4096
+#define FLASH_SIZE	(4 * SECTOR_SIZE)
+
+static u8 flash[FLASH_SIZE];
+/* Index of the flash operation the power is cut at, < 0 for never */
+static long cut_at = -1;
+static long power_ops;
+
+enum { POWER_ON, POWER_CUT, POWER_OFF };
+
+static int power_op(void)
+{
+	const long op = power_ops++;
+
+	if (cut_at < 0 || op < cut_at)
+		return POWER_ON;
+	return op == cut_at ? POWER_CUT : POWER_OFF;
+}
+
+static int power_lost(void)
+{
+	return cut_at >= 0 && power_ops > cut_at;
+}
+
+static void *flash_mmap(const struct region_device *rd, size_t offset,
+			size_t size)
+{
+	return power_lost() ? NULL : &flash[offset];
+}
+
+static int flash_munmap(const struct region_device *rd, void *mapping)
+{
+	return 0;
+}
+
+static ssize_t flash_readat(const struct region_device *rd, void *b,
+			    size_t offset, size_t size)
+{
+	if (power_lost())
+		return -1;
+	memcpy(b, &flash[offset], size);
+	return size;
+}
+
+static ssize_t flash_writeat(const struct region_device *rd, const void *b,
+			     size_t offset, size_t size)
+{
+	const u8 *p = b;
+	size_t i;
+
+	for (i = 0; i < size; i++) {
+		switch (power_op()) {
+		case POWER_CUT:
+			/* Some of the bits of a cut write made it. */
+			flash[offset + i] &= p[i] | next(256);
+			return -1;
+		case POWER_OFF:
+			return -1;
+		}
+		flash[offset + i] &= p[i];
+	}
+	return size;
+}
+
+static ssize_t flash_eraseat(const struct region_device *rd, size_t offset,
+			     size_t size)
+{
+	size_t i, j;
+
+	if (offset % SECTOR_SIZE || size % SECTOR_SIZE) {
+		printf("FAIL: unaligned erase 0x%zx+0x%zx\n", offset, size);
+		exit(1);
+	}
+
+	for (i = 0; i < size; i += SECTOR_SIZE) {
+		switch (power_op()) {
+		case POWER_CUT:
+			/* A cut erase leaves the sector in any state. */
+			for (j = 0; j < SECTOR_SIZE; j++)
+				flash[offset + i + j] = next(256);
+			return -1;
+		case POWER_OFF:
+			return -1;
+		}
+		memset(&flash[offset + i], 0xff, SECTOR_SIZE);
+	}
+	return size;
+}
+
+static const struct region_device_ops flash_ops = {
+	.mmap = flash_mmap,
+	.munmap = flash_munmap,
+	.readat = flash_readat,
+	.writeat = flash_writeat,
+	.eraseat = flash_eraseat,
+};
+
+static const struct region_device flash_rdev =
+	REGION_DEV_INIT(&flash_ops, 0, FLASH_SIZE);
+
+/* Payloads carry their length, a sequence number and a checksum. */
+
+#define MAX_PAYLOAD	2048
+
+struct payload {
+	u32 size;
+	u32 seq;
+	u32 checksum;
+	u8 data[MAX_PAYLOAD];
+};
+
+static u32 payload_checksum(const struct payload *p)
+{
+	u32 sum = p->size * 31 + p->seq;
+	size_t i;
+
+	for (i = 0; i < p->size; i++)
+		sum = sum * 33 + p->data[i];
+	return sum;
+}
+
+static size_t payload_bytes(const struct payload *p)
+{
+	return offsetof(struct payload, data) + p->size;
+}
+
+static void make_payload(struct payload *p, u32 seq)
+{
+	size_t i;
+
+	p->size = next(MAX_PAYLOAD);
+	p->seq = seq;
+	for (i = 0; i < p->size; i++)
+		p->data[i] = next(256);
+	p->checksum = payload_checksum(p);
+}
+
+static int same_payload(const struct payload *a, const struct payload *b)
+{
+	return a->size == b->size && a->seq == b->seq &&
+	       !memcmp(a->data, b->data, a->size);
+}
+
+enum { DATA_NONE, DATA_TORN, DATA_VALID };
+
+/* Read the latest data like a user on the next boot would. */
+static int read_latest(struct payload *p)
+{
+	struct region_file f;
+	struct region_device rdev;
+	size_t size;
+
+	if (region_file_init_banked(&f, &flash_rdev) < 0)
+		return -1;
+
+	if (region_file_data(&f, &rdev) < 0)
+		return DATA_NONE;
+
+	/* Updates are padded to the block size of the file. */
+	size = MIN(region_device_sz(&rdev), sizeof(*p));
+	memset(p, 0, sizeof(*p));
+	if (size < offsetof(struct payload, data) ||
+	    rdev_readat(&rdev, p, 0, size) != size)
+		return DATA_TORN;
+
+	if (payload_bytes(p) > size || payload_checksum(p) != p->checksum)
+		return DATA_TORN;
+
+	return DATA_VALID;
+}
+
+enum { OP_UPDATE, OP_ERASE_AHEAD };
+
+/* Open the file and run one operation on the flash as it is. */
+static int run_op(int op, const struct payload *p, int *switched)
+{
+	struct region_file f;
+	int bank;
+
+	if (region_file_init_banked(&f, &flash_rdev) < 0)
+		return -1;
+	bank = f.bank;
+
+	if (op == OP_ERASE_AHEAD) {
+		if (region_file_erase_ahead(&f) < 0)
+			return -1;
+	} else if (region_file_update_data(&f, p, payload_bytes(p)) < 0) {
+		return -1;
+	}
+
+	if (switched)
+		*switched = f.bank != bank;
+	return 0;
+}
+
+static int cur_step, cur_op;
+
+static void fail(const char *what, long cut)
+{
+	printf("FAIL: %s (step %d, %s, power cut at operation %ld)\n", what,
+	       cur_step, cur_op == OP_UPDATE ? "update" : "erase-ahead", cut);
+	exit(1);
+}
+
+static u8 saved[FLASH_SIZE];
+static struct payload committed, pending, latest;
+static int have_committed;
+static u32 seq;
+static unsigned long cuts;
+
+/* Check the data found after a power cut, and that updates still work. */
+static void check_after_cut(int op, int switched, long cut)
+{
+	struct payload again;
+	int ret;
+
+	ret = read_latest(&latest);
+	if (ret < 0)
+		fail("file can't be opened", cut);
+
+	/* An update within a bank is no different from a plain region file. */
+	if (ret == DATA_NONE || ret == DATA_TORN) {
+		if (have_committed && (op != OP_UPDATE || switched))
+			fail("committed data lost", cut);
+	} else if (!(have_committed && same_payload(&latest, &committed)) &&
+		   !(op == OP_UPDATE && same_payload(&latest, &pending))) {
+		fail("data is neither the old nor the new one", cut);
+	}
+
+	make_payload(&again, ~0);
+	if (run_op(OP_UPDATE, &again, NULL) < 0)
+		fail("update after power cut failed", cut);
+	if (read_latest(&latest) != DATA_VALID ||
+	    !same_payload(&latest, &again))
+		fail("update after power cut not read back", cut);
+}
+
+static void step(void)
+{
+	const int op = next(5) == 0 ? OP_ERASE_AHEAD : OP_UPDATE;
+	int switched = 0;
+	long ops, cut;
+
+	cur_op = op;
+	if (op == OP_UPDATE)
+		make_payload(&pending, ++seq);
+
+	/* Count the flash operations of a complete run. */
+	memcpy(saved, flash, sizeof(flash));
+	cut_at = -1;
+	power_ops = 0;
+	if (run_op(op, &pending, &switched) < 0)
+		fail("operation failed without a power cut", -1);
+	ops = power_ops;
+
+	for (cut = 0; cut < ops; cut++) {
+		memcpy(flash, saved, sizeof(flash));
+		cut_at = cut;
+		power_ops = 0;
+		if (run_op(op, &pending, NULL) == 0)
+			fail("operation survived its power cut", cut);
+		cut_at = -1;
+		check_after_cut(op, switched, cut);
+		cuts++;
+	}
+
+	/* Go on from the complete run. */
+	memcpy(flash, saved, sizeof(flash));
+	if (run_op(op, &pending, NULL) < 0)
+		fail("operation failed without a power cut", -1);
+	if (op == OP_UPDATE) {
+		committed = pending;
+		have_committed = 1;
+	}
+	if (read_latest(&latest) != (have_committed ? DATA_VALID : DATA_NONE) ||
+	    (have_committed && !same_payload(&latest, &committed)))
+		fail("data not read back", -1);
+}
+
+static void run(int steps)
+{
+	int i;
+
+	/* Start from flash in any state, like a new board would. */
+	for (i = 0; i < FLASH_SIZE; i++)
+		flash[i] = next(3) ? 0xff : next(256);
+	have_committed = 0;
+	seq = 0;
+
+	for (cur_step = 0; cur_step < steps; cur_step++)
+		step();
+}
+
+int main(int argc, char **argv)
+{
+	unsigned int seed;
+
+	if (read_input(argc, argv)) {
+		run(16);
+		return 0;
+	}
+
+	for (seed = 0; seed < 10; seed++) {
+		srand(seed);
+		run(40);
+	}
+	printf("region-file-test: %lu power cuts ok\n", cuts);
+	return 0;
+}
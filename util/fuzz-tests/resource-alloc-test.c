@@ -0,0 +1,386 @@
+/*
+ * This file is part of the coreboot project.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+/*
+ * Host harness for the resource allocator in src/device/device.c. It builds
+ * random device trees and checks that
+ *  - get_sorted_resources() returns the resources of every bus in the order
+ *    the former largest_resource() walk picked them one by one, and
+ *  - compute_resources() and allocate_resources() place every resource
+ *    aligned, inside its bridge window and without overlapping a sibling.
+ */
+
+#include "../../src/device/device.c"
+#include "../../src/device/device_util.c"
+
+#include "harness.h"
+
+/* Stubs for what the allocator pulls in from the rest of ramstage */
+
+struct device dev_root;
+struct device *all_devices = &dev_root;
+struct device *last_dev = &dev_root;
+
+void die(const char *fmt, ...)
+{
+	printf("die(%s)\n", fmt);
+	exit(1);
+}
+
+void post_code(u8 value) {}
+void setup_default_ebda(void) {}
+void timer_monotonic_get(struct mono_time *mt) { mt->microseconds = 0; }
+
+DEVTREE_CONST struct device *find_dev_path(
+	const struct bus *parent, const struct device_path *path)
+{
+	return NULL;
+}
+
+#define MAX_DEVICES	256
+#define MAX_RESOURCES	1024
+#define MAX_BUSES	64
+
+static struct device devices[MAX_DEVICES];
+static struct resource resources[MAX_RESOURCES];
+static struct bus buses[MAX_BUSES];
+static size_t num_devices, num_resources, num_buses;
+
+static struct bus *new_bus(struct device *dev)
+{
+	struct bus *bus = &buses[num_buses++];
+
+	memset(bus, 0, sizeof(*bus));
+	bus->dev = dev;
+	dev->link_list = bus;
+	return bus;
+}
+
+static struct device *new_device(struct bus *bus)
+{
+	struct device *dev = &devices[num_devices++];
+
+	memset(dev, 0, sizeof(*dev));
+	dev->path.type = DEVICE_PATH_PCI;
+	dev->path.pci.devfn = num_devices;
+	dev->bus = bus;
+	dev->enabled = next(8) != 0;
+	dev->sibling = bus->children;
+	bus->children = dev;
+	return dev;
+}
+
+static struct resource *add_resource(struct device *dev, unsigned long flags,
+				     unsigned long index)
+{
+	struct resource *res = &resources[num_resources++];
+
+	memset(res, 0, sizeof(*res));
+	res->flags = flags;
+	res->index = index;
+	res->next = dev->resource_list;
+	dev->resource_list = res;
+	return res;
+}
+
+static void add_device_resources(struct device *dev)
+{
+	unsigned int i, n = 1 + next(5);
+
+	for (i = 0; i < n && num_resources < MAX_RESOURCES; i++) {
+		const int io = next(4) == 0;
+		struct resource *res;
+
+		res = add_resource(dev, io ? IORESOURCE_IO : IORESOURCE_MEM,
+				   0x10 + 4 * i);
+		if (!io && next(2))
+			res->flags |= IORESOURCE_PREFETCH;
+		if (next(16) == 0)
+			res->flags |= IORESOURCE_FIXED;
+
+		res->align = io ? 2 + next(7) : next(24);
+		res->gran = res->align;
+		/* PCI BARs are naturally aligned, others may be any size. */
+		switch (next(8)) {
+		case 0:
+			res->size = 0;
+			break;
+		case 1:
+			res->size = 1 + next(io ? 0x100 : 0x10000);
+			break;
+		default:
+			res->size = 1ULL << res->align;
+		}
+		res->limit = io ? 0xffff : 0xffffffff;
+	}
+}
+
+static void add_bridge_windows(struct device *dev)
+{
+	struct resource *res;
+
+	res = add_resource(dev, IORESOURCE_IO | IORESOURCE_BRIDGE,
+			   IOINDEX(0x1c, 0));
+	res->align = res->gran = 12;
+	res->limit = 0xffff;
+
+	res = add_resource(dev, IORESOURCE_MEM | IORESOURCE_BRIDGE,
+			   IOINDEX(0x20, 0));
+	res->align = res->gran = 20;
+	res->limit = 0xffffffff;
+
+	res = add_resource(dev, IORESOURCE_MEM | IORESOURCE_PREFETCH |
+			   IORESOURCE_BRIDGE, IOINDEX(0x24, 0));
+	res->align = res->gran = 20;
+	res->limit = 0xffffffff;
+}
+
+static void build_bus(struct bus *bus, int depth)
+{
+	unsigned int i, n = 1 + next(12);
+
+	for (i = 0; i < n; i++) {
+		struct device *dev;
+
+		if (num_devices == MAX_DEVICES ||
+		    num_resources + 8 > MAX_RESOURCES)
+			return;
+
+		dev = new_device(bus);
+		if (depth < 3 && num_buses < MAX_BUSES && next(5) == 0) {
+			dev->enabled = 1;
+			add_bridge_windows(dev);
+			build_bus(new_bus(dev), depth + 1);
+		} else {
+			add_device_resources(dev);
+		}
+	}
+}
+
+/* The allocator's former way to pick the next resource, as reference */
+
+struct pick_largest_state {
+	struct resource *last;
+	const struct device *result_dev;
+	struct resource *result;
+	int seen_last;
+};
+
+static void pick_largest_resource(void *gp, struct device *dev,
+				  struct resource *resource)
+{
+	struct pick_largest_state *state = gp;
+	struct resource *last;
+
+	last = state->last;
+
+	if (resource == last) {
+		state->seen_last = 1;
+		return;
+	}
+	if (resource->flags & IORESOURCE_FIXED)
+		return;
+	if (last && ((last->align < resource->align) ||
+		     ((last->align == resource->align) &&
+		      (last->size < resource->size)) ||
+		     ((last->align == resource->align) &&
+		      (last->size == resource->size) && (!state->seen_last)))) {
+		return;
+	}
+	if (!state->result ||
+	    (state->result->align < resource->align) ||
+	    ((state->result->align == resource->align) &&
+	     (state->result->size < resource->size))) {
+		state->result_dev = dev;
+		state->result = resource;
+	}
+}
+
+static const struct device *largest_resource(struct bus *bus,
+				       struct resource **result_res,
+				       unsigned long type_mask,
+				       unsigned long type)
+{
+	struct pick_largest_state state;
+
+	state.last = *result_res;
+	state.result_dev = NULL;
+	state.result = NULL;
+	state.seen_last = 0;
+
+	search_bus_resources(bus, type_mask, type, pick_largest_resource,
+			     &state);
+
+	*result_res = state.result;
+	return state.result_dev;
+}
+
+static int fail(const char *what)
+{
+	printf("FAIL: %s\n", what);
+	exit(1);
+	return 1;
+}
+
+static void check_order(struct bus *bus, unsigned long type_mask,
+			unsigned long type)
+{
+	struct sorted_resource_list list;
+	struct resource *res = NULL;
+	const struct device *dev;
+	size_t i = 0;
+
+	get_sorted_resources(bus, &list, type_mask, type);
+	while ((dev = largest_resource(bus, &res, type_mask, type))) {
+		if (i == list.count)
+			fail("sorted list is too short");
+		if (list.entries[i].res != res || list.entries[i].dev != dev)
+			fail("sorted list differs from largest_resource()");
+		i++;
+	}
+	if (i != list.count)
+		fail("sorted list is too long");
+	free_sorted_resources(&list);
+}
+
+static void check_all_orders(void)
+{
+	size_t i;
+
+	for (i = 0; i < num_buses; i++) {
+		check_order(&buses[i], IORESOURCE_TYPE_MASK, IORESOURCE_IO);
+		check_order(&buses[i], IORESOURCE_TYPE_MASK, IORESOURCE_MEM);
+		check_order(&buses[i], IORESOURCE_TYPE_MASK | IORESOURCE_PREFETCH,
+			    IORESOURCE_MEM);
+		check_order(&buses[i], IORESOURCE_TYPE_MASK | IORESOURCE_PREFETCH,
+			    IORESOURCE_MEM | IORESOURCE_PREFETCH);
+	}
+}
+
+/* Which window of its upstream bus a resource is allocated from */
+static unsigned long window_type(const struct resource *res, int top)
+{
+	unsigned long mask = IORESOURCE_IO | IORESOURCE_MEM;
+
+	if (!top)
+		mask |= IORESOURCE_PREFETCH;
+	return res->flags & mask;
+}
+
+static void check_bus(const struct bus *bus, const struct resource *window,
+		      int top)
+{
+	const struct device *dev, *other;
+	const struct resource *res, *ores;
+
+	for (dev = bus->children; dev; dev = dev->sibling) {
+		if (!dev->enabled)
+			continue;
+		for (res = dev->resource_list; res; res = res->next) {
+			if (res->flags & IORESOURCE_FIXED || !res->size ||
+			    window_type(res, top) != window_type(window, top))
+				continue;
+			if (!(res->flags & IORESOURCE_ASSIGNED))
+				fail("resource not assigned");
+			if (res->base & ((1ULL << res->align) - 1))
+				fail("resource misaligned");
+			if (res->base < window->base ||
+			    res->base + res->size > window->base + window->size)
+				fail("resource outside of its bridge window");
+
+			for (other = bus->children; other;
+			     other = other->sibling) {
+				if (!other->enabled)
+					continue;
+				for (ores = other->resource_list; ores;
+				     ores = ores->next) {
+					if (ores == res ||
+					    ores->flags & IORESOURCE_FIXED ||
+					    !ores->size ||
+					    window_type(ores, top) !=
+					    window_type(res, top))
+						continue;
+					if (res->base < ores->base + ores->size &&
+					    ores->base < res->base + res->size)
+						fail("resources overlap");
+				}
+			}
+
+			if (res->flags & IORESOURCE_BRIDGE)
+				check_bus(dev->link_list, res, 0);
+		}
+	}
+}
+
+static void run(void)
+{
+	struct device *domain;
+	struct resource io, mem;
+
+	num_devices = num_resources = num_buses = 0;
+	errors_printed = 0;
+
+	domain = new_device(new_bus(&dev_root));
+	domain->enabled = 1;
+	domain->path.type = DEVICE_PATH_DOMAIN;
+	build_bus(new_bus(domain), 0);
+
+	check_all_orders();
+
+	memset(&io, 0, sizeof(io));
+	io.flags = IORESOURCE_IO;
+	io.base = 0x1000;
+	io.limit = 0xffff;
+
+	memset(&mem, 0, sizeof(mem));
+	mem.flags = IORESOURCE_MEM;
+	mem.base = 0x80000000;
+	mem.limit = 0xffffffff;
+
+	compute_resources(domain->link_list, &io, IORESOURCE_TYPE_MASK,
+			  IORESOURCE_IO);
+	compute_resources(domain->link_list, &mem, IORESOURCE_TYPE_MASK,
+			  IORESOURCE_MEM);
+
+	/* Random trees may not fit, that's no allocator bug. */
+	if (io.base + io.size - 1 > io.limit ||
+	    mem.base + mem.size - 1 > mem.limit)
+		return;
+
+	allocate_resources(domain->link_list, &io, IORESOURCE_TYPE_MASK,
+			   IORESOURCE_IO);
+	allocate_resources(domain->link_list, &mem, IORESOURCE_TYPE_MASK,
+			   IORESOURCE_MEM);
+	if (errors_printed)
+		fail("allocator reported an error");
+
+	check_bus(domain->link_list, &io, 1);
+	check_bus(domain->link_list, &mem, 1);
+}
+
+int main(int argc, char **argv)
+{
+	unsigned int seed;
+
+	if (read_input(argc, argv)) {
+		run();
+		return 0;
+	}
+
+	for (seed = 0; seed < 20000; seed++) {
+		srand(seed);
+		run();
+	}
+	printf("resource-alloc-test: %u trees ok\n", seed);
+	return 0;
+}
@@ -0,0 +1,258 @@
+/*
+ * This file is part of the coreboot project.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+/*
+ * Host harness for src/security/vboot/sha256_cpu.c with the compression
+ * function of the build host: SHA-NI (src/arch/x86/sha256_ni_asm.S) on
+ * x86_64 and the ARMv8 Cryptography Extensions (src/arch/arm64/sha256_ce.S)
+ * on aarch64. The digests must match the known answers from FIPS 180-2 and
+ * a plain C SHA-256 for messages of random length, alignment and update
+ * chunking. On hosts without the instructions it only checks the plain C
+ * implementation and says so.
+ */
+
+#include "../../src/security/vboot/sha256_cpu.c"
+
+#include "harness.h"
+
+#if defined(__x86_64__)
+#include <cpuid.h>
+
+static int host_has_sha256(void)
+{
+	unsigned int eax, ebx, ecx, edx;
+
+	if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx) ||
+	    !(ecx & bit_SSSE3) || !(ecx & bit_SSE4_1))
+		return 0;
+	if (!__get_cpuid_count(7, 0, &eax, &ebx, &ecx, &edx))
+		return 0;
+	return !!(ebx & bit_SHA);
+}
+#elif defined(__aarch64__)
+unsigned long getauxval(unsigned long type);
+
+#define AT_HWCAP	16
+#define HWCAP_SHA2	(1 << 6)
+
+/* sha256_cpu_supported() reads CurrentEL, which traps at EL0. */
+static int host_has_sha256(void)
+{
+	return !!(getauxval(AT_HWCAP) & HWCAP_SHA2);
+}
+#else
+static int host_has_sha256(void)
+{
+	return 0;
+}
+
+void sha256_cpu_blocks(uint32_t state[8], const uint8_t *data, size_t blocks)
+{
+	exit(1);
+}
+#endif
+
+/* Plain C SHA-256 following FIPS 180-4, to compare against */
+
+static const uint32_t k256[64] = {
+	0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5,
+	0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+	0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3,
+	0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+	0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc,
+	0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+	0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7,
+	0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+	0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13,
+	0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+	0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3,
+	0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+	0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5,
+	0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+	0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208,
+	0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2,
+};
+
+#define ROR(x, n)	((x) >> (n) | (x) << (32 - (n)))
+
+static void ref_block(uint32_t h[8], const uint8_t *p)
+{
+	uint32_t w[64], v[8], t1, t2;
+	int i;
+
+	for (i = 0; i < 16; i++)
+		w[i] = p[i * 4] << 24 | p[i * 4 + 1] << 16 |
+		       p[i * 4 + 2] << 8 | p[i * 4 + 3];
+	for (; i < 64; i++)
+		w[i] = w[i - 16] + w[i - 7] +
+		       (ROR(w[i - 15], 7) ^ ROR(w[i - 15], 18) ^ w[i - 15] >> 3) +
+		       (ROR(w[i - 2], 17) ^ ROR(w[i - 2], 19) ^ w[i - 2] >> 10);
+
+	memcpy(v, h, sizeof(v));
+	for (i = 0; i < 64; i++) {
+		t1 = v[7] + (ROR(v[4], 6) ^ ROR(v[4], 11) ^ ROR(v[4], 25)) +
+		     ((v[4] & v[5]) ^ (~v[4] & v[6])) + k256[i] + w[i];
+		t2 = (ROR(v[0], 2) ^ ROR(v[0], 13) ^ ROR(v[0], 22)) +
+		     ((v[0] & v[1]) ^ (v[0] & v[2]) ^ (v[1] & v[2]));
+		memmove(&v[1], &v[0], 7 * sizeof(v[0]));
+		v[4] += t1;
+		v[0] = t1 + t2;
+	}
+	for (i = 0; i < 8; i++)
+		h[i] += v[i];
+}
+
+static void ref_sha256(const uint8_t *data, size_t size, uint8_t digest[32])
+{
+	uint32_t h[8];
+	uint8_t block[64];
+	size_t done, rest;
+	int i;
+
+	memcpy(h, sha256_h0, sizeof(h));
+	for (done = 0; size - done >= sizeof(block); done += sizeof(block))
+		ref_block(h, data + done);
+
+	rest = size - done;
+	memset(block, 0, sizeof(block));
+	memcpy(block, data + done, rest);
+	block[rest] = 0x80;
+	if (rest >= 56) {
+		ref_block(h, block);
+		memset(block, 0, sizeof(block));
+	}
+	for (i = 0; i < 8; i++)
+		block[63 - i] = (uint64_t)size * 8 >> (i * 8);
+	ref_block(h, block);
+
+	for (i = 0; i < 32; i++)
+		digest[i] = h[i / 4] >> (24 - i % 4 * 8);
+}
+
+static int have_cpu;
+static unsigned long checked;
+
+static void fail(const char *what, size_t size)
+{
+	printf("FAIL: %s for a message of %zu bytes\n", what, size);
+	exit(1);
+}
+
+/* Hash data with sha256_cpu_update() called on chunks of random size. */
+static void cpu_sha256(const uint8_t *data, size_t size, uint8_t digest[32])
+{
+	struct sha256_cpu_ctx ctx;
+	size_t done, len;
+
+	sha256_cpu_init(&ctx);
+	for (done = 0; done < size; done += len) {
+		len = MIN(size - done, next(4) ? next(3 * 64) : next(4096));
+		sha256_cpu_update(&ctx, data + done, len);
+	}
+	sha256_cpu_final(&ctx, digest);
+}
+
+static void check(const uint8_t *data, size_t size, const uint8_t *expected)
+{
+	uint8_t ref[32], cpu[32];
+
+	ref_sha256(data, size, ref);
+	if (expected && memcmp(ref, expected, sizeof(ref)))
+		fail("plain C digest differs from the known answer", size);
+
+	if (have_cpu) {
+		cpu_sha256(data, size, cpu);
+		if (memcmp(cpu, ref, sizeof(cpu)))
+			fail("CPU digest differs", size);
+	}
+	checked++;
+}
+
+/* FIPS 180-2 appendix B */
+static const struct {
+	const char *msg;
+	size_t repeat;
+	uint8_t digest[32];
+} known_answers[] = {
+	{ "abc", 1, {
+		0xba, 0x78, 0x16, 0xbf, 0x8f, 0x01, 0xcf, 0xea,
+		0x41, 0x41, 0x40, 0xde, 0x5d, 0xae, 0x22, 0x23,
+		0xb0, 0x03, 0x61, 0xa3, 0x96, 0x17, 0x7a, 0x9c,
+		0xb4, 0x10, 0xff, 0x61, 0xf2, 0x00, 0x15, 0xad } },
+	{ "abcdbcdecdefdefgefghfghighijhijkijkljklmklmnlmnomnopnopq", 1, {
+		0x24, 0x8d, 0x6a, 0x61, 0xd2, 0x06, 0x38, 0xb8,
+		0xe5, 0xc0, 0x26, 0x93, 0x0c, 0x3e, 0x60, 0x39,
+		0xa3, 0x3c, 0xe4, 0x59, 0x64, 0xff, 0x21, 0x67,
+		0xf6, 0xec, 0xed, 0xd4, 0x19, 0xdb, 0x06, 0xc1 } },
+	{ "a", 1000000, {
+		0xcd, 0xc7, 0x6e, 0x5c, 0x99, 0x14, 0xfb, 0x92,
+		0x81, 0xa1, 0xc7, 0xe2, 0x84, 0xd7, 0x3e, 0x67,
+		0xf1, 0x80, 0x9a, 0x48, 0xa4, 0x97, 0x20, 0x0e,
+		0x04, 0x6d, 0x39, 0xcc, 0xc7, 0x11, 0x2c, 0xd0 } },
+	{ "", 1, {
+		0xe3, 0xb0, 0xc4, 0x42, 0x98, 0xfc, 0x1c, 0x14,
+		0x9a, 0xfb, 0xf4, 0xc8, 0x99, 0x6f, 0xb9, 0x24,
+		0x27, 0xae, 0x41, 0xe4, 0x64, 0x9b, 0x93, 0x4c,
+		0xa4, 0x95, 0x99, 0x1b, 0x78, 0x52, 0xb8, 0x55 } },
+};
+
+static uint8_t msg[1000000 + 16];
+
+static void check_known_answers(void)
+{
+	size_t i, j, len, size;
+
+	for (i = 0; i < ARRAY_SIZE(known_answers); i++) {
+		len = strlen(known_answers[i].msg);
+		size = len * known_answers[i].repeat;
+		for (j = 0; j < known_answers[i].repeat; j++)
+			memcpy(&msg[j * len], known_answers[i].msg, len);
+		check(msg, size, known_answers[i].digest);
+	}
+}
+
+/* A message of random length at a random alignment */
+static void check_random(void)
+{
+	const size_t offset = next(16);
+	const size_t size = next(4) ? next(300) : next(20000);
+	size_t i;
+
+	for (i = 0; i < size; i++)
+		msg[offset + i] = next(256);
+	check(&msg[offset], size, NULL);
+}
+
+int main(int argc, char **argv)
+{
+	unsigned int seed;
+	int i;
+
+	have_cpu = host_has_sha256();
+	check_known_answers();
+
+	if (read_input(argc, argv)) {
+		while (input_size)
+			check_random();
+		return 0;
+	}
+
+	for (seed = 0; seed < 20; seed++) {
+		srand(seed);
+		for (i = 0; i < 500; i++)
+			check_random();
+	}
+	printf("sha256-cpu-test: %lu digests ok%s\n", checked, have_cpu ? "" :
+	       ", CPU has no SHA-256 instructions, only the plain C one checked");
+	return 0;
+}
@@ -0,0 +1,161 @@
+/*
+ * This file is part of the coreboot project.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+/*
+ * Host harness for src/lib/stage_cache_pack.c. It packs stages that look
+ * like loaded ones (code-like bytes, runs of zeroes for .bss and heap) and
+ * checks that unpacking restores them exactly. It is built twice:
+ *  - stage-cache-pack-test with STAGE_CACHE_COMPRESS and
+ *    STAGE_CACHE_CHECKSUM, where every packed stage must fit the size
+ *    stage_cache_pack_size() asked for and a corrupted byte in the cache
+ *    must never restore a different stage, and
+ *  - stage-cache-pack-test-plain without either, where stages must be
+ *    stored as a plain copy without computing a checksum.
+ */
+
+#include "../../src/commonlib/bsd/lz4_wrapper.c"
+#include "../../src/commonlib/region.c"
+#include "../../src/lib/stage_cache_pack.c"
+
+#include "harness.h"
+
+void *mem_pool_alloc(struct mem_pool *mp, size_t sz)
+{
+	return NULL;
+}
+
+void mem_pool_free(struct mem_pool *mp, void *p) {}
+
+/* The host's address space, which isn't limited to 32 bits */
+const struct mem_region_device addrspace_32bit =
+	MEM_REGION_DEV_RO_INIT(0, ~(size_t)0);
+
+#define MAX_STAGE	(256 * 1024)
+
+static uint8_t stage_buf[MAX_STAGE];
+static uint8_t orig[MAX_STAGE];
+/* Room for the frame overhead of a stage that doesn't compress at all */
+static uint8_t cache[MAX_STAGE + 64];
+static unsigned long stages, corruptions;
+
+static void fail(const char *what, size_t size)
+{
+	printf("FAIL: %s for a stage of %zu bytes\n", what, size);
+	exit(1);
+}
+
+/* Fill the stage with runs of zeroes, repeated and random bytes. */
+static size_t make_stage(void)
+{
+	const size_t size = next(4) ? next(8192) : next(MAX_STAGE);
+	size_t i = 0, len, from;
+
+	while (i < size) {
+		len = MIN(size - i, (size_t)next(2048) + 1);
+		switch (next(4)) {
+		case 0:
+			memset(&stage_buf[i], 0, len);
+			break;
+		case 1:
+			/* Repeat earlier bytes, like code using the same idioms. */
+			if (i) {
+				from = next(i);
+				len = MIN(len, i - from);
+				memmove(&stage_buf[i], &stage_buf[from], len);
+				break;
+			}
+			/* fall through */
+		default:
+			for (from = 0; from < len; from++)
+				stage_buf[i + from] = next(256);
+			break;
+		}
+		i += len;
+	}
+	return size;
+}
+
+static void check_stage(void)
+{
+	const size_t size = make_stage();
+	struct prog stage = PROG_INIT(PROG_RAMSTAGE, "ramstage");
+	struct stage_cache meta;
+	size_t packed, i;
+	uint8_t saved;
+
+	prog_set_area(&stage, stage_buf, size);
+	memcpy(orig, stage_buf, size);
+
+	packed = stage_cache_pack_size(&stage, &meta);
+	if (packed > sizeof(cache))
+		fail("packed size is larger than the stage and the frame", size);
+	if (meta.size != size || meta.load_addr != (uintptr_t)stage_buf)
+		fail("wrong metadata", size);
+
+	if (!CONFIG(STAGE_CACHE_COMPRESS) &&
+	    (meta.compression != CBFS_COMPRESS_NONE || packed != size))
+		fail("stage not stored as a plain copy", size);
+	if (!CONFIG(STAGE_CACHE_CHECKSUM) && meta.checksum)
+		fail("checksum computed although it is disabled", size);
+
+	/* Guard bytes catch the encoder writing past the entry it sized. */
+	memset(cache, 0xa5, sizeof(cache));
+	if (stage_cache_pack(cache, packed, &stage, &meta))
+		fail("stage_cache_pack() failed", size);
+	for (i = packed; i < sizeof(cache); i++)
+		if (cache[i] != 0xa5)
+			fail("packed stage overruns its entry", size);
+
+	memset(stage_buf, 0x5a, size);
+	if (stage_cache_unpack(cache, packed, &meta) ||
+	    memcmp(stage_buf, orig, size))
+		fail("stage not restored", size);
+	stages++;
+
+	if (!CONFIG(STAGE_CACHE_CHECKSUM) || !packed)
+		return;
+
+	/*
+	 * A corrupted byte of the cache entry must be caught, unless it didn't
+	 * matter, like the match length bits of the final LZ4 token.
+	 */
+	i = next(packed);
+	saved = cache[i];
+	cache[i] ^= next(255) + 1;
+	memset(stage_buf, 0x5a, size);
+	if (!stage_cache_unpack(cache, packed, &meta) &&
+	    memcmp(stage_buf, orig, size))
+		fail("corrupted stage accepted", size);
+	cache[i] = saved;
+	corruptions++;
+}
+
+int main(int argc, char **argv)
+{
+	unsigned int seed;
+	int i;
+
+	if (read_input(argc, argv)) {
+		check_stage();
+		return 0;
+	}
+
+	for (seed = 0; seed < 20; seed++) {
+		srand(seed);
+		for (i = 0; i < 100; i++)
+			check_stage();
+	}
+	printf("stage-cache-pack-test%s: %lu stages, %lu corruptions ok\n",
+	       CONFIG(STAGE_CACHE_COMPRESS) ? "" : "-plain", stages, corruptions);
+	return 0;
+}
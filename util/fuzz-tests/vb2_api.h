@@ -0,0 +1,24 @@
+/*
+ * Stands in for vboot's vb2_api.h, which lives in the 3rdparty/vboot
+ * submodule, for harnesses whose sources only need its basic types. The
+ * error values don't match vboot's, only the names do.
+ */
+#ifndef FUZZ_TESTS_VB2_API_H
+#define FUZZ_TESTS_VB2_API_H
+
+#include <stdint.h>
+
+typedef uint32_t vb2_error_t;
+
+#define VB2_SUCCESS				0
+#define VB2_ERROR_UNKNOWN			1
+#define VB2_ERROR_EX_HWCRYPTO_UNSUPPORTED	2
+
+enum vb2_hash_algorithm {
+	VB2_HASH_NONE = 0,
+	VB2_HASH_SHA1 = 1,
+	VB2_HASH_SHA256 = 2,
+	VB2_HASH_SHA512 = 3,
+};
+
+#endif